@@ -10,21 +10,87 @@
 #define PORT                2024
 #define BUFFER_SIZE         1024
 #define MAX_NAME_LENGHT     32
+#define FRAME_HEADER_SIZE   2
+#define MAX_FRAME_SIZE      65535
+
+struct frame_buffer_t {
+    char data[FRAME_HEADER_SIZE + MAX_FRAME_SIZE];
+    size_t length;
+};
+
+int send_frame(int fd, const char* payload, size_t length) {
+    char frame[FRAME_HEADER_SIZE + BUFFER_SIZE];
+
+    if (length > BUFFER_SIZE) {
+        length = BUFFER_SIZE;
+    }
+
+    frame[0] = (char) ((length >> 8) & 0xff);
+    frame[1] = (char) (length & 0xff);
+
+    memcpy(frame + FRAME_HEADER_SIZE, payload, length);
+
+    size_t sent = 0;
+
+    while (sent < FRAME_HEADER_SIZE + length) {
+        ssize_t count_of_bytes = send(fd, frame + sent, FRAME_HEADER_SIZE + length - sent, MSG_NOSIGNAL);
+
+        if (count_of_bytes <= 0) {
+            return -1;
+        }
+
+        sent += count_of_bytes;
+    }
+
+    return 0;
+}
+
+int recv_frame(int fd, struct frame_buffer_t* in, char* payload, size_t size) {
+
+    while (1) {
+
+        if (in->length >= FRAME_HEADER_SIZE) {
+            size_t frame_length = ((size_t) (unsigned char) in->data[0] << 8) | (unsigned char) in->data[1];
+
+            if (in->length >= FRAME_HEADER_SIZE + frame_length) {
+                size_t copy = frame_length < size - 1 ? frame_length : size - 1;
+
+                memcpy(payload, in->data + FRAME_HEADER_SIZE, copy);
+                payload[copy] = '\0';
+
+                in->length -= FRAME_HEADER_SIZE + frame_length;
+
+                memmove(in->data, in->data + FRAME_HEADER_SIZE + frame_length, in->length);
+
+                return 1;
+            }
+
+        }
+
+        ssize_t count_of_bytes = recv(fd, in->data + in->length, sizeof(in->data) - in->length, 0);
+
+        if (count_of_bytes <= 0) {
+            return count_of_bytes == 0 ? 0 : -1;
+        }
+
+        in->length += count_of_bytes;
+    }
+
+}
 
 void* recv_handle(void* arg) {
     int* fd = (int*) arg;
+    static struct frame_buffer_t in;
     char buffer[BUFFER_SIZE] = {0};
-    ssize_t count_of_bytes = 0;
+    int result = 0;
     size_t len = 0;
 
     while (1) {
-        memset(buffer, 0, BUFFER_SIZE);
-
-        count_of_bytes = recv(*fd, buffer, BUFFER_SIZE - 1, 0);
+        result = recv_frame(*fd, &in, buffer, BUFFER_SIZE);
 
-        if (count_of_bytes <= 0) {
+        if (result <= 0) {
 
-            if (count_of_bytes == 0) {
+            if (result == 0) {
                 printf("\nServer disconnected!\n");
             } else {
                 perror("recv_handle: recv");
@@ -73,9 +139,7 @@ void send_name(int fd) {
         lenght--;
     }
 
-    ssize_t count_of_bytes = send(fd, name, lenght + 1, 0);
-
-    if (count_of_bytes <= 0) {
+    if (send_frame(fd, name, lenght) < 0) {
         perror("main: send");
 
         exit(EXIT_FAILURE);
@@ -88,9 +152,7 @@ int disconnecting_from_server(int fd, char* buffer) {
     if (strcmp(buffer, "!quit") == 0) {
         printf("Disconnecting...\n");
 
-        ssize_t count_of_bytes = send(fd, "!quit", 5, 0);
-
-        if (count_of_bytes <= 0) {
+        if (send_frame(fd, "!quit", strlen("!quit")) < 0) {
             perror("disconnecting_from_server: send");
         }
 
@@ -151,7 +213,6 @@ int main(int argc, char* argv[]) {
 
     pthread_detach(pthread);
 
-    ssize_t count_of_bytes = 0;
     size_t lenght = 0;
     char buffer[BUFFER_SIZE] = {0};
 
@@ -190,9 +251,7 @@ int main(int argc, char* argv[]) {
             break;
         }
 
-        count_of_bytes = send(fd, buffer, lenght + 1, 0);
-
-        if (count_of_bytes <= 0) {
+        if (send_frame(fd, buffer, lenght) < 0) {
             perror("main: send");
 
             break;
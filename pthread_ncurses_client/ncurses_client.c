@@ -13,10 +13,14 @@
 #include <wchar.h>
 #include <locale.h>
 
+#include "../pthread_server/headers/protocol.h"
+
 #define PORT                2024
 #define MESSAGE_SIZE        1024
 #define MAX_NAME_LENGTH     32
 #define MAX_MESSAGES_COUNT  100
+#define FRAME_HEADER_SIZE   2
+#define MAX_FRAME_SIZE      65535
 
 #define INPUT_WIN_HEIGHT    3
 #define STATUS_WIN_HEIGHT   1
@@ -29,27 +33,35 @@ struct windows_t {
     int chat_width; 
 };
 
+enum colors {
+    GREEN = 1,
+    YELLOW,
+    RED,
+    CYAN
+};
+
 struct message_history_t {
     wchar_t messages[MAX_MESSAGES_COUNT][MESSAGE_SIZE];
+    enum colors colors[MAX_MESSAGES_COUNT];
     int count;
     int offset;
     pthread_mutex_t mutex;
 };
 
+struct frame_buffer_t {
+    char data[FRAME_HEADER_SIZE + MAX_FRAME_SIZE];
+    size_t length;
+};
+
 struct pthread_data_t {
     struct message_history_t* history;
     struct windows_t* wins;
     atomic_int* keep_working;
+    struct frame_buffer_t* in;
+    int binary;
     int fd;
 };
 
-enum colors {
-    GREEN = 1,
-    YELLOW,
-    RED,
-    CYAN
-};
-
 void ncurses_settings(void) {
     cbreak();  
     noecho();
@@ -93,7 +105,7 @@ void create_windows(struct windows_t* wins) {
     refresh();
 }
 
-void add_message(struct message_history_t* history, int chat_height, char* message) {
+void add_message(struct message_history_t* history, int chat_height, char* message, enum colors color) {
     pthread_mutex_lock(&(history->mutex));
 
     wchar_t w_message[MESSAGE_SIZE] = {0};
@@ -106,6 +118,7 @@ void add_message(struct message_history_t* history, int chat_height, char* messa
         wcsncpy(history->messages[history->count], w_message, MESSAGE_SIZE - 1);
 
         history->messages[history->count][MESSAGE_SIZE - 1] = L'\0';
+        history->colors[history->count] = color;
 
         history->count++;
 
@@ -117,10 +130,13 @@ void add_message(struct message_history_t* history, int chat_height, char* messa
 
         for (int i = 1; i < MAX_MESSAGES_COUNT; i++) {
             wcscpy(history->messages[i - 1], history->messages[i]);
+            history->colors[i - 1] = history->colors[i];
         }
 
         wcsncpy(history->messages[MAX_MESSAGES_COUNT - 1], w_message, MESSAGE_SIZE - 1);
 
+        history->colors[MAX_MESSAGES_COUNT - 1] = color;
+
         history->messages[history->count][MESSAGE_SIZE - 1] = L'\0';
 
         if (history->offset > 0) {
@@ -145,13 +161,95 @@ void mvwprintw_with_time_prefix(WINDOW* win, int y_coord, int x_coord, wchar_t*
     wrefresh(win);
 }
 
-enum colors color_defination(wchar_t* message) {
+void redraw_chat(struct message_history_t* history, WINDOW* chat_win, int chat_height) {
+    pthread_mutex_lock(&(history->mutex));
+
+    werase(chat_win);
+
+    int start = history->offset;
+    int end = history->count;
+    int y = 1;
+
+    for (int i = start; i < end && y < chat_height; i++, y++) {
+        mvwprintw_with_time_prefix(chat_win, y, 1, history->messages[i], history->colors[i]);
+    }
+
+    box(chat_win, 0, 0);
+
+    wrefresh(chat_win);
+
+    pthread_mutex_unlock(&(history->mutex));
+}
+
+int send_frame(int fd, const char* payload, size_t length) {
+    char frame[FRAME_HEADER_SIZE + MESSAGE_SIZE];
+
+    if (length > MESSAGE_SIZE) {
+        length = MESSAGE_SIZE;
+    }
+
+    frame[0] = (char) ((length >> 8) & 0xff);
+    frame[1] = (char) (length & 0xff);
+
+    memcpy(frame + FRAME_HEADER_SIZE, payload, length);
+
+    size_t sent = 0;
+
+    while (sent < FRAME_HEADER_SIZE + length) {
+        ssize_t count_of_bytes = send(fd, frame + sent, FRAME_HEADER_SIZE + length - sent, MSG_NOSIGNAL);
+
+        if (count_of_bytes <= 0) {
+            return -1;
+        }
+
+        sent += count_of_bytes;
+    }
+
+    return 0;
+}
+
+int recv_frame(int fd, struct frame_buffer_t* in, char* payload, size_t size, size_t* length) {
+
+    while (1) {
+
+        if (in->length >= FRAME_HEADER_SIZE) {
+            size_t frame_length = ((size_t) (unsigned char) in->data[0] << 8) | (unsigned char) in->data[1];
+
+            if (in->length >= FRAME_HEADER_SIZE + frame_length) {
+                size_t copy = frame_length < size - 1 ? frame_length : size - 1;
+
+                memcpy(payload, in->data + FRAME_HEADER_SIZE, copy);
+                payload[copy] = '\0';
+
+                *length = copy;
+
+                in->length -= FRAME_HEADER_SIZE + frame_length;
+
+                memmove(in->data, in->data + FRAME_HEADER_SIZE + frame_length, in->length);
+
+                return 1;
+            }
+
+        }
+
+        ssize_t count_of_bytes = recv(fd, in->data + in->length, sizeof(in->data) - in->length, 0);
+
+        if (count_of_bytes <= 0) {
+            return count_of_bytes == 0 ? 0 : -1;
+        }
+
+        in->length += count_of_bytes;
+    }
+
+}
+
+enum colors color_defination(const char* message) {
 
-    if (wcsstr(message, L"You:")) {
+    if (strstr(message, "You:")) {
         return GREEN;
-    } else if (wcsstr(message, L"joined") || wcsstr(message, L"left")) {
+    } else if (strstr(message, "joined") || strstr(message, "left")) {
         return CYAN;
-    } else if (wcsstr(message, L"disconnected")) {
+    } else if (strstr(message, "disconnected")) {
         return RED;
     } else {
         return YELLOW;
@@ -160,28 +258,46 @@ enum colors color_defination(wchar_t* message) {
     return GREEN;
 }
 
-void redraw_chat(struct message_history_t* history, WINDOW* chat_win, int chat_height) {
-    pthread_mutex_lock(&(history->mutex));
+int format_event(char* payload, size_t length, char* message, enum colors* color) {
+    struct protocol_header_t header;
 
-    werase(chat_win);
+    if (protocol_header_decode(payload, length, &header) < 0) {
+        return -1;
+    }
 
-    int start = history->offset;
-    int end = history->count;
-    int y = 1;
+    int name_length = header.name_length;
+    int body_length = (int) (length - PROTOCOL_HEADER_SIZE - header.name_length);
+    char* name = payload + PROTOCOL_HEADER_SIZE;
+    char* body = name + name_length;
 
-    enum colors color = GREEN;
+    *color = YELLOW;
 
-    for (int i = start; i < end && y < chat_height; i++, y++) {
-        color = color_defination(history->messages[i]);
+    switch (header.opcode) {
+        case PROTOCOL_OP_MESSAGE:
+            snprintf(message, MESSAGE_SIZE, "<%.*s>: %.*s", name_length, name, body_length, body);
 
-        mvwprintw_with_time_prefix(chat_win, y, 1, history->messages[i], color);
-    }
+            break;
 
-    box(chat_win, 0, 0);
+        case PROTOCOL_OP_DIRECT:
+            snprintf(message, MESSAGE_SIZE, "[DM] <%.*s>: %.*s", name_length, name, body_length, body);
 
-    wrefresh(chat_win);
+            break;
 
-    pthread_mutex_unlock(&(history->mutex));
+        case PROTOCOL_OP_JOINED:
+        case PROTOCOL_OP_LEFT:
+            *color = CYAN;
+
+            snprintf(message, MESSAGE_SIZE, "<%.*s> %s #%.*s!", name_length, name, header.opcode == PROTOCOL_OP_JOINED ? "joined" : "left", body_length, body);
+
+            break;
+
+        default:
+            snprintf(message, MESSAGE_SIZE, "%.*s", body_length, body);
+
+            break;
+    }
+
+    return 0;
 }
 
 void* recv_handle(void* arg) {
@@ -189,27 +305,29 @@ void* recv_handle(void* arg) {
 
     struct message_history_t* history = p_data->history;
     struct windows_t* wins = p_data->wins; 
+    struct frame_buffer_t* in = p_data->in;
     
     atomic_int* keep_working = p_data->keep_working;
 
     int fd = p_data->fd;
+    int binary = p_data->binary;
 
     free(p_data);
 
+    static char payload[MAX_FRAME_SIZE + 1];
     char message[MESSAGE_SIZE] = {0};
 
-    ssize_t count_of_bytes = 0;
+    int result = 0;
     size_t length = 0;
+    enum colors color = YELLOW;
 
     while (atomic_load(keep_working)) {
-        memset(message, 0, MESSAGE_SIZE);
+        result = recv_frame(fd, in, payload, sizeof(payload), &length);
 
-        count_of_bytes = recv(fd, message, MESSAGE_SIZE - 1, 0);
+        if (result <= 0) {
 
-        if (count_of_bytes <= 0) {
-
-            if (count_of_bytes == 0) {
-                add_message(history, wins->chat_height, "Server disonnected!");
+            if (result == 0) {
+                add_message(history, wins->chat_height, "Server disonnected!", RED);
             } else {
                 perror("recv_handle: recv");
             }
@@ -219,21 +337,111 @@ void* recv_handle(void* arg) {
             break;
         }
 
+        if (!binary) {
+            length = length < MESSAGE_SIZE - 1 ? length : MESSAGE_SIZE - 1;
+
+            memcpy(message, payload, length);
+
+            message[length] = '\0';
+
+            color = color_defination(message);
+        } else if (format_event(payload, length, message, &color) < 0) {
+            continue;
+        }
+
         length = strlen(message);
 
         if (length > 0 && message[length - 1] == '\n') {
             message[length - 1] = '\0';
         }
 
-        add_message(history, wins->chat_height, message);
+        add_message(history, wins->chat_height, message, color);
     }
 
     return NULL;
 }
 
-int send_name(struct message_history_t* history, struct windows_t* wins, int fd) {
+int negotiate(int fd, struct frame_buffer_t* in) {
+    char payload[PROTOCOL_HEADER_SIZE + 1 + 1];
+    size_t length = protocol_hello_encode(payload, PROTOCOL_VERSION, PROTOCOL_VERSION);
+    struct protocol_header_t header;
+
+    if (send_frame(fd, payload, length) < 0 || recv_frame(fd, in, payload, sizeof(payload), &length) <= 0) {
+        return -1;
+    }
+
+    if (protocol_header_decode(payload, length, &header) < 0 || header.opcode != PROTOCOL_OP_HELLO || length < PROTOCOL_HEADER_SIZE + 1) {
+        return 0;
+    }
+
+    return (unsigned char) payload[PROTOCOL_HEADER_SIZE + header.name_length];
+}
+
+void parse_input(char* buffer, struct protocol_command_t* command) {
+    unsigned long long number = 0;
+    char* argument = NULL;
+    char* space = NULL;
+
+    memset(command, 0, sizeof(*command));
+
+    if (strcmp(buffer, "!quit") == 0) {
+        command->opcode = PROTOCOL_OP_QUIT;
+    } else if (strcmp(buffer, "!leave") == 0) {
+        command->opcode = PROTOCOL_OP_LEAVE;
+    } else if (strcmp(buffer, "!rooms") == 0) {
+        command->opcode = PROTOCOL_OP_ROOMS;
+    } else if (strcmp(buffer, "!list") == 0 || strncmp(buffer, "!list ", strlen("!list ")) == 0) {
+        command->opcode = PROTOCOL_OP_LIST;
+        command->list_mode = strcmp(buffer, "!list") == 0 ? PROTOCOL_LIST_ALL : UINT8_MAX;
+
+        if (sscanf(buffer, "!list page %llu", &number) == 1) {
+            command->list_mode = PROTOCOL_LIST_PAGE;
+        } else if (sscanf(buffer, "!list since %llu", &number) == 1) {
+            command->list_mode = PROTOCOL_LIST_SINCE;
+        }
+
+        command->number = number;
+    } else if (strncmp(buffer, "!join ", strlen("!join ")) == 0 || strncmp(buffer, "!msg ", strlen("!msg ")) == 0) {
+        argument = strchr(buffer, ' ') + 1;
+        space = strchr(argument, ' ');
+
+        command->opcode = buffer[1] == 'j' ? PROTOCOL_OP_JOIN : PROTOCOL_OP_DIRECT;
+        command->target = argument;
+        command->target_length = space ? (size_t) (space - argument) : strlen(argument);
+        command->text = space ? space + 1 : "";
+        command->text_length = strlen(command->text);
+
+        if (command->opcode == PROTOCOL_OP_JOIN) {
+            command->number = strtoull(command->text, NULL, 10);
+        }
+
+    } else {
+        command->opcode = PROTOCOL_OP_MESSAGE;
+        command->text = buffer;
+        command->text_length = strlen(buffer);
+    }
+
+}
+
+int send_line(int fd, int binary, char* buffer, size_t length) {
+    char payload[MESSAGE_SIZE];
+    struct protocol_command_t command;
+
+    if (!binary) {
+        return send_frame(fd, buffer, length);
+    }
+
+    parse_input(buffer, &command);
+
+    length = protocol_command_encode(payload, sizeof(payload), &command);
+
+    return length > 0 ? send_frame(fd, payload, length) : -1;
+}
+
+int send_name(struct message_history_t* history, struct windows_t* wins, int fd, int binary) {
     char name[MAX_NAME_LENGTH] = {0};
-    char message[MAX_NAME_LENGTH] = {0};
+    char message[MESSAGE_SIZE] = {0};
+    char payload[MESSAGE_SIZE] = {0};
 
     echo();
     mvwprintw(wins->input_win, 1, 1, "Enter your name: "); 
@@ -249,9 +457,20 @@ int send_name(struct message_history_t* history, struct windows_t* wins, int fd)
     nodelay(wins->input_win, TRUE);
 
     size_t length = strlen(name);
-    ssize_t count_of_bytes = send(fd, name, length + 1, 0);
 
-    if (count_of_bytes <= 0) {
+    struct protocol_command_t command = {
+        .opcode = PROTOCOL_OP_NAME,
+        .target = name,
+        .target_length = length
+    };
+
+    if (binary) {
+        length = protocol_command_encode(payload, sizeof(payload), &command);
+    } else {
+        memcpy(payload, name, length);
+    }
+
+    if (send_frame(fd, payload, length) < 0) {
         perror("main: send");
 
         return -1;
@@ -263,19 +482,17 @@ int send_name(struct message_history_t* history, struct windows_t* wins, int fd)
         snprintf(message, MESSAGE_SIZE, "You joined as: %s", name);
     }
     
-    add_message(history, wins->chat_height, message);
+    add_message(history, wins->chat_height, message, GREEN);
     redraw_chat(history, wins->chat_win, wins->chat_height);
 
     return 0;
 }
 
-int disconnecting_from_server(int fd, char* buffer) {
+int disconnecting_from_server(int fd, int binary, char* buffer) {
     
     if (strcmp(buffer, "!quit") == 0) {
 
-        ssize_t count_of_bytes = send(fd, "!quit", strlen("!quit"), 0);
-
-        if (count_of_bytes <= 0) {
+        if (send_line(fd, binary, buffer, strlen(buffer)) < 0) {
             perror("disconnecting_from_server: send");
         }
 
@@ -285,7 +502,7 @@ int disconnecting_from_server(int fd, char* buffer) {
     return -1;
 }
 
-int input_handler(struct message_history_t* history, struct windows_t* wins, int ch, int* pos, int fd, char* buffer) {
+int input_handler(struct message_history_t* history, struct windows_t* wins, int ch, int* pos, int fd, int binary, char* buffer) {
 
     switch (ch) {
         case KEY_UP:
@@ -322,22 +539,20 @@ int input_handler(struct message_history_t* history, struct windows_t* wins, int
         case '\n':
             
             if (*pos > 0) {
-                char message[MAX_NAME_LENGTH] = {0};
+                char message[MESSAGE_SIZE] = {0};
 
-                if (disconnecting_from_server(fd, buffer) == 0) {
+                if (disconnecting_from_server(fd, binary, buffer) == 0) {
                     return -1;
                 }
 
-                ssize_t count_of_bytes = send(fd, buffer, *pos + 1, 0);
-
-                if (count_of_bytes <= 0) {
+                if (send_line(fd, binary, buffer, *pos) < 0) {
                     perror("main: send");
 
                     return -1;
                 }
 
                 snprintf(message, MESSAGE_SIZE, "You: %s", buffer);
-                add_message(history, wins->chat_height, message);
+                add_message(history, wins->chat_height, message, GREEN);
                 redraw_chat(history, wins->chat_win, wins->chat_height);
 
                 memset(buffer, 0, MESSAGE_SIZE);
@@ -364,7 +579,7 @@ int input_handler(struct message_history_t* history, struct windows_t* wins, int
 }
 
 void cleanup(struct message_history_t* history, struct windows_t* wins, atomic_int* keep_working, pthread_t pthread, int fd) {
-    add_message(history, wins->chat_height, "Shutting down connection...");
+    add_message(history, wins->chat_height, "Shutting down connection...", RED);
     redraw_chat(history, wins->chat_win, wins->chat_height);
 
     napms(1000);
@@ -422,6 +637,18 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
+    static struct frame_buffer_t in;
+
+    int binary = negotiate(fd, &in);
+
+    if (binary < 0) {
+        perror("main: negotiate");
+
+        close(fd);
+
+        return EXIT_FAILURE;
+    }
+
     initscr();
     ncurses_settings();
     
@@ -439,7 +666,7 @@ int main(int argc, char* argv[]) {
     mvwprintw(wins.status_win, 0, 1, "Connected to server! Enter your name or '!anonim' to remain anonymous"); 
     wrefresh(wins.status_win);   
     
-    if (send_name(&history, &wins, fd) < 0) {
+    if (send_name(&history, &wins, fd, binary) < 0) {
         close(fd);
 
         endwin();
@@ -470,6 +697,8 @@ int main(int argc, char* argv[]) {
     p_data->history = &history;
     p_data->wins = &wins;
     p_data->keep_working = &keep_working;
+    p_data->in = &in;
+    p_data->binary = binary;
     p_data->fd = fd;
 
     pthread_t pthread = 0;
@@ -516,7 +745,7 @@ int main(int argc, char* argv[]) {
             continue;
         }
 
-        if (input_handler(&history, &wins, ch, &pos, fd, buffer) < 0) {
+        if (input_handler(&history, &wins, ch, &pos, fd, binary, buffer) < 0) {
             cleanup(&history, &wins, &keep_working, pthread, fd);
 
             return EXIT_FAILURE;
@@ -0,0 +1,1001 @@
+#define _GNU_SOURCE
+
+#include "../headers/common.h"
+#include "../headers/frame.h"
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#define DEFAULT_CLIENTS         1000
+#define DEFAULT_THREADS         4
+#define DEFAULT_SENDERS         10
+#define DEFAULT_RATE            100
+#define DEFAULT_SIZE            64
+#define DEFAULT_SECONDS         10
+#define DEFAULT_CONNECTS        2
+#define MAX_CLIENTS             (1 << 20)
+#define MAX_MESSAGE_SIZE        (BUFFER_SIZE - MAX_NAME_LENGTH - 8)
+#define MIN_MESSAGE_SIZE        40
+#define MAX_EVENTS              256
+#define READ_SIZE               65536
+#define QUIET_MS                500
+#define SETTLE_MAX_MS           30000
+#define DRAIN_MAX_MS            30000
+#define HIST_SUB_BITS           5
+#define HIST_BUCKETS            (64 << HIST_SUB_BITS)
+#define MESSAGE_MARK            ": LG "
+#define JOIN_REQUEST            "!rooms"
+#define JOIN_REPLY              "Rooms ("
+
+/**
+ * @brief Фаза прогона, меняет главный поток
+ */
+enum loadgen_phase {
+    PHASE_CONNECT,                          ///< Клиенты подключаются и отправляют имена
+    PHASE_SETTLE,                           ///< Подключения завершены, клиенты дочитывают уведомления о входе
+    PHASE_RUN,                              ///< Отправители шлют сообщения с заданной частотой
+    PHASE_DRAIN,                            ///< Отправка остановлена, клиенты дочитывают сообщения
+    PHASE_STOP                              ///< Потоки завершаются
+};
+
+/**
+ * @brief Состояние симулированного клиента
+ */
+enum lg_state {
+    LG_IDLE,                                ///< Подключение еще не начато
+    LG_CONNECTING,                          ///< Неблокирующий connect() в процессе
+    LG_ACTIVE,                              ///< Соединение установлено, имя отправлено
+    LG_CLOSED                               ///< Соединение закрыто
+};
+
+/**
+ * @brief Параметры прогона
+ */
+struct loadgen_config_t {
+    struct sockaddr_in addr;                ///< Адрес сервера
+    int clients;                            ///< Количество клиентов
+    int threads;                            ///< Количество потоков
+    int senders;                            ///< Сколько клиентов отправляют сообщения
+    int rate;                               ///< Суммарная частота отправки, сообщений в секунду
+    int size;                               ///< Длина сообщения, байт
+    int seconds;                            ///< Длительность фазы отправки, секунд
+    int connects;                           ///< Наибольшее количество клиентов потока, вход которых еще не подтвержден
+};
+
+/**
+ * @brief Лог-линейная гистограмма значений в наносекундах
+ *
+ * Для каждой степени двойки 2^HIST_SUB_BITS корзин, относительная ошибка не больше 1/32
+ */
+struct histogram_t {
+    uint64_t counts[HIST_BUCKETS];          ///< Количество значений в корзинах
+    uint64_t total;                         ///< Количество значений
+    uint64_t max;                           ///< Наибольшее значение
+};
+
+/**
+ * @brief Симулированный клиент
+ */
+struct lg_conn_t {
+    int fd;                                 ///< Сокет клиента
+    int index;                              ///< Номер клиента, из него строится имя
+    enum lg_state state;                    ///< Состояние клиента
+    uint64_t started;                       ///< Время вызова connect(), нс
+    int joined;                             ///< Сервер ответил на JOIN_REQUEST: клиент в комнате
+    struct frame_reader_t reader;           ///< Незавершенный входящий кадр
+    char out[FRAME_HEADER_SIZE + BUFFER_SIZE]; ///< Кадр, не принятый ядром целиком
+    size_t out_length;                      ///< Длина кадра в out
+    size_t out_offset;                      ///< Сколько байт кадра уже отправлено
+};
+
+/**
+ * @brief Данные потока генератора
+ */
+struct lg_thread_t {
+    int id;                                 ///< Номер потока
+    pthread_t thread;                       ///< Поток
+    int epoll_fd;                           ///< epoll потока
+    struct lg_conn_t* conns;                ///< Клиенты потока: номера id, id + threads, ...
+    int count;                              ///< Количество клиентов потока
+    int next_connect;                       ///< Первый клиент, подключение которого еще не начато
+    int connecting;                         ///< Количество клиентов, вход которых еще не подтвержден
+    int* senders;                           ///< Индексы отправителей в conns
+    int sender_count;                       ///< Количество отправителей
+    int next_sender;                        ///< Следующий отправитель по кругу
+    double rate;                            ///< Доля потока в частоте отправки, сообщений в секунду
+    uint64_t now;                           ///< Время текущей итерации, нс
+    struct lg_conn_t* reading;              ///< Клиент, кадры которого сейчас разбираются
+    uint64_t connected;                     ///< Установлено TCP соединений
+    uint64_t joined;                        ///< Клиентов, вход которых подтвердил сервер
+    uint64_t connect_failed;                ///< Клиентов, не вошедших в чат
+    uint64_t last_joined;                   ///< Время последнего подтвержденного входа, нс
+    uint64_t disconnected;                  ///< Соединений, закрытых сервером
+    uint64_t attempted;                     ///< Попыток отправки в фазе отправки
+    uint64_t sent;                          ///< Отправлено сообщений
+    uint64_t blocked;                       ///< Пропущено отправок: предыдущий кадр отправителя еще в буфере
+    uint64_t delivered;                     ///< Получено сообщений генератора
+    uint64_t last_delivered;                ///< Время получения последнего сообщения генератора, нс
+    uint64_t skipped;                       ///< Сообщений, пропущенных сервером по уведомлениям о пропуске
+    atomic_ullong frames;                   ///< Получено кадров всего, читает главный поток
+    struct histogram_t latency;             ///< Задержка доставки сообщений
+    struct histogram_t setup;               ///< Время от connect() до подтверждения входа
+    char buffer[READ_SIZE + 1];             ///< Буфер чтения
+};
+
+static struct loadgen_config_t config;
+static _Atomic int phase = PHASE_CONNECT;
+static int loadgen_pid;
+static uint64_t run_started;
+static uint64_t run_finished;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static int histogram_index(uint64_t value) {
+
+    if (value < (1u << HIST_SUB_BITS)) {
+        return (int) value;
+    }
+
+    int exponent = 63 - __builtin_clzll(value);
+
+    return ((exponent - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int) ((value >> (exponent - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+/**
+ * @brief Наибольшее значение корзины
+ *
+ */
+static uint64_t histogram_upper(int index) {
+
+    if (index < (1 << HIST_SUB_BITS)) {
+        return (uint64_t) index;
+    }
+
+    int exponent = (index >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = (uint64_t) (index & ((1 << HIST_SUB_BITS) - 1));
+
+    return (((1ull << HIST_SUB_BITS) + sub + 1) << (exponent - HIST_SUB_BITS)) - 1;
+}
+
+static void histogram_record(struct histogram_t* histogram, uint64_t value) {
+    histogram->counts[histogram_index(value)]++;
+    histogram->total++;
+
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+
+}
+
+static void histogram_merge(struct histogram_t* to, const struct histogram_t* from) {
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+
+    to->total += from->total;
+
+    if (from->max > to->max) {
+        to->max = from->max;
+    }
+
+}
+
+/**
+ * @brief Значение, не меньше которого доля quantile всех значений
+ *
+ */
+static uint64_t histogram_quantile(const struct histogram_t* histogram, double quantile) {
+
+    if (histogram->total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (quantile * histogram->total + 0.999999);
+    uint64_t seen = 0;
+
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += histogram->counts[i];
+
+        if (seen >= rank) {
+            uint64_t upper = histogram_upper(i);
+
+            return upper < histogram->max ? upper : histogram->max;
+        }
+
+    }
+
+    return histogram->max;
+}
+
+/**
+ * @brief Поднимает мягкий лимит открытых дескрипторов до жесткого
+ *
+ */
+static void raise_fd_limit(void) {
+    struct rlimit limit = {0};
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        perror("raise_fd_limit: getrlimit");
+
+        return;
+    }
+
+    limit.rlim_cur = limit.rlim_max;
+
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        perror("raise_fd_limit: setrlimit");
+    }
+
+}
+
+static void conn_close(struct lg_thread_t* self, struct lg_conn_t* conn) {
+
+    if (conn->state == LG_ACTIVE && !conn->joined) {
+        self->connect_failed++;
+    }
+
+    if (conn->state == LG_CONNECTING || (conn->state == LG_ACTIVE && !conn->joined)) {
+        self->connecting--;
+    }
+
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+
+    conn->fd = -1;
+    conn->state = LG_CLOSED;
+}
+
+/**
+ * @brief Дописывает в сокет остаток кадра
+ *
+ * @return int 0 если кадр отправлен целиком или ядро не принимает данные, -1 при ошибке
+ */
+static int conn_flush(struct lg_conn_t* conn) {
+
+    while (conn->out_offset < conn->out_length) {
+        ssize_t count_of_bytes = send(conn->fd, conn->out + conn->out_offset, conn->out_length - conn->out_offset, MSG_NOSIGNAL);
+
+        if (count_of_bytes < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+
+        conn->out_offset += count_of_bytes;
+    }
+
+    conn->out_length = 0;
+    conn->out_offset = 0;
+
+    return 0;
+}
+
+/**
+ * @brief Ставит кадр в буфер клиента и отправляет, что принимает ядро
+ *
+ * @return int 0 в случае успеха, 1 если предыдущий кадр еще не отправлен, -1 при ошибке
+ */
+static int conn_send(struct lg_conn_t* conn, const char* payload, size_t length) {
+
+    if (conn->out_length > 0) {
+        return 1;
+    }
+
+    frame_set_header(conn->out, length);
+
+    memcpy(conn->out + FRAME_HEADER_SIZE, payload, length);
+
+    conn->out_length = FRAME_HEADER_SIZE + length;
+    conn->out_offset = 0;
+
+    return conn_flush(conn);
+}
+
+/**
+ * @brief Начинает неблокирующее подключение следующего клиента
+ *
+ */
+static void conn_start(struct lg_thread_t* self, struct lg_conn_t* conn) {
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    conn->started = now_ns();
+
+    if (conn->fd < 0) {
+        perror("conn_start: socket");
+
+        self->connect_failed++;
+        conn->state = LG_CLOSED;
+
+        return;
+    }
+
+    int one = 1;
+
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->state = LG_CONNECTING;
+    self->connecting++;
+
+    if (connect(conn->fd, (struct sockaddr*) &config.addr, sizeof(config.addr)) < 0 && errno != EINPROGRESS) {
+        perror("conn_start: connect");
+
+        self->connect_failed++;
+
+        conn_close(self, conn);
+
+        return;
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.ptr = conn
+    };
+
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) < 0) {
+        perror("conn_start: epoll_ctl");
+
+        self->connect_failed++;
+
+        conn_close(self, conn);
+    }
+
+}
+
+/**
+ * @brief Завершение подключения: проверка ошибки, отправка имени и запроса JOIN_REQUEST
+ *
+ * Сервер выполняет команды по порядку, поэтому ответ на запрос означает, что клиент уже в комнате.
+ * Сокет может считаться подключенным, пока сервер еще не принял его из очереди listen()
+ *
+ */
+static void conn_established(struct lg_thread_t* self, struct lg_conn_t* conn) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+        fprintf(stderr, "conn_established: connect: %s\n", strerror(error ? error : errno));
+
+        self->connect_failed++;
+
+        conn_close(self, conn);
+
+        return;
+    }
+
+    char* frame = conn->out;
+    int name_length = snprintf(frame + FRAME_HEADER_SIZE, MAX_NAME_LENGTH, "lg%d-%d", loadgen_pid, conn->index);
+
+    frame_set_header(frame, name_length);
+
+    frame += FRAME_HEADER_SIZE + name_length;
+
+    frame_set_header(frame, strlen(JOIN_REQUEST));
+
+    memcpy(frame + FRAME_HEADER_SIZE, JOIN_REQUEST, strlen(JOIN_REQUEST));
+
+    conn->out_length = 2 * FRAME_HEADER_SIZE + name_length + strlen(JOIN_REQUEST);
+    conn->out_offset = 0;
+
+    self->connected++;
+    conn->state = LG_ACTIVE;
+
+    if (conn_flush(conn) < 0) {
+        conn_close(self, conn);
+    }
+
+}
+
+/**
+ * @brief Учет полученного кадра
+ *
+ * Сообщения генератора имеют вид "<name>: LG <pid> <время отправки> xxx...",
+ * сообщения других запусков из журнала комнаты не учитываются
+ *
+ */
+static int on_frame(void* arg, char* payload, size_t length) {
+    struct lg_thread_t* self = (struct lg_thread_t*) arg;
+    struct lg_conn_t* conn = self->reading;
+    const char* mark = memmem(payload, length, MESSAGE_MARK, strlen(MESSAGE_MARK));
+    unsigned long long sent = 0;
+    unsigned skipped = 0;
+    int pid = 0;
+
+    atomic_fetch_add_explicit(&self->frames, 1, memory_order_relaxed);
+
+    if (!conn->joined && strncmp(payload, JOIN_REPLY, strlen(JOIN_REPLY)) == 0) {
+        conn->joined = 1;
+
+        self->connecting--;
+        self->joined++;
+        self->last_joined = self->now;
+
+        histogram_record(&self->setup, self->now - conn->started);
+
+        return 0;
+    }
+
+    if (mark && sscanf(mark + strlen(MESSAGE_MARK), "%d %llu", &pid, &sent) == 2 && pid == loadgen_pid) {
+        self->delivered++;
+        self->last_delivered = self->now;
+
+        histogram_record(&self->latency, self->now > sent ? self->now - sent : 0);
+
+        return 0;
+    }
+
+    if (sscanf(payload, "%u messages were skipped", &skipped) == 1) {
+        self->skipped += skipped;
+    }
+
+    return 0;
+}
+
+static void conn_read(struct lg_thread_t* self, struct lg_conn_t* conn) {
+
+    while (conn->state == LG_ACTIVE) {
+        ssize_t count_of_bytes = recv(conn->fd, self->buffer, READ_SIZE, 0);
+
+        if (count_of_bytes > 0) {
+            self->now = now_ns();
+            self->reading = conn;
+
+            if (frame_reader_consume(&conn->reader, self->buffer, count_of_bytes, on_frame, self) < 0) {
+                self->disconnected++;
+
+                conn_close(self, conn);
+            }
+
+            continue;
+        }
+
+        if (count_of_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count_of_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        self->disconnected++;
+
+        conn_close(self, conn);
+    }
+
+}
+
+/**
+ * @brief Отправка сообщений, которые положены потоку к текущему моменту
+ *
+ * Отправители выбираются по кругу. Время отправки записывается в текст сообщения
+ *
+ */
+static void send_due(struct lg_thread_t* self) {
+
+    if (self->sender_count == 0) {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    uint64_t due = (uint64_t) ((now - run_started) / 1e9 * self->rate);
+    char payload[BUFFER_SIZE];
+
+    while (self->attempted < due) {
+        struct lg_conn_t* conn = &self->conns[self->senders[self->next_sender]];
+
+        self->next_sender = (self->next_sender + 1) % self->sender_count;
+        self->attempted++;
+
+        if (conn->state != LG_ACTIVE) {
+            self->blocked++;
+
+            continue;
+        }
+
+        int length = snprintf(payload, sizeof(payload), "LG %d %020llu ", loadgen_pid, (unsigned long long) now_ns());
+
+        memset(payload + length, 'x', config.size - length);
+
+        int result = conn_send(conn, payload, config.size);
+
+        if (result < 0) {
+            self->disconnected++;
+
+            conn_close(self, conn);
+        } else if (result > 0) {
+            self->blocked++;
+        } else {
+            self->sent++;
+        }
+
+    }
+
+}
+
+static void* loadgen_thread(void* arg) {
+    struct lg_thread_t* self = (struct lg_thread_t*) arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int current = atomic_load(&phase);
+
+        if (current == PHASE_STOP) {
+            break;
+        }
+
+        while (self->next_connect < self->count && self->connecting < config.connects) {
+            conn_start(self, &self->conns[self->next_connect++]);
+        }
+
+        if (current == PHASE_RUN) {
+            send_due(self);
+        }
+
+        int count = epoll_wait(self->epoll_fd, events, MAX_EVENTS, 1);
+
+        if (count < 0 && errno != EINTR) {
+            perror("loadgen_thread: epoll_wait");
+
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            struct lg_conn_t* conn = (struct lg_conn_t*) events[i].data.ptr;
+
+            if (conn->state == LG_CONNECTING && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                conn_established(self, conn);
+            }
+
+            if (conn->state != LG_ACTIVE) {
+                continue;
+            }
+
+            if ((events[i].events & EPOLLOUT) && conn_flush(conn) < 0) {
+                self->disconnected++;
+
+                conn_close(self, conn);
+
+                continue;
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                conn_read(self, conn);
+            }
+
+        }
+
+    }
+
+    return NULL;
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -H, --host <ip>          server address (default 127.0.0.1)\n"
+        "  -p, --port <port>        server port (default %d)\n"
+        "  -c, --clients <n>        simulated clients, all in the default room (default %d)\n"
+        "  -t, --threads <n>        generator threads (default %d)\n"
+        "  -S, --senders <n>        clients that send messages (default %d)\n"
+        "  -r, --rate <n>           messages per second from all senders (default %d)\n"
+        "  -s, --size <n>           message size in bytes, %d..%d (default %d)\n"
+        "  -d, --duration <s>       sending phase length in seconds (default %d)\n"
+        "  -C, --connects <n>       clients per thread connecting at once, until the server confirms the join (default %d)\n"
+        "  -h, --help               show this help\n",
+        program, PORT, DEFAULT_CLIENTS, DEFAULT_THREADS, DEFAULT_SENDERS, DEFAULT_RATE,
+        MIN_MESSAGE_SIZE, MAX_MESSAGE_SIZE, DEFAULT_SIZE, DEFAULT_SECONDS, DEFAULT_CONNECTS
+    );
+}
+
+static int parse_number(const char* name, const char* text, long min, long max, int* value) {
+    char* end = NULL;
+    long parsed = strtol(text, &end, 10);
+
+    if (*text == '\0' || *end != '\0' || parsed < min || parsed > max) {
+        fprintf(stderr, "Incorrect %s: %s (%ld..%ld)\n", name, text, min, max);
+
+        return -1;
+    }
+
+    *value = (int) parsed;
+
+    return 0;
+}
+
+static int parse_args(int argc, char* argv[]) {
+    static const struct option options[] = {
+        { "host",        required_argument, NULL, 'H' },
+        { "port",        required_argument, NULL, 'p' },
+        { "clients",     required_argument, NULL, 'c' },
+        { "threads",     required_argument, NULL, 't' },
+        { "senders",     required_argument, NULL, 'S' },
+        { "rate",        required_argument, NULL, 'r' },
+        { "size",        required_argument, NULL, 's' },
+        { "duration",    required_argument, NULL, 'd' },
+        { "connects",    required_argument, NULL, 'C' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL,          0,                 NULL, 0   }
+    };
+
+    int port = PORT;
+    int opt = 0;
+    int error = 0;
+
+    config.addr.sin_family = AF_INET;
+    config.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    config.clients = DEFAULT_CLIENTS;
+    config.threads = DEFAULT_THREADS;
+    config.senders = DEFAULT_SENDERS;
+    config.rate = DEFAULT_RATE;
+    config.size = DEFAULT_SIZE;
+    config.seconds = DEFAULT_SECONDS;
+    config.connects = DEFAULT_CONNECTS;
+
+    while (!error && (opt = getopt_long(argc, argv, "H:p:c:t:S:r:s:d:C:h", options, NULL)) != -1) {
+
+        switch (opt) {
+            case 'H':
+
+                if (inet_pton(AF_INET, optarg, &config.addr.sin_addr) != 1) {
+                    fprintf(stderr, "Incorrect host: %s\n", optarg);
+
+                    error = -1;
+                }
+
+                break;
+
+            case 'p':
+                error = parse_number("port", optarg, 1, 65535, &port);
+
+                break;
+
+            case 'c':
+                error = parse_number("number of clients", optarg, 1, MAX_CLIENTS, &config.clients);
+
+                break;
+
+            case 't':
+                error = parse_number("number of threads", optarg, 1, MAX_WORKERS, &config.threads);
+
+                break;
+
+            case 'S':
+                error = parse_number("number of senders", optarg, 0, MAX_CLIENTS, &config.senders);
+
+                break;
+
+            case 'r':
+                error = parse_number("rate", optarg, 1, 10000000, &config.rate);
+
+                break;
+
+            case 's':
+                error = parse_number("message size", optarg, MIN_MESSAGE_SIZE, MAX_MESSAGE_SIZE, &config.size);
+
+                break;
+
+            case 'd':
+                error = parse_number("duration", optarg, 1, 86400, &config.seconds);
+
+                break;
+
+            case 'C':
+                error = parse_number("concurrent connects", optarg, 1, 65536, &config.connects);
+
+                break;
+
+            case 'h':
+            default:
+                print_usage(argv[0]);
+
+                return -1;
+        }
+
+    }
+
+    if (error < 0) {
+        return -1;
+    }
+
+    if (optind < argc) {
+        print_usage(argv[0]);
+
+        return -1;
+    }
+
+    config.addr.sin_port = htons((uint16_t) port);
+
+    if (config.senders > config.clients) {
+        config.senders = config.clients;
+    }
+
+    if (config.threads > config.clients) {
+        config.threads = config.clients;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Распределение клиентов и отправителей по потокам
+ *
+ * Клиент i принадлежит потоку i % threads, отправители - клиенты с номерами меньше senders
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int threads_init(struct lg_thread_t* threads) {
+
+    for (int t = 0; t < config.threads; t++) {
+        struct lg_thread_t* self = &threads[t];
+
+        self->id = t;
+        self->count = (config.clients - t + config.threads - 1) / config.threads;
+        self->conns = calloc(self->count, sizeof(struct lg_conn_t));
+        self->senders = calloc(self->count, sizeof(int));
+        self->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        atomic_init(&self->frames, 0);
+
+        if (!self->conns || !self->senders || self->epoll_fd < 0) {
+            perror("threads_init");
+
+            return -1;
+        }
+
+        for (int i = 0; i < self->count; i++) {
+            self->conns[i].fd = -1;
+            self->conns[i].index = t + i * config.threads;
+
+            if (self->conns[i].index < config.senders) {
+                self->senders[self->sender_count++] = i;
+            }
+
+        }
+
+        self->rate = config.senders > 0 ? (double) config.rate * self->sender_count / config.senders : 0;
+    }
+
+    return 0;
+}
+
+static unsigned long long total_frames(struct lg_thread_t* threads) {
+    unsigned long long frames = 0;
+
+    for (int t = 0; t < config.threads; t++) {
+        frames += atomic_load_explicit(&threads[t].frames, memory_order_relaxed);
+    }
+
+    return frames;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (long) (ms % 1000) * 1000000
+    };
+
+    nanosleep(&ts, NULL);
+}
+
+/**
+ * @brief Ожидание, пока клиенты не перестанут получать кадры на QUIET_MS
+ *
+ * @param limit_ms Наибольшее время ожидания
+ */
+static void wait_quiet(struct lg_thread_t* threads, int limit_ms) {
+    unsigned long long frames = total_frames(threads);
+    uint64_t started = now_ns();
+    uint64_t quiet_since = started;
+
+    while (now_ns() - quiet_since < QUIET_MS * 1000000ull && now_ns() - started < limit_ms * 1000000ull) {
+        sleep_ms(50);
+
+        unsigned long long current = total_frames(threads);
+
+        if (current != frames) {
+            frames = current;
+            quiet_since = now_ns();
+        }
+
+    }
+
+}
+
+/**
+ * @brief Ожидание входа всех клиентов и затихания уведомлений о входе
+ *
+ * @return uint64_t Время последнего подтвержденного входа, нс
+ */
+static uint64_t wait_setup(struct lg_thread_t* threads) {
+
+    while (1) {
+        uint64_t done = 0;
+
+        for (int t = 0; t < config.threads; t++) {
+            done += threads[t].joined + threads[t].connect_failed;
+        }
+
+        if (done >= (uint64_t) config.clients) {
+            break;
+        }
+
+        sleep_ms(10);
+    }
+
+    atomic_store(&phase, PHASE_SETTLE);
+
+    wait_quiet(threads, SETTLE_MAX_MS);
+
+    uint64_t last = 0;
+
+    for (int t = 0; t < config.threads; t++) {
+
+        if (threads[t].last_joined > last) {
+            last = threads[t].last_joined;
+        }
+
+    }
+
+    return last;
+}
+
+static void print_report(struct lg_thread_t* threads, uint64_t started, uint64_t setup_finished) {
+    struct histogram_t* latency = calloc(1, sizeof(struct histogram_t));
+    struct histogram_t* setup = calloc(1, sizeof(struct histogram_t));
+
+    if (!latency || !setup) {
+        perror("print_report: calloc");
+
+        free(latency);
+        free(setup);
+
+        return;
+    }
+
+    uint64_t connected = 0, joined = 0, failed = 0, disconnected = 0, sent = 0, blocked = 0, delivered = 0, skipped = 0, last_delivered = run_started;
+
+    for (int t = 0; t < config.threads; t++) {
+        struct lg_thread_t* self = &threads[t];
+
+        connected += self->connected;
+        joined += self->joined;
+        failed += self->connect_failed;
+        disconnected += self->disconnected;
+        sent += self->sent;
+        blocked += self->blocked;
+        delivered += self->delivered;
+        skipped += self->skipped;
+
+        if (self->last_delivered > last_delivered) {
+            last_delivered = self->last_delivered;
+        }
+
+        histogram_merge(latency, &self->latency);
+        histogram_merge(setup, &self->setup);
+    }
+
+    double setup_seconds = setup_finished > started ? (setup_finished - started) / 1e9 : 0;
+    double run_seconds = (run_finished - run_started) / 1e9;
+    double delivery_seconds = last_delivered > run_started ? (last_delivered - run_started) / 1e9 : run_seconds;
+    uint64_t expected = sent * (joined > 0 ? joined - 1 : 0);
+
+    printf("clients %d, threads %d, senders %d, rate %d msg/s, size %d bytes, duration %d s\n",
+        config.clients, config.threads, config.senders, config.rate, config.size, config.seconds);
+    printf("setup: %llu joined (%llu connected), %llu failed in %.3f s, %.0f conn/s, setup p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        (unsigned long long) joined, (unsigned long long) connected, (unsigned long long) failed, setup_seconds,
+        setup_seconds > 0 ? joined / setup_seconds : 0,
+        histogram_quantile(setup, 0.5) / 1e3, histogram_quantile(setup, 0.99) / 1e3, setup->max / 1e3);
+    printf("send: %llu sent, %llu blocked by a full socket, %.0f msg/s\n",
+        (unsigned long long) sent, (unsigned long long) blocked, sent / run_seconds);
+    printf("fan-out: %llu of %llu delivered (%.2f%%), %llu skipped by the server, %llu disconnected, %.0f msg/s delivered\n",
+        (unsigned long long) delivered, (unsigned long long) expected, expected ? 100.0 * delivered / expected : 0,
+        (unsigned long long) skipped, (unsigned long long) disconnected, delivered / delivery_seconds);
+    printf("latency: p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+        histogram_quantile(latency, 0.5) / 1e3, histogram_quantile(latency, 0.99) / 1e3,
+        histogram_quantile(latency, 0.999) / 1e3, latency->max / 1e3);
+
+    free(latency);
+    free(setup);
+}
+
+/**
+ * @brief Синтетическая нагрузка на сервер по loopback
+ *
+ * Потоки подключают клиентов неблокирующими сокетами, передают имена и ждут, пока
+ * затихнут уведомления о входе. Затем отправители шлют сообщения с заданной частотой,
+ * время отправки записано в тексте сообщения, задержка считается по каждой доставке
+ */
+int main(int argc, char* argv[]) {
+
+    if (parse_args(argc, argv) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    loadgen_pid = (int) getpid();
+
+    raise_fd_limit();
+
+    struct lg_thread_t* threads = calloc(config.threads, sizeof(struct lg_thread_t));
+
+    if (!threads || threads_init(threads) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    uint64_t started = now_ns();
+
+    for (int t = 0; t < config.threads; t++) {
+        int error = pthread_create(&threads[t].thread, NULL, loadgen_thread, &threads[t]);
+
+        if (error != 0) {
+            fprintf(stderr, "main: pthread_create: %s\n", strerror(error));
+
+            return EXIT_FAILURE;
+        }
+
+    }
+
+    uint64_t setup_finished = wait_setup(threads);
+
+    run_started = now_ns();
+
+    atomic_store(&phase, PHASE_RUN);
+
+    sleep_ms(config.seconds * 1000);
+
+    run_finished = now_ns();
+
+    atomic_store(&phase, PHASE_DRAIN);
+
+    wait_quiet(threads, DRAIN_MAX_MS);
+
+    atomic_store(&phase, PHASE_STOP);
+
+    uint64_t joined = 0;
+
+    for (int t = 0; t < config.threads; t++) {
+        pthread_join(threads[t].thread, NULL);
+
+        joined += threads[t].joined;
+    }
+
+    print_report(threads, started, setup_finished);
+
+    for (int t = 0; t < config.threads; t++) {
+
+        for (int i = 0; i < threads[t].count; i++) {
+
+            if (threads[t].conns[i].fd >= 0) {
+                close(threads[t].conns[i].fd);
+            }
+
+            frame_reader_free(&threads[t].conns[i].reader);
+        }
+
+        close(threads[t].epoll_fd);
+
+        free(threads[t].conns);
+        free(threads[t].senders);
+    }
+
+    free(threads);
+
+    return joined > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,268 @@
+#include "../headers/chat_room.h"
+#include "../headers/room_registry.h"
+#include "../headers/client_utils.h"
+#include "../headers/logger.h"
+
+#include <fcntl.h>
+#include <time.h>
+
+#define DEFAULT_THREADS     64
+#define DEFAULT_MEMBERS     256
+#define DEFAULT_SECONDS     2
+
+/**
+ * @brief Прежняя схема: плотный массив клиентов под одним мьютексом
+ */
+struct mutex_table_t {
+    pthread_mutex_t mutex;                  ///< Мьютекс, который берут и читатели, и писатели
+    struct client_node_t* clients;          ///< Плотный массив клиентов
+    int count;                              ///< Количество клиентов
+    int capacity;                           ///< Размер массива
+};
+
+/**
+ * @brief Общие данные прогона
+ */
+struct bench_t {
+    int use_snapshots;                      ///< 1 - снимки chat_room, 0 - массив под мьютексом
+    struct room_registry_t* rooms;          ///< Реестр для прогона со снимками
+    struct chat_t* chat;                    ///< Комната для прогона со снимками
+    struct mutex_table_t table;             ///< Таблица для прогона с мьютексом
+    atomic_int running;                     ///< Сбрасывается в 0 по истечении времени
+    atomic_ullong visits;                   ///< Количество обработанных элементов всеми читателями
+    atomic_ullong iterations;               ///< Количество полных обходов всеми читателями
+    unsigned long long churn;               ///< Количество пар присоединение/выход писателя
+};
+
+static int visit_callback(struct client_node_t* client, void* arg) {
+    unsigned long long* visits = (unsigned long long*) arg;
+
+    *visits += client->data.client_name[0] != '\0';
+
+    return 0;
+}
+
+static void table_add(struct mutex_table_t* table, struct client_data_t* c_data) {
+    pthread_mutex_lock(&table->mutex);
+
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 16;
+        table->clients = realloc(table->clients, table->capacity * sizeof(struct client_node_t));
+
+        if (!table->clients) {
+            perror("table_add: realloc");
+
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    table->clients[table->count++].data = *c_data;
+
+    pthread_mutex_unlock(&table->mutex);
+}
+
+static void table_remove(struct mutex_table_t* table, int fd) {
+    pthread_mutex_lock(&table->mutex);
+
+    for (int i = 0; i < table->count; i++) {
+
+        if (table->clients[i].data.client_fd == fd) {
+            table->clients[i] = table->clients[--table->count];
+
+            break;
+        }
+
+    }
+
+    pthread_mutex_unlock(&table->mutex);
+}
+
+static void* reader_thread(void* arg) {
+    struct bench_t* bench = (struct bench_t*) arg;
+    unsigned long long visits = 0;
+    unsigned long long iterations = 0;
+
+    while (atomic_load_explicit(&bench->running, memory_order_relaxed)) {
+
+        if (bench->use_snapshots) {
+            foreach_client_expect(bench->chat, -1, visit_callback, &visits);
+        } else {
+            pthread_mutex_lock(&bench->table.mutex);
+
+            for (int i = 0; i < bench->table.count; i++) {
+                visit_callback(&bench->table.clients[i], &visits);
+            }
+
+            pthread_mutex_unlock(&bench->table.mutex);
+        }
+
+        iterations++;
+    }
+
+    atomic_fetch_add(&bench->visits, visits);
+    atomic_fetch_add(&bench->iterations, iterations);
+
+    return NULL;
+}
+
+static struct client_data_t make_client(int index) {
+    struct client_data_t c_data = {0};
+
+    c_data.client_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+    if (c_data.client_fd < 0) {
+        perror("make_client: open");
+
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(c_data.client_name, MAX_NAME_LENGTH, "member%d", index);
+    strncpy(c_data.client_ip, "127.0.0.1", INET_ADDRSTRLEN);
+
+    return c_data;
+}
+
+static void* writer_thread(void* arg) {
+    struct bench_t* bench = (struct bench_t*) arg;
+
+    while (atomic_load_explicit(&bench->running, memory_order_relaxed)) {
+        struct client_data_t c_data = make_client(-1);
+
+        if (bench->use_snapshots) {
+            client_add_to_chat(bench->chat, &c_data, BACKLOG_NONE);
+            client_remove_from_chat(bench->chat, &c_data);
+            client_close_deferred(c_data.client_fd);
+        } else {
+            table_add(&bench->table, &c_data);
+            table_remove(&bench->table, c_data.client_fd);
+
+            close(c_data.client_fd);
+        }
+
+        bench->churn++;
+    }
+
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Один прогон: threads читателей обходят members клиентов, один писатель без пауз присоединяет и удаляет клиента
+ *
+ */
+static void run(int use_snapshots, int threads, int members, int seconds) {
+    struct bench_t bench = {
+        .use_snapshots = use_snapshots
+    };
+
+    pthread_mutex_init(&bench.table.mutex, NULL);
+    atomic_init(&bench.running, 1);
+    atomic_init(&bench.visits, 0);
+    atomic_init(&bench.iterations, 0);
+
+    if (use_snapshots) {
+        bench.rooms = room_registry_init(1, &(struct backlog_limits_t) { 0 });
+        bench.chat = bench.rooms ? room_acquire(bench.rooms, "bench") : NULL;
+
+        if (!bench.chat) {
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    for (int i = 0; i < members; i++) {
+        struct client_data_t c_data = make_client(i);
+
+        if (use_snapshots) {
+            client_add_to_chat(bench.chat, &c_data, BACKLOG_NONE);
+        } else {
+            table_add(&bench.table, &c_data);
+        }
+
+    }
+
+    pthread_t* readers = malloc(threads * sizeof(pthread_t));
+    pthread_t writer;
+
+    if (!readers) {
+        perror("run: malloc");
+
+        exit(EXIT_FAILURE);
+    }
+
+    double start = now_seconds();
+
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&readers[i], NULL, reader_thread, &bench);
+    }
+
+    pthread_create(&writer, NULL, writer_thread, &bench);
+
+    sleep(seconds);
+
+    atomic_store(&bench.running, 0);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    pthread_join(writer, NULL);
+
+    double elapsed = now_seconds() - start;
+
+    fprintf(stderr, "%-9s threads %3d members %5d: %12.0f walks/s %14.0f visits/s %10.0f joins+leaves/s\n",
+        use_snapshots ? "snapshot" : "mutex",
+        threads,
+        members,
+        atomic_load(&bench.iterations) / elapsed,
+        atomic_load(&bench.visits) / elapsed,
+        bench.churn / elapsed
+    );
+
+    if (use_snapshots) {
+        room_release(bench.chat);
+        room_registry_free(bench.rooms);
+    } else {
+
+        for (int i = 0; i < bench.table.count; i++) {
+            close(bench.table.clients[i].data.client_fd);
+        }
+
+        free(bench.table.clients);
+        pthread_mutex_destroy(&bench.table.mutex);
+    }
+
+    free(readers);
+}
+
+/**
+ * @brief Сравнение обхода участников под мьютексом и по снимкам
+ *
+ * Журнал чата отключен до уровня ошибок, результаты печатаются в stderr
+ */
+int main(int argc, char* argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+    int members = argc > 2 ? atoi(argv[2]) : DEFAULT_MEMBERS;
+    int seconds = argc > 3 ? atoi(argv[3]) : DEFAULT_SECONDS;
+
+    if (threads <= 0 || members < 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [members] [seconds]\n", argv[0]);
+
+        return EXIT_FAILURE;
+    }
+
+    logger_level = LOG_LEVEL_ERROR;
+
+    run(0, threads, members, seconds);
+    run(1, threads, members, seconds);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,341 @@
+#include "../headers/frame.h"
+#include "../headers/logger.h"
+#include "../headers/message.h"
+#include "../headers/metrics.h"
+#include "../headers/zerocopy.h"
+
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+
+#define DEFAULT_RECIPIENTS  8
+#define DEFAULT_MEGABYTES   128
+#define MIN_SIZE            256
+#define RECEIVE_SIZE        (256 * 1024)
+#define COMPLETION_WAIT_MS  1000
+
+/**
+ * @brief Соединения одного прогона: отправитель рассылает один кадр по всем сокетам, как broadcast_callback()
+ */
+struct bench_t {
+    int count;                              ///< Количество получателей
+    int* senders;                           ///< Сокеты отправителя
+    int* receivers;                         ///< Сокеты получателей, их вычитывает отдельный поток
+    struct zerocopy_t** zerocopy;           ///< Учет отправок с MSG_ZEROCOPY, NULL при копировании
+    atomic_int running;                     ///< Сбрасывается в 0, когда отправитель закончил
+};
+
+/**
+ * @brief Результат прогона
+ */
+struct result_t {
+    double seconds;                         ///< Время рассылки вместе с ожиданием последних уведомлений
+    double cpu;                             ///< Процессорное время потока отправителя, с
+    uint64_t zerocopy_sends;                ///< Отправок с MSG_ZEROCOPY
+    uint64_t zerocopy_copied;               ///< Из них скопированных ядром
+};
+
+static double now_seconds(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* receiver_thread(void* arg) {
+    struct bench_t* bench = (struct bench_t*) arg;
+    struct pollfd* fds = calloc(bench->count, sizeof(struct pollfd));
+    char* buffer = malloc(RECEIVE_SIZE);
+
+    if (!fds || !buffer) {
+        perror("receiver_thread: malloc");
+
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < bench->count; i++) {
+        fds[i].fd = bench->receivers[i];
+        fds[i].events = POLLIN;
+    }
+
+    while (atomic_load(&bench->running)) {
+
+        if (poll(fds, bench->count, 100) <= 0) {
+            continue;
+        }
+
+        for (int i = 0; i < bench->count; i++) {
+
+            if (fds[i].revents & POLLIN) {
+
+                while (recv(fds[i].fd, buffer, RECEIVE_SIZE, MSG_DONTWAIT) > 0) {
+                }
+
+            }
+
+        }
+
+    }
+
+    free(buffer);
+    free(fds);
+
+    return NULL;
+}
+
+/**
+ * @brief Пары соединенных TCP-сокетов на loopback
+ *
+ */
+static void connect_pairs(struct bench_t* bench) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    socklen_t length = sizeof(addr);
+
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, bench->count) < 0 || getsockname(listen_fd, (struct sockaddr*) &addr, &length) < 0) {
+        perror("connect_pairs: listen");
+
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < bench->count; i++) {
+        bench->senders[i] = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (bench->senders[i] < 0 || connect(bench->senders[i], (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+            perror("connect_pairs: connect");
+
+            exit(EXIT_FAILURE);
+        }
+
+        bench->receivers[i] = accept(listen_fd, NULL, NULL);
+
+        if (bench->receivers[i] < 0) {
+            perror("connect_pairs: accept");
+
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    close(listen_fd);
+}
+
+/**
+ * @brief Ожидание уведомлений о завершении, пока незавершенных отправок не меньше limit
+ *
+ */
+static void wait_completions(struct zerocopy_t* zerocopy, int fd, uint32_t limit) {
+
+    while (zerocopy->next - zerocopy->oldest >= limit && zerocopy->next != zerocopy->oldest) {
+        struct pollfd pfd = {
+            .fd = fd
+        };
+
+        if (poll(&pfd, 1, COMPLETION_WAIT_MS) <= 0) {
+            fprintf(stderr, "wait_completions: no completion for %d ms\n", COMPLETION_WAIT_MS);
+
+            exit(EXIT_FAILURE);
+        }
+
+        zerocopy_complete(zerocopy, fd);
+    }
+
+}
+
+/**
+ * @brief Рассылка кадра size байт по count получателям, пока не отправлено total байт
+ *
+ */
+static struct result_t run(int use_zerocopy, int count, size_t size, size_t total) {
+    struct bench_t bench = {
+        .count = count,
+        .senders = calloc(count, sizeof(int)),
+        .receivers = calloc(count, sizeof(int)),
+        .zerocopy = calloc(count, sizeof(struct zerocopy_t*))
+    };
+    char* payload = malloc(size);
+
+    if (!bench.senders || !bench.receivers || !bench.zerocopy || !payload) {
+        perror("run: calloc");
+
+        exit(EXIT_FAILURE);
+    }
+
+    memset(payload, 'z', size);
+
+    struct message_t* message = message_create(payload, size);
+
+    if (!message) {
+        exit(EXIT_FAILURE);
+    }
+
+    connect_pairs(&bench);
+
+    for (int i = 0; use_zerocopy && i < count; i++) {
+        bench.zerocopy[i] = zerocopy_create(bench.senders[i]);
+
+        if (!bench.zerocopy[i]) {
+            exit(EXIT_FAILURE);
+        }
+
+    }
+
+    atomic_init(&bench.running, 1);
+
+    pthread_t receiver;
+
+    pthread_create(&receiver, NULL, receiver_thread, &bench);
+
+    static struct metrics_t before;
+    static struct metrics_t after;
+
+    memset(&before, 0, sizeof(before));
+    memset(&after, 0, sizeof(after));
+
+    metrics_collect(&before);
+
+    size_t rounds = total / (size * count) > 0 ? total / (size * count) : 1;
+    double start = now_seconds(CLOCK_MONOTONIC);
+    double cpu_start = now_seconds(CLOCK_THREAD_CPUTIME_ID);
+
+    for (size_t round = 0; round < rounds; round++) {
+
+        for (int i = 0; i < count; i++) {
+            size_t sent = 0;
+
+            while (sent < size) {
+                ssize_t count_of_bytes = 0;
+
+                if (use_zerocopy) {
+                    wait_completions(bench.zerocopy[i], bench.senders[i], ZEROCOPY_MAX_PENDING);
+
+                    count_of_bytes = zerocopy_send(bench.zerocopy[i], bench.senders[i], message, sent, 0);
+                } else {
+                    count_of_bytes = send(bench.senders[i], message->data + sent, size - sent, 0);
+                }
+
+                if (count_of_bytes < 0) {
+
+                    if (errno == EINTR) {
+                        continue;
+                    }
+
+                    perror("run: send");
+
+                    exit(EXIT_FAILURE);
+                }
+
+                sent += count_of_bytes;
+            }
+
+        }
+
+    }
+
+    for (int i = 0; use_zerocopy && i < count; i++) {
+        wait_completions(bench.zerocopy[i], bench.senders[i], 1);
+    }
+
+    struct result_t result = {
+        .seconds = now_seconds(CLOCK_MONOTONIC) - start,
+        .cpu = now_seconds(CLOCK_THREAD_CPUTIME_ID) - cpu_start
+    };
+
+    metrics_collect(&after);
+
+    result.zerocopy_sends = atomic_load(&after.counters[METRICS_ZEROCOPY_SENDS]) - atomic_load(&before.counters[METRICS_ZEROCOPY_SENDS]);
+    result.zerocopy_copied = atomic_load(&after.counters[METRICS_ZEROCOPY_COPIED]) - atomic_load(&before.counters[METRICS_ZEROCOPY_COPIED]);
+
+    atomic_store(&bench.running, 0);
+
+    pthread_join(receiver, NULL);
+
+    for (int i = 0; i < count; i++) {
+        zerocopy_free(bench.zerocopy[i]);
+
+        close(bench.senders[i]);
+        close(bench.receivers[i]);
+    }
+
+    message_unref(message);
+
+    free(payload);
+    free(bench.zerocopy);
+    free(bench.receivers);
+    free(bench.senders);
+
+    return result;
+}
+
+/**
+ * @brief Поиск размера кадра, с которого рассылка с MSG_ZEROCOPY выгоднее копирования
+ *
+ * Для каждого размера от MIN_SIZE до max_size (удвоением) один и тот же объем рассылается
+ * recipients получателям обычным send() и через zerocopy_send(). Сравниваются скорость
+ * рассылки и процессорное время потока отправителя на мегабайт. На loopback ядро
+ * копирует данные при доставке получателю, поэтому уведомления приходят с флагом
+ * SO_EE_CODE_ZEROCOPY_COPIED и точка перехода сдвигается вправо относительно сетевой карты.
+ * Результаты печатаются в stderr
+ */
+int main(int argc, char* argv[]) {
+    int recipients = argc > 1 ? atoi(argv[1]) : DEFAULT_RECIPIENTS;
+    long megabytes = argc > 2 ? atol(argv[2]) : DEFAULT_MEGABYTES;
+    long max_size = argc > 3 ? atol(argv[3]) : FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD;
+
+    if (recipients <= 0 || megabytes <= 0 || max_size < MIN_SIZE) {
+        fprintf(stderr, "Usage: %s [recipients] [megabytes per size] [max frame size, at least %d]\n", argv[0], MIN_SIZE);
+
+        return EXIT_FAILURE;
+    }
+
+    logger_level = LOG_LEVEL_ERROR;
+
+    size_t total = (size_t) megabytes * 1024 * 1024;
+    long throughput_crossover = 0;
+    long cpu_crossover = 0;
+
+    fprintf(stderr, "%8s %12s %12s %14s %14s %10s\n", "size", "copy MB/s", "zc MB/s", "copy cpu us/MB", "zc cpu us/MB", "zc copied");
+
+    for (long size = MIN_SIZE; size <= max_size; size = size < max_size && size * 2 > max_size ? max_size : size * 2) {
+        struct result_t copy = run(0, recipients, size, total);
+        struct result_t zerocopy = run(1, recipients, size, total);
+        double copy_mb = total / 1048576.0;
+
+        fprintf(stderr, "%8ld %12.0f %12.0f %14.1f %14.1f %9.0f%%\n",
+            size,
+            copy_mb / copy.seconds,
+            copy_mb / zerocopy.seconds,
+            copy.cpu * 1e6 / copy_mb,
+            zerocopy.cpu * 1e6 / copy_mb,
+            zerocopy.zerocopy_sends ? 100.0 * zerocopy.zerocopy_copied / zerocopy.zerocopy_sends : 0.0
+        );
+
+        if (!throughput_crossover && zerocopy.seconds < copy.seconds) {
+            throughput_crossover = size;
+        }
+
+        if (!cpu_crossover && zerocopy.cpu < copy.cpu) {
+            cpu_crossover = size;
+        }
+
+    }
+
+    if (throughput_crossover) {
+        fprintf(stderr, "throughput crossover: %ld bytes\n", throughput_crossover);
+    } else {
+        fprintf(stderr, "throughput crossover: none up to %ld bytes, copying is faster\n", max_size);
+    }
+
+    if (cpu_crossover) {
+        fprintf(stderr, "sender cpu crossover: %ld bytes\n", cpu_crossover);
+    } else {
+        fprintf(stderr, "sender cpu crossover: none up to %ld bytes, copying is cheaper\n", max_size);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,26 @@
+#ifndef ADMIN_H
+#define ADMIN_H
+
+#include "common.h"
+#include "config.h"
+
+/**
+ * @brief Запуск потока администратора на Unix-сокете config->admin_path
+ *
+ * Клиент подключается, может отправить одну строку команды и получает ответ, после чего
+ * сокет закрывается: "prometheus" или "metrics" - формат Prometheus, пустая строка
+ * или "text" - текст с частотами с момента предыдущего текстового запроса.
+ * Счетчики рабочих потоков складываются только в момент запроса.
+ * Если путь не задан, ничего не делает
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int admin_start(const struct server_config_t* config, struct room_registry_t* rooms);
+
+/**
+ * @brief Остановка потока администратора и удаление сокета
+ *
+ */
+void admin_stop(void);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+#define BACKLOG_LAST            0           ///< Повторить последние limits.replay сообщений
+#define BACKLOG_NONE            UINT64_MAX  ///< Не повторять журнал
+#define BACKLOG_REPLAY_ROUNDS   4           ///< Проходов повтора без мьютекса журнала
+
+typedef int (*backlog_callback) (struct message_t* message, void* arg);
+
+/**
+ * @brief Инициализация пустого журнала
+ *
+ * @param capacity Максимум сообщений, 0 - журнал только нумерует сообщения
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int backlog_init(struct backlog_t* backlog, unsigned capacity);
+
+/**
+ * @brief Освобождение сообщений журнала и его памяти
+ *
+ * @param total Общий счетчик байт журналов, из которого вычитаются байты журнала
+ */
+void backlog_free(struct backlog_t* backlog, atomic_size_t* total);
+
+/**
+ * @brief Запись сообщения в журнал комнаты перед рассылкой
+ *
+ * Сообщению присваивается следующий номер, журнал захватывает свою ссылку.
+ * Самые старые сообщения вытесняются, пока журнал превышает лимиты комнаты
+ * или общий лимит реестра
+ *
+ * @param prepare Вызывается под мьютексом журнала после присвоения номера и до записи:
+ *                повтор журнала не увидит сообщение, пока prepare() его не достроит.
+ *                Если prepare() вернул -1, номер возвращается и сообщение не записывается
+ * @return int 0 в случае успеха, -1 если prepare() завершился ошибкой
+ * @warning Вызывать до того, как сообщение увидит кто-то еще
+ */
+int backlog_append(struct chat_t* chat, struct message_t* message, backlog_callback prepare, void* arg);
+
+/**
+ * @brief Запись в журнал сообщения, восстановленного из хранилища
+ *
+ * Сообщение сохраняет свой номер, следующие номера комнаты продолжают его.
+ * Сообщения с номерами не больше последнего номера комнаты пропускаются
+ *
+ */
+void backlog_restore(struct chat_t* chat, struct message_t* message);
+
+/**
+ * @brief Повтор журнала новому участнику комнаты
+ *
+ * Отправляет клиенту те же сообщения, что хранит журнал, от старых к новым.
+ * Ссылки на сообщения копируются под мьютексом журнала, а отправляются без него:
+ * медленный клиент не задерживает запись в журнал комнаты. Сообщения, записанные
+ * за время отправки, повторяются следующим проходом. После BACKLOG_REPLAY_ROUNDS
+ * проходов остаток отправляется под мьютексом
+ *
+ * @param since Номер первого сообщения, BACKLOG_LAST - последние limits.replay сообщений
+ * @warning Возвращается с захваченным мьютексом журнала: все сообщения до last_seq уже
+ *          отправлены клиенту, вызывающий публикует клиента в комнате и отпускает мьютекс
+ */
+void backlog_replay(struct chat_t* chat, struct client_data_t* c_data, uint64_t since);
+
+#endif
@@ -2,31 +2,52 @@
 #define CHAT_ROOM_H
 
 #include "common.h"
+#include "backlog.h"
 
 /**
- * @brief Инициализация структуры чата
+ * @brief Создание комнаты с одной ссылкой
+ * 
+ * Количество шардов и таблица клиентов берутся из реестра.
+ * Комнаты создает и удаляет реестр, см. room_registry.h
  */
-struct chat_t* chat_init(void);
+struct chat_t* chat_init(struct room_registry_t* registry, const char* name);
 
 /**
- * @brief Очистка всех ресурсов
+ * @brief Освобождение комнаты
  * 
+ * Дескрипторы оставшихся в комнате клиентов закрываются
  */
 void chat_free(struct chat_t* chat);
 
 /**
- * @brief Добавление нового клиента в список
+ * @brief Добавление нового клиента в комнату
  *
- * Выделяет память под элемент списка и ставит в начале списка
+ * Публикует новый снимок шарда c_data->shard с клиентом в конце
+ * и запоминает комнату и позицию клиента в ячейке дескриптора.
+ * Журнал повторяется клиенту до публикации, публикация идет под мьютексом журнала: сообщения
+ * с номерами до ячейки replayed клиент получает только повтором, остальные - только рассылкой
  *  
+ * @param since Номер первого сообщения для повтора, BACKLOG_LAST или BACKLOG_NONE
  * @return int 0 в случае успеха, -1 при ошибке 
  */
-int client_add_to_chat(struct chat_t* chat, struct client_data_t* c_data);
+int client_add_to_chat(struct chat_t* chat, struct client_data_t* c_data, uint64_t since);
 
 /**
- * @brief Удаление клиента из списка по его дескриптору
+ * @brief Удаление клиента из комнаты по его дескриптору
+ * 
+ * Публикует новый снимок шарда c_data->shard без клиента, на его место
+ * переносится последний элемент. Дескриптор не закрывается
+ * 
+ */
+void client_remove_from_chat(struct chat_t* chat, struct client_data_t* c_data);
+
+/**
+ * @brief Закрытие дескриптора клиента, вышедшего из комнаты
+ * 
+ * Соединение сразу закрывается через shutdown(), а сам дескриптор - после того,
+ * как его перестанут видеть читатели старых снимков любой комнаты
  * 
  */
-void client_remove_from_chat(struct chat_t* chat, int client_fd);
+void client_close_deferred(int fd);
 
-#endif
\ No newline at end of file
+#endif
@@ -2,14 +2,111 @@
 #define CLIENT_HANDLER_H
 
 #include "common.h"
+#include "throttle.h"
+
+/**
+ * @brief Инициализация пула данных потоков клиентов
+ *
+ * @param preallocate Сколько записей выделить сразу
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int client_handler_pool_init(size_t preallocate);
+
+/**
+ * @brief Данные для нового потока клиента из пула
+ *
+ * Освобождает их сам поток в clients_handler()
+ *
+ * @return struct pthread_data_t* NULL при ошибке
+ */
+struct pthread_data_t* pthread_data_create(struct room_registry_t* rooms, const struct rate_limits_t* limits, struct client_data_t* c_data);
+
+/**
+ * @brief Возврат данных потока в пул, если поток не удалось создать
+ *
+ */
+void pthread_data_free(struct pthread_data_t* p_data);
 
 /**
  * @brief Обработчик клиента чата
  * 
  * Для каждого клиента выделяется свой поток
- * Полностью управляет работой сервера с одним клиентом
+ * Поток читает кадры, принимает имя клиента и проверяет ограничение частоты,
+ * команды по порядку выполняет пул рабочих потоков scheduler
  *  
  */
 void* clients_handler(void* arg);
 
+/**
+ * @brief Обработка кадра клиента до присоединения к чату: рукопожатие и имя
+ * 
+ * Кадр рукопожатия переводит соединение на выбранную версию двоичного протокола, клиент получает
+ * PROTOCOL_OP_HELLO со своим номером. Иначе кадр - имя: у текстовых клиентов весь кадр, у двоичных
+ * команда PROTOCOL_OP_NAME. "!anonim" заменяется на "ANONIM", слишком длинное имя обрезается.
+ * Анонимные клиенты и клиенты с пустым именем не регистрируются в индексе имен и не получают
+ * личных сообщений, имя "ANONIM" занято. Если имя занято, клиенту отправляется ответ,
+ * и он может прислать другое имя
+ * 
+ * @param payload Нагрузка кадра, завершенная '\0'
+ * @return int 0 если имя принято, 1 если нужен следующий кадр, -1 при ошибке
+ */
+int client_handshake(struct room_registry_t* rooms, struct client_data_t* c_data, const char* payload, size_t length);
+
+/**
+ * @brief Номер, который получит следующий клиент
+ *
+ */
+uint32_t client_id_next(void);
+
+/**
+ * @brief Продолжение выдачи номеров клиентов с next, например после горячего обновления
+ *
+ * Номера не выдаются повторно: меньшее значение, чем текущее, игнорируется
+ *
+ */
+void client_id_restore(uint32_t next);
+
+/**
+ * @brief Добавляет клиента в комнату, уведомляет остальных участников и повторяет клиенту журнал комнаты
+ * 
+ * Забирает ссылку на комнату: при успехе она переходит в c_data->room, при ошибке освобождается
+ * 
+ * @param since Номер первого сообщения для повтора, BACKLOG_LAST - последние сообщения
+ * @return int 0 в случае успеха, -1 при ошибке (клиент в комнату не добавлен)
+ */
+int client_join_chat(struct chat_t* chat, struct client_data_t* c_data, uint64_t since);
+
+/**
+ * @brief Уведомляет участников о выходе клиента и удаляет его из комнаты c_data->room
+ * 
+ * Ссылка на комнату освобождается, дескриптор клиента остается открытым:
+ * после отключения его нужно закрыть через client_close_deferred()
+ * 
+ */
+void client_leave_chat(struct client_data_t* c_data);
+
+/**
+ * @brief Проверка кадра клиента ограничением частоты до его разбора
+ *
+ * При первом выброшенном кадре серии клиент получает предупреждение,
+ * при превышении лимита нарушений отключается
+ *
+ * @param now Текущее монотонное время, мс
+ * @return int 1 если кадр нужно выполнить, 0 если кадр выброшен, -1 если клиента нужно отключить
+ */
+int client_throttle(struct client_data_t* c_data, struct throttle_t* throttle, const struct rate_limits_t* limits, size_t length, uint64_t now);
+
+/**
+ * @brief Выполнение полученной от клиента команды
+ * 
+ * Текстовые команды: !quit, !list [page <n> | since <generation>], !join <room> [seq], !leave, !rooms, !msg <name> <text>,
+ * остальное - сообщение в комнату клиента. Клиенты двоичного протокола присылают те же команды кодами операций
+ * 
+ * @param buffer Кадр клиента, завершенный '\0'
+ * @param length Длина кадра
+ * @param client_cycle Сбрасывается в 0, если клиента нужно отключить
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int executing_clients_command(struct room_registry_t* rooms, struct client_data_t* c_data, char* buffer, size_t length, int* client_cycle);
+
 #endif
\ No newline at end of file
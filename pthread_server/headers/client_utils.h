@@ -4,20 +4,34 @@
 #include "common.h"
 
 /**
- * @brief Поиск клиента по дескриптору
+ * @brief Поиск клиента комнаты по дескриптору через таблицу клиентов, O(1)
  * 
- * @warning Непотокобезопасная, использовать мьютекс
+ * @warning Непотокобезопасная, использовать мьютекс шарда клиента.
+ *          Указатель на элемент текущего снимка действителен, пока мьютекс удерживается
  * 
  * @return struct client_node_t* 
  */
 struct client_node_t* search_by_fd(struct chat_t* chat, int fd);
 
 /**
- * @brief Поиск всех клиентов, кроме заданного по дескриптору
+ * @brief Поиск всех клиентов шарда, кроме заданного по дескриптору
+ * 
+ * Для всех клиентов текущего снимка шарда выполняет callback функцию без блокировок.
+ * Клиент, вышедший во время обхода, еще может получить callback: его дескриптор
+ * уже закрыт shutdown(), но не переиспользован
  * 
- * Для всех клиентов выполняет callback функцию
+ * @param shard_index Номер шарда
+ * @param exclude_fd Дескриптор, который нужно исключить из поиска
+ * @param callback callback функция, которая должна быть применена с данными подходящего клиента
+ * @param arg Аргументы для callback функции
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int foreach_shard_client_expect(struct chat_t* chat, int shard_index, int exclude_fd, client_callback callback, void* arg);
+
+/**
+ * @brief Поиск всех клиентов, кроме заданного по дескриптору
  * 
- * @warning Непотокобезопасная, использовать мьютекс
+ * Обходит снимки всех шардов по очереди без блокировок
  * 
  * @param exclude_fd Дескриптор, который нужно исключить из поиска
  * @param callback callback функция, которая должна быть применена с данными подходящего клиента
@@ -26,22 +40,46 @@ struct client_node_t* search_by_fd(struct chat_t* chat, int fd);
  */
 int foreach_client_expect(struct chat_t* chat, int exclude_fd, client_callback callback, void* arg);
 
+/**
+ * @brief Отправка кадра одному клиенту
+ * 
+ * Клиент получает кадр в своем протоколе, см. message_for(). Не блокируется: в режиме потоков
+ * кадр уходит через отправитель клиента (writer.h), остаток дописывает поток клиента. В режиме реактора
+ * ставит ссылку на сообщение в исходящую очередь соединения
+ * 
+ * @return int 0 в случае успеха, -1 при ошибке 
+ */
+int client_send(struct client_data_t* c_data, struct message_t* message);
+
+/**
+ * @brief Отправка личного сообщения клиенту по имени
+ * 
+ * Один поиск в индексе имен и одна постановка в очередь получателя, без обхода участников комнат.
+ * Получателю другого рабочего потока сообщение передается через входящую очередь этого потока
+ * 
+ * @return int 0 если сообщение отправлено, 1 если клиента с таким именем нет, -1 при ошибке
+ */
+int client_send_direct(struct room_registry_t* rooms, struct client_data_t* sender, const char* name, struct message_t* message);
+
 /**
  * @brief callback, отправляющий клиенту сообщение
  * 
+ * Ошибка одного получателя не прерывает рассылку. Сообщения журнала,
+ * которые клиент уже получил повтором при входе в комнату, пропускаются
+ * 
  * @param client Клиент, которому нужно отправить сообщение
  * @param arg Указатель на struct broadcast_callback_data_t
- * @return int 0 в случае успеха, -1 при ошибке 
+ * @return int 0
  */
 int broadcast_callback(struct client_node_t* client, void* arg);
 
 /**
- * @brief callback, добавляющий в строку имя клиента
+ * @brief callback, добавляющий в строку имя комнаты и количество ее участников
  * 
- * @param client Клиент, чье имя нужно добавить в строку
+ * @param room Комната, которую нужно добавить в строку
  * @param arg Указатель на struct client_list_callback_data_t
  * @return int 0 в случае успеха, -1 при ошибке 
  */
-int client_list_callback(struct client_node_t* client, void* arg);
+int room_list_callback(struct chat_t* room, void* arg);
 
 #endif
\ No newline at end of file
@@ -9,11 +9,26 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
+
+#include "protocol.h"
 
 #define PORT                    2024
-#define MAX_CONNECTION_REQUEST  10
 #define BUFFER_SIZE             1024
 #define MAX_NAME_LENGTH         32
+#define MAX_WORKERS             256
+#define MAX_ROOM_NAME           32
+#define MAX_ROOMS               1024
+#define ROOM_BUCKETS            64
+#define DEFAULT_ROOM            "general"
+#define ROSTER_CHANGES          256
+#define NAME_LOCKS              64
+
+struct chat_t;
+struct client_writer_t;
+struct connection_t;
+struct message_t;
+struct rate_limits_t;
 
 /**
  * @brief Данные клиента
@@ -23,48 +38,201 @@ struct client_data_t {
     uint16_t client_port;                   ///< Порт клиента
     char client_ip[INET_ADDRSTRLEN];        ///< IP клиента
     char client_name[MAX_NAME_LENGTH];      ///< Имя клиента
+    uint32_t client_id;                     ///< Номер клиента в заголовках событий, выдается вместе с именем
+    int protocol;                           ///< Версия двоичного протокола, 0 - текстовый протокол
+    struct connection_t* conn;              ///< Соединение реактора, NULL в режиме потоков
+    struct client_writer_t* writer;         ///< Отправитель кадров в режиме потоков, NULL в режиме реактора
+    int shard;                              ///< Номер шарда чата (рабочего потока), в котором находится клиент
+    struct chat_t* room;                    ///< Комната клиента со ссылкой на нее, NULL до присоединения
 };
 
 /**
- * @brief Элемент списка клиентов
+ * @brief Элемент таблицы клиентов
  */
 struct client_node_t {
     struct client_data_t data;              ///< Данные клиента
-    struct client_node_t* next;             ///< Указатель на следующий элемент списка
 };
 
 /**
- * @brief Данные чата клиентов
+ * @brief Ячейка таблицы клиентов, индексируемой дескриптором
+ */
+struct client_slot_t {
+    struct chat_t* room;                    ///< Комната клиента, NULL если ячейка свободна
+    int shard;                              ///< Номер шарда клиента в комнате
+    int index;                              ///< Позиция клиента в текущем снимке шарда
+    uint64_t replayed;                      ///< Последний номер сообщения журнала, отправленный клиенту при входе
+};
+
+/**
+ * @brief Неизменяемый снимок клиентов шарда
+ * 
+ * Клиенты лежат подряд. Присоединение и выход клиента создают новый снимок,
+ * старый освобождается через ebr_retire(), когда его больше никто не обходит
+ */
+struct client_snapshot_t {
+    int count;                              ///< Количество клиентов
+    struct client_node_t clients[];         ///< Клиенты
+};
+
+/**
+ * @brief Часть чата, принадлежащая одному рабочему потоку
+ * 
+ * Снимок шарда заменяет только его рабочий поток под мьютексом шарда,
+ * читатели обходят текущий снимок без блокировок внутри ebr_enter()/ebr_exit()
+ */
+struct chat_shard_t {
+    pthread_mutex_t mutex;                  ///< Мьютекс писателей шарда
+    _Atomic(struct client_snapshot_t*) snapshot; ///< Текущий снимок, NULL если клиентов нет
+};
+
+/**
+ * @brief Журнал последних сообщений комнаты
+ * 
+ * Кольцо ссылок на те же сообщения, что рассылаются участникам. Номера сообщений
+ * идут подряд с 1, вытесняются самые старые сообщения
+ */
+struct backlog_t {
+    pthread_mutex_t mutex;                  ///< Мьютекс журнала
+    struct message_t** items;               ///< Кольцевой массив сообщений, NULL если журнал выключен
+    unsigned capacity;                      ///< Размер массива items
+    unsigned head;                          ///< Индекс самого старого сообщения
+    unsigned count;                         ///< Количество сообщений в журнале
+    size_t bytes;                           ///< Суммарная длина сообщений журнала
+    uint64_t last_seq;                      ///< Номер последнего записанного сообщения
+};
+
+/**
+ * @brief Изменение состава комнаты
+ */
+struct roster_change_t {
+    uint64_t generation;                    ///< Поколение состава после изменения
+    int joined;                             ///< 1 - клиент вошел, 0 - вышел
+    char name[MAX_NAME_LENGTH];             ///< Имя клиента
+};
+
+/**
+ * @brief Кэш списка участников комнаты
+ * 
+ * Каждое присоединение и выход увеличивают поколение и записываются в кольцо изменений.
+ * Готовые кадры списка собираются один раз на поколение, при первом запросе после изменения
+ */
+struct roster_t {
+    pthread_mutex_t mutex;                  ///< Мьютекс кэша
+    uint64_t generation;                    ///< Текущее поколение состава, 0 - изменений еще не было
+    uint64_t built;                         ///< Поколение, для которого собраны pages
+    struct message_t** pages;               ///< Готовые кадры списка, NULL если кэш пуст
+    int page_count;                         ///< Количество кадров
+    struct roster_change_t changes[ROSTER_CHANGES]; ///< Последние изменения, индекс - поколение по модулю ROSTER_CHANGES
+};
+
+/**
+ * @brief Ограничения журналов комнат
+ */
+struct backlog_limits_t {
+    unsigned capacity;                      ///< Максимум сообщений в журнале одной комнаты, 0 - журнал выключен
+    unsigned replay;                        ///< Сколько последних сообщений отправляется при входе в комнату
+    size_t room_bytes;                      ///< Лимит байт журнала одной комнаты
+    size_t total_bytes;                     ///< Лимит байт журналов всех комнат
+};
+
+/**
+ * @brief Комната чата
+ * 
+ * Живет, пока на нее есть ссылки: реестр, участники и сообщения в очередях рабочих потоков.
+ * Пустая комната, кроме DEFAULT_ROOM, удаляется из реестра, когда на нее ссылается только реестр
+ * и ее журнал пуст. Пустые комнаты с журналом удаляются, только когда нужно место под новую комнату
  */
 struct chat_t {
-    pthread_mutex_t mutex;                  ///< Общий мьютекс
-    struct client_node_t* head;             ///< Указатель на первый элемент списка клиентов
-    int client_count;                       ///< Количество клиентов
+    char name[MAX_ROOM_NAME];               ///< Имя комнаты
+    atomic_int refs;                        ///< Количество ссылок на комнату
+    struct room_registry_t* registry;       ///< Реестр, которому принадлежит комната
+    struct chat_t* next;                    ///< Следующая комната в корзине реестра
+    int linked;                             ///< Комната есть в реестре, меняется под мьютексом корзины
+    struct chat_shard_t* shards;            ///< Шарды комнаты, по одному на рабочий поток
+    int shard_count;                        ///< Количество шардов
+    atomic_int client_count;                ///< Количество клиентов комнаты
+    struct backlog_t backlog;               ///< Журнал последних сообщений
+    struct roster_t roster;                 ///< Кэш списка участников
+};
+
+/**
+ * @brief Запись индекса имен
+ */
+struct name_entry_t {
+    char name[MAX_NAME_LENGTH];             ///< Имя клиента
+    struct client_data_t target;            ///< Копия данных клиента для отправки: дескриптор, адрес, соединение и шард
+    struct name_entry_t* next;              ///< Следующая запись корзины
+};
+
+/**
+ * @brief Индекс имен клиентов: хэш-таблица имя -> соединение
+ * 
+ * Корзин не меньше, чем ячеек в таблице клиентов, поэтому цепочки короткие.
+ * Корзину i защищает мьютекс i % NAME_LOCKS
+ */
+struct name_index_t {
+    pthread_mutex_t locks[NAME_LOCKS];      ///< Мьютексы корзин
+    struct name_entry_t** buckets;          ///< Корзины по хэшу имени
+    uint32_t mask;                          ///< Количество корзин минус 1, корзин - степень двойки
+    atomic_int count;                       ///< Количество имен в индексе
+};
+
+/**
+ * @brief Корзина реестра комнат со своим мьютексом
+ */
+struct room_bucket_t {
+    pthread_mutex_t mutex;                  ///< Мьютекс корзины
+    struct chat_t* head;                    ///< Первая комната корзины
+};
+
+/**
+ * @brief Реестр комнат: хэш-таблица имен с мьютексом на корзину
+ */
+struct room_registry_t {
+    struct room_bucket_t buckets[ROOM_BUCKETS]; ///< Корзины по хэшу имени
+    struct chat_t* lobby;                   ///< Комната DEFAULT_ROOM, существует всегда
+    int shard_count;                        ///< Количество шардов каждой комнаты
+    atomic_int room_count;                  ///< Количество комнат в реестре
+    atomic_int client_count;                ///< Количество клиентов во всех комнатах
+    struct client_slot_t* slots;            ///< Таблица клиентов, индексируемая дескриптором
+    int slot_count;                         ///< Размер таблицы slots, равен жесткому пределу RLIMIT_NOFILE
+    struct backlog_limits_t backlog;        ///< Ограничения журналов комнат
+    atomic_size_t backlog_bytes;            ///< Суммарная длина сообщений во всех журналах
+    struct name_index_t names;              ///< Индекс имен клиентов для личных сообщений
 };
 
 /**
  * @brief Данные для передачи в поток клиента
  */
 struct pthread_data_t {
-    struct chat_t* chat;                    ///< Указатель на данные чата клиентов
+    struct room_registry_t* rooms;          ///< Реестр комнат
+    const struct rate_limits_t* limits;     ///< Ограничения частоты кадров клиента
     struct client_data_t client_data;       ///< Локаьная копия данных клиента 
 };
 
 /**
  * @brief Список команд клиента
+ *
+ * Значения совпадают с кодами команд двоичного протокола
  */
 enum commands {
-    CMD_QUIT,                               ///< Инициализация выхода из чата
-    CMD_LIST,                               ///< Запрос списка клиентов
-    CMD_MESSAGE                             ///< Отправка сообщения
+    CMD_QUIT = PROTOCOL_OP_QUIT,            ///< Инициализация выхода из чата
+    CMD_LIST = PROTOCOL_OP_LIST,            ///< Запрос списка клиентов комнаты
+    CMD_JOIN = PROTOCOL_OP_JOIN,            ///< Переход в другую комнату
+    CMD_LEAVE = PROTOCOL_OP_LEAVE,          ///< Возврат в DEFAULT_ROOM
+    CMD_ROOMS = PROTOCOL_OP_ROOMS,          ///< Запрос списка комнат
+    CMD_DIRECT = PROTOCOL_OP_DIRECT,        ///< Личное сообщение клиенту по имени
+    CMD_MESSAGE = PROTOCOL_OP_MESSAGE       ///< Отправка сообщения
 };
 
 /**
  * @brief Список типов сообщений для всех клиентов
+ *
+ * Значения совпадают с кодами событий двоичного протокола
  */
 enum notify_type {
-    LEFT,                                   ///< Уведомление о покидании чата
-    JOIN                                    ///< Уведомление о присоединениии к чату
+    LEFT = PROTOCOL_OP_LEFT,                ///< Уведомление о покидании чата
+    JOIN = PROTOCOL_OP_JOINED               ///< Уведомление о присоединениии к чату
 };
 
 /**
@@ -78,17 +246,16 @@ typedef int (*client_callback) (struct client_node_t* client, void* arg);
  * 
  */
 struct broadcast_callback_data_t {
-    char* message;                          ///< Сообщение, которое нужно разослать всем клиентам
-    ssize_t length;                         ///< Длина сообщения
+    struct message_t* message;              ///< Кадр, который нужно разослать всем клиентам
 };
 
 /**
- * @brief Аргументы для callback функции client_list_callback
+ * @brief Аргументы для callback функции room_list_callback
  * 
  */
 struct client_list_callback_data_t {
-    int* offset;                            ///< Указывает на позицию в строке, в которую нужно записать имя клиента
-    char* list_of_clients;                  ///< Строка для записи списка активных клиентов
+    int* offset;                            ///< Указывает на позицию в строке, в которую нужно записать следующий элемент
+    char* list_of_clients;                  ///< Строка для записи списка
 };
 
 #endif
\ No newline at end of file
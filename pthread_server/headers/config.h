@@ -0,0 +1,79 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "common.h"
+#include "logger.h"
+#include "throttle.h"
+
+/**
+ * @brief Режим работы сервера
+ */
+enum server_mode {
+    MODE_EPOLL,                             ///< Неблокирующий реактор на epoll (по умолчанию)
+    MODE_THREADS                            ///< Совместимый режим: отдельный поток на каждого клиента
+};
+
+/**
+ * @brief Механизм ввода-вывода рабочих потоков реактора
+ */
+enum io_backend {
+    IO_EPOLL,                               ///< Edge-triggered epoll и неблокирующие recv()/send()
+    IO_URING                                ///< io_uring: multishot accept/recv и связанные отправки
+};
+
+/**
+ * @brief Что делать с клиентом, который не успевает читать
+ */
+enum slow_consumer_policy {
+    SLOW_DISCONNECT,                        ///< Отключить клиента (по умолчанию)
+    SLOW_GAP                                ///< Выбросить неотправленные сообщения и сообщить клиенту о пропуске
+};
+
+/**
+ * @brief Когда реактор отправляет сообщения клиентам
+ */
+enum flush_mode {
+    FLUSH_TICK,                             ///< Сообщения клиенту за итерацию цикла уходят вместе в конце итерации (по умолчанию)
+    FLUSH_IMMEDIATE                         ///< Каждое сообщение отправляется сразу, у сокетов включен TCP_NODELAY
+};
+
+/**
+ * @brief Параметры запуска сервера
+ */
+struct server_config_t {
+    uint16_t port;                          ///< Порт, на котором сервер принимает соединения
+    enum server_mode mode;                  ///< Режим обработки клиентов
+    int workers;                            ///< Количество рабочих потоков-реакторов
+    enum io_backend io;                     ///< Механизм ввода-вывода реактора
+    size_t queue_bytes;                     ///< Лимит неотправленных байт в очереди одного клиента
+    int queue_age_ms;                       ///< Лимит возраста самого старого неотправленного сообщения, мс
+    enum slow_consumer_policy slow_policy;  ///< Действие при превышении лимитов очереди
+    enum flush_mode flush;                  ///< Объединение исходящих сообщений
+    size_t zerocopy_bytes;                  ///< Кадры не короче zerocopy_bytes отправляются с MSG_ZEROCOPY, 0 - выключено
+    enum log_level log_level;               ///< Уровень журнала
+    size_t prealloc;                        ///< Сколько записей соединений и буферов сообщений выделить при запуске
+    struct backlog_limits_t backlog;        ///< Ограничения журналов комнат
+    const char* data_dir;                   ///< Каталог хранилища сообщений, NULL - хранилище выключено
+    int fsync_ms;                           ///< Интервал сброса хранилища на диск, мс
+    size_t segment_bytes;                   ///< Размер сегмента хранилища
+    size_t retain_bytes;                    ///< Лимит размера хранилища, 0 - без лимита
+    int retain_age;                         ///< Лимит возраста сегментов хранилища, с, 0 - без лимита
+    const char* admin_path;                 ///< Путь Unix-сокета администратора, NULL - сокет выключен
+    struct rate_limits_t rate;              ///< Ограничения частоты кадров одного клиента
+    unsigned trace_sample;                  ///< Трассируется один recv() из trace_sample, 0 - трассировка выключена
+    int listen_backlog;                     ///< Длина очереди listen() слушающих сокетов и сокета администратора, ядро обрезает ее до somaxconn
+    int max_clients;                        ///< Лимит одновременных соединений, 0 - без лимита
+    int accept_batch;                       ///< Сколько соединений поток принимает за итерацию цикла
+    int task_workers;                       ///< Режим потоков: рабочих потоков выполнения команд, 0 - по одному на процессор
+};
+
+/**
+ * @brief Разбор аргументов командной строки
+ *
+ * Незаданные параметры получают значения по умолчанию
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int config_parse(struct server_config_t* config, int argc, char* argv[]);
+
+#endif
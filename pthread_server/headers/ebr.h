@@ -0,0 +1,50 @@
+#ifndef EBR_H
+#define EBR_H
+
+#include "common.h"
+
+/**
+ * @brief Освобождение памяти по эпохам (epoch-based reclamation)
+ *
+ * Читатели обходят неизменяемые снимки без блокировок, обрамляя обход вызовами
+ * ebr_enter()/ebr_exit(). Писатель публикует новый снимок и передает старый в
+ * ebr_retire(), объект освобождается, когда ни один читатель уже не может его видеть.
+ * Один домен на процесс, у каждого потока своя запись читателя
+ */
+
+/**
+ * @brief Функция освобождения отложенного объекта
+ */
+typedef void (*ebr_free_callback)(void* arg);
+
+/**
+ * @brief Начало читающей секции
+ *
+ * Допускает вложенность. Пока поток внутри секции, объекты, снятые после входа, не освобождаются
+ */
+void ebr_enter(void);
+
+/**
+ * @brief Конец читающей секции
+ *
+ */
+void ebr_exit(void);
+
+/**
+ * @brief Отложенное освобождение объекта
+ *
+ * Объект уже должен быть недоступен новым читателям. Заодно освобождает
+ * накопленные объекты, которые больше никто не видит
+ *
+ * @return int 0 в случае успеха, -1 если не удалось выделить память (тогда объект не освобожден)
+ */
+int ebr_retire(ebr_free_callback callback, void* arg);
+
+/**
+ * @brief Освобождение всех отложенных объектов
+ *
+ * @warning Вызывать, только когда ни один поток не находится в читающей секции
+ */
+void ebr_drain(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "common.h"
+
+#include <stdarg.h>
+
+/**
+ * Формат кадра: 2 байта длины полезной нагрузки (big-endian), затем сама нагрузка.
+ * Нагрузка не завершается '\0'
+ */
+#define FRAME_HEADER_SIZE       2
+#define MAX_FRAME_PAYLOAD       65535
+
+/**
+ * @brief Буфер входящих кадров соединения
+ *
+ * Хранит только незавершенный хвост прошлого чтения, полные кадры
+ * разбираются прямо в буфере recv()
+ */
+struct frame_reader_t {
+    char* pending;                          ///< Незавершенный кадр из прошлых чтений
+    size_t pending_length;                  ///< Количество байт незавершенного кадра
+    size_t pending_capacity;                ///< Размер выделенной под незавершенный кадр памяти
+};
+
+/**
+ * @brief Псевдоним для обработчика разобранного кадра
+ *
+ * @param payload Нагрузка кадра, на время вызова завершена '\0'
+ * @return int 0 чтобы продолжить разбор, -1 чтобы прекратить
+ */
+typedef int (*frame_callback) (void* arg, char* payload, size_t length);
+
+/**
+ * @brief Разбор всех полных кадров из прочитанных данных
+ *
+ * Для каждого полного кадра вызывает callback, незавершенный хвост сохраняет до следующего чтения
+ *
+ * @warning После data[length - 1] должен быть еще один доступный для записи байт
+ *
+ * @return int 0 в случае успеха, -1 если callback прервал разбор или не хватило памяти
+ */
+int frame_reader_consume(struct frame_reader_t* reader, char* data, size_t length, frame_callback callback, void* arg);
+
+/**
+ * @brief Освобождение буфера незавершенного кадра
+ *
+ */
+void frame_reader_free(struct frame_reader_t* reader);
+
+/**
+ * @brief Запись заголовка кадра
+ *
+ * @param frame Начало кадра, не меньше FRAME_HEADER_SIZE байт
+ * @param length Длина нагрузки, не больше MAX_FRAME_PAYLOAD
+ */
+void frame_set_header(char* frame, size_t length);
+
+/**
+ * @brief Форматирование нагрузки кадра вместе с заголовком
+ *
+ * Нагрузка, не поместившаяся в size, обрезается
+ *
+ * @param frame Буфер под кадр
+ * @param size Размер буфера вместе с заголовком
+ * @return size_t Полная длина кадра с заголовком
+ */
+size_t frame_vprintf(char* frame, size_t size, const char* format, va_list args);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include "common.h"
+
+/**
+ * @brief Создание слушающего сокета
+ *
+ * @param reuse_port Включить SO_REUSEPORT, чтобы несколько сокетов слушали один порт
+ * @param backlog Длина очереди принятых ядром соединений, ядро обрезает ее до net.core.somaxconn
+ * @return int Дескриптор сокета, -1 при ошибке
+ */
+int create_listener(uint16_t port, int reuse_port, int backlog);
+
+/**
+ * @brief Учет нового соединения в лимите одновременных соединений сервера
+ *
+ * @param max_clients Лимит соединений, 0 - без лимита
+ * @return int 1 если соединение допущено, 0 если сервер заполнен
+ */
+int listener_admit(int max_clients);
+
+/**
+ * @brief Освобождение места допущенного соединения после его закрытия
+ *
+ */
+void listener_release(void);
+
+/**
+ * @brief Количество допущенных соединений
+ *
+ */
+int listener_connections(void);
+
+/**
+ * @brief Отказ соединению, для которого нет места
+ *
+ * Отправляет кадр "server full" без ожидания и закрывает сокет: клиент узнает причину
+ * отказа, а сервер не тратит на него память соединения
+ *
+ */
+void listener_reject(int fd);
+
+/**
+ * @brief Переполнения очередей listen() по всей системе (TcpExt ListenOverflows)
+ *
+ * Ядро не ведет счетчик для отдельного сокета, поэтому значение включает и другие серверы машины
+ *
+ * @return uint64_t Значение из /proc/net/netstat, 0 если его не удалось прочитать
+ */
+uint64_t listener_overflows(void);
+
+/**
+ * @brief Отключение алгоритма Нейгла на сокете клиента
+ *
+ * Сервер сам решает, когда отправлять накопленные сообщения, поэтому
+ * ядро не должно задерживать последний неполный сегмент до подтверждения
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int set_nodelay(int fd);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include "common.h"
+
+#define LOG_RECORD_SIZE         512
+#define LOG_RING_SIZE           256
+#define LOG_BATCH_SIZE          (64 * 1024)
+#define LOG_IDLE_MS             20
+
+/**
+ * @brief Уровни журнала, каждый следующий подробнее предыдущего
+ */
+enum log_level {
+    LOG_LEVEL_ERROR,                        ///< Только ошибки
+    LOG_LEVEL_WARN,                         ///< Предупреждения: отключение медленных клиентов и т.п.
+    LOG_LEVEL_INFO,                         ///< Подключения, присоединения и выходы (по умолчанию)
+    LOG_LEVEL_DEBUG                         ///< Каждое сообщение и команда клиентов
+};
+
+/**
+ * @brief Текущий уровень журнала, задается один раз при запуске
+ */
+extern enum log_level logger_level;
+
+/**
+ * @brief Запись журнала с проверкой уровня
+ *
+ * Аргументы не вычисляются, если уровень выключен
+ */
+#define log_printf(level, ...)                          \
+    do {                                                \
+        if ((level) <= logger_level) {                  \
+            logger_write(__VA_ARGS__);                  \
+        }                                               \
+    } while (0)
+
+/**
+ * @brief Запуск фонового потока журнала
+ *
+ * До запуска и после logger_shutdown() записи выводятся сразу в вызывающем потоке
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int logger_init(enum log_level level);
+
+/**
+ * @brief Вывод накопленных записей и остановка фонового потока
+ *
+ */
+void logger_shutdown(void);
+
+/**
+ * @brief Разбор названия уровня: error, warn, info или debug
+ *
+ * @return int 0 в случае успеха, -1 если название неизвестно
+ */
+int logger_parse_level(const char* name, enum log_level* level);
+
+/**
+ * @brief Форматирует строку в кольцо текущего потока
+ *
+ * Не блокируется: кольцо у каждого потока свое, фоновый поток дописывает время
+ * и выводит записи пачками. Если кольцо заполнено, запись отбрасывается и учитывается
+ * в счетчике потерь. Текст длиннее записи обрезается. Использовать через log_printf()
+ *
+ */
+void logger_write(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include "common.h"
+#include "pool.h"
+
+#define MESSAGE_POOL_MIN_SIZE       64
+#define MESSAGE_POOL_CLASSES        7
+
+/**
+ * @brief Готовый к отправке кадр, общий для всех получателей
+ *
+ * После создания и записи в журнал комнаты не изменяется, кроме однократной установки binary,
+ * память освобождается, когда отпущена последняя ссылка
+ */
+struct message_t {
+    atomic_int refs;                        ///< Количество ссылок: создатель, очереди получателей и журнал комнаты
+    int size_class;                         ///< Класс размера в пуле сообщений, -1 если память выделена malloc()
+    uint64_t seq;                           ///< Номер сообщения в журнале комнаты, 0 если сообщение не журналируется
+    uint64_t traced;                        ///< Время recv() трассируемого исходного кадра, нс, 0 если сообщение не трассируется
+    _Atomic(struct message_t*) binary;      ///< То же сообщение для клиентов двоичного протокола со своей ссылкой, NULL пока не понадобилось
+    size_t length;                          ///< Длина кадра вместе с заголовком
+    char data[];                            ///< Кадр
+};
+
+/**
+ * @brief Элемент очереди исходящих сообщений
+ */
+struct queued_message_t {
+    struct message_t* message;              ///< Ссылка на сообщение
+    uint64_t enqueued;                      ///< Время постановки в очередь, мс
+};
+
+/**
+ * @brief Очередь исходящих сообщений соединения
+ *
+ * Кольцевой массив указателей на сообщения, каждое хранит одну ссылку
+ */
+struct message_queue_t {
+    struct queued_message_t* items;         ///< Кольцевой массив сообщений
+    unsigned head;                          ///< Индекс первого сообщения
+    unsigned count;                         ///< Количество сообщений в очереди
+    unsigned capacity;                      ///< Размер массива, степень двойки
+    size_t offset;                          ///< Количество уже отправленных байт первого сообщения
+    size_t bytes;                           ///< Количество еще не отправленных байт всей очереди
+};
+
+/**
+ * @brief Инициализация пула буферов сообщений
+ *
+ * Классы размеров от MESSAGE_POOL_MIN_SIZE до MESSAGE_POOL_MIN_SIZE << (MESSAGE_POOL_CLASSES - 1) байт,
+ * более крупные сообщения выделяются malloc(). До инициализации все сообщения выделяются malloc()
+ *
+ * @param preallocate Сколько буферов нарезать сразу в каждом классе, вмещающем кадр BUFFER_SIZE
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int message_pool_init(size_t preallocate);
+
+/**
+ * @brief Пул буферов сообщений по классам размеров
+ *
+ */
+struct size_pool_t* message_pool(void);
+
+/**
+ * @brief Создание сообщения из готового кадра
+ *
+ * @return struct message_t* Сообщение с одной ссылкой, NULL при ошибке
+ */
+struct message_t* message_create(const char* frame, size_t length);
+
+/**
+ * @brief Форматирование нагрузки и создание кадра-сообщения
+ *
+ * Нагрузка длиннее BUFFER_SIZE - 1 обрезается
+ *
+ * @return struct message_t* Сообщение с одной ссылкой, NULL при ошибке
+ */
+struct message_t* message_printf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Форматирование нагрузки произвольной длины в кадр-сообщение
+ *
+ * В отличие от message_printf() память выделяется по длине нагрузки:
+ * так собираются сообщения чата, которые могут быть длиннее BUFFER_SIZE
+ *
+ * @param limit Нагрузка длиннее limit байт обрезается, не больше MAX_FRAME_PAYLOAD
+ * @return struct message_t* Сообщение с одной ссылкой, NULL при ошибке
+ */
+struct message_t* message_format(size_t limit, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Создание кадра события двоичного протокола
+ *
+ * Тело, не поместившееся в MAX_FRAME_PAYLOAD вместе с заголовком и именем, обрезается
+ *
+ * @param name Имя отправителя, NULL для событий сервера
+ * @return struct message_t* Сообщение с одной ссылкой, NULL при ошибке
+ */
+struct message_t* message_event(uint8_t opcode, uint32_t sender, const char* name, uint64_t seq, const char* body, size_t length);
+
+/**
+ * @brief Прикрепляет к текстовому сообщению событие двоичного протокола с тем же содержанием
+ *
+ * Вызывается после присвоения номера и до того, как сообщение увидят рассылка, повтор
+ * журнала или хранилище. Обертка, установленная message_for() раньше, заменяется и отпускается
+ *
+ * @param sender Клиент, от имени которого событие
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int message_attach_event(struct message_t* message, uint8_t opcode, const struct client_data_t* sender, const char* body, size_t length);
+
+/**
+ * @brief Кадр сообщения в протоколе получателя
+ *
+ * Для текстового протокола это само сообщение. Для двоичного - прикрепленное событие,
+ * а если его нет, текст сообщения оборачивается в PROTOCOL_OP_INFO один раз на сообщение
+ *
+ * @param protocol Версия протокола получателя, 0 - текстовый
+ * @return struct message_t* Сообщение без дополнительной ссылки, живет не меньше message; NULL при ошибке
+ */
+struct message_t* message_for(struct message_t* message, int protocol);
+
+/**
+ * @brief Захват ссылки на сообщение
+ *
+ */
+struct message_t* message_ref(struct message_t* message);
+
+/**
+ * @brief Освобождение ссылки на сообщение
+ *
+ * Последняя ссылка освобождает память
+ *
+ */
+void message_unref(struct message_t* message);
+
+/**
+ * @brief Добавление сообщения в конец очереди
+ *
+ * Очередь захватывает собственную ссылку на сообщение
+ *
+ * @param now Текущее время, мс
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int message_queue_push(struct message_queue_t* queue, struct message_t* message, uint64_t now);
+
+/**
+ * @brief Сообщение очереди по порядковому номеру от начала
+ *
+ */
+struct message_t* message_queue_at(const struct message_queue_t* queue, unsigned index);
+
+/**
+ * @brief Время постановки в очередь самого старого сообщения
+ *
+ * @warning Очередь не должна быть пустой
+ *
+ */
+uint64_t message_queue_oldest(const struct message_queue_t* queue);
+
+/**
+ * @brief Выбрасывает из очереди все сообщения, кроме первых keep
+ *
+ * @return unsigned Количество выброшенных сообщений
+ */
+unsigned message_queue_truncate(struct message_queue_t* queue, unsigned keep);
+
+/**
+ * @brief Учет отправленных байт
+ *
+ * Полностью отправленные сообщения удаляются из очереди и отпускаются
+ *
+ */
+void message_queue_consume(struct message_queue_t* queue, size_t length);
+
+/**
+ * @brief Освобождение всех сообщений очереди и ее памяти
+ *
+ */
+void message_queue_clear(struct message_queue_t* queue);
+
+#endif
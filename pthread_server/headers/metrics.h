@@ -0,0 +1,171 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+
+#define METRICS_SUB_BITS        3
+#define METRICS_BUCKETS         (64 << METRICS_SUB_BITS)
+
+/**
+ * @brief Счетчик блока метрик
+ *
+ * Пишет только поток-владелец блока обычными load/store без lock-префикса,
+ * читатель складывает блоки всех потоков relaxed-загрузками
+ */
+typedef _Atomic uint64_t metric_t;
+
+/**
+ * @brief Счетчики потока
+ */
+enum metrics_counter {
+    METRICS_ACCEPTS,                        ///< Принято соединений
+    METRICS_REJECTED,                       ///< Соединений отклонено кадром "server full" сверх лимита клиентов
+    METRICS_ACCEPT_BATCHES_FULL,            ///< Итераций, после которых в очереди listen() остались соединения
+    METRICS_MESSAGES_IN,                    ///< Получено кадров от клиентов
+    METRICS_MESSAGES_OUT,                   ///< Передано кадров получателям
+    METRICS_BYTES_IN,                       ///< Получено байт от клиентов
+    METRICS_BYTES_OUT,                      ///< Отправлено байт клиентам
+    METRICS_SEND_CALLS,                     ///< Системных вызовов и операций io_uring, отправивших данные клиентам
+    METRICS_ZEROCOPY_SENDS,                 ///< Отправок с MSG_ZEROCOPY
+    METRICS_ZEROCOPY_COPIED,                ///< Отправок с MSG_ZEROCOPY, данные которых ядро все равно скопировало
+    METRICS_BROADCASTS,                     ///< Рассылок сообщений по комнате
+    METRICS_LOCK_WAITS,                     ///< Захватов мьютекса, которым пришлось ждать
+    METRICS_EVICTIONS,                      ///< Отключено медленных клиентов
+    METRICS_GAPS,                           ///< Отправлено уведомлений о пропуске сообщений
+    METRICS_DROPPED,                        ///< Сообщений выброшено из очередей медленных клиентов
+    METRICS_THROTTLED_MESSAGES,             ///< Кадров клиентов выброшено ограничением частоты
+    METRICS_THROTTLED_BYTES,                ///< Байт кадров клиентов выброшено ограничением частоты
+    METRICS_FLOOD_DISCONNECTS,              ///< Клиентов отключено за повторные превышения частоты
+    METRICS_TASKS,                          ///< Задач выполнено пулом рабочих потоков режима потоков
+    METRICS_TASKS_STOLEN,                   ///< Из них украдено из деков других рабочих потоков
+    METRICS_QUEUED_MESSAGES,                ///< Сообщений во всех исходящих очередях потока (текущее значение)
+    METRICS_QUEUED_BYTES,                   ///< Неотправленных байт во всех исходящих очередях потока (текущее значение)
+    METRICS_QUEUE_HIGH_WATER,               ///< Наибольшая глубина одной очереди, сообщений (максимум по потокам)
+    METRICS_COUNTERS                        ///< Количество счетчиков
+};
+
+/**
+ * @brief Гистограммы потока
+ */
+enum metrics_histogram {
+    METRICS_FRAME,                          ///< Обработка одного кадра клиента, нс (выборка)
+    METRICS_READ,                           ///< От recv() до начала обработки кадра, нс (выборка)
+    METRICS_PARSE,                          ///< Разбор команды, нс (выборка)
+    METRICS_ENQUEUE,                        ///< Сборка сообщения и запись в журналы, нс (выборка)
+    METRICS_LOCK,                           ///< Захват мьютекса, нс (выборка)
+    METRICS_SEND,                           ///< Отправка одному получателю, нс (выборка)
+    METRICS_BROADCAST,                      ///< Рассылка сообщения по комнате из потока отправителя, нс (выборка)
+    METRICS_DELIVERY,                       ///< От recv() до последней отправки в шарде получателей, нс (выборка)
+    METRICS_FANOUT,                         ///< Участников комнаты на одну рассылку (выборка)
+    METRICS_LOCK_WAIT,                      ///< Ожидание занятого мьютекса, нс
+    METRICS_ACCEPT_WAIT,                    ///< От готовности слушающего сокета до accept() соединения, нс
+    METRICS_HISTOGRAMS                      ///< Количество гистограмм
+};
+
+/**
+ * @brief Лог-линейная гистограмма: 2^METRICS_SUB_BITS корзин на каждую степень двойки
+ *
+ * Относительная ошибка значения корзины не больше 1/8
+ */
+struct metrics_histogram_t {
+    metric_t counts[METRICS_BUCKETS];       ///< Количество значений в корзинах
+    metric_t count;                         ///< Количество значений
+    metric_t sum;                           ///< Сумма значений
+    metric_t max;                           ///< Наибольшее значение
+};
+
+/**
+ * @brief Блок метрик одного потока
+ *
+ * Блоки не освобождаются: после завершения потока блок помечается свободным и достается
+ * следующему потоку вместе с накопленными значениями, поэтому суммы не теряются
+ */
+struct metrics_t {
+    metric_t counters[METRICS_COUNTERS];    ///< Счетчики
+    struct metrics_histogram_t histograms[METRICS_HISTOGRAMS]; ///< Гистограммы
+    atomic_int in_use;                      ///< Блок занят живым потоком
+    struct metrics_t* next;                 ///< Следующий блок списка
+};
+
+/**
+ * @brief Блок метрик текущего потока, NULL до первого обращения
+ */
+extern __thread struct metrics_t* metrics_self;
+
+/**
+ * @brief Выделение или повторное использование блока для текущего потока
+ *
+ * Не возвращает NULL: если памяти нет, поток пишет в общий запасной блок
+ *
+ * @return struct metrics_t* Блок текущего потока
+ */
+struct metrics_t* metrics_attach(void);
+
+#define metrics_local() (metrics_self ? metrics_self : metrics_attach())
+
+/**
+ * @brief Изменение счетчика текущего потока на value
+ *
+ */
+#define metrics_add(counter, value)                                                                     \
+    do {                                                                                                \
+        metric_t* metric_ = &metrics_local()->counters[counter];                                        \
+        atomic_store_explicit(metric_, atomic_load_explicit(metric_, memory_order_relaxed) + (uint64_t) (value), memory_order_relaxed); \
+    } while (0)
+
+/**
+ * @brief Уменьшение текущего значения счетчика текущего потока на value
+ *
+ */
+#define metrics_sub(counter, value) metrics_add(counter, -(uint64_t) (value))
+
+/**
+ * @brief Запись наибольшего значения счетчика текущего потока
+ *
+ */
+#define metrics_max(counter, value)                                                                     \
+    do {                                                                                                \
+        metric_t* metric_ = &metrics_local()->counters[counter];                                        \
+        if ((uint64_t) (value) > atomic_load_explicit(metric_, memory_order_relaxed)) {                 \
+            atomic_store_explicit(metric_, (uint64_t) (value), memory_order_relaxed);                   \
+        }                                                                                               \
+    } while (0)
+
+/**
+ * @brief Монотонное время, нс
+ *
+ */
+uint64_t metrics_now(void);
+
+/**
+ * @brief Запись значения в гистограмму текущего потока
+ *
+ */
+void metrics_record(enum metrics_histogram histogram, uint64_t value);
+
+/**
+ * @brief Захват мьютекса с учетом времени ожидания
+ *
+ * Свободный мьютекс захватывается без замера времени
+ *
+ */
+void metrics_lock(pthread_mutex_t* mutex);
+
+/**
+ * @brief Сумма блоков всех потоков
+ *
+ * Счетчики складываются, METRICS_QUEUE_HIGH_WATER и максимумы гистограмм берутся наибольшие.
+ * Значения разных счетчиков могут относиться к немного разным моментам
+ *
+ * @param total Блок для результата, перед вызовом должен быть обнулен
+ */
+void metrics_collect(struct metrics_t* total);
+
+/**
+ * @brief Значение, не меньше которого доля quantile значений гистограммы
+ *
+ * @return uint64_t Верхняя граница корзины, 0 если гистограмма пуста
+ */
+uint64_t metrics_quantile(const struct metrics_histogram_t* histogram, double quantile);
+
+#endif
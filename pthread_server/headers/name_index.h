@@ -0,0 +1,48 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include "common.h"
+
+/**
+ * @brief Инициализация пустого индекса имен
+ *
+ * @param capacity Наибольшее количество клиентов, количество корзин округляется вверх до степени двойки
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int name_index_init(struct name_index_t* index, int capacity);
+
+/**
+ * @brief Освобождение индекса и всех записей
+ *
+ * @warning Вызывать, когда рабочие потоки остановлены
+ */
+void name_index_free(struct name_index_t* index);
+
+/**
+ * @brief Регистрация имени c_data->client_name за клиентом
+ *
+ * @return int 0 в случае успеха, 1 если имя уже занято другим клиентом, -1 при ошибке
+ */
+int name_index_add(struct name_index_t* index, const struct client_data_t* c_data);
+
+/**
+ * @brief Снятие имени клиента с регистрации
+ *
+ * Запись удаляется, только если она принадлежит этому клиенту.
+ * Вызывать до закрытия дескриптора клиента
+ *
+ */
+void name_index_remove(struct name_index_t* index, const struct client_data_t* c_data);
+
+/**
+ * @brief Поиск клиента по имени, O(1)
+ *
+ * Дескриптор и соединение из target остаются действительными, пока вызывающий поток
+ * находится внутри ebr_enter()/ebr_exit(): клиент снимается с регистрации до client_close_deferred()
+ *
+ * @param target Копия данных найденного клиента
+ * @return int 1 если клиент найден, 0 иначе
+ */
+int name_index_find(struct name_index_t* index, const char* name, struct client_data_t* target);
+
+#endif
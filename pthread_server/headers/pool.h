@@ -0,0 +1,125 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "common.h"
+
+#define POOL_MAX_POOLS          32
+#define POOL_CACHE_SIZE         32
+#define POOL_CHUNK_BYTES        (64 * 1024)
+#define SIZE_POOL_MAX_CLASSES   12
+
+/**
+ * @brief Статистика пула
+ *
+ * Объект считается живым, пока он не вернулся в общий склад пула:
+ * объекты в кэшах потоков тоже живые, их не больше POOL_CACHE_SIZE на поток
+ */
+struct pool_stats_t {
+    size_t capacity;                        ///< Количество объектов, нарезанных из блоков
+    size_t live;                            ///< Количество объектов вне общего склада
+    size_t high_water;                      ///< Наибольшее значение live
+};
+
+/**
+ * @brief Пул объектов одного размера
+ *
+ * Объекты нарезаются из блоков по POOL_CHUNK_BYTES и не возвращаются системе до object_pool_destroy().
+ * У каждого потока свой кэш объектов пула, общий склад под мьютексом
+ * пополняет и разгружает кэш пачками по POOL_CACHE_SIZE / 2
+ */
+struct object_pool_t {
+    const char* name;                       ///< Имя пула для статистики
+    size_t object_size;                     ///< Размер объекта, кратный 16
+    int id;                                 ///< Номер кэша пула в кэшах потоков
+    pthread_mutex_t mutex;                  ///< Мьютекс склада
+    void* free_list;                        ///< Свободные объекты склада, связаны через первое слово
+    size_t free_count;                      ///< Количество объектов на складе
+    void* chunks;                           ///< Список выделенных блоков
+    size_t capacity;                        ///< Количество нарезанных объектов
+    size_t high_water;                      ///< Наибольшее количество объектов вне склада
+};
+
+/**
+ * @brief Набор пулов по классам размеров: степени двойки от min_size
+ *
+ * Запрос больше самого крупного класса обслуживается malloc()
+ */
+struct size_pool_t {
+    struct object_pool_t classes[SIZE_POOL_MAX_CLASSES]; ///< Пулы классов по возрастанию размера
+    int class_count;                        ///< Количество классов
+    size_t min_size;                        ///< Размер самого мелкого класса
+};
+
+/**
+ * @brief Инициализация пула объектов
+ *
+ * @param name Имя пула, строка должна жить дольше пула
+ * @param preallocate Сколько объектов нарезать сразу
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int object_pool_init(struct object_pool_t* pool, const char* name, size_t object_size, size_t preallocate);
+
+/**
+ * @brief Освобождение блоков пула
+ *
+ * @warning Вызывать, когда ни один поток больше не пользуется пулом
+ */
+void object_pool_destroy(struct object_pool_t* pool);
+
+/**
+ * @brief Объект из кэша потока или со склада, содержимое не определено
+ *
+ * @return void* NULL, если не удалось выделить память
+ */
+void* object_pool_alloc(struct object_pool_t* pool);
+
+/**
+ * @brief Возврат объекта в кэш текущего потока
+ *
+ * Объект можно вернуть из любого потока, не только из выделившего его
+ */
+void object_pool_free(struct object_pool_t* pool, void* object);
+
+/**
+ * @brief Снимок статистики пула
+ *
+ */
+void object_pool_stats(struct object_pool_t* pool, struct pool_stats_t* stats);
+
+/**
+ * @brief Функция, вызываемая для каждого пула
+ */
+typedef void (*object_pool_callback)(struct object_pool_t* pool, void* arg);
+
+/**
+ * @brief Обход всех инициализированных пулов процесса
+ *
+ * @warning Не вызывать одновременно с object_pool_destroy()
+ */
+void object_pool_foreach(object_pool_callback callback, void* arg);
+
+/**
+ * @brief Инициализация пулов по классам размеров
+ *
+ * @param min_size Размер самого мелкого класса, степень двойки
+ * @param class_count Количество классов, не больше SIZE_POOL_MAX_CLASSES
+ * @param preallocate Сколько объектов нарезать сразу в каждом классе не больше preallocate_limit байт
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int size_pool_init(struct size_pool_t* pool, const char* name, size_t min_size, int class_count, size_t preallocate, size_t preallocate_limit);
+
+/**
+ * @brief Буфер не меньше size байт
+ *
+ * @param size_class Номер класса, который нужно передать в size_pool_free(), -1 для malloc()
+ * @return void* NULL, если не удалось выделить память
+ */
+void* size_pool_alloc(struct size_pool_t* pool, size_t size, int* size_class);
+
+/**
+ * @brief Возврат буфера в пул его класса
+ *
+ */
+void size_pool_free(struct size_pool_t* pool, void* buffer, int size_class);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Двоичный протокол поверх кадров frame.h. Заголовок не зависит от остальных заголовков сервера:
+ * его подключают клиенты, а protocol.c линкуется с ними отдельно.
+ *
+ * Рукопожатие: первым кадром клиент отправляет PROTOCOL_MAGIC, минимальную и максимальную
+ * поддерживаемые версии (по байту). Сервер отвечает событием PROTOCOL_OP_HELLO с выбранной
+ * версией в нагрузке и номером клиента в sender; версия 0 означает, что соединение остается
+ * текстовым. Старые клиенты рукопожатие не отправляют: их первый кадр - имя, и соединение
+ * работает по текстовому протоколу.
+ *
+ * Кадр команды клиента: байт кода операции, затем аргументы:
+ *   PROTOCOL_OP_NAME     имя
+ *   PROTOCOL_OP_LIST     байт режима PROTOCOL_LIST_*, 8 байт номера страницы или поколения
+ *   PROTOCOL_OP_JOIN     8 байт номера сообщения для повтора (0 - последние), имя комнаты
+ *   PROTOCOL_OP_DIRECT   байт длины имени, имя получателя, текст
+ *   PROTOCOL_OP_MESSAGE  текст
+ *   PROTOCOL_OP_QUIT, PROTOCOL_OP_LEAVE, PROTOCOL_OP_ROOMS без аргументов
+ *
+ * Кадр события сервера: заголовок PROTOCOL_HEADER_SIZE байт, имя отправителя, тело.
+ * Все числа big-endian
+ */
+#define PROTOCOL_VERSION        1
+#define PROTOCOL_MAGIC          "\0CHT"
+#define PROTOCOL_MAGIC_SIZE     4
+#define PROTOCOL_HELLO_SIZE     (PROTOCOL_MAGIC_SIZE + 2)
+#define PROTOCOL_HEADER_SIZE    24
+
+#define PROTOCOL_OP_HELLO       0x00        ///< Ответ на рукопожатие, тело - байт выбранной версии
+#define PROTOCOL_OP_QUIT        0x01        ///< Выход из чата
+#define PROTOCOL_OP_LIST        0x02        ///< Список участников комнаты
+#define PROTOCOL_OP_JOIN        0x03        ///< Переход в комнату
+#define PROTOCOL_OP_LEAVE       0x04        ///< Возврат в комнату по умолчанию
+#define PROTOCOL_OP_ROOMS       0x05        ///< Список комнат
+#define PROTOCOL_OP_DIRECT      0x06        ///< Личное сообщение; событие - личное сообщение от sender
+#define PROTOCOL_OP_MESSAGE     0x07        ///< Сообщение в комнату; событие - сообщение sender в комнате
+#define PROTOCOL_OP_NAME        0x08        ///< Имя клиента, первая команда после рукопожатия
+#define PROTOCOL_OP_LEFT        0x20        ///< Событие: sender вышел из комнаты, тело - имя комнаты
+#define PROTOCOL_OP_JOINED      0x21        ///< Событие: sender вошел в комнату, тело - имя комнаты
+#define PROTOCOL_OP_INFO        0x30        ///< Событие: служебный текст сервера
+
+#define PROTOCOL_LIST_ALL       0           ///< Все страницы списка
+#define PROTOCOL_LIST_PAGE      1           ///< Одна страница с номером number
+#define PROTOCOL_LIST_SINCE     2           ///< Изменения состава после поколения number
+
+/**
+ * @brief Заголовок события сервера
+ */
+struct protocol_header_t {
+    uint8_t opcode;                         ///< Код события PROTOCOL_OP_*
+    uint8_t flags;                          ///< Зарезервировано, 0
+    uint16_t name_length;                   ///< Длина имени отправителя после заголовка
+    uint32_t sender;                        ///< Номер клиента-отправителя, 0 - сервер
+    uint64_t seq;                           ///< Номер сообщения в журнале комнаты, 0 если сообщение не журналируется
+    uint64_t timestamp;                     ///< Время создания события, мс с начала эпохи
+};
+
+/**
+ * @brief Разобранная команда клиента
+ *
+ * Строки указывают в буфер кадра и не завершены '\0'
+ */
+struct protocol_command_t {
+    uint8_t opcode;                         ///< Код команды PROTOCOL_OP_*
+    uint8_t list_mode;                      ///< PROTOCOL_OP_LIST: режим PROTOCOL_LIST_*
+    uint64_t number;                        ///< PROTOCOL_OP_LIST: страница или поколение, PROTOCOL_OP_JOIN: номер сообщения
+    const char* target;                     ///< Имя клиента, комнаты или получателя
+    size_t target_length;                   ///< Длина target
+    const char* text;                       ///< Текст сообщения
+    size_t text_length;                     ///< Длина text
+};
+
+/**
+ * @brief Запись кадра рукопожатия клиента
+ *
+ * @param payload Буфер не меньше PROTOCOL_HELLO_SIZE байт
+ * @return size_t Длина нагрузки
+ */
+size_t protocol_hello_encode(char* payload, uint8_t min_version, uint8_t max_version);
+
+/**
+ * @brief Выбор версии по кадру рукопожатия
+ *
+ * @return int Выбранная версия, 0 если общих версий нет, -1 если кадр не рукопожатие
+ */
+int protocol_hello_negotiate(const char* payload, size_t length);
+
+/**
+ * @brief Запись заголовка события
+ *
+ * @param payload Буфер не меньше PROTOCOL_HEADER_SIZE байт
+ */
+void protocol_header_encode(char* payload, const struct protocol_header_t* header);
+
+/**
+ * @brief Разбор заголовка события
+ *
+ * @return int 0 в случае успеха, -1 если кадр короче заголовка и имени
+ */
+int protocol_header_decode(const char* payload, size_t length, struct protocol_header_t* header);
+
+/**
+ * @brief Запись кадра команды
+ *
+ * Слишком длинные имя и текст обрезаются по size
+ *
+ * @param size Размер буфера payload
+ * @return size_t Длина нагрузки, 0 если команда не помещается в буфер
+ */
+size_t protocol_command_encode(char* payload, size_t size, const struct protocol_command_t* command);
+
+/**
+ * @brief Разбор кадра команды
+ *
+ * @return int 0 в случае успеха, -1 если кадр поврежден или код команды неизвестен
+ */
+int protocol_command_decode(const char* payload, size_t length, struct protocol_command_t* command);
+
+#endif
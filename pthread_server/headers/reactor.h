@@ -0,0 +1,206 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "common.h"
+#include "config.h"
+#include "frame.h"
+#include "message.h"
+#include "throttle.h"
+
+#define READ_BUFFER_SIZE        16384
+#define REACTOR_UPGRADED        1
+
+/**
+ * @brief Состояние соединения в реакторе
+ */
+enum connection_state {
+    CONN_HANDSHAKE,                         ///< Ожидание рукопожатия или имени клиента
+    CONN_ACTIVE,                            ///< Клиент участвует в чате
+    CONN_CLOSED                             ///< Соединение закрыто, память освобождается в конце итерации
+};
+
+struct reactor_t;
+struct uring_t;
+struct zerocopy_t;
+
+/**
+ * @brief Соединение, обслуживаемое реактором
+ */
+struct connection_t {
+    struct client_data_t data;              ///< Данные клиента
+    enum connection_state state;            ///< Текущее состояние соединения
+    struct reactor_t* reactor;              ///< Реактор, которому принадлежит соединение
+    struct frame_reader_t reader;           ///< Незавершенный входящий кадр
+    struct message_queue_t out;             ///< Исходящие сообщения, еще не принятые ядром
+    struct message_t* gap_notice;           ///< Последнее уведомление о пропуске, поставленное в очередь
+    unsigned gap_skipped;                   ///< Сколько сообщений пропуска указано в gap_notice
+    int failed;                             ///< Ошибка записи, соединение будет закрыто
+    struct throttle_t throttle;             ///< Корзины токенов ограничения частоты кадров
+    struct zerocopy_t* zerocopy;            ///< Незавершенные отправки с MSG_ZEROCOPY, NULL если MSG_ZEROCOPY выключен
+    struct connection_t* next_pending;      ///< Следующий элемент в списке на закрытие или освобождение
+    int uring_refs;                         ///< io_uring: количество незавершенных операций с соединением
+    int sends_in_flight;                    ///< io_uring: количество сообщений из начала очереди, переданных ядру
+    int dirty;                              ///< Соединение в списке на отправку в конце итерации
+    struct connection_t* next_dirty;        ///< Следующий элемент в списке на отправку
+    struct connection_t* prev_open;         ///< Предыдущее открытое соединение потока
+    struct connection_t* next_open;         ///< Следующее открытое соединение потока
+};
+
+/**
+ * @brief Сообщение, переданное рабочему потоку для рассылки по его шарду или для одного его клиента
+ */
+struct inbound_t {
+    struct inbound_t* next;                 ///< Следующий элемент очереди
+    struct chat_t* chat;                    ///< Комната со ссылкой на нее, участникам которой нужно разослать сообщение, NULL для личного сообщения
+    struct message_t* message;              ///< Ссылка на общий кадр сообщения
+    char target[MAX_NAME_LENGTH];           ///< Имя получателя личного сообщения
+};
+
+/**
+ * @brief Данные рабочего потока-реактора
+ */
+struct reactor_t {
+    int id;                                 ///< Номер потока, он же номер шарда чата
+    int count;                              ///< Общее количество рабочих потоков
+    struct reactor_t* group;                ///< Массив всех рабочих потоков
+    pthread_t thread;                       ///< Поток реактора
+    int epoll_fd;                           ///< Дескриптор epoll, -1 при работе через io_uring
+    int listen_fd;                          ///< Собственный слушающий сокет с SO_REUSEPORT
+    int event_fd;                           ///< eventfd для пробуждения при появлении входящих сообщений
+    _Atomic(struct inbound_t*) inbound;     ///< Входящая очередь от других потоков (стек, MPSC)
+    struct room_registry_t* rooms;          ///< Реестр комнат
+    const struct server_config_t* config;   ///< Параметры запуска сервера
+    struct uring_t* ring;                   ///< Кольцо io_uring, NULL при работе через epoll
+    uint64_t now;                           ///< Время начала текущей итерации цикла, мс
+    struct connection_t* closing;           ///< Соединения, которые нужно закрыть в конце итерации
+    struct connection_t* closed;            ///< Закрытые соединения, память которых нужно освободить
+    struct connection_t* dirty;             ///< Соединения, исходящие очереди которых отправляются в конце итерации
+    struct connection_t* open;              ///< Открытые соединения потока, передаются при горячем обновлении
+    struct zerocopy_t* parked;              ///< Учеты MSG_ZEROCOPY закрытых соединений, ждущие уведомлений ядра
+    int accept_pending;                     ///< В очереди listen() могут быть соединения, они принимаются в конце итерации
+    uint64_t accept_since;                  ///< Когда слушающий сокет стал готов, нс
+    atomic_int stop;                        ///< Поток должен выйти из цикла в конце итерации
+    char buffer[READ_BUFFER_SIZE + 1];      ///< Общий буфер чтения, кадры разбираются сразу после recv()
+};
+
+/**
+ * @brief Запуск сервера на edge-triggered epoll или io_uring
+ *
+ * Запускает config->workers рабочих потоков. У каждого свой слушающий сокет
+ * с SO_REUSEPORT, свой epoll (или кольцо io_uring) и свой шард в каждой комнате; поток
+ * закрепляется за ядром. Поток принимает соединения, получает имена клиентов
+ * и выполняет их команды без блокирующих вызовов.
+ *
+ * По SIGUSR2 (только epoll) потоки останавливаются, а слушающие сокеты и соединения
+ * с именами, комнатами и неотправленными байтами передаются новому процессу сервера
+ * (upgrade.h). Если сервер сам запущен для обновления, он продолжает обслуживать
+ * переданные соединения. При неудачной передаче потоки запускаются снова
+ *
+ * @return int -1 при критической ошибке, REACTOR_UPGRADED после передачи соединений новому процессу
+ */
+int reactor_run(const struct server_config_t* config, struct room_registry_t* rooms);
+
+/**
+ * @brief Рассылка сообщения всем участникам комнаты, кроме отправителя
+ *
+ * Своему шарду поток рассылает сразу, остальным рабочим потокам, у которых
+ * есть участники комнаты, передается ссылка на то же сообщение через
+ * их входящие очереди без общих блокировок
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int reactor_broadcast(struct connection_t* sender, struct chat_t* chat, struct message_t* message);
+
+/**
+ * @brief Передача личного сообщения клиенту другого рабочего потока
+ *
+ * Соединение чужого потока может быть освобождено в любой момент, поэтому передается имя:
+ * поток-владелец еще раз находит получателя в индексе имен и ставит сообщение в его очередь
+ *
+ * @param target Данные получателя из name_index_find()
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int reactor_direct(struct connection_t* sender, const struct client_data_t* target, struct message_t* message);
+
+/**
+ * @brief Запись сообщения в соединение
+ *
+ * Кадр выбирается по протоколу клиента через message_for(). В режиме FLUSH_IMMEDIATE при пустой очереди отправляет сразу то, что принимает ядро.
+ * Иначе в исходящую очередь ставится ссылка на сообщение: в режиме FLUSH_TICK и с io_uring
+ * все сообщения соединения за итерацию уходят вместе в конце итерации, остаток очереди
+ * дописывается по событию EPOLLOUT.
+ * Если очередь превышает лимит байт или возраста, клиент отключается либо теряет
+ * неотправленные сообщения и получает уведомление о пропуске.
+ * При ошибке соединение помечается на закрытие, само закрытие выполняет реактор
+ * вне блокировок чата
+ *
+ * @return int 0, ошибка соединения получателя не считается ошибкой отправителя
+ */
+int connection_write(struct connection_t* conn, struct message_t* message);
+
+/**
+ * @brief Ставит соединение в список на отправку исходящей очереди в конце итерации
+ *
+ */
+void connection_mark_dirty(struct connection_t* conn);
+
+/**
+ * @brief Учет байт исходящей очереди, принятых ядром
+ *
+ */
+void connection_consume(struct connection_t* conn, size_t length);
+
+/**
+ * @brief Обновление времени текущей итерации реактора
+ *
+ */
+void reactor_update_clock(struct reactor_t* reactor);
+
+/**
+ * @brief Создание соединения для принятого сокета
+ *
+ * Сверх лимита config->max_clients соединение получает кадр "server full" и закрывается
+ *
+ * @return struct connection_t* NULL при ошибке или отказе, сокет при этом закрывается
+ */
+struct connection_t* reactor_accept_connection(struct reactor_t* reactor, int client_fd, struct sockaddr_in* client_addr);
+
+/**
+ * @brief Обработка прочитанных из соединения байт
+ *
+ * Выполняет все полные кадры, незавершенный хвост сохраняет в соединении.
+ * Первые кадры - рукопожатие и имя клиента, после имени клиент добавляется в чат,
+ * остальные кадры - команды. При ошибке соединение ставится в очередь на закрытие
+ *
+ * @param data Прочитанные байты, после них должен быть еще один доступный для записи байт
+ */
+void connection_on_data(struct connection_t* conn, char* data, size_t length);
+
+/**
+ * @brief Ставит соединение в очередь на закрытие
+ *
+ * Закрытие откладывается до конца итерации: соединение может быть в середине
+ * рассылки под мьютексом чата или встречаться дальше в массиве событий
+ *
+ */
+void connection_schedule_close(struct connection_t* conn);
+
+/**
+ * @brief Освобождение памяти закрытого соединения
+ *
+ */
+void connection_free(struct connection_t* conn);
+
+/**
+ * @brief Рассылает по своему шарду сообщения, пришедшие от других рабочих потоков
+ *
+ */
+void reactor_process_inbound(struct reactor_t* reactor);
+
+/**
+ * @brief Закрывает соединения, поставленные в очередь за итерацию, и освобождает память
+ *
+ */
+void reactor_reap_connections(struct reactor_t* reactor);
+
+#endif
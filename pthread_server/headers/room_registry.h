@@ -0,0 +1,69 @@
+#ifndef ROOM_REGISTRY_H
+#define ROOM_REGISTRY_H
+
+#include "common.h"
+
+/**
+ * @brief Псевдоним для callback функций обхода комнат
+ *
+ */
+typedef int (*room_callback) (struct chat_t* room, void* arg);
+
+/**
+ * @brief Создание реестра и комнаты DEFAULT_ROOM
+ *
+ * @param shard_count Количество шардов каждой комнаты, по одному на рабочий поток
+ * @param limits Ограничения журналов комнат
+ * @return struct room_registry_t* NULL при ошибке
+ */
+struct room_registry_t* room_registry_init(int shard_count, const struct backlog_limits_t* limits);
+
+/**
+ * @brief Освобождение реестра и всех комнат
+ *
+ * @warning Вызывать, когда рабочие потоки остановлены
+ */
+void room_registry_free(struct room_registry_t* registry);
+
+/**
+ * @brief Поиск комнаты по имени, комната создается, если ее нет
+ *
+ * Если комнат уже MAX_ROOMS, удаляется одна пустая комната, которую держит только журнал
+ *
+ * @return struct chat_t* Комната с захваченной ссылкой, NULL при ошибке или если все MAX_ROOMS комнат заняты
+ */
+struct chat_t* room_acquire(struct room_registry_t* registry, const char* name);
+
+/**
+ * @brief Захват еще одной ссылки на комнату
+ *
+ */
+struct chat_t* room_ref(struct chat_t* room);
+
+/**
+ * @brief Освобождение ссылки на комнату
+ *
+ * Если ссылка осталась только у реестра, пустая комната без сообщений в журнале удаляется
+ *
+ */
+void room_release(struct chat_t* room);
+
+/**
+ * @brief Обход всех комнат реестра
+ *
+ * callback выполняется под мьютексом корзины комнаты
+ *
+ * @return int 0 в случае успеха, -1 если callback вернул ошибку
+ */
+int foreach_room(struct room_registry_t* registry, room_callback callback, void* arg);
+
+/**
+ * @brief Проверка имени комнаты
+ *
+ * Допустимы латинские буквы, цифры, '-' и '_', длина от 1 до MAX_ROOM_NAME - 1
+ *
+ * @return int 1 если имя допустимо, 0 иначе
+ */
+int room_name_valid(const char* name);
+
+#endif
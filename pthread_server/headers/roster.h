@@ -0,0 +1,52 @@
+#ifndef ROSTER_H
+#define ROSTER_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+#define ROSTER_ALL_PAGES        0
+#define ROSTER_HEADER_RESERVE   128
+
+/**
+ * @brief Инициализация пустого кэша списка участников
+ *
+ */
+void roster_init(struct roster_t* roster);
+
+/**
+ * @brief Освобождение готовых кадров кэша
+ *
+ */
+void roster_free(struct roster_t* roster);
+
+/**
+ * @brief Учет присоединения или выхода клиента
+ *
+ * Увеличивает поколение состава и записывает изменение, готовые кадры становятся устаревшими
+ *
+ * @param joined 1 - клиент вошел в комнату, 0 - вышел
+ */
+void roster_record(struct chat_t* chat, const struct client_data_t* c_data, int joined);
+
+/**
+ * @brief Отправка клиенту списка участников комнаты
+ *
+ * Список, не помещающийся в один кадр, делится на страницы. Кадры собираются заново,
+ * только если состав изменился с прошлого запроса
+ *
+ * @param page Номер страницы с 1, ROSTER_ALL_PAGES - все страницы подряд
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int roster_send(struct chat_t* chat, struct client_data_t* c_data, int page);
+
+/**
+ * @brief Отправка клиенту изменений состава комнаты после поколения since
+ *
+ * Если нужных изменений уже нет в кольце, отправляется полный список
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int roster_send_delta(struct chat_t* chat, struct client_data_t* c_data, uint64_t since);
+
+#endif
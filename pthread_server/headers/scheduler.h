@@ -0,0 +1,64 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "common.h"
+
+#define SCHEDULER_DEQUE_SIZE    1024
+
+struct task_t;
+
+/**
+ * @brief Псевдоним для функции выполнения задачи
+ *
+ */
+typedef void (*task_callback)(struct task_t* task);
+
+/**
+ * @brief Задача пула рабочих потоков
+ *
+ * Встраивается в структуру владельца, память задачи пул не выделяет и не освобождает
+ */
+struct task_t {
+    task_callback run;                      ///< Выполнение задачи
+    struct task_t* next;                    ///< Следующий элемент общей очереди
+};
+
+/**
+ * @brief Дек задач одного рабочего потока (Chase-Lev)
+ *
+ * Владелец кладет и забирает задачи с нижнего конца без блокировок, остальные
+ * потоки крадут с верхнего одним CAS. Размер фиксирован: если дек полон,
+ * задача уходит в общую очередь
+ */
+struct task_deque_t {
+    _Atomic int64_t top;                    ///< Верхний конец, с него крадут
+    _Atomic int64_t bottom;                 ///< Нижний конец, с ним работает владелец
+    _Atomic(struct task_t*) items[SCHEDULER_DEQUE_SIZE]; ///< Кольцевой массив задач
+};
+
+/**
+ * @brief Запуск фиксированного пула рабочих потоков
+ *
+ * @param workers Количество потоков, 0 - по одному на процессор
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int scheduler_start(int workers);
+
+/**
+ * @brief Постановка задачи в пул
+ *
+ * Рабочий поток пула кладет задачу в свой дек, остальные потоки - в общую очередь.
+ * Спящий рабочий поток будится, только если такие есть
+ *
+ */
+void scheduler_submit(struct task_t* task);
+
+/**
+ * @brief Остановка пула: потоки доделывают поставленные задачи и завершаются
+ *
+ * Повторный вызов и вызов без scheduler_start() ничего не делают
+ *
+ */
+void scheduler_stop(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "common.h"
+#include "config.h"
+#include "frame.h"
+
+#define STORE_INDEX_INTERVAL    4096
+#define STORE_BATCH             1024
+#define STORE_RECORD_HEADER     40
+#define STORE_MIN_SEGMENT       (STORE_RECORD_HEADER + MAX_ROOM_NAME + FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD)
+
+/**
+ * @brief Открытие хранилища сообщений в config->data_dir и восстановление истории комнат
+ *
+ * Хранилище - журнал записей, разбитый на сегменты фиксированного размера с разреженным
+ * индексом. Запись в активный сегмент идет через mmap в фоновом потоке, сброс на диск
+ * выполняется пачками раз в config->fsync_ms. При запуске конец журнала находится по индексу
+ * последнего сегмента, а в журналы комнат загружается только хвост хранилища размером
+ * с общий лимит журналов
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int store_open(const struct server_config_t* config, struct room_registry_t* rooms);
+
+/**
+ * @brief Постановка сообщения комнаты в очередь на запись
+ *
+ * Не выполняет ввода-вывода: сообщение с захваченной ссылкой передается фоновому потоку.
+ * Если хранилище не открыто, ничего не делает
+ *
+ * @warning Вызывать после backlog_append(), чтобы у сообщения был номер
+ */
+void store_append(struct chat_t* chat, struct message_t* message);
+
+/**
+ * @brief Запись оставшихся сообщений, сброс на диск и остановка фонового потока
+ *
+ */
+void store_close(void);
+
+#endif
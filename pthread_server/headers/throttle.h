@@ -0,0 +1,64 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include "common.h"
+
+#define THROTTLE_SCALE          1000
+
+/**
+ * @brief Ограничения частоты кадров одного клиента
+ *
+ * Емкость каждой корзины - секундный лимит, то есть клиент может отправить
+ * пачку в одну секунду трафика, после чего ограничен средней частотой
+ */
+struct rate_limits_t {
+    unsigned messages;                      ///< Кадров в секунду, 0 - без ограничения
+    size_t bytes;                           ///< Байт кадров в секунду, 0 - без ограничения
+    unsigned strikes;                       ///< Выброшенных кадров в одной серии нарушений до отключения клиента, 0 - не отключать
+    int window_ms;                          ///< Серия нарушений заканчивается после window_ms мс без нарушений
+};
+
+/**
+ * @brief Решение по кадру клиента
+ */
+enum throttle_verdict {
+    THROTTLE_PASS,                          ///< Кадр выполняется
+    THROTTLE_DROP,                          ///< Кадр выбрасывается без разбора
+    THROTTLE_NOTIFY,                        ///< Кадр выбрасывается, клиента нужно предупредить: первое нарушение серии
+    THROTTLE_DISCONNECT                     ///< Клиент превысил лимит нарушений и отключается
+};
+
+/**
+ * @brief Корзины токенов одного клиента
+ *
+ * Токены хранятся в тысячных долях, пополняются по прошедшему времени при каждом кадре.
+ * Меняет только поток, читающий сокет клиента
+ */
+struct throttle_t {
+    uint64_t messages;                      ///< Токены кадров, THROTTLE_SCALE на кадр
+    uint64_t bytes;                         ///< Токены байт, THROTTLE_SCALE на байт
+    uint64_t updated;                       ///< Время последнего пополнения, мс
+    uint64_t violated;                      ///< Время последнего нарушения, мс
+    unsigned strikes;                       ///< Нарушений в текущей серии
+};
+
+/**
+ * @brief Полные корзины для нового клиента
+ *
+ * @param now Текущее монотонное время, мс
+ */
+void throttle_init(struct throttle_t* throttle, const struct rate_limits_t* limits, uint64_t now);
+
+/**
+ * @brief Проверка кадра длиной length по корзинам клиента
+ *
+ * Вызывается до разбора и рассылки кадра. Кадр проходит, только если токенов
+ * хватает в обеих корзинах; выброшенный кадр токенов не тратит.
+ * Выброшенные кадры учитываются в счетчиках метрик
+ *
+ * @param now Текущее монотонное время, мс
+ * @return enum throttle_verdict Решение по кадру
+ */
+enum throttle_verdict throttle_admit(struct throttle_t* throttle, const struct rate_limits_t* limits, size_t length, uint64_t now);
+
+#endif
@@ -1,15 +0,0 @@
-#ifndef TIME_PREFIX_H
-#define TIME_PREFIX_H
-
-#include <time.h>
-#include <stdio.h>
-
-/**
- * @brief Выводит время 
- * 
- * Не использует '\n' чтобы за вызовом функции выволнить вывод нужный данных
- * 
- */
-void print_time_prefix(void);
-
-#endif
\ No newline at end of file
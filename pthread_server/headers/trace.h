@@ -0,0 +1,101 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "common.h"
+#include "metrics.h"
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define TRACE_PROBE1(name, a)           DTRACE_PROBE1(chat, name, a)
+#define TRACE_PROBE2(name, a, b)        DTRACE_PROBE2(chat, name, a, b)
+#else
+#define TRACE_PROBE1(name, a)           do { } while (0)
+#define TRACE_PROBE2(name, a, b)        do { } while (0)
+#endif
+
+#define TRACE_DEFAULT_SAMPLE    64
+
+/**
+ * @brief Трассировка стадий обработки сообщения от recv() до последней отправки
+ *
+ * Трассируется одно прочитанное recv() из trace_sample: стадии первого кадра прочитанного
+ * блока замеряются монотонными часами и пишутся в гистограммы потока. У остальных кадров
+ * проверяется только флаг потока. Статические точки USDT провайдера chat (receive, parse,
+ * enqueue, lock, send, deliver) срабатывают для всех кадров, если сервер собран с sys/sdt.h
+ */
+
+/**
+ * @brief Состояние трассировки потока
+ */
+struct trace_t {
+    unsigned received;                      ///< recv() с последнего трассированного
+    int active;                             ///< Текущий кадр трассируется
+    uint64_t pending;                       ///< Время трассируемого recv(), нс, 0 если кадр уже начат
+    uint64_t start;                         ///< Время recv() текущего кадра, нс
+    uint64_t frame;                         ///< Начало обработки текущего кадра, нс
+    uint64_t mark;                          ///< Конец предыдущей стадии, нс
+};
+
+/**
+ * @brief Частота трассировки: один recv() из trace_sample, 0 - выключено
+ */
+extern unsigned trace_sample;
+
+extern __thread struct trace_t trace_self;
+
+/**
+ * @brief Установка частоты трассировки
+ *
+ * @warning Вызывать до запуска рабочих потоков
+ */
+void trace_init(unsigned sample);
+
+/**
+ * @brief Начало трассировки прочитанного блока
+ *
+ */
+void trace_sampled(void);
+
+/**
+ * @brief Учет recv(), вызывать сразу после успешного чтения
+ *
+ */
+#define trace_receive(fd, length)                                                                       \
+    do {                                                                                                \
+        TRACE_PROBE2(receive, fd, length);                                                              \
+        if (trace_sample && ++trace_self.received >= trace_sample) {                                    \
+            trace_sampled();                                                                            \
+        }                                                                                               \
+    } while (0)
+
+#define trace_active() (trace_self.active)
+
+/**
+ * @brief Начало обработки кадра
+ *
+ * Первый кадр трассируемого блока становится трассируемым, время сборки кадра
+ * после recv() пишется в METRICS_READ
+ *
+ */
+void trace_frame_begin(void);
+
+/**
+ * @brief Конец обработки кадра
+ *
+ */
+void trace_frame_end(void);
+
+/**
+ * @brief Запись длительности стадии с конца предыдущей стадии трассируемого кадра
+ *
+ */
+void trace_stage(enum metrics_histogram stage);
+
+/**
+ * @brief Время recv() трассируемого кадра для передачи вместе с сообщением, 0 если кадр не трассируется
+ *
+ */
+#define trace_origin() (trace_self.active ? trace_self.start : 0)
+
+#endif
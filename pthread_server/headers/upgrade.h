@@ -0,0 +1,146 @@
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include "common.h"
+
+#include <sys/uio.h>
+
+#define UPGRADE_ENV             "CHAT_UPGRADE_FD"
+
+/**
+ * @brief Тип записи передачи состояния
+ */
+enum upgrade_record_type {
+    UPGRADE_LISTENER,                       ///< Слушающий сокет рабочего потока
+    UPGRADE_CONNECTION,                     ///< Соединение клиента
+    UPGRADE_END                             ///< Конец передачи
+};
+
+/**
+ * @brief Запись передачи состояния старым процессом новому
+ *
+ * Дескриптор записи передается в той же sendmsg() через SCM_RIGHTS, за записью в потоке
+ * идут out_length байт исходящей очереди и pending_length байт незавершенного входящего кадра.
+ * Оба процесса - один и тот же сервер на одной машине, поэтому запись передается как есть
+ */
+struct upgrade_record_t {
+    int type;                               ///< Тип записи enum upgrade_record_type
+    int index;                              ///< Номер рабочего потока слушающего сокета или шард соединения
+    int state;                              ///< Состояние соединения enum connection_state
+    int protocol;                           ///< Версия двоичного протокола клиента, 0 - текстовый
+    uint32_t client_id;                     ///< Номер клиента; в UPGRADE_END - следующий свободный номер
+    uint16_t client_port;                   ///< Порт клиента
+    char client_ip[INET_ADDRSTRLEN];        ///< IP клиента
+    char client_name[MAX_NAME_LENGTH];      ///< Имя клиента
+    char room[MAX_ROOM_NAME];               ///< Комната клиента, пустая строка до присоединения
+    uint32_t out_length;                    ///< Неотправленные байты исходящей очереди
+    uint32_t pending_length;                ///< Байты незавершенного входящего кадра
+    uint32_t zerocopy_next;                 ///< Номер следующей отправки MSG_ZEROCOPY, ядро продолжает счет на сокете
+};
+
+/**
+ * @brief Соединение, полученное новым процессом
+ */
+struct upgrade_connection_t {
+    struct upgrade_record_t record;         ///< Запись соединения
+    int fd;                                 ///< Сокет клиента, -1 после передачи реактору
+    char* out;                              ///< Неотправленные байты, NULL если их нет
+    char* pending;                          ///< Незавершенный входящий кадр, NULL если его нет
+};
+
+/**
+ * @brief Запоминает путь к исполняемому файлу и аргументы для перезапуска
+ *
+ * Вызывается в main() до разбора аргументов. Путь берется из /proc/self/exe при запуске:
+ * новый бинарный файл, записанный на его место, запускается по тому же пути
+ *
+ */
+void upgrade_init(char* argv[]);
+
+/**
+ * @brief Запуск нового процесса сервера
+ *
+ * Создает пару Unix-сокетов и запускает сервер заново с теми же аргументами, передав
+ * ему свой конец пары через переменную окружения UPGRADE_ENV
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int upgrade_spawn(void);
+
+/**
+ * @brief Отправка записи новому процессу
+ *
+ * @param fd Передаваемый дескриптор, -1 если его нет
+ * @param data Байты после записи: исходящая очередь и незавершенный кадр
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int upgrade_send(const struct upgrade_record_t* record, int fd, const struct iovec* data, int count);
+
+/**
+ * @brief Ожидание подтверждения, что новый процесс получил все состояние
+ *
+ * @return int 0 если новый процесс готов, -1 если он завершился или ответил ошибкой
+ */
+int upgrade_wait_ready(void);
+
+/**
+ * @brief Отмена обновления: новый процесс завершается, старый продолжает работу
+ *
+ */
+void upgrade_abort(void);
+
+/**
+ * @brief Разрешение новому процессу начать работу
+ *
+ * Вызывается после остановки хранилища и сокета администратора, которые новый процесс
+ * открывает заново
+ *
+ */
+void upgrade_commit(void);
+
+/**
+ * @brief Прием состояния от старого процесса, если сервер запущен для горячего обновления
+ *
+ * Получает все записи, подтверждает прием и ждет, пока старый процесс освободит
+ * хранилище и сокет администратора
+ *
+ * @return int 1 если состояние получено, 0 если это обычный запуск, -1 при ошибке
+ */
+int upgrade_receive(void);
+
+/**
+ * @brief Слушающий сокет рабочего потока index, полученный от старого процесса
+ *
+ * Сокет передается вызывающему
+ *
+ * @return int Дескриптор, -1 если такого сокета нет
+ */
+int upgrade_take_listener(int index);
+
+/**
+ * @brief Количество полученных соединений
+ *
+ */
+int upgrade_connection_count(void);
+
+/**
+ * @brief Полученное соединение по порядковому номеру
+ *
+ */
+struct upgrade_connection_t* upgrade_connection(int index);
+
+/**
+ * @brief Номер, с которого продолжается выдача номеров клиентов, 0 если состояние не получено
+ *
+ */
+uint32_t upgrade_next_client_id(void);
+
+/**
+ * @brief Освобождение полученного состояния
+ *
+ * Дескрипторы, которые никто не забрал, закрываются
+ *
+ */
+void upgrade_finish(void);
+
+#endif
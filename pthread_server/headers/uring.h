@@ -0,0 +1,36 @@
+#ifndef URING_H
+#define URING_H
+
+#include "reactor.h"
+
+/**
+ * @brief Доступен ли backend io_uring в этой сборке
+ *
+ * @return int 1 если сервер собран с поддержкой io_uring, иначе 0
+ */
+int uring_supported(void);
+
+/**
+ * @brief Создание кольца io_uring и кольца предоставленных буферов для рабочего потока
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+int uring_init(struct reactor_t* reactor);
+
+/**
+ * @brief Освобождение кольца рабочего потока
+ *
+ */
+void uring_destroy(struct reactor_t* reactor);
+
+/**
+ * @brief Цикл событий рабочего потока на io_uring
+ *
+ * Multishot accept на слушающем сокете, multishot recv с кольцом
+ * предоставленных буферов на каждом соединении и связанные (IOSQE_IO_LINK)
+ * отправки: все отправки итерации уходят в ядро одним io_uring_enter()
+ *
+ */
+void uring_loop(struct reactor_t* reactor);
+
+#endif
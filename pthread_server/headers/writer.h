@@ -0,0 +1,98 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "common.h"
+#include "message.h"
+
+#define WRITER_IOV              16
+
+/**
+ * @brief Отправитель кадров одному клиенту в режиме потоков
+ *
+ * Рассылки обходят снимки комнат без блокировок, поэтому в сокет одного клиента
+ * одновременно пишут несколько потоков. Мьютекс удерживается на время записи:
+ * частичная запись одного потока не перемешивается с кадром другого.
+ *
+ * Отправка не блокируется: то, что сокет не принял сразу, остается в очереди, и дописывает
+ * ее только поток самого клиента, ожидая готовности сокета к записи. Рабочие потоки
+ * и рассылки других клиентов не ждут медленного получателя. Клиент, очередь которого
+ * превышает лимиты, отключается при любой политике slow_policy. Копии данных клиента
+ * в снимках и индексе имен ссылаются на один отправитель
+ */
+struct client_writer_t {
+    pthread_mutex_t lock;                   ///< Защищает очередь и failed, удерживается на время записи в сокет
+    int fd;                                 ///< Сокет клиента
+    uint16_t client_port;                   ///< Порт клиента для журнала
+    char client_ip[INET_ADDRSTRLEN];        ///< IP клиента для журнала
+    int wake_fd;                            ///< eventfd: очередь стала непустой, потоку клиента нужно ждать записи
+    struct message_queue_t out;             ///< Кадры, которые сокет не принял сразу
+    size_t max_bytes;                       ///< Лимит неотправленных байт очереди
+    int max_age_ms;                         ///< Лимит возраста самого старого кадра очереди, мс
+    int failed;                             ///< Клиент отключается, кадры больше не принимаются
+};
+
+/**
+ * @brief Создание отправителя клиента
+ *
+ * @param c_data Данные клиента: сокет и адрес
+ * @param max_bytes Лимит неотправленных байт, при превышении клиент отключается
+ * @param max_age_ms Лимит возраста неотправленного кадра, при превышении клиент отключается
+ * @return struct client_writer_t* NULL при ошибке
+ */
+struct client_writer_t* client_writer_create(const struct client_data_t* c_data, size_t max_bytes, int max_age_ms);
+
+/**
+ * @brief Освобождение отправителя, о котором другие потоки не знают
+ *
+ * Неотправленные кадры отпускаются, дескриптор клиента не закрывается
+ *
+ */
+void client_writer_free(struct client_writer_t* writer);
+
+/**
+ * @brief Отложенное освобождение отправителя клиента, вышедшего из чата
+ *
+ * Рассылки, начатые до выхода, еще могут писать через копии данных клиента:
+ * отправитель освобождается через ebr_retire() вместе с дескриптором
+ *
+ */
+void client_writer_retire(struct client_writer_t* writer);
+
+/**
+ * @brief Отправка кадра без блокировки
+ *
+ * Если очередь пуста, кадр сразу пишется в сокет, а остаток, который сокет не принял,
+ * ставится в очередь, и поток клиента будится через wake_fd. Клиент, очередь которого превышает лимиты,
+ * отключается: shutdown() завершает его поток
+ *
+ * @return int 0 если кадр отправлен или поставлен в очередь, -1 если клиент отключается
+ */
+int client_writer_send(struct client_writer_t* writer, struct message_t* message);
+
+/**
+ * @brief Время, которое поток клиента может ждать событий сокета
+ *
+ * @return int -1 если очередь пуста, иначе мс до истечения лимита возраста очереди
+ */
+int client_writer_timeout(struct client_writer_t* writer);
+
+/**
+ * @brief Дописывает очередь в сокет, сколько он примет
+ *
+ * Вызывает поток клиента по пробуждению через wake_fd, по готовности сокета к записи
+ * или по истечении client_writer_timeout()
+ *
+ * @return int 1 если в очереди остались кадры, 0 если очередь пуста, -1 если клиент отключается
+ */
+int client_writer_flush(struct client_writer_t* writer);
+
+/**
+ * @brief Отправка остатка очереди перед закрытием соединения
+ *
+ * Ждет готовности сокета не дольше лимита возраста очереди, после чего отправитель
+ * перестает принимать кадры
+ *
+ */
+void client_writer_drain(struct client_writer_t* writer);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include "common.h"
+#include "message.h"
+
+#define ZEROCOPY_MAX_PENDING    64
+#define ZEROCOPY_LINGER_POLL_MS 50
+
+/**
+ * @brief Отправки с MSG_ZEROCOPY одного сокета, память которых еще читает ядро
+ *
+ * Ядро нумерует успешные вызовы send() с MSG_ZEROCOPY на сокете подряд с нуля и сообщает
+ * о завершении диапазонами номеров через очередь ошибок сокета. Каждая незавершенная отправка
+ * держит ссылку на сообщение: общий кадр не освобождается и не возвращается в пул,
+ * пока ядро не отпустит его страницы. Поэтому и после закрытия соединения учет
+ * с незавершенными отправками ждет уведомлений в списке рабочего потока, см. zerocopy_park()
+ */
+struct zerocopy_t {
+    struct message_t* pending[ZEROCOPY_MAX_PENDING]; ///< Сообщения незавершенных отправок по номеру отправки
+    uint32_t next;                          ///< Номер следующей отправки
+    uint32_t oldest;                        ///< Номер самой старой незавершенной отправки
+    int fd;                                 ///< Копия дескриптора закрытого соединения, -1 пока соединение открыто
+    uint64_t deadline;                      ///< Срок ожидания уведомлений закрытого соединения, мс
+    struct zerocopy_t* next_parked;         ///< Следующий учет в списке ожидающих уведомлений
+};
+
+/**
+ * @brief Включение SO_ZEROCOPY на сокете клиента
+ *
+ * @return struct zerocopy_t* Учет отправок сокета, NULL если ядро не поддерживает MSG_ZEROCOPY или не хватило памяти
+ */
+struct zerocopy_t* zerocopy_create(int fd);
+
+/**
+ * @brief Отправка кадра сообщения, начиная с offset, без копирования в буферы сокета
+ *
+ * Если незавершенных отправок уже ZEROCOPY_MAX_PENDING или ядру не хватило памяти
+ * на закрепление страниц, кадр отправляется обычным send()
+ *
+ * @param flags Флаги send() в дополнение к MSG_ZEROCOPY
+ * @return ssize_t Как у send(): количество принятых ядром байт, -1 при ошибке
+ */
+ssize_t zerocopy_send(struct zerocopy_t* zerocopy, int fd, struct message_t* message, size_t offset, int flags);
+
+/**
+ * @brief Разбор уведомлений о завершении из очереди ошибок сокета
+ *
+ * Отпускает ссылки на сообщения завершенных отправок. Вызывать по EPOLLERR
+ *
+ */
+void zerocopy_complete(struct zerocopy_t* zerocopy, int fd);
+
+/**
+ * @brief Перенос учета закрываемого соединения в список ожидающих уведомлений
+ *
+ * Ядро читает страницы сообщений, пока данные не покинули очередь сокета, и после close().
+ * Учет держит копию дескриптора: сокет не уничтожается, уведомления о завершении
+ * по-прежнему приходят в его очередь ошибок, а ссылки на сообщения отпускаются только по ним.
+ * Перед переносом сокет закрывается на чтение и запись: клиент получает FIN и больше не может
+ * держать соединение открытым, не читая данных
+ *
+ * @param parked Список ожидающих учетов рабочего потока
+ * @param deadline Время, мс, после которого соединение сбрасывается, не дождавшись уведомлений
+ * @return int 0 если учет перенесен в список и принадлежит ему, -1 если незавершенных отправок нет
+ *         или не удалось скопировать дескриптор (тогда учет освобождает вызывающий)
+ */
+int zerocopy_park(struct zerocopy_t** parked, struct zerocopy_t* zerocopy, int fd, uint64_t deadline);
+
+/**
+ * @brief Разбор уведомлений всех ожидающих учетов
+ *
+ * Учет, все отправки которого завершены, закрывает свою копию дескриптора и освобождается.
+ * Соединение, срок ожидания которого истек, сбрасывается RST, и ссылки его учета отпускаются.
+ * Вызывать периодически, пока список не пуст, раз в ZEROCOPY_LINGER_POLL_MS мс
+ *
+ * @param now Текущее время, мс
+ * @return int 1 если в списке остались учеты, 0 если список пуст
+ */
+int zerocopy_drain(struct zerocopy_t** parked, uint64_t now);
+
+/**
+ * @brief Освобождение учета отправок
+ *
+ * Ссылки на сообщения незавершенных отправок отпускаются сразу. Для закрываемого
+ * соединения сначала вызывается zerocopy_park(), здесь освобождается учет
+ * без незавершенных отправок
+ *
+ */
+void zerocopy_free(struct zerocopy_t* zerocopy);
+
+#endif
@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+
+#include "../headers/admin.h"
+#include "../headers/listener.h"
+#include "../headers/metrics.h"
+#include "../headers/pool.h"
+#include "../headers/trace.h"
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define ADMIN_COMMAND_SIZE      64
+#define ADMIN_READ_TIMEOUT_MS   200
+
+/**
+ * @brief Описание счетчика для вывода
+ */
+struct admin_counter_t {
+    const char* name;                       ///< Имя метрики без префикса
+    const char* help;                       ///< Описание для # HELP
+    int gauge;                              ///< 1 для текущих значений, 0 для монотонных счетчиков
+};
+
+/**
+ * @brief Описание гистограммы для вывода
+ */
+struct admin_histogram_t {
+    const char* name;                       ///< Имя метрики без префикса и единиц
+    const char* help;                       ///< Описание для # HELP
+    int timing;                             ///< Значения в наносекундах
+};
+
+static const struct admin_counter_t admin_counters[METRICS_COUNTERS] = {
+    [METRICS_ACCEPTS]          = { "accepts_total",          "Accepted connections",                          0 },
+    [METRICS_REJECTED]         = { "rejected_total",         "Connections rejected with a server full frame", 0 },
+    [METRICS_ACCEPT_BATCHES_FULL] = { "accept_batches_full_total", "Loop iterations that left connections in the listen queue", 0 },
+    [METRICS_MESSAGES_IN]      = { "messages_in_total",      "Frames received from clients",                  0 },
+    [METRICS_MESSAGES_OUT]     = { "messages_out_total",     "Frames delivered to clients",                   0 },
+    [METRICS_BYTES_IN]         = { "bytes_in_total",         "Bytes received from clients",                   0 },
+    [METRICS_BYTES_OUT]        = { "bytes_out_total",        "Bytes sent to clients",                         0 },
+    [METRICS_SEND_CALLS]       = { "send_calls_total",       "Send calls and io_uring sends to clients",      0 },
+    [METRICS_ZEROCOPY_SENDS]   = { "zerocopy_sends_total",   "Sends with MSG_ZEROCOPY",                       0 },
+    [METRICS_ZEROCOPY_COPIED]  = { "zerocopy_copied_total",  "MSG_ZEROCOPY sends the kernel copied anyway",   0 },
+    [METRICS_BROADCASTS]       = { "broadcasts_total",       "Messages broadcast to a room",                  0 },
+    [METRICS_LOCK_WAITS]       = { "lock_waits_total",       "Mutex acquisitions that had to wait",           0 },
+    [METRICS_EVICTIONS]        = { "evictions_total",        "Slow clients disconnected",                     0 },
+    [METRICS_GAPS]             = { "gaps_total",             "Gap notices sent to slow clients",              0 },
+    [METRICS_DROPPED]          = { "dropped_total",          "Messages dropped from slow client queues",      0 },
+    [METRICS_THROTTLED_MESSAGES] = { "throttled_messages_total", "Client frames dropped by the rate limit",  0 },
+    [METRICS_THROTTLED_BYTES]  = { "throttled_bytes_total",  "Bytes of client frames dropped by the rate limit", 0 },
+    [METRICS_FLOOD_DISCONNECTS] = { "flood_disconnects_total", "Clients disconnected for repeated flooding",  0 },
+    [METRICS_TASKS]            = { "tasks_total",            "Tasks run by the threads mode worker pool",     0 },
+    [METRICS_TASKS_STOLEN]     = { "tasks_stolen_total",     "Tasks stolen from another worker's deque",      0 },
+    [METRICS_QUEUED_MESSAGES]  = { "queued_messages",        "Messages in outbound queues",                   1 },
+    [METRICS_QUEUED_BYTES]     = { "queued_bytes",           "Unsent bytes in outbound queues",               1 },
+    [METRICS_QUEUE_HIGH_WATER] = { "queue_high_water",       "Deepest outbound queue seen, messages",         1 }
+};
+
+static const struct admin_histogram_t admin_histograms[METRICS_HISTOGRAMS] = {
+    [METRICS_FRAME]     = { "frame",            "Time to handle one client frame, sampled",                1 },
+    [METRICS_READ]      = { "stage_read",       "From recv() to the start of frame handling, sampled",     1 },
+    [METRICS_PARSE]     = { "stage_parse",      "Command parsing, sampled",                                1 },
+    [METRICS_ENQUEUE]   = { "stage_enqueue",    "Building a message and appending it to the logs, sampled", 1 },
+    [METRICS_LOCK]      = { "stage_lock",       "Mutex acquisition, sampled",                              1 },
+    [METRICS_SEND]      = { "stage_send",       "Send to one recipient, sampled",                          1 },
+    [METRICS_BROADCAST] = { "broadcast",        "Broadcast from the sender thread, sampled",               1 },
+    [METRICS_DELIVERY]  = { "delivery",         "From recv() to the last send in a recipient shard, sampled", 1 },
+    [METRICS_FANOUT]    = { "broadcast_fanout", "Room members per broadcast, sampled",                     0 },
+    [METRICS_LOCK_WAIT] = { "lock_wait",        "Time spent waiting for a contended mutex",                1 },
+    [METRICS_ACCEPT_WAIT] = { "accept_wait",      "From listener readiness to accept() of a connection",     1 }
+};
+
+static const double admin_quantiles[] = { 0.5, 0.99, 0.999 };
+
+/**
+ * @brief Состояние потока администратора
+ */
+struct admin_t {
+    int listen_fd;                          ///< Слушающий Unix-сокет, -1 если поток не запущен
+    pthread_t thread;                       ///< Поток администратора
+    atomic_int running;                     ///< Сбрасывается в 0 при остановке
+    const char* path;                       ///< Путь сокета
+    struct room_registry_t* rooms;          ///< Реестр комнат
+    uint64_t started;                       ///< Время запуска, нс
+    uint64_t previous_time;                 ///< Время предыдущего текстового запроса, нс
+    uint64_t previous[METRICS_COUNTERS];    ///< Счетчики на момент предыдущего текстового запроса
+};
+
+static struct admin_t admin = {
+    .listen_fd = -1
+};
+
+/**
+ * @brief Вывод статистики одного пула в формате Prometheus
+ *
+ */
+static void admin_pool_prometheus(struct object_pool_t* pool, void* arg) {
+    FILE* out = (FILE*) arg;
+    struct pool_stats_t stats;
+
+    object_pool_stats(pool, &stats);
+
+    fprintf(out, "chat_pool_objects{pool=\"%s\",size=\"%zu\",state=\"live\"} %zu\n", pool->name, pool->object_size, stats.live);
+    fprintf(out, "chat_pool_objects{pool=\"%s\",size=\"%zu\",state=\"capacity\"} %zu\n", pool->name, pool->object_size, stats.capacity);
+    fprintf(out, "chat_pool_objects{pool=\"%s\",size=\"%zu\",state=\"high_water\"} %zu\n", pool->name, pool->object_size, stats.high_water);
+}
+
+/**
+ * @brief Вывод статистики одного пула текстом
+ *
+ */
+static void admin_pool_text(struct object_pool_t* pool, void* arg) {
+    FILE* out = (FILE*) arg;
+    struct pool_stats_t stats;
+
+    object_pool_stats(pool, &stats);
+
+    fprintf(out, "pool %s/%zu: live %zu, capacity %zu, high water %zu\n", pool->name, pool->object_size, stats.live, stats.capacity, stats.high_water);
+}
+
+/**
+ * @brief Вывод одного значения в формате Prometheus с описанием
+ *
+ */
+static void admin_prometheus_value(FILE* out, const char* name, const char* help, const char* type, uint64_t value) {
+    fprintf(out, "# HELP chat_%s %s\n# TYPE chat_%s %s\nchat_%s %llu\n", name, help, name, type, name, (unsigned long long) value);
+}
+
+/**
+ * @brief Ответ в формате Prometheus
+ *
+ * Гистограммы выводятся как summary с квантилями, время - в секундах
+ *
+ */
+static void admin_write_prometheus(FILE* out, const struct metrics_t* total) {
+    struct room_registry_t* rooms = admin.rooms;
+
+    fprintf(out, "# HELP chat_uptime_seconds Time since the server start\n# TYPE chat_uptime_seconds gauge\nchat_uptime_seconds %.3f\n",
+        (double) (metrics_now() - admin.started) / 1e9
+    );
+
+    admin_prometheus_value(out, "trace_sample", "One read in n is traced, 0 if tracing is off", "gauge", trace_sample);
+    admin_prometheus_value(out, "connections", "Admitted client connections", "gauge", (uint64_t) listener_connections());
+    admin_prometheus_value(out, "listen_overflows_total", "Listen queue overflows of the whole host", "counter", listener_overflows());
+    admin_prometheus_value(out, "clients", "Clients in rooms", "gauge", (uint64_t) atomic_load(&rooms->client_count));
+    admin_prometheus_value(out, "rooms", "Rooms in the registry", "gauge", (uint64_t) atomic_load(&rooms->room_count));
+    admin_prometheus_value(out, "names", "Registered client names", "gauge", (uint64_t) atomic_load(&rooms->names.count));
+    admin_prometheus_value(out, "backlog_bytes", "Bytes kept in room backlogs", "gauge", (uint64_t) atomic_load(&rooms->backlog_bytes));
+
+    for (int i = 0; i < METRICS_COUNTERS; i++) {
+        const struct admin_counter_t* counter = &admin_counters[i];
+
+        admin_prometheus_value(out, counter->name, counter->help, counter->gauge ? "gauge" : "counter", atomic_load_explicit(&total->counters[i], memory_order_relaxed));
+    }
+
+    for (int i = 0; i < METRICS_HISTOGRAMS; i++) {
+        const struct admin_histogram_t* description = &admin_histograms[i];
+        const struct metrics_histogram_t* histogram = &total->histograms[i];
+        double scale = description->timing ? 1e-9 : 1.0;
+        const char* unit = description->timing ? "_seconds" : "";
+
+        fprintf(out, "# HELP chat_%s%s %s\n# TYPE chat_%s%s summary\n", description->name, unit, description->help, description->name, unit);
+
+        for (size_t q = 0; q < sizeof(admin_quantiles) / sizeof(admin_quantiles[0]); q++) {
+            fprintf(out, "chat_%s%s{quantile=\"%g\"} %.9g\n", description->name, unit, admin_quantiles[q],
+                (double) metrics_quantile(histogram, admin_quantiles[q]) * scale
+            );
+        }
+
+        fprintf(out, "chat_%s%s_sum %.9g\nchat_%s%s_count %llu\n",
+            description->name, unit, (double) atomic_load_explicit(&histogram->sum, memory_order_relaxed) * scale,
+            description->name, unit, (unsigned long long) atomic_load_explicit(&histogram->count, memory_order_relaxed)
+        );
+    }
+
+    fprintf(out, "# HELP chat_pool_objects Objects of the memory pools\n# TYPE chat_pool_objects gauge\n");
+
+    object_pool_foreach(admin_pool_prometheus, out);
+}
+
+/**
+ * @brief Ответ текстом: счетчики с частотой с момента предыдущего текстового запроса
+ *
+ * Время в гистограммах - в микросекундах
+ *
+ */
+static void admin_write_text(FILE* out, const struct metrics_t* total) {
+    struct room_registry_t* rooms = admin.rooms;
+    uint64_t now = metrics_now();
+    double interval = (double) (now - admin.previous_time) / 1e9;
+
+    fprintf(out, "uptime %.1f s, rates over the last %.1f s, tracing one read in %u\n", (double) (now - admin.started) / 1e9, interval, trace_sample);
+    fprintf(out, "connections %d, host listen overflows %llu\n", listener_connections(), (unsigned long long) listener_overflows());
+    fprintf(out, "clients %d, rooms %d, names %d, backlog bytes %zu\n",
+        atomic_load(&rooms->client_count),
+        atomic_load(&rooms->room_count),
+        atomic_load(&rooms->names.count),
+        atomic_load(&rooms->backlog_bytes)
+    );
+
+    for (int i = 0; i < METRICS_COUNTERS; i++) {
+        const struct admin_counter_t* counter = &admin_counters[i];
+        uint64_t value = atomic_load_explicit(&total->counters[i], memory_order_relaxed);
+
+        if (counter->gauge) {
+            fprintf(out, "%s %llu\n", counter->name, (unsigned long long) value);
+        } else {
+            fprintf(out, "%s %llu (%.1f/s)\n", counter->name, (unsigned long long) value, interval > 0 ? (double) (value - admin.previous[i]) / interval : 0.0);
+        }
+
+        admin.previous[i] = value;
+    }
+
+    admin.previous_time = now;
+
+    for (int i = 0; i < METRICS_HISTOGRAMS; i++) {
+        const struct admin_histogram_t* description = &admin_histograms[i];
+        const struct metrics_histogram_t* histogram = &total->histograms[i];
+        double scale = description->timing ? 1e-3 : 1.0;
+        uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+
+        fprintf(out, "%s%s: count %llu, mean %.1f, p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n",
+            description->name, description->timing ? " us" : "",
+            (unsigned long long) count,
+            count ? (double) atomic_load_explicit(&histogram->sum, memory_order_relaxed) * scale / (double) count : 0.0,
+            (double) metrics_quantile(histogram, 0.5) * scale,
+            (double) metrics_quantile(histogram, 0.99) * scale,
+            (double) metrics_quantile(histogram, 0.999) * scale,
+            (double) atomic_load_explicit(&histogram->max, memory_order_relaxed) * scale
+        );
+    }
+
+    object_pool_foreach(admin_pool_text, out);
+}
+
+/**
+ * @brief Чтение необязательной строки команды
+ *
+ * Клиент, который ничего не отправил за ADMIN_READ_TIMEOUT_MS, получает текстовый ответ
+ *
+ */
+static void admin_read_command(int fd, char* command, size_t size) {
+    struct timeval timeout = {
+        .tv_sec = 0,
+        .tv_usec = ADMIN_READ_TIMEOUT_MS * 1000
+    };
+
+    size_t length = 0;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        perror("admin_read_command: setsockopt");
+    }
+
+    while (length < size - 1 && !memchr(command, '\n', length)) {
+        ssize_t count_of_bytes = recv(fd, command + length, size - 1 - length, 0);
+
+        if (count_of_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count_of_bytes <= 0) {
+            break;
+        }
+
+        length += count_of_bytes;
+    }
+
+    command[length] = '\0';
+    command[strcspn(command, "\r\n")] = '\0';
+}
+
+/**
+ * @brief Отправка ответа целиком
+ *
+ */
+static void admin_send(int fd, const char* data, size_t length) {
+
+    while (length > 0) {
+        ssize_t count_of_bytes = send(fd, data, length, MSG_NOSIGNAL);
+
+        if (count_of_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count_of_bytes <= 0) {
+            return;
+        }
+
+        data += count_of_bytes;
+        length -= count_of_bytes;
+    }
+
+}
+
+/**
+ * @brief Обслуживание одного подключения к сокету администратора
+ *
+ */
+static void admin_serve(int fd) {
+    char command[ADMIN_COMMAND_SIZE] = {0};
+    char* response = NULL;
+    size_t length = 0;
+
+    admin_read_command(fd, command, sizeof(command));
+
+    FILE* out = open_memstream(&response, &length);
+
+    if (!out) {
+        perror("admin_serve: open_memstream");
+
+        return;
+    }
+
+    struct metrics_t* total = calloc(1, sizeof(struct metrics_t));
+
+    if (!total) {
+        perror("admin_serve: calloc");
+
+        fclose(out);
+        free(response);
+
+        return;
+    }
+
+    metrics_collect(total);
+
+    if (strcmp(command, "prometheus") == 0 || strcmp(command, "metrics") == 0) {
+        admin_write_prometheus(out, total);
+    } else if (command[0] == '\0' || strcmp(command, "text") == 0) {
+        admin_write_text(out, total);
+    } else {
+        fprintf(out, "Unknown command: %s (text, metrics or prometheus)\n", command);
+    }
+
+    free(total);
+    fclose(out);
+
+    admin_send(fd, response, length);
+
+    free(response);
+}
+
+/**
+ * @brief Цикл потока администратора: подключения обслуживаются по одному
+ *
+ */
+static void* admin_loop(void* arg) {
+    (void) arg;
+
+    while (atomic_load(&admin.running)) {
+        int fd = accept4(admin.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+        if (fd < 0) {
+
+            if (errno != EINTR && errno != ECONNABORTED && atomic_load(&admin.running)) {
+                perror("admin_loop: accept4");
+            }
+
+            continue;
+        }
+
+        admin_serve(fd);
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int admin_start(const struct server_config_t* config, struct room_registry_t* rooms) {
+
+    if (!config->admin_path) {
+        return 0;
+    }
+
+    struct sockaddr_un address = {
+        .sun_family = AF_UNIX
+    };
+
+    strncpy(address.sun_path, config->admin_path, sizeof(address.sun_path) - 1);
+
+    struct stat status;
+
+    if (lstat(config->admin_path, &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(config->admin_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        perror("admin_start: socket");
+
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+        perror("admin_start: bind");
+
+        close(fd);
+
+        return -1;
+    }
+
+    if (chmod(config->admin_path, S_IRUSR | S_IWUSR) < 0) {
+        perror("admin_start: chmod");
+    }
+
+    if (listen(fd, config->listen_backlog) < 0) {
+        perror("admin_start: listen");
+
+        close(fd);
+        unlink(config->admin_path);
+
+        return -1;
+    }
+
+    admin.listen_fd = fd;
+    admin.path = config->admin_path;
+    admin.rooms = rooms;
+    admin.started = metrics_now();
+    admin.previous_time = admin.started;
+
+    atomic_store(&admin.running, 1);
+
+    if (pthread_create(&admin.thread, NULL, admin_loop, NULL) != 0) {
+        perror("admin_start: pthread_create");
+
+        atomic_store(&admin.running, 0);
+
+        close(fd);
+        unlink(config->admin_path);
+
+        admin.listen_fd = -1;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void admin_stop(void) {
+
+    if (admin.listen_fd < 0) {
+        return;
+    }
+
+    atomic_store(&admin.running, 0);
+
+    shutdown(admin.listen_fd, SHUT_RDWR);
+
+    pthread_join(admin.thread, NULL);
+
+    close(admin.listen_fd);
+    unlink(admin.path);
+
+    admin.listen_fd = -1;
+}
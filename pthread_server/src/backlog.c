@@ -0,0 +1,230 @@
+#include "../headers/backlog.h"
+#include "../headers/client_utils.h"
+#include "../headers/message.h"
+#include "../headers/metrics.h"
+
+int backlog_init(struct backlog_t* backlog, unsigned capacity) {
+    backlog->items = NULL;
+    backlog->capacity = capacity;
+    backlog->head = 0;
+    backlog->count = 0;
+    backlog->bytes = 0;
+    backlog->last_seq = 0;
+
+    if (capacity > 0) {
+        backlog->items = calloc(capacity, sizeof(struct message_t*));
+
+        if (!backlog->items) {
+            perror("backlog_init: calloc");
+
+            return -1;
+        }
+
+    }
+
+    pthread_mutex_init(&backlog->mutex, NULL);
+
+    return 0;
+}
+
+/**
+ * @brief Сообщение журнала по порядковому номеру от самого старого
+ *
+ */
+static struct message_t** backlog_at(struct backlog_t* backlog, unsigned index) {
+    return &backlog->items[(backlog->head + index) % backlog->capacity];
+}
+
+/**
+ * @brief Вытеснение самого старого сообщения
+ *
+ * @warning Вызывать под мьютексом журнала
+ */
+static void backlog_drop_oldest(struct backlog_t* backlog, atomic_size_t* total) {
+    struct message_t** item = backlog_at(backlog, 0);
+    struct message_t* message = *item;
+
+    *item = NULL;
+
+    backlog->head = (backlog->head + 1) % backlog->capacity;
+    backlog->count--;
+    backlog->bytes -= message->length;
+
+    atomic_fetch_sub_explicit(total, message->length, memory_order_relaxed);
+
+    message_unref(message);
+}
+
+void backlog_free(struct backlog_t* backlog, atomic_size_t* total) {
+
+    while (backlog->count > 0) {
+        backlog_drop_oldest(backlog, total);
+    }
+
+    free(backlog->items);
+
+    pthread_mutex_destroy(&backlog->mutex);
+}
+
+/**
+ * @brief Запись пронумерованного сообщения и вытеснение старых сообщений по лимитам
+ *
+ * @warning Вызывать под мьютексом журнала
+ */
+static void backlog_store(struct chat_t* chat, struct message_t* message) {
+    struct backlog_t* backlog = &chat->backlog;
+    struct room_registry_t* registry = chat->registry;
+
+    if (backlog->capacity == 0) {
+        return;
+    }
+
+    if (backlog->count == backlog->capacity) {
+        backlog_drop_oldest(backlog, &registry->backlog_bytes);
+    }
+
+    *backlog_at(backlog, backlog->count) = message_ref(message);
+
+    backlog->count++;
+    backlog->bytes += message->length;
+
+    size_t total = atomic_fetch_add_explicit(&registry->backlog_bytes, message->length, memory_order_relaxed) + message->length;
+
+    while (backlog->count > 0 && (backlog->bytes > registry->backlog.room_bytes || total > registry->backlog.total_bytes)) {
+        size_t length = (*backlog_at(backlog, 0))->length;
+
+        backlog_drop_oldest(backlog, &registry->backlog_bytes);
+
+        total -= length;
+    }
+
+}
+
+int backlog_append(struct chat_t* chat, struct message_t* message, backlog_callback prepare, void* arg) {
+    metrics_lock(&chat->backlog.mutex);
+
+    message->seq = chat->backlog.last_seq + 1;
+
+    if (prepare && prepare(message, arg) < 0) {
+        pthread_mutex_unlock(&chat->backlog.mutex);
+
+        return -1;
+    }
+
+    chat->backlog.last_seq = message->seq;
+
+    backlog_store(chat, message);
+
+    pthread_mutex_unlock(&chat->backlog.mutex);
+
+    return 0;
+}
+
+void backlog_restore(struct chat_t* chat, struct message_t* message) {
+    pthread_mutex_lock(&chat->backlog.mutex);
+
+    if (message->seq > chat->backlog.last_seq) {
+        chat->backlog.last_seq = message->seq;
+
+        backlog_store(chat, message);
+    }
+
+    pthread_mutex_unlock(&chat->backlog.mutex);
+}
+
+/**
+ * @brief Порядковый номер первого сообщения журнала для повтора
+ *
+ * @warning Вызывать под мьютексом журнала
+ */
+static unsigned backlog_first(struct chat_t* chat, uint64_t since) {
+    struct backlog_t* backlog = &chat->backlog;
+    unsigned first = 0;
+
+    if (since == BACKLOG_LAST) {
+        unsigned last = chat->registry->backlog.replay;
+
+        return backlog->count > last ? backlog->count - last : 0;
+    }
+
+    while (first < backlog->count && (*backlog_at(backlog, first))->seq < since) {
+        first++;
+    }
+
+    return first;
+}
+
+/**
+ * @brief Отправка сообщений журнала с first до конца под мьютексом журнала
+ *
+ * @return int 0 в случае успеха, -1 если клиент отключен
+ */
+static int backlog_send_locked(struct backlog_t* backlog, struct client_data_t* c_data, unsigned first) {
+
+    for (unsigned i = first; i < backlog->count; i++) {
+
+        if (client_send(c_data, *backlog_at(backlog, i)) < 0) {
+            return -1;
+        }
+
+    }
+
+    return 0;
+}
+
+void backlog_replay(struct chat_t* chat, struct client_data_t* c_data, uint64_t since) {
+    struct backlog_t* backlog = &chat->backlog;
+
+    metrics_lock(&backlog->mutex);
+
+    if (since == BACKLOG_NONE) {
+        return;
+    }
+
+    for (int round = 0; round < BACKLOG_REPLAY_ROUNDS; round++) {
+        unsigned first = backlog_first(chat, since);
+        unsigned count = backlog->count - first;
+
+        if (count == 0) {
+            return;
+        }
+
+        struct message_t** items = malloc(count * sizeof(struct message_t*));
+
+        if (!items) {
+            perror("backlog_replay: malloc");
+
+            break;
+        }
+
+        for (unsigned i = 0; i < count; i++) {
+            items[i] = message_ref(*backlog_at(backlog, first + i));
+        }
+
+        since = backlog->last_seq + 1;
+
+        pthread_mutex_unlock(&backlog->mutex);
+
+        int result = 0;
+
+        for (unsigned i = 0; i < count; i++) {
+
+            if (result == 0 && client_send(c_data, items[i]) < 0) {
+                result = -1;
+            }
+
+            message_unref(items[i]);
+        }
+
+        free(items);
+
+        metrics_lock(&backlog->mutex);
+
+        if (result < 0) {
+            return;
+        }
+
+    }
+
+    backlog_send_locked(backlog, c_data, backlog_first(chat, since));
+}
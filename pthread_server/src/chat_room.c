@@ -1,7 +1,11 @@
 #include "../headers/chat_room.h"
-#include "../headers/time_prefix.h"
+#include "../headers/backlog.h"
+#include "../headers/ebr.h"
+#include "../headers/logger.h"
+#include "../headers/metrics.h"
+#include "../headers/roster.h"
 
-struct chat_t* chat_init(void) {
+struct chat_t* chat_init(struct room_registry_t* registry, const char* name) {
     struct chat_t* chat = malloc(sizeof(struct chat_t));
 
     if (!chat) {
@@ -10,107 +14,226 @@ struct chat_t* chat_init(void) {
         return NULL;
     }
 
-    chat->head = NULL;
-    chat->client_count = 0;
+    chat->shards = calloc(registry->shard_count, sizeof(struct chat_shard_t));
 
-    pthread_mutex_init(&chat->mutex, NULL);
+    if (!chat->shards) {
+        perror("chat_init: calloc");
 
-    print_time_prefix();
-    printf("Chat has been initialized\n");
+        free(chat);
+
+        return NULL;
+    }
+
+    if (backlog_init(&chat->backlog, registry->backlog.capacity) < 0) {
+        free(chat->shards);
+        free(chat);
+
+        return NULL;
+    }
+
+    strncpy(chat->name, name, MAX_ROOM_NAME - 1);
+    chat->name[MAX_ROOM_NAME - 1] = '\0';
+
+    chat->registry = registry;
+    chat->next = NULL;
+    chat->linked = 0;
+    chat->shard_count = registry->shard_count;
+
+    atomic_init(&chat->refs, 1);
+    atomic_init(&chat->client_count, 0);
+
+    roster_init(&chat->roster);
+
+    for (int i = 0; i < chat->shard_count; i++) {
+        pthread_mutex_init(&chat->shards[i].mutex, NULL);
+        atomic_init(&chat->shards[i].snapshot, NULL);
+    }
+
+    log_printf(LOG_LEVEL_INFO, "Room #%s has been created", chat->name);
 
     return chat;
 }
 
+/**
+ * @brief Отложенное закрытие дескриптора
+ *
+ * Дескриптор закрывается после того, как ни один читатель не может держать снимок
+ * с этим клиентом: иначе номер мог бы достаться новому клиенту и получить чужие кадры
+ */
+static void client_close_retired(void* arg) {
+    close((int) (intptr_t) arg);
+}
+
+/**
+ * @brief Публикация нового снимка шарда и отложенное освобождение старого
+ *
+ * @warning Вызывать под мьютексом шарда
+ */
+static void shard_publish(struct chat_shard_t* shard, struct client_snapshot_t* snapshot) {
+    struct client_snapshot_t* old = atomic_exchange_explicit(&shard->snapshot, snapshot, memory_order_seq_cst);
+
+    if (old && ebr_retire(free, old) < 0) {
+        log_printf(LOG_LEVEL_ERROR, "Chat snapshot leaked: out of memory");
+    }
+
+}
+
 void chat_free(struct chat_t* chat) {
-    pthread_mutex_lock(&chat->mutex);
 
-    struct client_node_t* current = chat->head;
-    struct client_node_t* next;
+    for (int i = 0; i < chat->shard_count; i++) {
+        struct chat_shard_t* shard = &chat->shards[i];
+
+        pthread_mutex_lock(&shard->mutex);
 
-    while(current) {
-        next = current->next;
+        struct client_snapshot_t* snapshot = atomic_exchange(&shard->snapshot, NULL);
 
-        close(current->data.client_fd);
-        
-        free(current);
+        for (int j = 0; snapshot && j < snapshot->count; j++) {
+            close(snapshot->clients[j].data.client_fd);
+        }
+
+        free(snapshot);
 
-        current = next;
+        pthread_mutex_unlock(&shard->mutex);
+        pthread_mutex_destroy(&shard->mutex);
     }
 
-    pthread_mutex_unlock(&chat->mutex);
-    pthread_mutex_destroy(&chat->mutex);
+    backlog_free(&chat->backlog, &chat->registry->backlog_bytes);
+    roster_free(&chat->roster);
 
-    free(chat);
+    log_printf(LOG_LEVEL_INFO, "Room #%s has been removed", chat->name);
 
-    print_time_prefix();
-    printf("Chat has been free\n");
+    free(chat->shards);
+    free(chat);
 }
 
-int client_add_to_chat(struct chat_t* chat, struct client_data_t* c_data) {
-    pthread_mutex_lock(&chat->mutex);
+int client_add_to_chat(struct chat_t* chat, struct client_data_t* c_data, uint64_t since) {
+    struct room_registry_t* registry = chat->registry;
+    struct chat_shard_t* shard = &chat->shards[c_data->shard];
 
-    struct client_node_t* new_node = malloc(sizeof(struct client_node_t));
+    if (c_data->client_fd < 0 || c_data->client_fd >= registry->slot_count) {
+        fprintf(stderr, "client_add: fd %d is out of the client table\n", c_data->client_fd);
+
+        return -1;
+    }
 
-    if (!new_node) {
+    backlog_replay(chat, c_data, since);
+
+    metrics_lock(&shard->mutex);
+
+    struct client_snapshot_t* old = atomic_load_explicit(&shard->snapshot, memory_order_relaxed);
+    int count = old ? old->count : 0;
+
+    struct client_snapshot_t* snapshot = malloc(sizeof(struct client_snapshot_t) + (count + 1) * sizeof(struct client_node_t));
+
+    if (!snapshot) {
         perror("client_add: malloc");
 
+        pthread_mutex_unlock(&shard->mutex);
+        pthread_mutex_unlock(&chat->backlog.mutex);
+
         return -1;
     }
 
-    new_node->data = *c_data;
-    new_node->next = chat->head;
+    if (count > 0) {
+        memcpy(snapshot->clients, old->clients, count * sizeof(struct client_node_t));
+    }
+
+    snapshot->clients[count].data = *c_data;
+    snapshot->count = count + 1;
 
-    chat->head = new_node;
-    chat->client_count++;
+    registry->slots[c_data->client_fd].room = chat;
+    registry->slots[c_data->client_fd].shard = c_data->shard;
+    registry->slots[c_data->client_fd].index = count;
+    registry->slots[c_data->client_fd].replayed = chat->backlog.last_seq;
 
-    print_time_prefix();
-    printf("Client added: %s:%d [fd: %d]\n",
+    shard_publish(shard, snapshot);
+    roster_record(chat, c_data, 1);
+
+    atomic_fetch_add(&chat->client_count, 1);
+    atomic_fetch_add(&registry->client_count, 1);
+
+    log_printf(LOG_LEVEL_INFO, "Client added to #%s: %s:%d [fd: %d]",
+        chat->name,
         c_data->client_ip,
         c_data->client_port,
         c_data->client_fd
     );
 
-    pthread_mutex_unlock(&chat->mutex);
+    pthread_mutex_unlock(&shard->mutex);
+    pthread_mutex_unlock(&chat->backlog.mutex);
 
     return 0;
 }
 
-void client_remove_from_chat(struct chat_t* chat, int client_fd) {
-    pthread_mutex_lock(&chat->mutex);
+void client_remove_from_chat(struct chat_t* chat, struct client_data_t* c_data) {
+    struct room_registry_t* registry = chat->registry;
+    struct chat_shard_t* shard = &chat->shards[c_data->shard];
+    int fd = c_data->client_fd;
+
+    if (fd < 0 || fd >= registry->slot_count) {
+        return;
+    }
+
+    metrics_lock(&shard->mutex);
+
+    struct client_slot_t* slot = &registry->slots[fd];
+
+    if (slot->room != chat || slot->shard != c_data->shard) {
+        pthread_mutex_unlock(&shard->mutex);
 
-    struct client_node_t* prev = NULL;
-    struct client_node_t* current = chat->head;
+        return;
+    }
 
-    while (current) {
+    struct client_snapshot_t* old = atomic_load_explicit(&shard->snapshot, memory_order_relaxed);
+    struct client_snapshot_t* snapshot = NULL;
 
-        if (current->data.client_fd == client_fd) {
+    int index = slot->index;
+    int last = old->count - 1;
 
-            if (prev == NULL) {
-                chat->head = current->next;
-            } else {
-                prev->next = current->next;
-            }
+    log_printf(LOG_LEVEL_INFO, "Removing client from #%s: %s:%d [fd: %d]",
+        chat->name,
+        old->clients[index].data.client_ip,
+        old->clients[index].data.client_port,
+        fd
+    );
 
-            print_time_prefix();
-    
-            printf("Removing client: %s:%d [fd: %d]\n",
-                current->data.client_ip,
-                current->data.client_port,
-                current->data.client_fd
-            );
+    if (last > 0) {
+        snapshot = malloc(sizeof(struct client_snapshot_t) + last * sizeof(struct client_node_t));
 
-            close(current->data.client_fd);
-            
-            free(current);
+        if (!snapshot) {
+            perror("client_remove: malloc");
 
-            chat->client_count--;
+            pthread_mutex_unlock(&shard->mutex);
 
-            break;
+            return;
         }
 
-        prev = current;
-        current = current->next;
+        memcpy(snapshot->clients, old->clients, last * sizeof(struct client_node_t));
+
+        if (index != last) {
+            snapshot->clients[index] = old->clients[last];
+            registry->slots[snapshot->clients[index].data.client_fd].index = index;
+        }
+
+        snapshot->count = last;
+    }
+
+    slot->room = NULL;
+
+    shard_publish(shard, snapshot);
+    roster_record(chat, c_data, 0);
+
+    atomic_fetch_sub(&chat->client_count, 1);
+    atomic_fetch_sub(&registry->client_count, 1);
+
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void client_close_deferred(int fd) {
+    shutdown(fd, SHUT_RDWR);
+
+    if (ebr_retire(client_close_retired, (void*) (intptr_t) fd) < 0) {
+        close(fd);
     }
 
-    pthread_mutex_unlock(&chat->mutex);
-}
\ No newline at end of file
+}
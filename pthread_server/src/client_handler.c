@@ -1,208 +1,737 @@
 #include "../headers/client_handler.h"
+#include "../headers/backlog.h"
 #include "../headers/chat_room.h"
 #include "../headers/client_utils.h"
-#include "../headers/time_prefix.h"
+#include "../headers/frame.h"
+#include "../headers/listener.h"
+#include "../headers/logger.h"
+#include "../headers/message.h"
+#include "../headers/metrics.h"
+#include "../headers/name_index.h"
+#include "../headers/pool.h"
+#include "../headers/reactor.h"
+#include "../headers/room_registry.h"
+#include "../headers/roster.h"
+#include "../headers/scheduler.h"
+#include "../headers/store.h"
+#include "../headers/trace.h"
+#include "../headers/writer.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <poll.h>
+
+#define SESSION_BATCH           16
+#define SESSION_MAX_QUEUED      64
+
+static struct object_pool_t pthread_data_pool;
+static struct object_pool_t command_pool;
+static atomic_uint client_ids = 1;
 
 /**
- * @brief Получает имя от клиента либо указание об анонимности
- *  
- * @return int 0 в случае успеха, -1 при ошибке
+ * @brief Команда клиента режима потоков, ожидающая выполнения в пуле рабочих потоков
  */
-static int get_client_name(struct client_data_t* c_data) {
-    char name[MAX_NAME_LENGTH] = {0};
-
-    ssize_t count_of_bytes = recv(c_data->client_fd, name, MAX_NAME_LENGTH - 1, 0);
+struct command_task_t {
+    struct command_task_t* next;            ///< Следующая команда того же клиента
+    struct message_t* frame;                ///< Копия нагрузки кадра вместе с завершающим '\0'
+};
 
-    if (count_of_bytes <= 0) {
-            
-        if (count_of_bytes == 0) {
-            print_time_prefix();
-            printf("Client %s:%d disconnected\n", c_data->client_ip, c_data->client_port);
-        } else {
-            perror("getting_name: recv");
-        }
+int client_handler_pool_init(size_t preallocate) {
 
+    if (object_pool_init(&command_pool, "commands", sizeof(struct command_task_t), preallocate) < 0) {
         return -1;
     }
 
-    if (strcmp(name, "!anonim") == 0) {
-        strncpy(c_data->client_name, "ANONIM", MAX_NAME_LENGTH);
+    return object_pool_init(&pthread_data_pool, "thread data", sizeof(struct pthread_data_t), preallocate);
+}
+
+struct pthread_data_t* pthread_data_create(struct room_registry_t* rooms, const struct rate_limits_t* limits, struct client_data_t* c_data) {
+    struct pthread_data_t* p_data = object_pool_alloc(&pthread_data_pool);
+
+    if (!p_data) {
+        return NULL;
+    }
+
+    p_data->rooms = rooms;
+    p_data->limits = limits;
+    p_data->client_data = *c_data;
+
+    return p_data;
+}
+
+void pthread_data_free(struct pthread_data_t* p_data) {
+    object_pool_free(&pthread_data_pool, p_data);
+}
+
+/**
+ * @brief Состояние клиента в режиме потоков между кадрами
+ *
+ * Поток клиента только читает сокет, проверяет ограничение частоты и ставит команды
+ * в очередь session. Команды выполняет пул рабочих потоков: у сессии одна задача,
+ * и пока она стоит в пуле или выполняется (scheduled), новые команды лишь дописываются
+ * в очередь. Поэтому команды клиента выполняются по одной и в порядке получения
+ */
+struct session_t {
+    struct room_registry_t* rooms;          ///< Реестр комнат
+    struct client_data_t* c_data;           ///< Данные клиента
+    const struct rate_limits_t* limits;     ///< Ограничения частоты кадров
+    struct throttle_t throttle;             ///< Корзины токенов клиента
+    int joined;                             ///< Имя получено, клиент добавлен в чат
+    int client_cycle;                       ///< Сбрасывается в 0, если клиента нужно отключить
+    struct task_t task;                     ///< Задача выполнения команд клиента в пуле
+    pthread_mutex_t lock;                   ///< Защищает очередь команд, queued и scheduled
+    pthread_cond_t idle;                    ///< Очередь укоротилась или задача сессии завершилась
+    struct command_task_t* head;            ///< Очередь команд в порядке получения
+    struct command_task_t* tail;            ///< Конец очереди команд
+    unsigned queued;                        ///< Команд в очереди
+    int scheduled;                          ///< Задача сессии стоит в пуле или выполняется
+    atomic_int closed;                      ///< Команда отключила клиента, остальные команды выбрасываются
+};
+
+/**
+ * @brief Отправка кадра всем участникам комнаты
+ * 
+ * Кадр кодируется один раз, получатели хранят ссылки на него.
+ * Клиенты реактора рассылают сообщение через свой рабочий поток,
+ * клиенты режима потоков обходят все шарды сами
+ * 
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int client_broadcast(struct chat_t* chat, struct client_data_t* sender, struct message_t* message) {
+    uint64_t start = trace_active() ? metrics_now() : 0;
+    int result = 0;
+
+    metrics_add(METRICS_BROADCASTS, 1);
 
-        print_time_prefix();
-        printf("Client %s:%d has chosen to reamain anonymous: <%s>\n", c_data->client_ip, c_data->client_port, c_data->client_name);
+    if (start) {
+        metrics_record(METRICS_FANOUT, atomic_load_explicit(&chat->client_count, memory_order_relaxed));
+    }
+
+    if (sender->conn) {
+        result = reactor_broadcast(sender->conn, chat, message);
     } else {
-        name[count_of_bytes] = '\0';
-        strncpy(c_data->client_name, name, MAX_NAME_LENGTH);
-        
-        print_time_prefix();
-        printf("Client %s:%d has chosen the name: <%s>\n", c_data->client_ip, c_data->client_port, c_data->client_name);
+        struct broadcast_callback_data_t data = {
+            .message = message
+        };
+
+        result = foreach_client_expect(chat, sender->client_fd, broadcast_callback, &data) < 0 ? -1 : 0;
     }
 
-    return 0;
+    if (start) {
+        uint64_t now = metrics_now();
+
+        metrics_record(METRICS_BROADCAST, now - start);
+        metrics_record(METRICS_DELIVERY, now - trace_self.start);
+    }
+
+    TRACE_PROBE2(deliver, message->seq, sender->shard);
+
+    return result;
 }
 
 /**
- * @brief Отправка сообщения всем участникам чата
+ * @brief Отправка клиенту служебного сообщения
+ * 
+ * Забирает ссылку на сообщение
  * 
+ * @param message Сообщение от message_printf(), NULL считается ошибкой
  * @return int 0 в случае успеха, -1 при ошибке
  */
-static int client_broadcast(struct chat_t* chat, int sender_fd, char* message, size_t length) {
-    pthread_mutex_lock(&chat->mutex);
+static int client_reply(struct client_data_t* c_data, struct message_t* message) {
 
-    struct broadcast_callback_data_t data = {
-        .message = message,
-        .length = length
-    };
+    if (!message) {
+        return -1;
+    }
+
+    int result = client_send(c_data, message);
+
+    message_unref(message);
+
+    return result < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Сохраняет имя, полученное от клиента при подключении, и регистрирует его в индексе имен
+ * 
+ * "!anonim" заменяется на "ANONIM", слишком длинное имя обрезается. Анонимные клиенты
+ * и клиенты с пустым именем не регистрируются и не получают личных сообщений, имя "ANONIM" занято.
+ * Если имя занято, клиенту отправляется ответ, и он может прислать другое имя
+ * 
+ * @param name Полученные байты имени, не обязательно завершенные '\0'
+ * @return int 0 в случае успеха, 1 если имя занято, -1 при ошибке
+ */
+static int set_client_name(struct room_registry_t* rooms, struct client_data_t* c_data, const char* name, size_t length) {
+
+    if (length >= MAX_NAME_LENGTH) {
+        length = MAX_NAME_LENGTH - 1;
+    }
+
+    if (length == strlen("!anonim") && strncmp(name, "!anonim", length) == 0) {
+        strncpy(c_data->client_name, "ANONIM", MAX_NAME_LENGTH);
+
+        log_printf(LOG_LEVEL_INFO, "Client %s:%d has chosen to reamain anonymous: <%s>", c_data->client_ip, c_data->client_port, c_data->client_name);
+
+        return 0;
+    }
+
+    memcpy(c_data->client_name, name, length);
+    c_data->client_name[length] = '\0';
 
-    if (foreach_client_expect(chat, sender_fd, broadcast_callback, &data) < 0) {
-        pthread_mutex_unlock(&chat->mutex);        
+    int result = strcmp(c_data->client_name, "ANONIM") == 0 ? 1 : 0;
 
+    if (result == 0 && length > 0) {
+        result = name_index_add(&rooms->names, c_data);
+    }
+
+    if (result < 0) {
         return -1;
     }
 
-    pthread_mutex_unlock(&chat->mutex);
+    if (result > 0) {
+        log_printf(LOG_LEVEL_INFO, "Client %s:%d has chosen a taken name: <%s>", c_data->client_ip, c_data->client_port, c_data->client_name);
+
+        return client_reply(c_data, message_printf("Name <%s> is already taken, send another name", c_data->client_name)) < 0 ? -1 : 1;
+    }
+
+    log_printf(LOG_LEVEL_INFO, "Client %s:%d has chosen the name: <%s>", c_data->client_ip, c_data->client_port, c_data->client_name);
 
     return 0;
 }
 
+int client_handshake(struct room_registry_t* rooms, struct client_data_t* c_data, const char* payload, size_t length) {
+    struct protocol_command_t command;
+
+    if (c_data->client_id == 0) {
+        c_data->client_id = atomic_fetch_add_explicit(&client_ids, 1, memory_order_relaxed);
+    }
+
+    if (c_data->protocol == 0) {
+        int version = protocol_hello_negotiate(payload, length);
+
+        if (version < 0) {
+            return set_client_name(rooms, c_data, payload, strnlen(payload, length));
+        }
+
+        char chosen = (char) version;
+
+        if (client_reply(c_data, message_event(PROTOCOL_OP_HELLO, c_data->client_id, NULL, 0, &chosen, 1)) < 0) {
+            return -1;
+        }
+
+        c_data->protocol = version;
+
+        log_printf(LOG_LEVEL_DEBUG, "Client %s:%d negotiated protocol version %d", c_data->client_ip, c_data->client_port, version);
+
+        return 1;
+    }
+
+    if (protocol_command_decode(payload, length, &command) < 0 || command.opcode != PROTOCOL_OP_NAME) {
+        return client_reply(c_data, message_printf("Send your name first")) < 0 ? -1 : 1;
+    }
+
+    return set_client_name(rooms, c_data, command.target, command.target_length);
+}
+
+uint32_t client_id_next(void) {
+    return atomic_load_explicit(&client_ids, memory_order_relaxed);
+}
+
+void client_id_restore(uint32_t next) {
+    unsigned current = atomic_load_explicit(&client_ids, memory_order_relaxed);
+
+    while (next > current && !atomic_compare_exchange_weak_explicit(&client_ids, &current, next, memory_order_relaxed, memory_order_relaxed)) {
+    }
+
+}
+
 /**
- * @brief Уведомление всех учатников чата
+ * @brief Уведомление всех учатников комнаты
  * 
- * Либо о присоединении клиента к чату, либо о выходе клиента из чата
+ * Либо о присоединении клиента к комнате, либо о выходе клиента из комнаты
  * 
  * @return int 0 в случае успеха, -1 при ошибке
  */
-static int notify_all_clients(struct chat_t* chat, int sender_fd, char* name, enum notify_type notification) { 
-    char message[BUFFER_SIZE] = {0};
+static int notify_all_clients(struct chat_t* chat, struct client_data_t* c_data, enum notify_type notification) { 
+    struct message_t* message = NULL;
 
     switch (notification) {
         case JOIN:
-            snprintf(message, BUFFER_SIZE, "<%s> joined the chat!", name);    
+            message = message_printf("<%s> joined #%s!", c_data->client_name, chat->name);    
 
             break;
     
         case LEFT:
-            snprintf(message, BUFFER_SIZE, "<%s> left the chat!", name);
+            message = message_printf("<%s> left #%s!", c_data->client_name, chat->name);
 
             break;
     }
 
-    if (client_broadcast(chat, sender_fd, message, strlen(message)) < 0) {
+    if (!message) {
         return -1;
     }
 
-    return 0;
+    if (message_attach_event(message, notification, c_data, chat->name, strlen(chat->name)) < 0) {
+        message_unref(message);
+
+        return -1;
+    }
+
+    int result = client_broadcast(chat, c_data, message);
+
+    message_unref(message);
+
+    return result < 0 ? -1 : 0;
 }
 
 /**
- * @brief Отправка клиенту списка всех учатников чата 
+ * @brief Отправка кадра, собранного в буфере после заголовка
  * 
- * Собирает список имен и отправляет клиенту
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int send_built_frame(struct client_data_t* c_data, char* frame, int offset) {
+    frame_set_header(frame, offset);
+
+    return client_reply(c_data, message_create(frame, FRAME_HEADER_SIZE + offset));
+}
+
+/**
+ * @brief Отправка клиенту списка учатников его комнаты
+ * 
+ * PROTOCOL_LIST_ALL - все страницы списка, PROTOCOL_LIST_PAGE - одна страница,
+ * PROTOCOL_LIST_SINCE - только изменения состава после поколения number
  * 
  * @return int 0 в случае успеха, -1 при ошибке
  */
-static int send_client_list(struct chat_t* chat, int fd) {
-    pthread_mutex_lock(&chat->mutex);
-    
-    char list_of_clients[BUFFER_SIZE] = {0};
+static int send_client_list(struct client_data_t* c_data, const struct protocol_command_t* command) {
+    struct chat_t* chat = c_data->room;
+
+    switch (command->list_mode) {
+        case PROTOCOL_LIST_ALL:
+            return roster_send(chat, c_data, ROSTER_ALL_PAGES);
+
+        case PROTOCOL_LIST_PAGE:
+
+            if (command->number > 0 && command->number <= INT32_MAX) {
+                return roster_send(chat, c_data, (int) command->number);
+            }
+
+            break;
+
+        case PROTOCOL_LIST_SINCE:
+            return roster_send_delta(chat, c_data, command->number);
+    }
+
+    return client_reply(c_data, message_printf("Usage: !list, !list page <n> or !list since <generation>"));
+}
+
+/**
+ * @brief Отправка клиенту списка комнат с количеством участников
+ * 
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int send_room_list(struct room_registry_t* rooms, struct client_data_t* c_data) {
+    char frame[FRAME_HEADER_SIZE + BUFFER_SIZE] = {0};
+    char* list_of_rooms = frame + FRAME_HEADER_SIZE;
     int offset = 0;
 
-    offset += snprintf(list_of_clients, BUFFER_SIZE, "Online (%d and YOU): ", chat->client_count - 1);
-    
+    offset += snprintf(list_of_rooms, BUFFER_SIZE, "Rooms (%d): ", atomic_load(&rooms->room_count));
+
     struct client_list_callback_data_t data = {
         .offset = &offset,
-        .list_of_clients = list_of_clients
+        .list_of_clients = list_of_rooms
     };
 
-    if (foreach_client_expect(chat, fd, client_list_callback, &data) < 0) {
-        pthread_mutex_unlock(&chat->mutex);
-
+    if (foreach_room(rooms, room_list_callback, &data) < 0) {
         return -1;
     }
 
-    if (offset > 0 && list_of_clients[offset - 2] == ',') {
-        list_of_clients[offset - 2] = '\0';
+    if (offset >= 2 && list_of_rooms[offset - 2] == ',') {
+        offset -= 2;
+        list_of_rooms[offset] = '\0';
+    }
+
+    return send_built_frame(c_data, frame, offset);
+}
+
+/**
+ * @brief Переход клиента в комнату
+ * 
+ * Ошибки в имени комнаты и превышение MAX_ROOMS сообщаются клиенту, клиент остается в своей комнате
+ * 
+ * @param command Имя комнаты в target и номер сообщения, с которого повторить журнал, в number
+ * @return int 0 в случае успеха, -1 если клиента нужно отключить
+ */
+static int client_switch_room(struct room_registry_t* rooms, struct client_data_t* c_data, const struct protocol_command_t* command) {
+    const char* target = command->target;
+    size_t length = command->target_length;
+    char name[MAX_ROOM_NAME] = {0};
+
+    if (length > 0 && *target == '#') {
+        target++;
+        length--;
     }
 
-    pthread_mutex_unlock(&chat->mutex);
+    if (length < MAX_ROOM_NAME) {
+        memcpy(name, target, length);
+    }
 
-    if (offset == 0) {
-        strncpy(list_of_clients, "No other clients online", BUFFER_SIZE - 1);
+    if (!room_name_valid(name)) {
+        return client_reply(c_data, message_printf("Incorrect room name: letters, digits, '-' and '_', up to %d characters", MAX_ROOM_NAME - 1));
+    }
 
-        offset = strlen(list_of_clients);
+    if (c_data->room && strcmp(c_data->room->name, name) == 0) {
+        return client_reply(c_data, message_printf("You are already in #%s", name));
     }
 
-    ssize_t count_of_bytes = send(fd, list_of_clients, offset, 0);
+    struct chat_t* room = room_acquire(rooms, name);
+
+    if (!room) {
+        return client_reply(c_data, message_printf("Room #%s cannot be created: too many rooms", name));
+    }
 
-    if (count_of_bytes <= 0) {
-        perror("send_client_list: send");
+    client_leave_chat(c_data);
 
+    if (client_join_chat(room, c_data, command->number) < 0) {
         return -1;
     }
 
-    print_time_prefix();
-    printf("Client list has been sent\n");
+    return client_reply(c_data, message_printf("You joined #%s (%d online, last message #%llu)",
+        room->name,
+        atomic_load(&room->client_count),
+        (unsigned long long) rooms->slots[c_data->client_fd].replayed
+    ));
+}
 
-    return 0;
+/**
+ * @brief Отправка личного сообщения клиенту по имени
+ * 
+ * Отправителю отвечают только при ошибке: получателя нет или команда без текста
+ * 
+ * @param command Имя получателя в target и текст в text
+ * @return int 0 в случае успеха, -1 если клиента нужно отключить
+ */
+static int client_direct_message(struct room_registry_t* rooms, struct client_data_t* c_data, const struct protocol_command_t* command) {
+    char target[MAX_NAME_LENGTH] = {0};
+
+    if (command->target_length == 0 || command->text_length == 0) {
+        return client_reply(c_data, message_printf("Usage: !msg <name> <text>"));
+    }
+
+    if (command->target_length >= MAX_NAME_LENGTH) {
+        return client_reply(c_data, message_printf("No client named <%.*s>", (int) command->target_length, command->target));
+    }
+
+    memcpy(target, command->target, command->target_length);
+
+    log_printf(LOG_LEVEL_DEBUG, "Client <%s> %s:%d to <%s>: %.*s", c_data->client_name, c_data->client_ip, c_data->client_port, target, (int) command->text_length, command->text);
+
+    struct message_t* message = message_format(MAX_FRAME_PAYLOAD, "[DM] <%s>: %.*s", c_data->client_name, (int) command->text_length, command->text);
+
+    if (!message) {
+        return -1;
+    }
+
+    if (message_attach_event(message, CMD_DIRECT, c_data, command->text, command->text_length) < 0) {
+        message_unref(message);
+
+        return -1;
+    }
+
+    int result = client_send_direct(rooms, c_data, target, message);
+
+    message_unref(message);
+
+    if (result > 0) {
+        return client_reply(c_data, message_printf("No client named <%s>", target));
+    }
+
+    return result;
 }
 
 /**
- * @brief Обработчик команд клиента 
+ * @brief Пропуск пробелов
+ *
+ */
+static const char* skip_spaces(const char* text) {
+
+    while (*text == ' ') {
+        text++;
+    }
+
+    return text;
+}
+
+/**
+ * @brief Разбор команды текстового протокола
+ * 
+ * Команды: !quit, !list [page <n> | since <generation>], !join <room> [seq], !leave, !rooms, !msg <name> <text>,
+ * остальное - сообщение в комнату клиента. Неизвестные аргументы !list дают режим UINT8_MAX
  * 
- * @return enum commands CMD_QUIT - клиент хочет выйти из чата, 
- *                       CMD_LIST - клиент хочет список участников чата
- *                       CMD_MESSAGE - клиент отправил обычное сообщение
+ * @param buffer Кадр клиента, завершенный '\0'
+ * @return int 0 если команда разобрана, 1 если клиенту отправлена подсказка, -1 при ошибке
  */
-static enum commands command_handler(struct client_data_t* c_data, char* buffer) {
-    
+static int command_parse_text(struct client_data_t* c_data, const char* buffer, struct protocol_command_t* command) {
+    unsigned long long number = 0;
+    char tail = '\0';
+
+    memset(command, 0, sizeof(*command));
+
     if (strcmp(buffer, "!quit") == 0) {
-        print_time_prefix();
-        printf("Client %s:%d <%s> requested disconnect\n", c_data->client_ip, c_data->client_port, c_data->client_name);
+        command->opcode = CMD_QUIT;
+
+        return 0;
+    }
+
+    if (strcmp(buffer, "!list") == 0 || strncmp(buffer, "!list ", strlen("!list ")) == 0) {
+        const char* argument = skip_spaces(buffer + strlen("!list"));
+
+        command->opcode = CMD_LIST;
+        command->list_mode = UINT8_MAX;
+
+        if (*argument == '\0') {
+            command->list_mode = PROTOCOL_LIST_ALL;
+        } else if (sscanf(argument, "page %llu%c", &number, &tail) == 1) {
+            command->list_mode = PROTOCOL_LIST_PAGE;
+        } else if (sscanf(argument, "since %llu%c", &number, &tail) == 1) {
+            command->list_mode = PROTOCOL_LIST_SINCE;
+        }
+
+        command->number = number;
+
+        return 0;
+    }
+
+    if (strncmp(buffer, "!join ", strlen("!join ")) == 0) {
+        const char* argument = skip_spaces(buffer + strlen("!join "));
+        const char* space = strchr(argument, ' ');
+
+        command->opcode = CMD_JOIN;
+        command->target = argument;
+        command->target_length = space ? (size_t) (space - argument) : strlen(argument);
+        command->number = BACKLOG_LAST;
+
+        const char* seq = space ? skip_spaces(space) : "";
+
+        if (*seq) {
+            char* end = NULL;
+
+            command->number = strtoull(seq, &end, 10);
+
+            if (*end != '\0' || command->number == 0) {
+                return client_reply(c_data, message_printf("Incorrect message number: %s", seq)) < 0 ? -1 : 1;
+            }
+
+        }
+
+        return 0;
+    }
+
+    if (strncmp(buffer, "!msg ", strlen("!msg ")) == 0) {
+        const char* argument = skip_spaces(buffer + strlen("!msg "));
+        const char* space = strchr(argument, ' ');
+
+        command->opcode = CMD_DIRECT;
+        command->target = argument;
+        command->target_length = space ? (size_t) (space - argument) : strlen(argument);
+        command->text = space ? skip_spaces(space) : "";
+        command->text_length = strlen(command->text);
+
+        return 0;
+    }
 
-        return CMD_QUIT;
+    if (strcmp(buffer, "!leave") == 0) {
+        command->opcode = CMD_LEAVE;
+
+        return 0;
     }
 
-    if (strcmp(buffer, "!list") == 0) {
-        print_time_prefix();
-        printf("Client %s:%d requested a list of clients\n", c_data->client_ip, c_data->client_port);
+    if (strcmp(buffer, "!rooms") == 0) {
+        command->opcode = CMD_ROOMS;
 
-        return CMD_LIST;
+        return 0;
     }
 
-    return CMD_MESSAGE;
+    command->opcode = CMD_MESSAGE;
+    command->text = buffer;
+    command->text_length = strlen(buffer);
+
+    return 0;
+}
+
+/**
+ * @brief Сообщение комнаты, событие которого собирается под мьютексом журнала
+ */
+struct chat_event_t {
+    const struct client_data_t* sender;     ///< Отправитель
+    const struct protocol_command_t* command; ///< Команда с текстом сообщения
+};
+
+/**
+ * @brief Прикрепление события к сообщению комнаты, получившему номер
+ *
+ * Вызывается из backlog_append(): повтор журнала и хранилище видят сообщение уже с событием
+ *
+ */
+static int chat_event_attach(struct message_t* message, void* arg) {
+    struct chat_event_t* event = arg;
+
+    return message_attach_event(message, CMD_MESSAGE, event->sender, event->command->text, event->command->text_length);
 }
 
 /**
- * @brief Выполнение полученной от клиента команды
+ * @brief Обработчик команд клиента 
  * 
- * @return int 0 в случае успеха, -1 при ошибке
+ * Кадры клиентов двоичного протокола разбираются по коду операции без сравнения строк,
+ * кадры текстовых клиентов - command_parse_text()
+ * 
+ * @param buffer Кадр клиента, завершенный '\0'
+ * @return int 0 если команда разобрана, 1 если кадр отклонен с ответом клиенту, -1 при ошибке
  */
-static int executing_clients_command(struct chat_t* chat, struct client_data_t* c_data, char* buffer, int* client_cycle) {
-    enum commands cmd = command_handler(c_data, buffer);
+static int command_handler(struct client_data_t* c_data, const char* buffer, size_t length, struct protocol_command_t* command) {
+
+    if (c_data->protocol == 0) {
+        return command_parse_text(c_data, buffer, command);
+    }
+
+    if (protocol_command_decode(buffer, length, command) < 0 || command->opcode == PROTOCOL_OP_NAME) {
+        log_printf(LOG_LEVEL_WARN, "Client %s:%d <%s> sent a malformed command", c_data->client_ip, c_data->client_port, c_data->client_name);
+
+        return client_reply(c_data, message_printf("Malformed command")) < 0 ? -1 : 1;
+    }
+
+    return 0;
+}
+
+int client_throttle(struct client_data_t* c_data, struct throttle_t* throttle, const struct rate_limits_t* limits, size_t length, uint64_t now) {
+
+    switch (throttle_admit(throttle, limits, length, now)) {
+        case THROTTLE_PASS:
+            return 1;
+
+        case THROTTLE_NOTIFY:
+            log_printf(LOG_LEVEL_WARN, "Client %s:%d <%s> is flooding, dropping messages", c_data->client_ip, c_data->client_port, c_data->client_name);
+
+            return client_reply(c_data, message_printf("You are sending too fast: messages are dropped until you slow down")) < 0 ? -1 : 0;
+
+        case THROTTLE_DROP:
+            return 0;
+
+        default:
+            log_printf(LOG_LEVEL_WARN, "Client %s:%d <%s> keeps flooding, disconnecting", c_data->client_ip, c_data->client_port, c_data->client_name);
+
+            client_reply(c_data, message_printf("Disconnected for flooding"));
+
+            return -1;
+    }
+
+}
+
+int executing_clients_command(struct room_registry_t* rooms, struct client_data_t* c_data, char* buffer, size_t length, int* client_cycle) {
+    struct protocol_command_t command;
+    int parsed = command_handler(c_data, buffer, length, &command);
+
+    trace_stage(METRICS_PARSE);
+
+    TRACE_PROBE2(parse, c_data->client_fd, command.opcode);
+
+    if (parsed != 0) {
+        *client_cycle = parsed > 0;
+
+        return 0;
+    }
 
-    char message[BUFFER_SIZE] = {0};
+    struct message_t* message = NULL;
+    int result = 0;
 
-    switch (cmd) {
+    switch ((enum commands) command.opcode) {
         case CMD_QUIT:
+            log_printf(LOG_LEVEL_INFO, "Client %s:%d <%s> requested disconnect", c_data->client_ip, c_data->client_port, c_data->client_name);
+
             *client_cycle = 0;
 
             return 0;
 
         case CMD_LIST:
+            log_printf(LOG_LEVEL_DEBUG, "Client %s:%d requested a list of clients", c_data->client_ip, c_data->client_port);
+            
+            if (send_client_list(c_data, &command) < 0) {
+                *client_cycle = 0;
+            }
+
+            return 0;
+
+        case CMD_JOIN:
+            
+            if (client_switch_room(rooms, c_data, &command) < 0) {
+                *client_cycle = 0;
+            }
+
+            return 0;
+
+        case CMD_LEAVE:
+            command.target = DEFAULT_ROOM;
+            command.target_length = strlen(DEFAULT_ROOM);
+            command.number = BACKLOG_LAST;
             
-            if (send_client_list(chat, c_data->client_fd)) {
+            if (client_switch_room(rooms, c_data, &command) < 0) {
+                *client_cycle = 0;
+            }
+
+            return 0;
+
+        case CMD_ROOMS:
+            
+            if (send_room_list(rooms, c_data) < 0) {
+                *client_cycle = 0;
+            }
+
+            return 0;
+
+        case CMD_DIRECT:
+            
+            if (client_direct_message(rooms, c_data, &command) < 0) {
                 *client_cycle = 0;
             }
 
             return 0;
         
         case CMD_MESSAGE:
-            print_time_prefix();
-            printf("Client <%s> %s:%d: %s\n", c_data->client_name, c_data->client_ip, c_data->client_port, buffer);
+            log_printf(LOG_LEVEL_DEBUG, "Client <%s> %s:%d in #%s: %.*s", c_data->client_name, c_data->client_ip, c_data->client_port, c_data->room->name, (int) command.text_length, command.text);
+
+            message = message_format(MAX_FRAME_PAYLOAD, "<%s>: %.*s", c_data->client_name, (int) command.text_length, command.text);
+
+            if (!message) {
+                *client_cycle = 0;
+
+                return 0;
+            }
+
+            message->traced = trace_origin();
+
+            struct chat_event_t event = {
+                .sender = c_data,
+                .command = &command
+            };
+
+            if (backlog_append(c_data->room, message, chat_event_attach, &event) < 0) {
+                message_unref(message);
+
+                *client_cycle = 0;
+
+                return 0;
+            }
+
+            store_append(c_data->room, message);
+
+            trace_stage(METRICS_ENQUEUE);
+
+            TRACE_PROBE2(enqueue, c_data->client_fd, message->seq);
 
-            snprintf(message, BUFFER_SIZE, "<%s>: %s", c_data->client_name, buffer);
+            result = client_broadcast(c_data->room, c_data, message);
+
+            message_unref(message);
         
-            if (client_broadcast(chat, c_data->client_fd, message, strlen(message))) {
+            if (result < 0) {
                 *client_cycle = 0;
             }
 
@@ -215,65 +744,355 @@ static int executing_clients_command(struct chat_t* chat, struct client_data_t*
     
 }
 
-void* clients_handler(void* arg) {
-    struct pthread_data_t* p_data = (struct pthread_data_t*) arg;
-    struct chat_t* chat = p_data->chat;
-    struct client_data_t c_data = p_data->client_data;
+int client_join_chat(struct chat_t* chat, struct client_data_t* c_data, uint64_t since) {
+    c_data->room = chat;
 
-    free(p_data);
+    if (client_add_to_chat(chat, c_data, since) < 0) {
+        c_data->room = NULL;
 
-    char buffer[BUFFER_SIZE] = {0};
+        room_release(chat);
 
-    if (get_client_name(&c_data) < 0) {
-        return NULL;
+        return -1;
     }
 
-    if (client_add_to_chat(chat, &c_data) < 0) {
-        return NULL;
+    if (notify_all_clients(chat, c_data, JOIN) < 0) {
+        client_remove_from_chat(chat, c_data);
+
+        c_data->room = NULL;
+
+        room_release(chat);
+
+        return -1;
     }
 
-    if (notify_all_clients(chat, c_data.client_fd, c_data.client_name, JOIN) < 0) {
-        client_remove_from_chat(chat, c_data.client_fd);
+    return 0;
+}
 
-        return NULL;
+void client_leave_chat(struct client_data_t* c_data) {
+    struct chat_t* chat = c_data->room;
+
+    if (!chat) {
+        return;
+    }
+
+    notify_all_clients(chat, c_data, LEFT);
+
+    client_remove_from_chat(chat, c_data);
+
+    c_data->room = NULL;
+
+    room_release(chat);
+}
+
+/**
+ * @brief Выполнение одной команды клиента в рабочем потоке пула
+ *
+ * Если команда отключает клиента, чтение сокета останавливается через shutdown():
+ * поток клиента выходит из recv() и закрывает соединение
+ *
+ */
+static void session_execute(struct session_t* session, struct command_task_t* command) {
+
+    if (!atomic_load(&session->closed)) {
+        int client_cycle = 1;
+
+        if (executing_clients_command(session->rooms, session->c_data, command->frame->data, command->frame->length - 1, &client_cycle) < 0 || !client_cycle) {
+            atomic_store(&session->closed, 1);
+
+            shutdown(session->c_data->client_fd, SHUT_RD);
+        }
+
+    }
+
+    message_unref(command->frame);
+
+    object_pool_free(&command_pool, command);
+}
+
+/**
+ * @brief Задача сессии: выполняет до SESSION_BATCH команд клиента
+ *
+ * Если команды остались, задача ставится в пул заново, в дек текущего рабочего потока:
+ * один болтливый клиент не занимает поток надолго, а простаивающие потоки могут забрать его
+ *
+ */
+static void session_run(struct task_t* task) {
+    struct session_t* session = (struct session_t*) ((char*) task - offsetof(struct session_t, task));
+
+    for (int i = 0; i < SESSION_BATCH; i++) {
+        pthread_mutex_lock(&session->lock);
+
+        struct command_task_t* command = session->head;
+
+        if (!command) {
+            session->scheduled = 0;
+
+            pthread_cond_broadcast(&session->idle);
+            pthread_mutex_unlock(&session->lock);
+
+            return;
+        }
+
+        session->head = command->next;
+
+        if (!session->head) {
+            session->tail = NULL;
+        }
+
+        if (session->queued-- == SESSION_MAX_QUEUED) {
+            pthread_cond_broadcast(&session->idle);
+        }
+
+        pthread_mutex_unlock(&session->lock);
+
+        session_execute(session, command);
+    }
+
+    scheduler_submit(&session->task);
+}
+
+/**
+ * @brief Постановка команды клиента в очередь сессии
+ *
+ * Если в очереди SESSION_MAX_QUEUED команд, поток клиента ждет и не читает сокет:
+ * медленное выполнение команд доходит до клиента через окно TCP, а не копится в памяти
+ *
+ * @param payload Нагрузка кадра, завершенная '\0'
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int session_submit(struct session_t* session, const char* payload, size_t length) {
+    struct command_task_t* command = object_pool_alloc(&command_pool);
+
+    if (!command) {
+        perror("session_submit: object_pool_alloc");
+
+        return -1;
+    }
+
+    command->next = NULL;
+    command->frame = message_create(payload, length + 1);
+
+    if (!command->frame) {
+        object_pool_free(&command_pool, command);
+
+        return -1;
+    }
+
+    pthread_mutex_lock(&session->lock);
+
+    while (session->queued >= SESSION_MAX_QUEUED) {
+        pthread_cond_wait(&session->idle, &session->lock);
+    }
+
+    if (session->tail) {
+        session->tail->next = command;
+    } else {
+        session->head = command;
+    }
+
+    session->tail = command;
+    session->queued++;
+
+    int schedule = !session->scheduled;
+
+    session->scheduled = 1;
+
+    pthread_mutex_unlock(&session->lock);
+
+    if (schedule) {
+        scheduler_submit(&session->task);
     }
 
-    int client_cycle = 1;
+    return 0;
+}
 
-    while (client_cycle) {
-        memset(buffer, 0, BUFFER_SIZE);
+/**
+ * @brief Обработка одного кадра клиента в режиме потоков
+ * 
+ * Первые кадры - рукопожатие и имя клиента, они обрабатываются сразу. Остальные кадры
+ * после проверки ограничения частоты уходят командами в пул рабочих потоков
+ * 
+ * @return int 0 чтобы продолжить разбор, -1 если клиента нужно отключить
+ */
+static int session_process(struct session_t* session, char* payload, size_t length) {
 
-        ssize_t count_of_bytes = recv(c_data.client_fd, buffer, BUFFER_SIZE - 1, 0);
+    if (atomic_load(&session->closed)) {
+        session->client_cycle = 0;
+
+        return -1;
+    }
+
+    if (!session->joined) {
+
+        int named = client_handshake(session->rooms, session->c_data, payload, length);
+
+        if (named < 0) {
+            session->client_cycle = 0;
+
+            return -1;
+        }
+
+        if (named > 0) {
+            return 0;
+        }
+
+        if (client_join_chat(room_ref(session->rooms->lobby), session->c_data, BACKLOG_LAST) < 0) {
+            name_index_remove(&session->rooms->names, session->c_data);
+
+            session->client_cycle = 0;
+
+            return -1;
+        }
+
+        session->joined = 1;
+
+        throttle_init(&session->throttle, session->limits, metrics_now() / 1000000);
+
+        return 0;
+    }
+
+    int admitted = client_throttle(session->c_data, &session->throttle, session->limits, length, metrics_now() / 1000000);
+
+    if (admitted <= 0) {
+        session->client_cycle = admitted == 0;
+
+        return session->client_cycle ? 0 : -1;
+    }
+
+    if (session_submit(session, payload, length) < 0) {
+        session->client_cycle = 0;
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Выполнение одного кадра клиента с учетом метрик
+ *
+ * @return int 0 чтобы продолжить разбор, -1 если клиента нужно отключить
+ */
+static int session_on_frame(void* arg, char* payload, size_t length) {
+    metrics_add(METRICS_MESSAGES_IN, 1);
+
+    trace_frame_begin();
+
+    int result = session_process((struct session_t*) arg, payload, length);
+
+    trace_frame_end();
+
+    return result;
+}
+
+void* clients_handler(void* arg) {
+    struct pthread_data_t* p_data = (struct pthread_data_t*) arg;
+    struct room_registry_t* rooms = p_data->rooms;
+    const struct rate_limits_t* limits = p_data->limits;
+    struct client_data_t c_data = p_data->client_data;
+
+    pthread_data_free(p_data);
+
+    char buffer[BUFFER_SIZE + 1];
+    struct frame_reader_t reader = {0};
+
+    struct session_t session = {
+        .rooms = rooms,
+        .c_data = &c_data,
+        .limits = limits,
+        .joined = 0,
+        .client_cycle = 1,
+        .task.run = session_run
+    };
+
+    pthread_mutex_init(&session.lock, NULL);
+    pthread_cond_init(&session.idle, NULL);
+
+    while (session.client_cycle) {
+        int timeout = client_writer_timeout(c_data.writer);
+        struct pollfd fds[2] = {
+            { .fd = c_data.client_fd, .events = timeout < 0 ? POLLIN : POLLIN | POLLOUT },
+            { .fd = c_data.writer->wake_fd, .events = POLLIN }
+        };
+
+        int ready = poll(fds, 2, timeout);
+
+        if (ready < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("clients_handler: poll");
+
+            break;
+        }
+
+        if ((ready == 0 || (fds[0].revents & POLLOUT) || fds[1].revents) && client_writer_flush(c_data.writer) < 0) {
+            break;
+        }
+
+        if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+
+        ssize_t count_of_bytes = recv(c_data.client_fd, buffer, BUFFER_SIZE, MSG_DONTWAIT);
 
         if (count_of_bytes <= 0) {
             
             if (count_of_bytes == 0) {
-                print_time_prefix();
-                printf("Client %s:%d disconnected\n", c_data.client_ip, c_data.client_port);
+                log_printf(LOG_LEVEL_INFO, "Client %s:%d disconnected", c_data.client_ip, c_data.client_port);
 
                 break;
-            } else {
-                perror("clients_handler: recv");
             }
 
-            continue;
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+
+            perror("clients_handler: recv");
+
+            break;
         }
 
-        buffer[count_of_bytes] = '\0';
+        metrics_add(METRICS_BYTES_IN, count_of_bytes);
 
-        if (executing_clients_command(chat, &c_data, buffer, &client_cycle) < 0) {
-            client_cycle = 0;
+        trace_receive(c_data.client_fd, count_of_bytes);
+
+        if (frame_reader_consume(&reader, buffer, count_of_bytes, session_on_frame, &session) < 0) {
+            break;
         }
 
     }
 
-    if (notify_all_clients(chat, c_data.client_fd, c_data.client_name, LEFT) < 0) {
-        client_remove_from_chat(chat, c_data.client_fd);
+    frame_reader_free(&reader);
 
-        return NULL;
+    atomic_store(&session.closed, 1);
+
+    pthread_mutex_lock(&session.lock);
+
+    while (session.scheduled) {
+        pthread_cond_wait(&session.idle, &session.lock);
+    }
+
+    pthread_mutex_unlock(&session.lock);
+
+    pthread_cond_destroy(&session.idle);
+    pthread_mutex_destroy(&session.lock);
+
+    client_writer_drain(c_data.writer);
+
+    if (session.joined) {
+        client_leave_chat(&c_data);
+        name_index_remove(&rooms->names, &c_data);
+        client_close_deferred(c_data.client_fd);
+        client_writer_retire(c_data.writer);
+    } else {
+        close(c_data.client_fd);
+        client_writer_free(c_data.writer);
     }
 
-    client_remove_from_chat(chat, c_data.client_fd);
+    listener_release();
 
     return NULL;
 }
@@ -1,69 +1,160 @@
 #include "../headers/client_utils.h"
+#include "../headers/ebr.h"
+#include "../headers/message.h"
+#include "../headers/metrics.h"
+#include "../headers/name_index.h"
+#include "../headers/reactor.h"
+#include "../headers/trace.h"
+#include "../headers/writer.h"
+
+#include <stdarg.h>
 
 struct client_node_t* search_by_fd(struct chat_t* chat, int fd) {
-    struct client_node_t* current = chat->head;
 
-    while (current) {
-        
-        if (current->data.client_fd == fd) {
-            return current;
-        }
+    if (fd < 0 || fd >= chat->registry->slot_count) {
+        return NULL;
+    }
 
-        current = current->next;
+    struct client_slot_t* slot = &chat->registry->slots[fd];
+
+    if (slot->room != chat) {
+        return NULL;
     }
 
-    return NULL;
+    struct client_snapshot_t* snapshot = atomic_load(&chat->shards[slot->shard].snapshot);
+
+    return &snapshot->clients[slot->index];
 }
 
-int foreach_client_expect(struct chat_t* chat, int exclude_fd, client_callback callback, void* arg) {
-    struct client_node_t* current = chat->head;
+int foreach_shard_client_expect(struct chat_t* chat, int shard_index, int exclude_fd, client_callback callback, void* arg) {
+    struct chat_shard_t* shard = &chat->shards[shard_index];
+
+    ebr_enter();
+
+    struct client_snapshot_t* snapshot = atomic_load_explicit(&shard->snapshot, memory_order_seq_cst);
+    int count = snapshot ? snapshot->count : 0;
     int result = 0;
 
-    while (current) {
+    for (int i = 0; i < count; i++) {
         
-        if (current->data.client_fd != exclude_fd) {
-            result = callback(current, arg);
+        if (snapshot->clients[i].data.client_fd != exclude_fd) {
+            result = callback(&snapshot->clients[i], arg);
 
             if (result < 0) {
+                ebr_exit();
+
                 return -1;
             }
 
         }
 
-        current = current->next;
     }
 
+    ebr_exit();
+
+    return result;
+}
+
+int foreach_client_expect(struct chat_t* chat, int exclude_fd, client_callback callback, void* arg) {
+
+    for (int i = 0; i < chat->shard_count; i++) {
+
+        if (foreach_shard_client_expect(chat, i, exclude_fd, callback, arg) < 0) {
+            return -1;
+        }
+
+    }
+
+    return 0;
+}
+
+int client_send(struct client_data_t* c_data, struct message_t* message) {
+
+    if (c_data->conn) {
+        return connection_write(c_data->conn, message);
+    }
+
+    message = message_for(message, c_data->protocol);
+
+    if (!message) {
+        shutdown(c_data->client_fd, SHUT_RDWR);
+
+        return -1;
+    }
+
+    return client_writer_send(c_data->writer, message);
+}
+
+int client_send_direct(struct room_registry_t* rooms, struct client_data_t* sender, const char* name, struct message_t* message) {
+    struct client_data_t target;
+    int result = 0;
+
+    ebr_enter();
+
+    if (!name_index_find(&rooms->names, name, &target)) {
+        ebr_exit();
+
+        return 1;
+    }
+
+    if (sender->conn && target.shard != sender->shard) {
+        result = reactor_direct(sender->conn, &target, message);
+    } else {
+        client_send(&target, message);
+    }
+
+    ebr_exit();
+
     return result;
 }
 
 int broadcast_callback(struct client_node_t* client, void* arg) {
     struct broadcast_callback_data_t* data = (struct broadcast_callback_data_t*) arg;
+    struct client_slot_t* slot = &client->data.room->registry->slots[client->data.client_fd];
 
-    ssize_t count_of_bytes = send(client->data.client_fd, data->message, data->length, 0);
+    if (data->message->seq != 0 && slot->room == client->data.room && data->message->seq <= slot->replayed) {
+        return 0;
+    }
 
-    if (count_of_bytes <= 0) {
-        perror("client_broadcast: send");
+    if (trace_active()) {
+        uint64_t start = metrics_now();
 
-        return -1;
+        client_send(&client->data, data->message);
+
+        metrics_record(METRICS_SEND, metrics_now() - start);
+    } else {
+        client_send(&client->data, data->message);
     }
 
+    TRACE_PROBE2(send, client->data.client_fd, data->message->length);
+
     return 0;
 }
 
-int client_list_callback(struct client_node_t* client, void* arg) {
-    struct client_list_callback_data_t* data = (struct client_list_callback_data_t*) arg;
+/**
+ * @brief Дописывает в строку списка элемент с обрезкой по BUFFER_SIZE
+ * 
+ * @return int 0 в случае успеха, -1 при ошибке 
+ */
+static int list_append(struct client_list_callback_data_t* data, const char* format, ...) __attribute__((format(printf, 2, 3)));
 
+static int list_append(struct client_list_callback_data_t* data, const char* format, ...) {
     int offset = *(data->offset);
-    
-    int written = snprintf(
-        data->list_of_clients + offset, 
-        BUFFER_SIZE - offset, 
-        "<%s>, ", 
-        client->data.client_name
-    );
+
+    if (offset >= BUFFER_SIZE - 1) {
+        return 0;
+    }
+
+    va_list args;
+
+    va_start(args, format);
+
+    int written = vsnprintf(data->list_of_clients + offset, BUFFER_SIZE - offset, format, args);
+
+    va_end(args);
 
     if (written > 0) {
-        *(data->offset) = offset + written;
+        *(data->offset) = offset + written < BUFFER_SIZE - 1 ? offset + written : BUFFER_SIZE - 1;
     } else {
         return -1;
     }
@@ -71,3 +162,6 @@ int client_list_callback(struct client_node_t* client, void* arg) {
     return 0;
 }
 
+int room_list_callback(struct chat_t* room, void* arg) {
+    return list_append((struct client_list_callback_data_t*) arg, "#%s (%d), ", room->name, atomic_load(&room->client_count));
+}
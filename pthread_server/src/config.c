@@ -0,0 +1,481 @@
+#include "../headers/config.h"
+#include "../headers/frame.h"
+#include "../headers/store.h"
+#include "../headers/trace.h"
+
+#include <getopt.h>
+#include <sys/un.h>
+
+#define DEFAULT_QUEUE_BYTES     (1024 * 1024)
+#define DEFAULT_QUEUE_AGE_MS    10000
+#define DEFAULT_BACKLOG         256
+#define DEFAULT_REPLAY          20
+#define DEFAULT_BACKLOG_BYTES   (256 * 1024)
+#define DEFAULT_BACKLOG_TOTAL   (64 * 1024 * 1024)
+#define MAX_BACKLOG             65536
+#define DEFAULT_FSYNC_MS        100
+#define DEFAULT_SEGMENT_BYTES   (16 * 1024 * 1024)
+#define DEFAULT_RATE_MESSAGES   100
+#define DEFAULT_RATE_BYTES      (64 * 1024)
+#define DEFAULT_FLOOD_STRIKES   200
+#define FLOOD_WINDOW_MS         10000
+#define DEFAULT_LISTEN_BACKLOG  4096
+#define DEFAULT_ACCEPT_BATCH    64
+
+/**
+ * @brief Вывод подсказки по аргументам
+ *
+ */
+static void print_usage(const char* program) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -p, --port <port>        listening port (default %d)\n"
+        "  -t, --threads            compatibility mode: one thread per client\n"
+        "  -w, --workers <n>        number of reactor threads, each with its own listener (default 1)\n"
+        "  -i, --io <backend>       reactor I/O backend: epoll or uring (default epoll)\n"
+        "  -q, --queue-bytes <n>    per-client limit of unsent bytes (default %d)\n"
+        "  -a, --queue-age <ms>     per-client limit of the oldest unsent message age (default %d)\n"
+        "  -s, --slow <policy>      slow consumer over a limit: disconnect or gap (default disconnect)\n"
+        "  -F, --flush <mode>       tick: send a client's messages of one loop iteration together;\n"
+        "                           immediate: send every message at once with TCP_NODELAY (default tick)\n"
+        "  -z, --zerocopy <n>       epoll reactor: send frames of at least n bytes with MSG_ZEROCOPY, 0 disables (default 0)\n"
+        "  -l, --log-level <level>  error, warn, info or debug; debug logs every message (default info)\n"
+        "  -P, --prealloc <n>       preallocate n connection records and n message buffers per size class up to 2 KB (default 0)\n"
+        "  -b, --backlog <n>        messages kept per room for replay on join, 0 disables (default %d)\n"
+        "  -r, --replay <n>         messages replayed on join without a sequence number (default %d)\n"
+        "  -m, --backlog-bytes <n>  per-room backlog limit in bytes, at most the queue limit (default %d)\n"
+        "  -M, --backlog-total <n>  backlog limit of all rooms in bytes (default %d)\n"
+        "  -d, --data-dir <dir>     persist chat messages in a segmented log in dir (default off)\n"
+        "  -f, --fsync-ms <ms>      group commit interval of the log (default %d)\n"
+        "  -g, --segment-bytes <n>  size of a log segment (default %d)\n"
+        "  -R, --retain-bytes <n>   remove the oldest log segments above n bytes, 0 keeps all (default 0)\n"
+        "  -A, --retain-age <s>     remove log segments older than s seconds, 0 keeps all (default 0)\n"
+        "  -u, --admin <path>       serve counters and histograms on a Unix socket at path (default off)\n"
+        "  -T, --trace-sample <n>   time the stages of one read in n, 0 disables (default %d)\n"
+        "  -L, --rate-messages <n>  per-client limit of messages per second, 0 disables (default %d)\n"
+        "  -B, --rate-bytes <n>     per-client limit of message bytes per second, 0 disables (default %d)\n"
+        "  -K, --flood-strikes <n>  disconnect a client after n dropped messages without a %d s pause, 0 never (default %d)\n"
+        "  -k, --listen-backlog <n> length of the chat and admin listen() queues, capped by net.core.somaxconn (default %d)\n"
+        "  -C, --max-clients <n>    reject connections above n with a \"server full\" frame, 0 disables (default 0)\n"
+        "  -x, --accept-batch <n>   connections a thread accepts per loop iteration (default %d)\n"
+        "  -W, --task-workers <n>   threads mode: worker threads executing client commands, 0 is one per CPU (default 0)\n"
+        "  -h, --help               show this help\n"
+        "SIGUSR2 starts the server binary again and hands the listeners and clients over to it (epoll backend)\n",
+        program, PORT, DEFAULT_QUEUE_BYTES, DEFAULT_QUEUE_AGE_MS,
+        DEFAULT_BACKLOG, DEFAULT_REPLAY, DEFAULT_BACKLOG_BYTES, DEFAULT_BACKLOG_TOTAL,
+        DEFAULT_FSYNC_MS, DEFAULT_SEGMENT_BYTES, TRACE_DEFAULT_SAMPLE,
+        DEFAULT_RATE_MESSAGES, DEFAULT_RATE_BYTES, FLOOD_WINDOW_MS / 1000, DEFAULT_FLOOD_STRIKES,
+        DEFAULT_LISTEN_BACKLOG, DEFAULT_ACCEPT_BATCH
+    );
+}
+
+/**
+ * @brief Разбор целого числа из аргумента с проверкой диапазона
+ *
+ * @return int 0 в случае успеха, -1 если строка не число или вне [min, max]
+ */
+static int parse_number(const char* name, const char* text, long min, long max, long* value) {
+    char* end = NULL;
+
+    *value = strtol(text, &end, 10);
+
+    if (*text == '\0' || *end != '\0' || *value < min || *value > max) {
+        fprintf(stderr, "Incorrect %s: %s (%ld..%ld)\n", name, text, min, max);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int config_parse(struct server_config_t* config, int argc, char* argv[]) {
+    static const struct option options[] = {
+        { "port",        required_argument, NULL, 'p' },
+        { "threads",     no_argument,       NULL, 't' },
+        { "workers",     required_argument, NULL, 'w' },
+        { "io",          required_argument, NULL, 'i' },
+        { "queue-bytes", required_argument, NULL, 'q' },
+        { "queue-age",   required_argument, NULL, 'a' },
+        { "slow",        required_argument, NULL, 's' },
+        { "flush",       required_argument, NULL, 'F' },
+        { "zerocopy",    required_argument, NULL, 'z' },
+        { "log-level",   required_argument, NULL, 'l' },
+        { "prealloc",    required_argument, NULL, 'P' },
+        { "backlog",     required_argument, NULL, 'b' },
+        { "replay",      required_argument, NULL, 'r' },
+        { "backlog-bytes", required_argument, NULL, 'm' },
+        { "backlog-total", required_argument, NULL, 'M' },
+        { "data-dir",    required_argument, NULL, 'd' },
+        { "fsync-ms",    required_argument, NULL, 'f' },
+        { "segment-bytes", required_argument, NULL, 'g' },
+        { "retain-bytes", required_argument, NULL, 'R' },
+        { "retain-age",  required_argument, NULL, 'A' },
+        { "admin",       required_argument, NULL, 'u' },
+        { "trace-sample", required_argument, NULL, 'T' },
+        { "rate-messages", required_argument, NULL, 'L' },
+        { "rate-bytes",  required_argument, NULL, 'B' },
+        { "flood-strikes", required_argument, NULL, 'K' },
+        { "listen-backlog", required_argument, NULL, 'k' },
+        { "max-clients", required_argument, NULL, 'C' },
+        { "accept-batch", required_argument, NULL, 'x' },
+        { "task-workers", required_argument, NULL, 'W' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL,          0,                 NULL, 0   }
+    };
+
+    config->port = PORT;
+    config->mode = MODE_EPOLL;
+    config->workers = 1;
+    config->io = IO_EPOLL;
+    config->queue_bytes = DEFAULT_QUEUE_BYTES;
+    config->queue_age_ms = DEFAULT_QUEUE_AGE_MS;
+    config->slow_policy = SLOW_DISCONNECT;
+    config->flush = FLUSH_TICK;
+    config->zerocopy_bytes = 0;
+    config->log_level = LOG_LEVEL_INFO;
+    config->prealloc = 0;
+    config->backlog.capacity = DEFAULT_BACKLOG;
+    config->backlog.replay = DEFAULT_REPLAY;
+    config->backlog.room_bytes = DEFAULT_BACKLOG_BYTES;
+    config->backlog.total_bytes = DEFAULT_BACKLOG_TOTAL;
+    config->data_dir = NULL;
+    config->fsync_ms = DEFAULT_FSYNC_MS;
+    config->segment_bytes = DEFAULT_SEGMENT_BYTES;
+    config->retain_bytes = 0;
+    config->retain_age = 0;
+    config->admin_path = NULL;
+    config->trace_sample = TRACE_DEFAULT_SAMPLE;
+    config->rate.messages = DEFAULT_RATE_MESSAGES;
+    config->rate.bytes = DEFAULT_RATE_BYTES;
+    config->rate.strikes = DEFAULT_FLOOD_STRIKES;
+    config->rate.window_ms = FLOOD_WINDOW_MS;
+    config->listen_backlog = DEFAULT_LISTEN_BACKLOG;
+    config->max_clients = 0;
+    config->accept_batch = DEFAULT_ACCEPT_BATCH;
+    config->task_workers = 0;
+
+    int opt = 0;
+    long value = 0;
+
+    while ((opt = getopt_long(argc, argv, "p:tw:i:q:a:s:F:z:l:P:b:r:m:M:d:f:g:R:A:u:T:L:B:K:k:C:x:W:h", options, NULL)) != -1) {
+
+        switch (opt) {
+            case 'p':
+
+                if (parse_number("port", optarg, 1, 65535, &value) < 0) {
+                    return -1;
+                }
+
+                config->port = (uint16_t) value;
+
+                break;
+
+            case 't':
+                config->mode = MODE_THREADS;
+
+                break;
+
+            case 'w':
+
+                if (parse_number("number of workers", optarg, 1, MAX_WORKERS, &value) < 0) {
+                    return -1;
+                }
+
+                config->workers = (int) value;
+
+                break;
+
+            case 'i':
+
+                if (strcmp(optarg, "epoll") == 0) {
+                    config->io = IO_EPOLL;
+                } else if (strcmp(optarg, "uring") == 0) {
+                    config->io = IO_URING;
+                } else {
+                    fprintf(stderr, "Incorrect I/O backend: %s (epoll or uring)\n", optarg);
+
+                    return -1;
+                }
+
+                break;
+
+            case 'q':
+
+                if (parse_number("queue limit", optarg, BUFFER_SIZE, 1L << 30, &value) < 0) {
+                    return -1;
+                }
+
+                config->queue_bytes = (size_t) value;
+
+                break;
+
+            case 'a':
+
+                if (parse_number("queue age", optarg, 1, 3600000, &value) < 0) {
+                    return -1;
+                }
+
+                config->queue_age_ms = (int) value;
+
+                break;
+
+            case 's':
+
+                if (strcmp(optarg, "disconnect") == 0) {
+                    config->slow_policy = SLOW_DISCONNECT;
+                } else if (strcmp(optarg, "gap") == 0) {
+                    config->slow_policy = SLOW_GAP;
+                } else {
+                    fprintf(stderr, "Incorrect slow consumer policy: %s (disconnect or gap)\n", optarg);
+
+                    return -1;
+                }
+
+                break;
+
+            case 'F':
+
+                if (strcmp(optarg, "tick") == 0) {
+                    config->flush = FLUSH_TICK;
+                } else if (strcmp(optarg, "immediate") == 0) {
+                    config->flush = FLUSH_IMMEDIATE;
+                } else {
+                    fprintf(stderr, "Incorrect flush mode: %s (tick or immediate)\n", optarg);
+
+                    return -1;
+                }
+
+                break;
+
+            case 'z':
+
+                if (parse_number("zero-copy threshold", optarg, 0, FRAME_HEADER_SIZE + MAX_FRAME_PAYLOAD, &value) < 0) {
+                    return -1;
+                }
+
+                config->zerocopy_bytes = (size_t) value;
+
+                break;
+
+            case 'l':
+
+                if (logger_parse_level(optarg, &config->log_level) < 0) {
+                    fprintf(stderr, "Incorrect log level: %s (error, warn, info or debug)\n", optarg);
+
+                    return -1;
+                }
+
+                break;
+
+            case 'P':
+
+                if (parse_number("preallocation", optarg, 0, 1L << 20, &value) < 0) {
+                    return -1;
+                }
+
+                config->prealloc = (size_t) value;
+
+                break;
+
+            case 'b':
+
+                if (parse_number("backlog size", optarg, 0, MAX_BACKLOG, &value) < 0) {
+                    return -1;
+                }
+
+                config->backlog.capacity = (unsigned) value;
+
+                break;
+
+            case 'r':
+
+                if (parse_number("replay size", optarg, 0, MAX_BACKLOG, &value) < 0) {
+                    return -1;
+                }
+
+                config->backlog.replay = (unsigned) value;
+
+                break;
+
+            case 'm':
+
+                if (parse_number("room backlog limit", optarg, 0, 1L << 30, &value) < 0) {
+                    return -1;
+                }
+
+                config->backlog.room_bytes = (size_t) value;
+
+                break;
+
+            case 'M':
+
+                if (parse_number("total backlog limit", optarg, 0, 1L << 40, &value) < 0) {
+                    return -1;
+                }
+
+                config->backlog.total_bytes = (size_t) value;
+
+                break;
+
+            case 'd':
+                config->data_dir = optarg;
+
+                break;
+
+            case 'f':
+
+                if (parse_number("fsync interval", optarg, 1, 60000, &value) < 0) {
+                    return -1;
+                }
+
+                config->fsync_ms = (int) value;
+
+                break;
+
+            case 'g':
+
+                if (parse_number("segment size", optarg, STORE_MIN_SEGMENT, 1L << 30, &value) < 0) {
+                    return -1;
+                }
+
+                config->segment_bytes = (size_t) value;
+
+                break;
+
+            case 'R':
+
+                if (parse_number("store retention size", optarg, 0, 1L << 50, &value) < 0) {
+                    return -1;
+                }
+
+                config->retain_bytes = (size_t) value;
+
+                break;
+
+            case 'A':
+
+                if (parse_number("store retention age", optarg, 0, 1L << 30, &value) < 0) {
+                    return -1;
+                }
+
+                config->retain_age = (int) value;
+
+                break;
+
+            case 'u':
+
+                if (strlen(optarg) >= sizeof(((struct sockaddr_un*) NULL)->sun_path)) {
+                    fprintf(stderr, "Admin socket path is too long: %s\n", optarg);
+
+                    return -1;
+                }
+
+                config->admin_path = optarg;
+
+                break;
+
+            case 'T':
+
+                if (parse_number("trace sample", optarg, 0, 1L << 30, &value) < 0) {
+                    return -1;
+                }
+
+                config->trace_sample = (unsigned) value;
+
+                break;
+
+            case 'L':
+
+                if (parse_number("message rate", optarg, 0, 1L << 20, &value) < 0) {
+                    return -1;
+                }
+
+                config->rate.messages = (unsigned) value;
+
+                break;
+
+            case 'B':
+
+                if (parse_number("byte rate", optarg, 0, 1L << 30, &value) < 0) {
+                    return -1;
+                }
+
+                if (value > 0 && value < BUFFER_SIZE) {
+                    fprintf(stderr, "Byte rate %ld is below the frame size %d: no message would pass\n", value, BUFFER_SIZE);
+
+                    return -1;
+                }
+
+                config->rate.bytes = (size_t) value;
+
+                break;
+
+            case 'K':
+
+                if (parse_number("flood strikes", optarg, 0, 1L << 20, &value) < 0) {
+                    return -1;
+                }
+
+                config->rate.strikes = (unsigned) value;
+
+                break;
+
+            case 'k':
+
+                if (parse_number("listen backlog", optarg, 1, 1L << 20, &value) < 0) {
+                    return -1;
+                }
+
+                config->listen_backlog = (int) value;
+
+                break;
+
+            case 'C':
+
+                if (parse_number("max clients", optarg, 0, 1L << 24, &value) < 0) {
+                    return -1;
+                }
+
+                config->max_clients = (int) value;
+
+                break;
+
+            case 'x':
+
+                if (parse_number("accept batch", optarg, 1, 1L << 16, &value) < 0) {
+                    return -1;
+                }
+
+                config->accept_batch = (int) value;
+
+                break;
+
+            case 'W':
+
+                if (parse_number("number of task workers", optarg, 0, MAX_WORKERS, &value) < 0) {
+                    return -1;
+                }
+
+                config->task_workers = (int) value;
+
+                break;
+
+            default:
+                print_usage(argv[0]);
+
+                return -1;
+        }
+
+    }
+
+    if (config->backlog.room_bytes > config->queue_bytes) {
+        fprintf(stderr, "Room backlog limit %zu exceeds the queue limit %zu: replay would overflow the client queue\n",
+            config->backlog.room_bytes,
+            config->queue_bytes
+        );
+
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include "../headers/ebr.h"
+
+#define EBR_ACTIVE          1ULL
+
+/**
+ * @brief Запись читателя, одна на поток
+ *
+ * Записи не освобождаются: после завершения потока запись помечается
+ * свободной и достается следующему потоку
+ */
+struct ebr_record_t {
+    _Atomic uint64_t state;                 ///< Эпоха входа, сдвинутая на 1 бит, младший бит - поток в секции
+    atomic_int in_use;                      ///< Запись занята живым потоком
+    int depth;                              ///< Глубина вложенности секций, меняет только владелец
+    struct ebr_record_t* next;              ///< Следующая запись домена
+};
+
+/**
+ * @brief Отложенный объект
+ */
+struct ebr_retired_t {
+    uint64_t epoch;                         ///< Глобальная эпоха в момент снятия
+    ebr_free_callback callback;             ///< Функция освобождения
+    void* arg;                              ///< Аргумент функции освобождения
+    struct ebr_retired_t* next;             ///< Следующий отложенный объект
+};
+
+static _Atomic uint64_t ebr_epoch = 1;
+static _Atomic(struct ebr_record_t*) ebr_records = NULL;
+
+static pthread_mutex_t ebr_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct ebr_retired_t* ebr_retired = NULL;
+
+static pthread_once_t ebr_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ebr_key;
+
+static __thread struct ebr_record_t* ebr_self = NULL;
+
+/**
+ * @brief Возвращает запись завершившегося потока в домен
+ *
+ */
+static void ebr_release_record(void* arg) {
+    struct ebr_record_t* record = (struct ebr_record_t*) arg;
+
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+    atomic_store_explicit(&record->in_use, 0, memory_order_release);
+}
+
+static void ebr_create_key(void) {
+    pthread_key_create(&ebr_key, ebr_release_record);
+}
+
+/**
+ * @brief Запись текущего потока: свободная чужая или новая
+ *
+ */
+static struct ebr_record_t* ebr_record(void) {
+
+    if (ebr_self) {
+        return ebr_self;
+    }
+
+    struct ebr_record_t* record = atomic_load_explicit(&ebr_records, memory_order_acquire);
+
+    for (; record; record = record->next) {
+        int expected = 0;
+
+        if (atomic_compare_exchange_strong(&record->in_use, &expected, 1)) {
+            break;
+        }
+
+    }
+
+    if (!record) {
+        record = calloc(1, sizeof(struct ebr_record_t));
+
+        if (!record) {
+            perror("ebr_record: calloc");
+
+            abort();
+        }
+
+        atomic_init(&record->in_use, 1);
+
+        struct ebr_record_t* head = atomic_load_explicit(&ebr_records, memory_order_relaxed);
+
+        do {
+            record->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&ebr_records, &head, record, memory_order_release, memory_order_relaxed));
+
+    }
+
+    pthread_once(&ebr_key_once, ebr_create_key);
+    pthread_setspecific(ebr_key, record);
+
+    ebr_self = record;
+
+    return record;
+}
+
+void ebr_enter(void) {
+    struct ebr_record_t* record = ebr_record();
+
+    if (record->depth++ > 0) {
+        return;
+    }
+
+    uint64_t epoch = atomic_load_explicit(&ebr_epoch, memory_order_relaxed);
+
+    atomic_store_explicit(&record->state, (epoch << 1) | EBR_ACTIVE, memory_order_seq_cst);
+}
+
+void ebr_exit(void) {
+    struct ebr_record_t* record = ebr_self;
+
+    if (--record->depth > 0) {
+        return;
+    }
+
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+}
+
+/**
+ * @brief Переход к следующей эпохе
+ *
+ * Возможен, только если все потоки в секциях вошли в текущую эпоху
+ *
+ * @return int 1 если эпоха сменилась, 0 иначе
+ */
+static int ebr_try_advance(void) {
+    uint64_t epoch = atomic_load_explicit(&ebr_epoch, memory_order_seq_cst);
+
+    for (struct ebr_record_t* record = atomic_load_explicit(&ebr_records, memory_order_acquire); record; record = record->next) {
+        uint64_t state = atomic_load_explicit(&record->state, memory_order_seq_cst);
+
+        if ((state & EBR_ACTIVE) && (state >> 1) != epoch) {
+            return 0;
+        }
+
+    }
+
+    atomic_store_explicit(&ebr_epoch, epoch + 1, memory_order_seq_cst);
+
+    return 1;
+}
+
+/**
+ * @brief Освобождает объекты, снятые две и более эпохи назад
+ *
+ * @warning Вызывать под ebr_mutex
+ */
+static void ebr_collect(void) {
+
+    for (int i = 0; i < 2 && ebr_try_advance(); i++) {
+    }
+
+    uint64_t epoch = atomic_load_explicit(&ebr_epoch, memory_order_acquire);
+
+    struct ebr_retired_t** link = &ebr_retired;
+
+    while (*link) {
+        struct ebr_retired_t* item = *link;
+
+        if (item->epoch + 2 > epoch) {
+            link = &item->next;
+
+            continue;
+        }
+
+        *link = item->next;
+
+        item->callback(item->arg);
+
+        free(item);
+    }
+
+}
+
+int ebr_retire(ebr_free_callback callback, void* arg) {
+    struct ebr_retired_t* item = malloc(sizeof(struct ebr_retired_t));
+
+    if (!item) {
+        perror("ebr_retire: malloc");
+
+        return -1;
+    }
+
+    item->callback = callback;
+    item->arg = arg;
+
+    pthread_mutex_lock(&ebr_mutex);
+
+    item->epoch = atomic_load_explicit(&ebr_epoch, memory_order_seq_cst);
+    item->next = ebr_retired;
+
+    ebr_retired = item;
+
+    ebr_collect();
+
+    pthread_mutex_unlock(&ebr_mutex);
+
+    return 0;
+}
+
+void ebr_drain(void) {
+    pthread_mutex_lock(&ebr_mutex);
+
+    while (ebr_retired) {
+        struct ebr_retired_t* item = ebr_retired;
+
+        ebr_retired = item->next;
+
+        item->callback(item->arg);
+
+        free(item);
+    }
+
+    pthread_mutex_unlock(&ebr_mutex);
+}
@@ -0,0 +1,185 @@
+#include "../headers/frame.h"
+
+/**
+ * @brief Чтение длины нагрузки из заголовка кадра
+ *
+ */
+static size_t frame_get_length(const char* header) {
+    return ((size_t) (unsigned char) header[0] << 8) | (unsigned char) header[1];
+}
+
+/**
+ * @brief Вызов обработчика для нагрузки, временно завершенной '\0'
+ *
+ * Байт после нагрузки может быть заголовком следующего кадра, поэтому он восстанавливается
+ *
+ */
+static int frame_dispatch(char* payload, size_t length, frame_callback callback, void* arg) {
+    char saved = payload[length];
+
+    payload[length] = '\0';
+
+    int result = callback(arg, payload, length);
+
+    payload[length] = saved;
+
+    return result;
+}
+
+/**
+ * @brief Дописывает байты в буфер незавершенного кадра
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int frame_reader_append(struct frame_reader_t* reader, const char* data, size_t length) {
+    size_t required = reader->pending_length + length + 1;
+
+    if (required > reader->pending_capacity) {
+        size_t capacity = reader->pending_capacity ? reader->pending_capacity : BUFFER_SIZE;
+
+        while (capacity < required) {
+            capacity *= 2;
+        }
+
+        char* pending = realloc(reader->pending, capacity);
+
+        if (!pending) {
+            perror("frame_reader_append: realloc");
+
+            return -1;
+        }
+
+        reader->pending = pending;
+        reader->pending_capacity = capacity;
+    }
+
+    memcpy(reader->pending + reader->pending_length, data, length);
+
+    reader->pending_length += length;
+
+    return 0;
+}
+
+/**
+ * @brief Дополняет незавершенный кадр из прошлых чтений
+ *
+ * @param consumed Сколько байт data ушло в кадр
+ * @return int 1 если кадр собран, 0 если данных не хватило, -1 при ошибке
+ */
+static int frame_reader_complete(struct frame_reader_t* reader, const char* data, size_t length, size_t* consumed) {
+    size_t take = 0;
+
+    *consumed = 0;
+
+    if (reader->pending_length < FRAME_HEADER_SIZE) {
+        take = FRAME_HEADER_SIZE - reader->pending_length;
+
+        if (take > length) {
+            take = length;
+        }
+
+        if (frame_reader_append(reader, data, take) < 0) {
+            return -1;
+        }
+
+        *consumed += take;
+
+        if (reader->pending_length < FRAME_HEADER_SIZE) {
+            return 0;
+        }
+
+    }
+
+    size_t missing = FRAME_HEADER_SIZE + frame_get_length(reader->pending) - reader->pending_length;
+
+    take = missing < length - *consumed ? missing : length - *consumed;
+
+    if (frame_reader_append(reader, data + *consumed, take) < 0) {
+        return -1;
+    }
+
+    *consumed += take;
+
+    return take == missing ? 1 : 0;
+}
+
+int frame_reader_consume(struct frame_reader_t* reader, char* data, size_t length, frame_callback callback, void* arg) {
+
+    if (reader->pending_length > 0) {
+        size_t consumed = 0;
+        int complete = frame_reader_complete(reader, data, length, &consumed);
+
+        if (complete < 0) {
+            return -1;
+        }
+
+        if (complete == 0) {
+            return 0;
+        }
+
+        data += consumed;
+        length -= consumed;
+
+        reader->pending_length = 0;
+
+        if (frame_dispatch(reader->pending + FRAME_HEADER_SIZE, frame_get_length(reader->pending), callback, arg) < 0) {
+            return -1;
+        }
+
+        if (reader->pending_capacity > 4 * BUFFER_SIZE) {
+            free(reader->pending);
+
+            reader->pending = NULL;
+            reader->pending_capacity = 0;
+        }
+
+    }
+
+    while (length >= FRAME_HEADER_SIZE) {
+        size_t frame_length = frame_get_length(data);
+
+        if (length < FRAME_HEADER_SIZE + frame_length) {
+            break;
+        }
+
+        if (frame_dispatch(data + FRAME_HEADER_SIZE, frame_length, callback, arg) < 0) {
+            return -1;
+        }
+
+        data += FRAME_HEADER_SIZE + frame_length;
+        length -= FRAME_HEADER_SIZE + frame_length;
+    }
+
+    if (length > 0) {
+        return frame_reader_append(reader, data, length);
+    }
+
+    return 0;
+}
+
+void frame_reader_free(struct frame_reader_t* reader) {
+    free(reader->pending);
+
+    reader->pending = NULL;
+    reader->pending_length = 0;
+    reader->pending_capacity = 0;
+}
+
+void frame_set_header(char* frame, size_t length) {
+    frame[0] = (char) ((length >> 8) & 0xff);
+    frame[1] = (char) (length & 0xff);
+}
+
+size_t frame_vprintf(char* frame, size_t size, const char* format, va_list args) {
+    int written = vsnprintf(frame + FRAME_HEADER_SIZE, size - FRAME_HEADER_SIZE, format, args);
+
+    size_t length = written < 0 ? 0 : (size_t) written;
+
+    if (length > size - FRAME_HEADER_SIZE - 1) {
+        length = size - FRAME_HEADER_SIZE - 1;
+    }
+
+    frame_set_header(frame, length);
+
+    return FRAME_HEADER_SIZE + length;
+}
@@ -0,0 +1,156 @@
+#include "../headers/listener.h"
+#include "../headers/frame.h"
+
+#include <netinet/tcp.h>
+
+#define LISTENER_FULL_TEXT      "Server is full, try again later"
+
+static atomic_int listener_admitted;
+
+int create_listener(uint16_t port, int reuse_port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        perror("create_listener: socket");
+
+        return -1;
+    }
+
+    int opt = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("create_listener: setsockopt");
+
+        close(fd);
+
+        return -1;
+    }
+
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("create_listener: setsockopt SO_REUSEPORT");
+
+        close(fd);
+
+        return -1;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = INADDR_ANY
+    };
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("create_listener: bind");
+
+        close(fd);
+
+        return -1;
+    }
+
+    if (listen(fd, backlog) < 0) {
+        perror("create_listener: listen");
+
+        close(fd);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+int set_nodelay(int fd) {
+    int opt = 1;
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) < 0) {
+        perror("set_nodelay: setsockopt TCP_NODELAY");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+int listener_admit(int max_clients) {
+
+    if (max_clients == 0) {
+        atomic_fetch_add_explicit(&listener_admitted, 1, memory_order_relaxed);
+
+        return 1;
+    }
+
+    int admitted = atomic_load_explicit(&listener_admitted, memory_order_relaxed);
+
+    do {
+
+        if (admitted >= max_clients) {
+            return 0;
+        }
+
+    } while (!atomic_compare_exchange_weak_explicit(&listener_admitted, &admitted, admitted + 1, memory_order_relaxed, memory_order_relaxed));
+
+    return 1;
+}
+
+void listener_release(void) {
+    atomic_fetch_sub_explicit(&listener_admitted, 1, memory_order_relaxed);
+}
+
+int listener_connections(void) {
+    return atomic_load_explicit(&listener_admitted, memory_order_relaxed);
+}
+
+void listener_reject(int fd) {
+    char frame[FRAME_HEADER_SIZE + sizeof(LISTENER_FULL_TEXT) - 1];
+
+    frame_set_header(frame, sizeof(LISTENER_FULL_TEXT) - 1);
+
+    memcpy(frame + FRAME_HEADER_SIZE, LISTENER_FULL_TEXT, sizeof(LISTENER_FULL_TEXT) - 1);
+
+    if (send(fd, frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        perror("listener_reject: send");
+    }
+
+    close(fd);
+}
+
+uint64_t listener_overflows(void) {
+    FILE* file = fopen("/proc/net/netstat", "r");
+    char names[4096];
+    char values[4096];
+    uint64_t result = 0;
+
+    if (!file) {
+        return 0;
+    }
+
+    while (fgets(names, sizeof(names), file) && fgets(values, sizeof(values), file)) {
+
+        if (strncmp(names, "TcpExt:", 7) != 0) {
+            continue;
+        }
+
+        char* name_state = NULL;
+        char* value_state = NULL;
+        char* name = strtok_r(names, " \n", &name_state);
+        char* value = strtok_r(values, " \n", &value_state);
+
+        while (name && value) {
+
+            if (strcmp(name, "ListenOverflows") == 0) {
+                result = strtoull(value, NULL, 10);
+
+                break;
+            }
+
+            name = strtok_r(NULL, " \n", &name_state);
+            value = strtok_r(NULL, " \n", &value_state);
+        }
+
+        break;
+    }
+
+    fclose(file);
+
+    return result;
+}
@@ -0,0 +1,404 @@
+#include "../headers/logger.h"
+
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+
+#define LOG_PREFIX_SIZE     16
+
+/**
+ * @brief Запись журнала фиксированного размера
+ */
+struct log_record_t {
+    time_t time;                            ///< Время записи, секунды
+    uint32_t length;                        ///< Длина текста
+    char text[LOG_RECORD_SIZE - sizeof(time_t) - sizeof(uint32_t)]; ///< Текст без перевода строки
+};
+
+/**
+ * @brief Состояние кольца
+ */
+enum log_ring_state {
+    RING_ACTIVE,                            ///< Кольцо принадлежит живому потоку
+    RING_CLOSED,                            ///< Поток завершился, фоновый поток дочитывает записи
+    RING_FREE                               ///< Кольцо пусто и может достаться новому потоку
+};
+
+/**
+ * @brief Кольцо записей одного потока
+ *
+ * Один писатель (поток-владелец) и один читатель (фоновый поток), без блокировок
+ */
+struct log_ring_t {
+    _Atomic unsigned head;                  ///< Номер следующей записи для чтения, меняет фоновый поток
+    _Atomic unsigned tail;                  ///< Номер следующей записи для заполнения, меняет владелец
+    atomic_ulong dropped;                   ///< Записи, отброшенные из-за заполненного кольца
+    atomic_int state;                       ///< enum log_ring_state
+    struct log_ring_t* next;                ///< Следующее кольцо в списке колец
+    struct log_record_t records[LOG_RING_SIZE]; ///< Записи
+};
+
+enum log_level logger_level = LOG_LEVEL_INFO;
+
+static pthread_mutex_t logger_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logger_cond = PTHREAD_COND_INITIALIZER;
+static struct log_ring_t* logger_rings = NULL;
+static pthread_t logger_thread;
+static atomic_int logger_running = 0;
+static int logger_stop = 0;
+
+static pthread_once_t logger_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t logger_key;
+
+static __thread struct log_ring_t* logger_ring_self = NULL;
+
+/**
+ * @brief Отдает кольцо завершившегося потока фоновому потоку
+ *
+ */
+static void logger_release_ring(void* arg) {
+    struct log_ring_t* ring = (struct log_ring_t*) arg;
+
+    atomic_store_explicit(&ring->state, RING_CLOSED, memory_order_release);
+}
+
+static void logger_create_key(void) {
+    pthread_key_create(&logger_key, logger_release_ring);
+}
+
+/**
+ * @brief Кольцо текущего потока: освободившееся чужое или новое
+ *
+ * @return struct log_ring_t* NULL, если не удалось выделить память
+ */
+static struct log_ring_t* logger_ring(void) {
+
+    if (logger_ring_self) {
+        return logger_ring_self;
+    }
+
+    pthread_mutex_lock(&logger_mutex);
+
+    struct log_ring_t* ring = logger_rings;
+
+    for (; ring; ring = ring->next) {
+        int expected = RING_FREE;
+
+        if (atomic_compare_exchange_strong(&ring->state, &expected, RING_ACTIVE)) {
+            break;
+        }
+
+    }
+
+    if (!ring) {
+        ring = malloc(sizeof(struct log_ring_t));
+
+        if (ring) {
+            atomic_init(&ring->head, 0);
+            atomic_init(&ring->tail, 0);
+            atomic_init(&ring->dropped, 0);
+            atomic_init(&ring->state, RING_ACTIVE);
+
+            ring->next = logger_rings;
+            logger_rings = ring;
+        }
+
+    }
+
+    pthread_mutex_unlock(&logger_mutex);
+
+    if (!ring) {
+        return NULL;
+    }
+
+    pthread_once(&logger_key_once, logger_create_key);
+    pthread_setspecific(logger_key, ring);
+
+    logger_ring_self = ring;
+
+    return ring;
+}
+
+/**
+ * @brief Префикс времени записи
+ *
+ * localtime_r() вызывается только при смене секунды
+ *
+ * @return size_t Длина префикса
+ */
+static size_t logger_prefix(time_t time, char* prefix) {
+    static __thread time_t cached_time = -1;
+    static __thread char cached_prefix[LOG_PREFIX_SIZE];
+    static __thread size_t cached_length = 0;
+
+    if (time != cached_time) {
+        struct tm now;
+
+        localtime_r(&time, &now);
+
+        cached_length = (size_t) snprintf(cached_prefix, sizeof(cached_prefix), "[%02d:%02d:%02d]    ", now.tm_hour, now.tm_min, now.tm_sec);
+        cached_time = time;
+    }
+
+    memcpy(prefix, cached_prefix, cached_length);
+
+    return cached_length;
+}
+
+/**
+ * @brief Запись буфера в stdout целиком
+ *
+ */
+static void logger_flush(char* buffer, size_t* length) {
+    size_t written = 0;
+
+    while (written < *length) {
+        ssize_t count = write(STDOUT_FILENO, buffer + written, *length - written);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count <= 0) {
+            break;
+        }
+
+        written += count;
+    }
+
+    *length = 0;
+}
+
+/**
+ * @brief Добавление строки журнала в буфер пачки
+ *
+ */
+static void logger_append(char* buffer, size_t* length, time_t time, const char* text, size_t text_length) {
+
+    if (*length + LOG_PREFIX_SIZE + text_length + 1 > LOG_BATCH_SIZE) {
+        logger_flush(buffer, length);
+    }
+
+    *length += logger_prefix(time, buffer + *length);
+
+    memcpy(buffer + *length, text, text_length);
+
+    *length += text_length;
+
+    buffer[(*length)++] = '\n';
+}
+
+/**
+ * @brief Перенос всех готовых записей колец в буфер пачки
+ *
+ * @return int Количество перенесенных записей
+ */
+static int logger_drain(char* buffer, size_t* length) {
+    int drained = 0;
+
+    pthread_mutex_lock(&logger_mutex);
+
+    for (struct log_ring_t* ring = logger_rings; ring; ring = ring->next) {
+        int state = atomic_load_explicit(&ring->state, memory_order_acquire);
+
+        if (state == RING_FREE) {
+            continue;
+        }
+
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+        for (; head != tail; head++) {
+            struct log_record_t* record = &ring->records[head & (LOG_RING_SIZE - 1)];
+
+            logger_append(buffer, length, record->time, record->text, record->length);
+
+            drained++;
+        }
+
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        unsigned long dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+
+        if (dropped > 0) {
+            char text[64];
+            int text_length = snprintf(text, sizeof(text), "%lu log records were dropped", dropped);
+
+            logger_append(buffer, length, time(NULL), text, (size_t) text_length);
+        }
+
+        if (state == RING_CLOSED) {
+            atomic_store_explicit(&ring->state, RING_FREE, memory_order_release);
+        }
+
+    }
+
+    pthread_mutex_unlock(&logger_mutex);
+
+    return drained;
+}
+
+/**
+ * @brief Фоновый поток: собирает записи всех колец и выводит их пачками
+ *
+ */
+static void* logger_loop(void* arg) {
+    (void) arg;
+
+    char* buffer = malloc(LOG_BATCH_SIZE);
+    size_t length = 0;
+
+    if (!buffer) {
+        perror("logger_loop: malloc");
+
+        atomic_store(&logger_running, 0);
+
+        return NULL;
+    }
+
+    while (1) {
+        int drained = logger_drain(buffer, &length);
+
+        logger_flush(buffer, &length);
+
+        if (drained > 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&logger_mutex);
+
+        if (logger_stop) {
+            pthread_mutex_unlock(&logger_mutex);
+
+            break;
+        }
+
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_nsec += LOG_IDLE_MS * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&logger_cond, &logger_mutex, &deadline);
+
+        pthread_mutex_unlock(&logger_mutex);
+    }
+
+    logger_drain(buffer, &length);
+    logger_flush(buffer, &length);
+
+    free(buffer);
+
+    return NULL;
+}
+
+int logger_init(enum log_level level) {
+    logger_level = level;
+    logger_stop = 0;
+
+    int error = pthread_create(&logger_thread, NULL, logger_loop, NULL);
+
+    if (error != 0) {
+        fprintf(stderr, "logger_init: pthread_create: %s\n", strerror(error));
+
+        return -1;
+    }
+
+    atomic_store(&logger_running, 1);
+
+    return 0;
+}
+
+void logger_shutdown(void) {
+
+    if (!atomic_exchange(&logger_running, 0)) {
+        return;
+    }
+
+    pthread_mutex_lock(&logger_mutex);
+
+    logger_stop = 1;
+
+    pthread_cond_signal(&logger_cond);
+    pthread_mutex_unlock(&logger_mutex);
+
+    pthread_join(logger_thread, NULL);
+}
+
+int logger_parse_level(const char* name, enum log_level* level) {
+    static const char* names[] = { "error", "warn", "info", "debug" };
+
+    for (int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++) {
+
+        if (strcmp(name, names[i]) == 0) {
+            *level = (enum log_level) i;
+
+            return 0;
+        }
+
+    }
+
+    return -1;
+}
+
+void logger_write(const char* format, ...) {
+    struct timespec now;
+    va_list args;
+
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    struct log_ring_t* ring = atomic_load_explicit(&logger_running, memory_order_acquire) ? logger_ring() : NULL;
+
+    if (!ring) {
+        char line[LOG_PREFIX_SIZE + LOG_RECORD_SIZE + 1];
+        size_t length = logger_prefix(now.tv_sec, line);
+
+        va_start(args, format);
+
+        int count = vsnprintf(line + length, LOG_RECORD_SIZE, format, args);
+
+        va_end(args);
+
+        if (count < 0) {
+            return;
+        }
+
+        length += (size_t) count < LOG_RECORD_SIZE ? (size_t) count : LOG_RECORD_SIZE - 1;
+        line[length++] = '\n';
+
+        logger_flush(line, &length);
+
+        return;
+    }
+
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail - head == LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+
+        return;
+    }
+
+    struct log_record_t* record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+
+    va_start(args, format);
+
+    int count = vsnprintf(record->text, sizeof(record->text), format, args);
+
+    va_end(args);
+
+    if (count < 0) {
+        return;
+    }
+
+    record->time = now.tv_sec;
+    record->length = (size_t) count < sizeof(record->text) ? (uint32_t) count : (uint32_t) sizeof(record->text) - 1;
+
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
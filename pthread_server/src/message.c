@@ -0,0 +1,321 @@
+#include "../headers/message.h"
+#include "../headers/frame.h"
+
+#include <time.h>
+
+#define MESSAGE_QUEUE_MIN_CAPACITY      16
+
+static struct size_pool_t message_buffers;
+
+int message_pool_init(size_t preallocate) {
+    return size_pool_init(&message_buffers, "messages", MESSAGE_POOL_MIN_SIZE, MESSAGE_POOL_CLASSES, preallocate, 2 * BUFFER_SIZE);
+}
+
+struct size_pool_t* message_pool(void) {
+    return &message_buffers;
+}
+
+/**
+ * @brief Выделение сообщения с одной ссылкой под кадр не длиннее capacity
+ *
+ */
+static struct message_t* message_alloc(size_t capacity) {
+    int size_class = -1;
+    struct message_t* message = size_pool_alloc(&message_buffers, sizeof(struct message_t) + capacity, &size_class);
+
+    if (!message) {
+        perror("message_alloc: size_pool_alloc");
+
+        return NULL;
+    }
+
+    atomic_init(&message->refs, 1);
+
+    message->size_class = size_class;
+    message->seq = 0;
+    message->traced = 0;
+
+    atomic_init(&message->binary, NULL);
+
+    return message;
+}
+
+struct message_t* message_create(const char* frame, size_t length) {
+    struct message_t* message = message_alloc(length);
+
+    if (!message) {
+        return NULL;
+    }
+
+    message->length = length;
+
+    memcpy(message->data, frame, length);
+
+    return message;
+}
+
+struct message_t* message_printf(const char* format, ...) {
+    char frame[FRAME_HEADER_SIZE + BUFFER_SIZE];
+    va_list args;
+
+    va_start(args, format);
+
+    size_t length = frame_vprintf(frame, sizeof(frame), format, args);
+
+    va_end(args);
+
+    return message_create(frame, length);
+}
+
+struct message_t* message_format(size_t limit, const char* format, ...) {
+    va_list args;
+
+    va_start(args, format);
+
+    int written = vsnprintf(NULL, 0, format, args);
+
+    va_end(args);
+
+    if (written < 0) {
+        perror("message_format: vsnprintf");
+
+        return NULL;
+    }
+
+    size_t length = (size_t) written < limit ? (size_t) written : limit;
+    struct message_t* message = message_alloc(FRAME_HEADER_SIZE + length + 1);
+
+    if (!message) {
+        return NULL;
+    }
+
+    va_start(args, format);
+
+    message->length = frame_vprintf(message->data, FRAME_HEADER_SIZE + length + 1, format, args);
+
+    va_end(args);
+
+    return message;
+}
+
+struct message_t* message_event(uint8_t opcode, uint32_t sender, const char* name, uint64_t seq, const char* body, size_t length) {
+    size_t name_length = name ? strlen(name) : 0;
+    size_t limit = MAX_FRAME_PAYLOAD - PROTOCOL_HEADER_SIZE - name_length;
+    struct timespec now;
+
+    if (length > limit) {
+        length = limit;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    struct protocol_header_t header = {
+        .opcode = opcode,
+        .name_length = (uint16_t) name_length,
+        .sender = sender,
+        .seq = seq,
+        .timestamp = (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000
+    };
+
+    size_t payload = PROTOCOL_HEADER_SIZE + name_length + length;
+    struct message_t* message = message_alloc(FRAME_HEADER_SIZE + payload);
+
+    if (!message) {
+        return NULL;
+    }
+
+    char* data = message->data + FRAME_HEADER_SIZE;
+
+    frame_set_header(message->data, payload);
+    protocol_header_encode(data, &header);
+
+    if (name_length > 0) {
+        memcpy(data + PROTOCOL_HEADER_SIZE, name, name_length);
+    }
+
+    memcpy(data + PROTOCOL_HEADER_SIZE + name_length, body, length);
+
+    message->seq = seq;
+    message->length = FRAME_HEADER_SIZE + payload;
+
+    return message;
+}
+
+int message_attach_event(struct message_t* message, uint8_t opcode, const struct client_data_t* sender, const char* body, size_t length) {
+    struct message_t* event = message_event(opcode, sender->client_id, sender->client_name, message->seq, body, length);
+
+    if (!event) {
+        return -1;
+    }
+
+    event->traced = message->traced;
+
+    struct message_t* binary = atomic_load_explicit(&message->binary, memory_order_acquire);
+
+    while (!atomic_compare_exchange_weak_explicit(&message->binary, &binary, event, memory_order_acq_rel, memory_order_acquire)) {
+        continue;
+    }
+
+    if (binary) {
+        message_unref(binary);
+    }
+
+    return 0;
+}
+
+struct message_t* message_for(struct message_t* message, int protocol) {
+
+    if (protocol == 0) {
+        return message;
+    }
+
+    struct message_t* binary = atomic_load_explicit(&message->binary, memory_order_acquire);
+
+    if (binary) {
+        return binary;
+    }
+
+    struct message_t* info = message_event(PROTOCOL_OP_INFO, 0, NULL, message->seq, message->data + FRAME_HEADER_SIZE, message->length - FRAME_HEADER_SIZE);
+
+    if (!info) {
+        return NULL;
+    }
+
+    info->traced = message->traced;
+
+    if (!atomic_compare_exchange_strong_explicit(&message->binary, &binary, info, memory_order_acq_rel, memory_order_acquire)) {
+        message_unref(info);
+
+        return binary;
+    }
+
+    return info;
+}
+
+struct message_t* message_ref(struct message_t* message) {
+    atomic_fetch_add_explicit(&message->refs, 1, memory_order_relaxed);
+
+    return message;
+}
+
+void message_unref(struct message_t* message) {
+
+    if (atomic_fetch_sub_explicit(&message->refs, 1, memory_order_acq_rel) == 1) {
+        struct message_t* binary = atomic_load_explicit(&message->binary, memory_order_acquire);
+
+        if (binary) {
+            message_unref(binary);
+        }
+
+        size_pool_free(&message_buffers, message, message->size_class);
+    }
+
+}
+
+int message_queue_push(struct message_queue_t* queue, struct message_t* message, uint64_t now) {
+
+    if (queue->count == queue->capacity) {
+        unsigned capacity = queue->capacity ? queue->capacity * 2 : MESSAGE_QUEUE_MIN_CAPACITY;
+        struct queued_message_t* items = malloc(capacity * sizeof(struct queued_message_t));
+
+        if (!items) {
+            perror("message_queue_push: malloc");
+
+            return -1;
+        }
+
+        for (unsigned i = 0; i < queue->count; i++) {
+            items[i] = queue->items[(queue->head + i) & (queue->capacity - 1)];
+        }
+
+        free(queue->items);
+
+        queue->items = items;
+        queue->head = 0;
+        queue->capacity = capacity;
+    }
+
+    struct queued_message_t* item = &queue->items[(queue->head + queue->count) & (queue->capacity - 1)];
+
+    item->message = message_ref(message);
+    item->enqueued = now;
+
+    queue->count++;
+    queue->bytes += message->length;
+
+    return 0;
+}
+
+struct message_t* message_queue_at(const struct message_queue_t* queue, unsigned index) {
+    return queue->items[(queue->head + index) & (queue->capacity - 1)].message;
+}
+
+uint64_t message_queue_oldest(const struct message_queue_t* queue) {
+    return queue->items[queue->head].enqueued;
+}
+
+unsigned message_queue_truncate(struct message_queue_t* queue, unsigned keep) {
+    unsigned dropped = 0;
+
+    while (queue->count > keep) {
+        struct message_t* message = message_queue_at(queue, queue->count - 1);
+
+        queue->bytes -= message->length;
+
+        if (queue->count == 1) {
+            queue->bytes += queue->offset;
+            queue->offset = 0;
+        }
+
+        message_unref(message);
+
+        queue->count--;
+
+        dropped++;
+    }
+
+    return dropped;
+}
+
+void message_queue_consume(struct message_queue_t* queue, size_t length) {
+
+    queue->bytes -= length;
+
+    while (queue->count > 0) {
+        struct message_t* message = queue->items[queue->head].message;
+        size_t left = message->length - queue->offset;
+
+        if (length < left) {
+            queue->offset += length;
+
+            return;
+        }
+
+        length -= left;
+
+        message_unref(message);
+
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+        queue->count--;
+        queue->offset = 0;
+    }
+
+}
+
+void message_queue_clear(struct message_queue_t* queue) {
+
+    while (queue->count > 0) {
+        message_unref(queue->items[queue->head].message);
+
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+        queue->count--;
+    }
+
+    free(queue->items);
+
+    queue->items = NULL;
+    queue->head = 0;
+    queue->capacity = 0;
+    queue->offset = 0;
+    queue->bytes = 0;
+}
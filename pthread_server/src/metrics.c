@@ -0,0 +1,261 @@
+#include "../headers/metrics.h"
+#include "../headers/trace.h"
+
+#include <time.h>
+
+#define METRICS_SUB_COUNT   (1 << METRICS_SUB_BITS)
+
+__thread struct metrics_t* metrics_self = NULL;
+
+static _Atomic(struct metrics_t*) metrics_blocks = NULL;
+
+static pthread_once_t metrics_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t metrics_key;
+
+/**
+ * @brief Блок для потоков, которым не хватило памяти
+ *
+ * Пишут в него несколько потоков, поэтому часть обновлений может потеряться
+ */
+static struct metrics_t metrics_fallback;
+
+/**
+ * @brief Освобождает блок завершившегося потока для следующего потока
+ *
+ */
+static void metrics_release(void* arg) {
+    struct metrics_t* block = (struct metrics_t*) arg;
+
+    atomic_store_explicit(&block->in_use, 0, memory_order_release);
+}
+
+static void metrics_create_key(void) {
+    pthread_key_create(&metrics_key, metrics_release);
+}
+
+struct metrics_t* metrics_attach(void) {
+    struct metrics_t* block = atomic_load_explicit(&metrics_blocks, memory_order_acquire);
+
+    for (; block; block = block->next) {
+        int expected = 0;
+
+        if (atomic_compare_exchange_strong(&block->in_use, &expected, 1)) {
+            break;
+        }
+
+    }
+
+    if (!block) {
+        block = calloc(1, sizeof(struct metrics_t));
+
+        if (!block) {
+            perror("metrics_attach: calloc");
+
+            metrics_self = &metrics_fallback;
+
+            return metrics_self;
+        }
+
+        atomic_init(&block->in_use, 1);
+
+        struct metrics_t* head = atomic_load_explicit(&metrics_blocks, memory_order_relaxed);
+
+        do {
+            block->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&metrics_blocks, &head, block, memory_order_release, memory_order_relaxed));
+
+    }
+
+    pthread_once(&metrics_key_once, metrics_create_key);
+    pthread_setspecific(metrics_key, block);
+
+    metrics_self = block;
+
+    return block;
+}
+
+uint64_t metrics_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * @brief Номер корзины значения
+ *
+ */
+static int metrics_bucket(uint64_t value) {
+
+    if (value < METRICS_SUB_COUNT) {
+        return (int) value;
+    }
+
+    int shift = 63 - __builtin_clzll(value) - METRICS_SUB_BITS;
+
+    return ((shift + 1) << METRICS_SUB_BITS) + (int) ((value >> shift) & (METRICS_SUB_COUNT - 1));
+}
+
+/**
+ * @brief Наибольшее значение, попадающее в корзину
+ *
+ */
+static uint64_t metrics_bucket_upper(int bucket) {
+
+    if (bucket < METRICS_SUB_COUNT) {
+        return (uint64_t) bucket;
+    }
+
+    int shift = (bucket >> METRICS_SUB_BITS) - 1;
+    uint64_t mantissa = (uint64_t) ((bucket & (METRICS_SUB_COUNT - 1)) | METRICS_SUB_COUNT);
+
+    return (mantissa << shift) + ((1ULL << shift) - 1);
+}
+
+/**
+ * @brief Увеличение значения, которое меняет только текущий поток
+ *
+ */
+static void metrics_bump(metric_t* metric, uint64_t value) {
+    atomic_store_explicit(metric, atomic_load_explicit(metric, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void metrics_record(enum metrics_histogram histogram, uint64_t value) {
+    struct metrics_histogram_t* target = &metrics_local()->histograms[histogram];
+
+    metrics_bump(&target->counts[metrics_bucket(value)], 1);
+    metrics_bump(&target->count, 1);
+    metrics_bump(&target->sum, value);
+
+    if (value > atomic_load_explicit(&target->max, memory_order_relaxed)) {
+        atomic_store_explicit(&target->max, value, memory_order_relaxed);
+    }
+
+}
+
+void metrics_lock(pthread_mutex_t* mutex) {
+    uint64_t start = trace_active() ? metrics_now() : 0;
+
+    if (pthread_mutex_trylock(mutex) == 0) {
+
+        if (start) {
+            metrics_record(METRICS_LOCK, metrics_now() - start);
+        }
+
+        TRACE_PROBE2(lock, mutex, 0);
+
+        return;
+    }
+
+    if (!start) {
+        start = metrics_now();
+    }
+
+    pthread_mutex_lock(mutex);
+
+    uint64_t waited = metrics_now() - start;
+
+    metrics_add(METRICS_LOCK_WAITS, 1);
+    metrics_record(METRICS_LOCK_WAIT, waited);
+
+    if (trace_active()) {
+        metrics_record(METRICS_LOCK, waited);
+    }
+
+    TRACE_PROBE2(lock, mutex, waited);
+}
+
+/**
+ * @brief Прибавление значения к результату сбора
+ *
+ */
+static void metrics_merge(metric_t* total, const metric_t* value) {
+    atomic_store_explicit(total, atomic_load_explicit(total, memory_order_relaxed) + atomic_load_explicit(value, memory_order_relaxed), memory_order_relaxed);
+}
+
+/**
+ * @brief Наибольшее из значений результата сбора и блока
+ *
+ */
+static void metrics_merge_max(metric_t* total, const metric_t* value) {
+    uint64_t current = atomic_load_explicit(value, memory_order_relaxed);
+
+    if (current > atomic_load_explicit(total, memory_order_relaxed)) {
+        atomic_store_explicit(total, current, memory_order_relaxed);
+    }
+
+}
+
+/**
+ * @brief Добавление одного блока к результату сбора
+ *
+ */
+static void metrics_collect_block(struct metrics_t* total, const struct metrics_t* block) {
+
+    for (int i = 0; i < METRICS_COUNTERS; i++) {
+
+        if (i == METRICS_QUEUE_HIGH_WATER) {
+            metrics_merge_max(&total->counters[i], &block->counters[i]);
+        } else {
+            metrics_merge(&total->counters[i], &block->counters[i]);
+        }
+
+    }
+
+    for (int i = 0; i < METRICS_HISTOGRAMS; i++) {
+        struct metrics_histogram_t* target = &total->histograms[i];
+        const struct metrics_histogram_t* source = &block->histograms[i];
+
+        for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+            metrics_merge(&target->counts[bucket], &source->counts[bucket]);
+        }
+
+        metrics_merge(&target->count, &source->count);
+        metrics_merge(&target->sum, &source->sum);
+        metrics_merge_max(&target->max, &source->max);
+    }
+
+}
+
+void metrics_collect(struct metrics_t* total) {
+
+    for (struct metrics_t* block = atomic_load_explicit(&metrics_blocks, memory_order_acquire); block; block = block->next) {
+        metrics_collect_block(total, block);
+    }
+
+    metrics_collect_block(total, &metrics_fallback);
+}
+
+uint64_t metrics_quantile(const struct metrics_histogram_t* histogram, double quantile) {
+    uint64_t total = 0;
+
+    for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+        total += atomic_load_explicit(&histogram->counts[bucket], memory_order_relaxed);
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (quantile * (double) total);
+    uint64_t seen = 0;
+
+    if (rank >= total) {
+        rank = total - 1;
+    }
+
+    for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+        seen += atomic_load_explicit(&histogram->counts[bucket], memory_order_relaxed);
+
+        if (seen > rank) {
+            uint64_t upper = metrics_bucket_upper(bucket);
+            uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+
+            return upper < max ? upper : max;
+        }
+
+    }
+
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
@@ -0,0 +1,154 @@
+#include "../headers/name_index.h"
+
+/**
+ * @brief Номер корзины для имени (FNV-1a)
+ *
+ */
+static uint32_t name_bucket(const struct name_index_t* index, const char* name) {
+    uint32_t hash = 2166136261u;
+
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+
+    return hash & index->mask;
+}
+
+int name_index_init(struct name_index_t* index, int capacity) {
+    uint32_t bucket_count = 1;
+
+    while (bucket_count < (uint32_t) capacity) {
+        bucket_count <<= 1;
+    }
+
+    index->buckets = calloc(bucket_count, sizeof(struct name_entry_t*));
+
+    if (!index->buckets) {
+        perror("name_index_init: calloc");
+
+        return -1;
+    }
+
+    index->mask = bucket_count - 1;
+
+    atomic_init(&index->count, 0);
+
+    for (int i = 0; i < NAME_LOCKS; i++) {
+        pthread_mutex_init(&index->locks[i], NULL);
+    }
+
+    return 0;
+}
+
+void name_index_free(struct name_index_t* index) {
+
+    for (uint32_t i = 0; i <= index->mask; i++) {
+        struct name_entry_t* entry = index->buckets[i];
+
+        while (entry) {
+            struct name_entry_t* next = entry->next;
+
+            free(entry);
+
+            entry = next;
+        }
+
+    }
+
+    for (int i = 0; i < NAME_LOCKS; i++) {
+        pthread_mutex_destroy(&index->locks[i]);
+    }
+
+    free(index->buckets);
+}
+
+int name_index_add(struct name_index_t* index, const struct client_data_t* c_data) {
+    uint32_t bucket = name_bucket(index, c_data->client_name);
+    pthread_mutex_t* lock = &index->locks[bucket % NAME_LOCKS];
+
+    struct name_entry_t* added = malloc(sizeof(struct name_entry_t));
+
+    if (!added) {
+        perror("name_index_add: malloc");
+
+        return -1;
+    }
+
+    memcpy(added->name, c_data->client_name, MAX_NAME_LENGTH);
+
+    added->target = *c_data;
+    added->target.room = NULL;
+
+    pthread_mutex_lock(lock);
+
+    for (struct name_entry_t* entry = index->buckets[bucket]; entry; entry = entry->next) {
+
+        if (strcmp(entry->name, added->name) == 0) {
+            pthread_mutex_unlock(lock);
+
+            free(added);
+
+            return 1;
+        }
+
+    }
+
+    added->next = index->buckets[bucket];
+    index->buckets[bucket] = added;
+
+    pthread_mutex_unlock(lock);
+
+    atomic_fetch_add(&index->count, 1);
+
+    return 0;
+}
+
+void name_index_remove(struct name_index_t* index, const struct client_data_t* c_data) {
+    uint32_t bucket = name_bucket(index, c_data->client_name);
+    pthread_mutex_t* lock = &index->locks[bucket % NAME_LOCKS];
+
+    pthread_mutex_lock(lock);
+
+    for (struct name_entry_t** link = &index->buckets[bucket]; *link; link = &(*link)->next) {
+        struct name_entry_t* entry = *link;
+
+        if (entry->target.client_fd == c_data->client_fd && entry->target.conn == c_data->conn && strcmp(entry->name, c_data->client_name) == 0) {
+            *link = entry->next;
+
+            pthread_mutex_unlock(lock);
+
+            free(entry);
+
+            atomic_fetch_sub(&index->count, 1);
+
+            return;
+        }
+
+    }
+
+    pthread_mutex_unlock(lock);
+}
+
+int name_index_find(struct name_index_t* index, const char* name, struct client_data_t* target) {
+    uint32_t bucket = name_bucket(index, name);
+    pthread_mutex_t* lock = &index->locks[bucket % NAME_LOCKS];
+
+    pthread_mutex_lock(lock);
+
+    for (struct name_entry_t* entry = index->buckets[bucket]; entry; entry = entry->next) {
+
+        if (strcmp(entry->name, name) == 0) {
+            *target = entry->target;
+
+            pthread_mutex_unlock(lock);
+
+            return 1;
+        }
+
+    }
+
+    pthread_mutex_unlock(lock);
+
+    return 0;
+}
@@ -0,0 +1,332 @@
+#include "../headers/pool.h"
+
+#define POOL_ALIGNMENT      16
+#define POOL_BATCH          (POOL_CACHE_SIZE / 2)
+
+/**
+ * @brief Кэш одного пула в одном потоке
+ */
+struct pool_cache_t {
+    void* items[POOL_CACHE_SIZE];           ///< Свободные объекты
+    int count;                              ///< Количество объектов в кэше
+};
+
+/**
+ * @brief Заголовок блока, из которого нарезаются объекты
+ */
+struct pool_chunk_t {
+    struct pool_chunk_t* next;              ///< Следующий блок пула
+    size_t padding;                         ///< Выравнивает объекты блока на POOL_ALIGNMENT
+};
+
+static struct object_pool_t* pool_registry[POOL_MAX_POOLS];
+static atomic_int pool_count = 0;
+
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+
+static __thread struct pool_cache_t pool_caches[POOL_MAX_POOLS];
+static __thread int pool_thread_registered = 0;
+
+/**
+ * @brief Кладет на склад count объектов
+ *
+ * @warning Вызывать под мьютексом пула
+ */
+static void pool_push_locked(struct object_pool_t* pool, void** items, int count) {
+
+    for (int i = 0; i < count; i++) {
+        *(void**) items[i] = pool->free_list;
+        pool->free_list = items[i];
+    }
+
+    pool->free_count += count;
+}
+
+/**
+ * @brief Возвращает на склады кэши завершившегося потока
+ *
+ */
+static void pool_thread_exit(void* arg) {
+    (void) arg;
+
+    int count = atomic_load(&pool_count);
+
+    for (int i = 0; i < count; i++) {
+        struct pool_cache_t* cache = &pool_caches[i];
+        struct object_pool_t* pool = pool_registry[i];
+
+        if (cache->count == 0 || !pool) {
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+
+        pool_push_locked(pool, cache->items, cache->count);
+
+        pthread_mutex_unlock(&pool->mutex);
+
+        cache->count = 0;
+    }
+
+}
+
+static void pool_create_key(void) {
+    pthread_key_create(&pool_key, pool_thread_exit);
+}
+
+/**
+ * @brief Кэш пула текущего потока
+ *
+ * При первом обращении поток регистрирует сброс своих кэшей при завершении
+ */
+static struct pool_cache_t* pool_cache(struct object_pool_t* pool) {
+
+    if (!pool_thread_registered) {
+        pthread_once(&pool_key_once, pool_create_key);
+        pthread_setspecific(pool_key, pool_caches);
+
+        pool_thread_registered = 1;
+    }
+
+    return &pool_caches[pool->id];
+}
+
+/**
+ * @brief Нарезает новый блок объектов на склад
+ *
+ * @warning Вызывать под мьютексом пула
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int pool_grow_locked(struct object_pool_t* pool, size_t count) {
+    struct pool_chunk_t* chunk = malloc(sizeof(struct pool_chunk_t) + count * pool->object_size);
+
+    if (!chunk) {
+        perror("pool_grow: malloc");
+
+        return -1;
+    }
+
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+
+    char* objects = (char*) (chunk + 1);
+
+    for (size_t i = 0; i < count; i++) {
+        void* object = objects + i * pool->object_size;
+
+        *(void**) object = pool->free_list;
+        pool->free_list = object;
+    }
+
+    pool->free_count += count;
+    pool->capacity += count;
+
+    return 0;
+}
+
+/**
+ * @brief Количество объектов в одном блоке
+ *
+ */
+static size_t pool_chunk_objects(struct object_pool_t* pool) {
+    size_t count = POOL_CHUNK_BYTES / pool->object_size;
+
+    return count < POOL_BATCH ? POOL_BATCH : count;
+}
+
+/**
+ * @brief Обновляет наибольшее количество объектов вне склада
+ *
+ * @warning Вызывать под мьютексом пула
+ */
+static void pool_update_high_water(struct object_pool_t* pool) {
+    size_t live = pool->capacity - pool->free_count;
+
+    if (live > pool->high_water) {
+        pool->high_water = live;
+    }
+
+}
+
+int object_pool_init(struct object_pool_t* pool, const char* name, size_t object_size, size_t preallocate) {
+    int id = atomic_fetch_add(&pool_count, 1);
+
+    if (id >= POOL_MAX_POOLS) {
+        fprintf(stderr, "object_pool_init: too many pools (%d)\n", POOL_MAX_POOLS);
+
+        atomic_fetch_sub(&pool_count, 1);
+
+        return -1;
+    }
+
+    if (object_size < sizeof(void*)) {
+        object_size = sizeof(void*);
+    }
+
+    pool->name = name;
+    pool->object_size = (object_size + POOL_ALIGNMENT - 1) & ~(size_t) (POOL_ALIGNMENT - 1);
+    pool->id = id;
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    pool->chunks = NULL;
+    pool->capacity = 0;
+    pool->high_water = 0;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    if (preallocate > 0 && pool_grow_locked(pool, preallocate) < 0) {
+        pthread_mutex_destroy(&pool->mutex);
+
+        return -1;
+    }
+
+    pool_registry[id] = pool;
+
+    return 0;
+}
+
+void object_pool_destroy(struct object_pool_t* pool) {
+    pool_registry[pool->id] = NULL;
+    pool_caches[pool->id].count = 0;
+
+    struct pool_chunk_t* chunk = pool->chunks;
+
+    while (chunk) {
+        struct pool_chunk_t* next = chunk->next;
+
+        free(chunk);
+
+        chunk = next;
+    }
+
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+void* object_pool_alloc(struct object_pool_t* pool) {
+    struct pool_cache_t* cache = pool_cache(pool);
+
+    if (cache->count > 0) {
+        return cache->items[--cache->count];
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+
+    if (pool->free_count == 0 && pool_grow_locked(pool, pool_chunk_objects(pool)) < 0) {
+        pthread_mutex_unlock(&pool->mutex);
+
+        return NULL;
+    }
+
+    while (cache->count < POOL_BATCH && pool->free_list) {
+        void* object = pool->free_list;
+
+        pool->free_list = *(void**) object;
+        pool->free_count--;
+
+        cache->items[cache->count++] = object;
+    }
+
+    pool_update_high_water(pool);
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return cache->items[--cache->count];
+}
+
+void object_pool_free(struct object_pool_t* pool, void* object) {
+    struct pool_cache_t* cache = pool_cache(pool);
+
+    if (cache->count == POOL_CACHE_SIZE) {
+        pthread_mutex_lock(&pool->mutex);
+
+        pool_push_locked(pool, cache->items + POOL_CACHE_SIZE - POOL_BATCH, POOL_BATCH);
+
+        pthread_mutex_unlock(&pool->mutex);
+
+        cache->count -= POOL_BATCH;
+    }
+
+    cache->items[cache->count++] = object;
+}
+
+void object_pool_stats(struct object_pool_t* pool, struct pool_stats_t* stats) {
+    pthread_mutex_lock(&pool->mutex);
+
+    stats->capacity = pool->capacity;
+    stats->live = pool->capacity - pool->free_count;
+    stats->high_water = pool->high_water;
+
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void object_pool_foreach(object_pool_callback callback, void* arg) {
+    int count = atomic_load(&pool_count);
+
+    if (count > POOL_MAX_POOLS) {
+        count = POOL_MAX_POOLS;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct object_pool_t* pool = pool_registry[i];
+
+        if (pool) {
+            callback(pool, arg);
+        }
+
+    }
+
+}
+
+int size_pool_init(struct size_pool_t* pool, const char* name, size_t min_size, int class_count, size_t preallocate, size_t preallocate_limit) {
+
+    if (class_count > SIZE_POOL_MAX_CLASSES) {
+        class_count = SIZE_POOL_MAX_CLASSES;
+    }
+
+    pool->class_count = 0;
+    pool->min_size = min_size;
+
+    for (int i = 0; i < class_count; i++) {
+        size_t size = min_size << i;
+
+        if (object_pool_init(&pool->classes[i], name, size, size <= preallocate_limit ? preallocate : 0) < 0) {
+            return -1;
+        }
+
+        pool->class_count++;
+    }
+
+    return 0;
+}
+
+void* size_pool_alloc(struct size_pool_t* pool, size_t size, int* size_class) {
+
+    for (int i = 0; i < pool->class_count; i++) {
+
+        if (size <= pool->min_size << i) {
+            *size_class = i;
+
+            return object_pool_alloc(&pool->classes[i]);
+        }
+
+    }
+
+    *size_class = -1;
+
+    return malloc(size);
+}
+
+void size_pool_free(struct size_pool_t* pool, void* buffer, int size_class) {
+
+    if (size_class < 0) {
+        free(buffer);
+
+        return;
+    }
+
+    object_pool_free(&pool->classes[size_class], buffer);
+}
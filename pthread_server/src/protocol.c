@@ -0,0 +1,222 @@
+#include "../headers/protocol.h"
+
+#include <string.h>
+
+/**
+ * @brief Запись беззнакового числа size байт в big-endian
+ *
+ */
+static void put_be(char* out, uint64_t value, int size) {
+
+    for (int i = size - 1; i >= 0; i--) {
+        out[i] = (char) (value & 0xff);
+        value >>= 8;
+    }
+
+}
+
+/**
+ * @brief Чтение беззнакового числа size байт в big-endian
+ *
+ */
+static uint64_t get_be(const char* in, int size) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < size; i++) {
+        value = (value << 8) | (unsigned char) in[i];
+    }
+
+    return value;
+}
+
+size_t protocol_hello_encode(char* payload, uint8_t min_version, uint8_t max_version) {
+    memcpy(payload, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+
+    payload[PROTOCOL_MAGIC_SIZE] = (char) min_version;
+    payload[PROTOCOL_MAGIC_SIZE + 1] = (char) max_version;
+
+    return PROTOCOL_HELLO_SIZE;
+}
+
+int protocol_hello_negotiate(const char* payload, size_t length) {
+
+    if (length != PROTOCOL_HELLO_SIZE || memcmp(payload, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) != 0) {
+        return -1;
+    }
+
+    unsigned min_version = (unsigned char) payload[PROTOCOL_MAGIC_SIZE];
+    unsigned max_version = (unsigned char) payload[PROTOCOL_MAGIC_SIZE + 1];
+
+    if (min_version > PROTOCOL_VERSION || max_version < 1 || min_version > max_version) {
+        return 0;
+    }
+
+    return max_version < PROTOCOL_VERSION ? (int) max_version : PROTOCOL_VERSION;
+}
+
+void protocol_header_encode(char* payload, const struct protocol_header_t* header) {
+    payload[0] = (char) header->opcode;
+    payload[1] = (char) header->flags;
+
+    put_be(payload + 2, header->name_length, 2);
+    put_be(payload + 4, header->sender, 4);
+    put_be(payload + 8, header->seq, 8);
+    put_be(payload + 16, header->timestamp, 8);
+}
+
+int protocol_header_decode(const char* payload, size_t length, struct protocol_header_t* header) {
+
+    if (length < PROTOCOL_HEADER_SIZE) {
+        return -1;
+    }
+
+    header->opcode = (uint8_t) payload[0];
+    header->flags = (uint8_t) payload[1];
+    header->name_length = (uint16_t) get_be(payload + 2, 2);
+    header->sender = (uint32_t) get_be(payload + 4, 4);
+    header->seq = get_be(payload + 8, 8);
+    header->timestamp = get_be(payload + 16, 8);
+
+    return length - PROTOCOL_HEADER_SIZE < header->name_length ? -1 : 0;
+}
+
+size_t protocol_command_encode(char* payload, size_t size, const struct protocol_command_t* command) {
+    size_t offset = 1;
+    size_t target_length = command->target_length;
+    size_t text_length = command->text_length;
+
+    if (size < 1 + 1 + 8) {
+        return 0;
+    }
+
+    payload[0] = (char) command->opcode;
+
+    switch (command->opcode) {
+        case PROTOCOL_OP_LIST:
+            payload[offset++] = (char) command->list_mode;
+
+            put_be(payload + offset, command->number, 8);
+
+            return offset + 8;
+
+        case PROTOCOL_OP_JOIN:
+            put_be(payload + offset, command->number, 8);
+
+            offset += 8;
+            text_length = 0;
+
+            break;
+
+        case PROTOCOL_OP_DIRECT:
+
+            if (target_length > 255) {
+                target_length = 255;
+            }
+
+            payload[offset++] = (char) target_length;
+
+            break;
+
+        case PROTOCOL_OP_NAME:
+            text_length = 0;
+
+            break;
+
+        case PROTOCOL_OP_MESSAGE:
+            target_length = 0;
+
+            break;
+
+        default:
+            return offset;
+    }
+
+    if (target_length > size - offset) {
+        target_length = size - offset;
+    }
+
+    memcpy(payload + offset, command->target, target_length);
+
+    offset += target_length;
+
+    if (text_length > size - offset) {
+        text_length = size - offset;
+    }
+
+    memcpy(payload + offset, command->text, text_length);
+
+    return offset + text_length;
+}
+
+int protocol_command_decode(const char* payload, size_t length, struct protocol_command_t* command) {
+
+    if (length < 1) {
+        return -1;
+    }
+
+    memset(command, 0, sizeof(*command));
+
+    command->opcode = (uint8_t) payload[0];
+
+    const char* args = payload + 1;
+    size_t size = length - 1;
+
+    switch (command->opcode) {
+        case PROTOCOL_OP_QUIT:
+        case PROTOCOL_OP_LEAVE:
+        case PROTOCOL_OP_ROOMS:
+            return 0;
+
+        case PROTOCOL_OP_LIST:
+
+            if (size != 1 + 8) {
+                return -1;
+            }
+
+            command->list_mode = (uint8_t) args[0];
+            command->number = get_be(args + 1, 8);
+
+            return 0;
+
+        case PROTOCOL_OP_JOIN:
+
+            if (size < 8) {
+                return -1;
+            }
+
+            command->number = get_be(args, 8);
+            command->target = args + 8;
+            command->target_length = size - 8;
+
+            return 0;
+
+        case PROTOCOL_OP_DIRECT:
+
+            if (size < 1 || size - 1 < (unsigned char) args[0]) {
+                return -1;
+            }
+
+            command->target = args + 1;
+            command->target_length = (unsigned char) args[0];
+            command->text = command->target + command->target_length;
+            command->text_length = size - 1 - command->target_length;
+
+            return 0;
+
+        case PROTOCOL_OP_NAME:
+            command->target = args;
+            command->target_length = size;
+
+            return 0;
+
+        case PROTOCOL_OP_MESSAGE:
+            command->text = args;
+            command->text_length = size;
+
+            return 0;
+
+        default:
+            return -1;
+    }
+
+}
@@ -0,0 +1,1561 @@
+#define _GNU_SOURCE
+
+#include "../headers/reactor.h"
+#include "../headers/chat_room.h"
+#include "../headers/client_handler.h"
+#include "../headers/client_utils.h"
+#include "../headers/listener.h"
+#include "../headers/logger.h"
+#include "../headers/metrics.h"
+#include "../headers/name_index.h"
+#include "../headers/pool.h"
+#include "../headers/room_registry.h"
+#include "../headers/trace.h"
+#include "../headers/upgrade.h"
+#include "../headers/uring.h"
+#include "../headers/zerocopy.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define MAX_EVENTS              256
+#define MAX_FLUSH_IOV           64
+
+/**
+ * @brief Поднимает мягкий лимит открытых дескрипторов до жесткого
+ *
+ * Каждый клиент реактора - это один дескриптор, лимита по умолчанию хватает на ~1000 клиентов
+ *
+ */
+static void raise_fd_limit(void) {
+    struct rlimit limit = {0};
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        perror("raise_fd_limit: getrlimit");
+
+        return;
+    }
+
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0) {
+            perror("raise_fd_limit: setrlimit");
+        }
+
+    }
+
+}
+
+static struct object_pool_t connection_pool;
+static struct object_pool_t inbound_pool;
+static atomic_int running_reactors;
+
+void connection_schedule_close(struct connection_t* conn) {
+
+    if (conn->failed || conn->state == CONN_CLOSED) {
+        return;
+    }
+
+    conn->failed = 1;
+    conn->next_pending = conn->reactor->closing;
+    conn->reactor->closing = conn;
+}
+
+void reactor_update_clock(struct reactor_t* reactor) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    reactor->now = (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+void connection_mark_dirty(struct connection_t* conn) {
+
+    if (conn->dirty) {
+        return;
+    }
+
+    conn->dirty = 1;
+    conn->next_dirty = conn->reactor->dirty;
+    conn->reactor->dirty = conn;
+}
+
+void connection_consume(struct connection_t* conn, size_t length) {
+    unsigned count = conn->out.count;
+
+    message_queue_consume(&conn->out, length);
+
+    metrics_sub(METRICS_QUEUED_MESSAGES, count - conn->out.count);
+    metrics_sub(METRICS_QUEUED_BYTES, length);
+    metrics_add(METRICS_MESSAGES_OUT, count - conn->out.count);
+    metrics_add(METRICS_BYTES_OUT, length);
+}
+
+/**
+ * @brief Ставит ссылку на сообщение в исходящую очередь с учетом счетчиков
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int connection_enqueue(struct connection_t* conn, struct message_t* message) {
+
+    if (message_queue_push(&conn->out, message, conn->reactor->now) < 0) {
+        return -1;
+    }
+
+    metrics_add(METRICS_QUEUED_MESSAGES, 1);
+    metrics_add(METRICS_QUEUED_BYTES, message->length);
+    metrics_max(METRICS_QUEUE_HIGH_WATER, conn->out.count);
+
+    return 0;
+}
+
+/**
+ * @brief Превысит ли очередь соединения лимиты, если добавить length байт
+ *
+ */
+static int connection_over_budget(struct connection_t* conn, size_t length) {
+    const struct server_config_t* config = conn->reactor->config;
+
+    if (conn->out.bytes + length > config->queue_bytes) {
+        return 1;
+    }
+
+    return conn->out.count > 0 && conn->reactor->now - message_queue_oldest(&conn->out) > (uint64_t) config->queue_age_ms;
+}
+
+/**
+ * @brief Обработка клиента, очередь которого превысила лимиты
+ *
+ * Сообщения, которые уже начали отправляться, выбросить нельзя: если среди них
+ * есть слишком старое, клиент отключается при любой политике. Если предыдущее
+ * уведомление о пропуске тоже выброшено, его счетчик переходит в новое
+ *
+ * @return int 0 если в очередь можно добавлять сообщения, -1 если соединение закрывается
+ */
+static int connection_handle_slow(struct connection_t* conn) {
+    struct reactor_t* reactor = conn->reactor;
+    unsigned keep = conn->sends_in_flight > 0 ? (unsigned) conn->sends_in_flight : (conn->out.offset > 0 ? 1 : 0);
+    int stalled = keep > 0 && reactor->now - message_queue_oldest(&conn->out) > (uint64_t) reactor->config->queue_age_ms;
+
+    if (reactor->config->slow_policy == SLOW_DISCONNECT || stalled) {
+        log_printf(LOG_LEVEL_WARN, "Client %s:%d is too slow (%u messages, %zu bytes queued), disconnecting", conn->data.client_ip, conn->data.client_port, conn->out.count, conn->out.bytes);
+
+        metrics_add(METRICS_EVICTIONS, 1);
+
+        connection_schedule_close(conn);
+
+        return -1;
+    }
+
+    unsigned skipped = 0;
+    unsigned notices = 0;
+
+    if (conn->gap_notice) {
+
+        for (unsigned i = keep; i < conn->out.count; i++) {
+
+            if (message_queue_at(&conn->out, i) == conn->gap_notice) {
+                skipped = conn->gap_skipped;
+                notices = 1;
+
+                break;
+            }
+
+        }
+
+        message_unref(conn->gap_notice);
+
+        conn->gap_notice = NULL;
+    }
+
+    size_t bytes = conn->out.bytes;
+    unsigned dropped = message_queue_truncate(&conn->out, keep);
+
+    skipped += dropped - notices;
+
+    metrics_sub(METRICS_QUEUED_MESSAGES, dropped);
+    metrics_sub(METRICS_QUEUED_BYTES, bytes - conn->out.bytes);
+    metrics_add(METRICS_DROPPED, dropped - notices);
+    metrics_add(METRICS_GAPS, 1);
+
+    struct message_t* notice = message_printf("%u messages were skipped: connection is too slow", skipped);
+    struct message_t* frame = notice ? message_for(notice, conn->data.protocol) : NULL;
+
+    if (!frame) {
+
+        if (notice) {
+            message_unref(notice);
+        }
+
+        connection_schedule_close(conn);
+
+        return -1;
+    }
+
+    conn->gap_notice = message_ref(frame);
+    conn->gap_skipped = skipped;
+
+    int result = connection_enqueue(conn, frame);
+
+    message_unref(notice);
+
+    if (result < 0) {
+        connection_schedule_close(conn);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Отправляется ли кадр сообщения соединению с MSG_ZEROCOPY
+ *
+ */
+static int connection_zerocopy(const struct connection_t* conn, const struct message_t* message) {
+    return conn->zerocopy && message->length >= conn->reactor->config->zerocopy_bytes;
+}
+
+/**
+ * @brief Отправка начала исходящей очереди одним sendmsg() с массивом iovec
+ *
+ * В массив попадают сообщения до первого кадра, который отправляется с MSG_ZEROCOPY.
+ * Если в массив попала не вся очередь, вызов идет с MSG_MORE:
+ * ядро не отправляет неполный сегмент, пока не придет остаток
+ *
+ * @return ssize_t Как у sendmsg()
+ */
+static ssize_t connection_send_batch(struct connection_t* conn) {
+    struct iovec iov[MAX_FLUSH_IOV];
+    unsigned count = conn->out.count < MAX_FLUSH_IOV ? conn->out.count : MAX_FLUSH_IOV;
+
+    for (unsigned i = 0; i < count; i++) {
+        struct message_t* message = message_queue_at(&conn->out, i);
+        size_t offset = i == 0 ? conn->out.offset : 0;
+
+        if (i > 0 && connection_zerocopy(conn, message)) {
+            count = i;
+
+            break;
+        }
+
+        iov[i].iov_base = message->data + offset;
+        iov[i].iov_len = message->length - offset;
+    }
+
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = count
+    };
+
+    return sendmsg(conn->data.client_fd, &msg, count < conn->out.count ? MSG_NOSIGNAL | MSG_MORE : MSG_NOSIGNAL);
+}
+
+/**
+ * @brief Дописывает исходящую очередь в сокет
+ *
+ * Короткие сообщения уходят пачками через connection_send_batch(),
+ * длинный кадр при включенном MSG_ZEROCOPY - отдельным вызовом
+ *
+ * @return int 0 если очередь отправлена или ядро не принимает данные, -1 при ошибке
+ */
+static int connection_flush(struct connection_t* conn) {
+
+    while (conn->out.count > 0) {
+        struct message_t* first = message_queue_at(&conn->out, 0);
+        ssize_t count_of_bytes = 0;
+
+        if (connection_zerocopy(conn, first)) {
+            count_of_bytes = zerocopy_send(conn->zerocopy, conn->data.client_fd, first, conn->out.offset, conn->out.count > 1 ? MSG_NOSIGNAL | MSG_MORE : MSG_NOSIGNAL);
+        } else {
+            count_of_bytes = connection_send_batch(conn);
+        }
+
+        if (count_of_bytes < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+
+            perror("connection_flush: sendmsg");
+
+            return -1;
+        }
+
+        metrics_add(METRICS_SEND_CALLS, 1);
+
+        connection_consume(conn, count_of_bytes);
+    }
+
+    return 0;
+}
+
+int connection_write(struct connection_t* conn, struct message_t* message) {
+
+    if (conn->failed || conn->state == CONN_CLOSED) {
+        return 0;
+    }
+
+    message = message_for(message, conn->data.protocol);
+
+    if (!message) {
+        connection_schedule_close(conn);
+
+        return 0;
+    }
+
+    size_t sent = 0;
+
+    if (conn->out.count == 0 && !conn->reactor->ring && conn->reactor->config->flush == FLUSH_IMMEDIATE) {
+
+        while (sent < message->length) {
+            ssize_t count_of_bytes = 0;
+
+            if (connection_zerocopy(conn, message)) {
+                count_of_bytes = zerocopy_send(conn->zerocopy, conn->data.client_fd, message, sent, MSG_NOSIGNAL);
+            } else {
+                count_of_bytes = send(conn->data.client_fd, message->data + sent, message->length - sent, MSG_NOSIGNAL);
+            }
+
+            if (count_of_bytes < 0) {
+
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+
+                perror("connection_write: send");
+
+                connection_schedule_close(conn);
+
+                return 0;
+            }
+
+            metrics_add(METRICS_SEND_CALLS, 1);
+
+            sent += count_of_bytes;
+        }
+
+        if (sent == message->length) {
+            metrics_add(METRICS_MESSAGES_OUT, 1);
+            metrics_add(METRICS_BYTES_OUT, sent);
+
+            return 0;
+        }
+
+    }
+
+    if (connection_over_budget(conn, message->length - sent) && connection_handle_slow(conn) < 0) {
+        return 0;
+    }
+
+    if (connection_enqueue(conn, message) < 0) {
+        connection_schedule_close(conn);
+
+        return 0;
+    }
+
+    connection_consume(conn, sent);
+
+    if (conn->reactor->ring || conn->reactor->config->flush == FLUSH_TICK) {
+        connection_mark_dirty(conn);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Выполнение сообщения клиента в зависимости от состояния соединения
+ *
+ * @return int 0 в случае успеха, -1 если соединение нужно закрыть
+ */
+static int connection_process(struct connection_t* conn, char* buffer, size_t length) {
+    struct room_registry_t* rooms = conn->reactor->rooms;
+    int client_cycle = 1;
+    int named = 0;
+    int admitted = 0;
+
+    switch (conn->state) {
+        case CONN_HANDSHAKE:
+            named = client_handshake(rooms, &conn->data, buffer, length);
+
+            if (named != 0) {
+                return named < 0 ? -1 : 0;
+            }
+
+            if (client_join_chat(room_ref(rooms->lobby), &conn->data, BACKLOG_LAST) < 0) {
+                name_index_remove(&rooms->names, &conn->data);
+
+                return -1;
+            }
+
+            conn->state = CONN_ACTIVE;
+
+            throttle_init(&conn->throttle, &conn->reactor->config->rate, conn->reactor->now);
+
+            return 0;
+
+        case CONN_ACTIVE:
+
+            admitted = client_throttle(&conn->data, &conn->throttle, &conn->reactor->config->rate, length, conn->reactor->now);
+
+            if (admitted <= 0) {
+                return admitted;
+            }
+
+            if (executing_clients_command(rooms, &conn->data, buffer, length, &client_cycle) < 0 || !client_cycle) {
+                return -1;
+            }
+
+            return 0;
+
+        default:
+            return -1;
+    }
+
+}
+
+/**
+ * @brief Выполнение одного кадра клиента
+ *
+ * @return int 0 чтобы продолжить разбор, -1 если соединение закрывается
+ */
+static int connection_on_frame(void* arg, char* payload, size_t length) {
+    struct connection_t* conn = (struct connection_t*) arg;
+
+    metrics_add(METRICS_MESSAGES_IN, 1);
+
+    trace_frame_begin();
+
+    if (connection_process(conn, payload, length) < 0) {
+        connection_schedule_close(conn);
+    }
+
+    trace_frame_end();
+
+    return conn->failed ? -1 : 0;
+}
+
+void connection_on_data(struct connection_t* conn, char* data, size_t length) {
+
+    if (conn->failed) {
+        return;
+    }
+
+    metrics_add(METRICS_BYTES_IN, length);
+
+    trace_receive(conn->data.client_fd, length);
+
+    if (frame_reader_consume(&conn->reader, data, length, connection_on_frame, conn) < 0) {
+        connection_schedule_close(conn);
+    }
+
+}
+
+/**
+ * @brief Вычитывает сокет клиента до EAGAIN
+ *
+ * Edge-triggered epoll не сообщит о данных повторно, поэтому читать нужно все
+ *
+ */
+static void connection_read(struct reactor_t* reactor, struct connection_t* conn) {
+
+    while (!conn->failed) {
+        ssize_t count_of_bytes = recv(conn->data.client_fd, reactor->buffer, READ_BUFFER_SIZE, 0);
+
+        if (count_of_bytes > 0) {
+            connection_on_data(conn, reactor->buffer, count_of_bytes);
+
+            continue;
+        }
+
+        if (count_of_bytes == 0) {
+            log_printf(LOG_LEVEL_INFO, "Client %s:%d disconnected", conn->data.client_ip, conn->data.client_port);
+
+            connection_schedule_close(conn);
+
+            return;
+        }
+
+        if (errno == EINTR) {
+            continue;
+        }
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("connection_read: recv");
+
+            connection_schedule_close(conn);
+        }
+
+        return;
+    }
+
+}
+
+/**
+ * @brief Создание соединения потока для сокета клиента
+ *
+ * @return struct connection_t* NULL при ошибке, сокет при этом закрывается
+ */
+static struct connection_t* connection_create(struct reactor_t* reactor, int client_fd) {
+    struct connection_t* conn = object_pool_alloc(&connection_pool);
+
+    if (!conn) {
+        perror("connection_create: object_pool_alloc");
+
+        close(client_fd);
+
+        return NULL;
+    }
+
+    memset(conn, 0, sizeof(struct connection_t));
+
+    conn->data.client_fd = client_fd;
+    conn->data.conn = conn;
+    conn->data.shard = reactor->id;
+    conn->state = CONN_HANDSHAKE;
+    conn->reactor = reactor;
+
+    set_nodelay(client_fd);
+
+    if (reactor->config->zerocopy_bytes && !reactor->ring) {
+        conn->zerocopy = zerocopy_create(client_fd);
+    }
+
+    conn->next_open = reactor->open;
+
+    if (reactor->open) {
+        reactor->open->prev_open = conn;
+    }
+
+    reactor->open = conn;
+
+    return conn;
+}
+
+struct connection_t* reactor_accept_connection(struct reactor_t* reactor, int client_fd, struct sockaddr_in* client_addr) {
+
+    if (!listener_admit(reactor->config->max_clients)) {
+        metrics_add(METRICS_REJECTED, 1);
+
+        listener_reject(client_fd);
+
+        return NULL;
+    }
+
+    struct connection_t* conn = connection_create(reactor, client_fd);
+
+    if (!conn) {
+        listener_release();
+
+        return NULL;
+    }
+
+    conn->data.client_port = ntohs(client_addr->sin_port);
+
+    inet_ntop(AF_INET, &client_addr->sin_addr.s_addr, conn->data.client_ip, INET_ADDRSTRLEN);
+
+    metrics_add(METRICS_ACCEPTS, 1);
+
+    log_printf(LOG_LEVEL_INFO, "New connection: %s:%d", conn->data.client_ip, conn->data.client_port);
+
+    return conn;
+}
+
+/**
+ * @brief Регистрация соединения в epoll рабочего потока
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int connection_watch(struct reactor_t* reactor, struct connection_t* conn) {
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.ptr = conn
+    };
+
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, conn->data.client_fd, &event) < 0) {
+        perror("connection_watch: epoll_ctl");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Принимает ожидающие соединения, не больше config->accept_batch за итерацию
+ *
+ * Если пачка заполнена, остаток очереди принимается в следующих итерациях: epoll
+ * edge-triggered и о нем больше не сообщит, поэтому цикл не засыпает, пока accept_pending
+ *
+ */
+static void accept_clients(struct reactor_t* reactor) {
+
+    for (int accepted = 0; accepted < reactor->config->accept_batch; accepted++) {
+        struct sockaddr_in client_addr = {0};
+        socklen_t client_len = (socklen_t) sizeof(struct sockaddr_in);
+
+        int client_fd = accept4(reactor->listen_fd, (struct sockaddr*) &client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_fd < 0) {
+
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept_clients: accept4");
+            }
+
+            reactor->accept_pending = 0;
+
+            return;
+        }
+
+        metrics_record(METRICS_ACCEPT_WAIT, metrics_now() - reactor->accept_since);
+
+        struct connection_t* conn = reactor_accept_connection(reactor, client_fd, &client_addr);
+
+        if (conn && connection_watch(reactor, conn) < 0) {
+            connection_schedule_close(conn);
+        }
+
+    }
+
+    metrics_add(METRICS_ACCEPT_BATCHES_FULL, 1);
+}
+
+void connection_free(struct connection_t* conn) {
+    metrics_sub(METRICS_QUEUED_MESSAGES, conn->out.count);
+    metrics_sub(METRICS_QUEUED_BYTES, conn->out.bytes);
+
+    frame_reader_free(&conn->reader);
+
+    message_queue_clear(&conn->out);
+
+    zerocopy_free(conn->zerocopy);
+
+    if (conn->gap_notice) {
+        message_unref(conn->gap_notice);
+    }
+
+    object_pool_free(&connection_pool, conn);
+}
+
+void reactor_reap_connections(struct reactor_t* reactor) {
+
+    while (reactor->closing) {
+        struct connection_t* conn = reactor->closing;
+
+        reactor->closing = conn->next_pending;
+
+        if (reactor->ring) {
+            shutdown(conn->data.client_fd, SHUT_RDWR);
+        }
+
+        if (conn->zerocopy && zerocopy_park(&reactor->parked, conn->zerocopy, conn->data.client_fd, reactor->now + reactor->config->queue_age_ms) == 0) {
+            conn->zerocopy = NULL;
+        }
+
+        if (conn->state == CONN_ACTIVE) {
+
+            if (reactor->epoll_fd >= 0) {
+                epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->data.client_fd, NULL);
+            }
+
+            client_leave_chat(&conn->data);
+            name_index_remove(&reactor->rooms->names, &conn->data);
+            client_close_deferred(conn->data.client_fd);
+        } else {
+            close(conn->data.client_fd);
+        }
+
+        listener_release();
+
+        if (conn->prev_open) {
+            conn->prev_open->next_open = conn->next_open;
+        } else {
+            reactor->open = conn->next_open;
+        }
+
+        if (conn->next_open) {
+            conn->next_open->prev_open = conn->prev_open;
+        }
+
+        conn->state = CONN_CLOSED;
+        conn->next_pending = reactor->closed;
+        reactor->closed = conn;
+    }
+
+    while (reactor->closed) {
+        struct connection_t* conn = reactor->closed;
+
+        reactor->closed = conn->next_pending;
+
+        if (conn->uring_refs == 0 && !conn->dirty) {
+            connection_free(conn);
+        }
+
+    }
+
+}
+
+/**
+ * @brief Отправляет исходящие очереди соединений, получивших сообщения за итерацию
+ *
+ * Вызывается после закрытия соединений, чтобы уведомления о выходе ушли в той же итерации.
+ * Закрытые соединения из списка освобождаются здесь
+ *
+ */
+static void reactor_flush_dirty(struct reactor_t* reactor) {
+
+    while (reactor->dirty) {
+        struct connection_t* conn = reactor->dirty;
+
+        reactor->dirty = conn->next_dirty;
+
+        conn->dirty = 0;
+        conn->next_dirty = NULL;
+
+        if (conn->state == CONN_CLOSED) {
+            connection_free(conn);
+
+            continue;
+        }
+
+        if (conn->failed) {
+            continue;
+        }
+
+        if (connection_flush(conn) < 0) {
+            connection_schedule_close(conn);
+        }
+
+    }
+
+}
+
+/**
+ * @brief Закрытие соединений и отправка очередей до конца итерации
+ *
+ * Неудачная отправка ставит соединение в очередь закрытия, а его выход из комнаты
+ * добавляет уведомления в очереди соседей. Цикл повторяется, пока есть что закрывать:
+ * иначе соединение ждало бы следующего события, а epoll_wait() без таймаута может не вернуться
+ *
+ */
+static void reactor_settle(struct reactor_t* reactor) {
+
+    do {
+        reactor_reap_connections(reactor);
+        reactor_flush_dirty(reactor);
+    } while (reactor->closing);
+
+}
+
+/**
+ * @brief Кладет сообщение во входящую очередь рабочего потока
+ *
+ * Будит поток через eventfd только если очередь была пуста:
+ * непустую очередь поток и так заберет целиком
+ *
+ */
+static void reactor_push(struct reactor_t* reactor, struct inbound_t* item) {
+    struct inbound_t* head = atomic_load_explicit(&reactor->inbound, memory_order_relaxed);
+
+    do {
+        item->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&reactor->inbound, &head, item, memory_order_release, memory_order_relaxed));
+
+    if (head == NULL) {
+        uint64_t value = 1;
+
+        if (write(reactor->event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            perror("reactor_push: write");
+        }
+
+    }
+
+}
+
+void reactor_process_inbound(struct reactor_t* reactor) {
+    struct inbound_t* item = atomic_exchange_explicit(&reactor->inbound, NULL, memory_order_acquire);
+    struct inbound_t* ordered = NULL;
+
+    while (item) {
+        struct inbound_t* next = item->next;
+
+        item->next = ordered;
+        ordered = item;
+
+        item = next;
+    }
+
+    while (ordered) {
+        struct inbound_t* next = ordered->next;
+
+        if (ordered->chat) {
+            struct broadcast_callback_data_t data = {
+                .message = ordered->message
+            };
+
+            foreach_shard_client_expect(ordered->chat, reactor->id, -1, broadcast_callback, &data);
+
+            if (ordered->message->traced) {
+                metrics_record(METRICS_DELIVERY, metrics_now() - ordered->message->traced);
+            }
+
+            TRACE_PROBE2(deliver, ordered->message->seq, reactor->id);
+
+            room_release(ordered->chat);
+        } else {
+            struct client_data_t target;
+
+            if (name_index_find(&reactor->rooms->names, ordered->target, &target) && target.conn && target.shard == reactor->id) {
+                connection_write(target.conn, ordered->message);
+            }
+
+        }
+
+        message_unref(ordered->message);
+
+        object_pool_free(&inbound_pool, ordered);
+
+        ordered = next;
+    }
+
+}
+
+int reactor_broadcast(struct connection_t* sender, struct chat_t* chat, struct message_t* message) {
+    struct reactor_t* reactor = sender->reactor;
+
+    for (int i = 0; i < reactor->count; i++) {
+
+        if (i == reactor->id || !atomic_load_explicit(&chat->shards[i].snapshot, memory_order_acquire)) {
+            continue;
+        }
+
+        struct inbound_t* item = object_pool_alloc(&inbound_pool);
+
+        if (!item) {
+            perror("reactor_broadcast: object_pool_alloc");
+
+            return -1;
+        }
+
+        item->chat = room_ref(chat);
+        item->message = message_ref(message);
+
+        reactor_push(&reactor->group[i], item);
+    }
+
+    struct broadcast_callback_data_t data = {
+        .message = message
+    };
+
+    return foreach_shard_client_expect(chat, reactor->id, sender->data.client_fd, broadcast_callback, &data);
+}
+
+int reactor_direct(struct connection_t* sender, const struct client_data_t* target, struct message_t* message) {
+    struct inbound_t* item = object_pool_alloc(&inbound_pool);
+
+    if (!item) {
+        perror("reactor_direct: object_pool_alloc");
+
+        return -1;
+    }
+
+    item->chat = NULL;
+    item->message = message_ref(message);
+
+    memcpy(item->target, target->client_name, MAX_NAME_LENGTH);
+
+    reactor_push(&sender->reactor->group[target->shard], item);
+
+    return 0;
+}
+
+/**
+ * @brief Сбрасывает счетчик eventfd и обрабатывает входящую очередь
+ *
+ */
+static void reactor_drain_inbound(struct reactor_t* reactor) {
+    uint64_t value = 0;
+
+    if (read(reactor->event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        perror("reactor_drain_inbound: read");
+    }
+
+    reactor_process_inbound(reactor);
+}
+
+/**
+ * @brief Закрепляет текущий поток за ядром
+ *
+ */
+static void pin_to_cpu(int index) {
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpu_count <= 0) {
+        return;
+    }
+
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(index % cpu_count, &set);
+
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if (error != 0) {
+        fprintf(stderr, "pin_to_cpu: pthread_setaffinity_np: %s\n", strerror(error));
+    }
+
+}
+
+/**
+ * @brief Цикл событий одного рабочего потока
+ *
+ */
+static void* reactor_loop(void* arg) {
+    struct reactor_t* reactor = (struct reactor_t*) arg;
+
+    if (reactor->count > 1) {
+        pin_to_cpu(reactor->id);
+    }
+
+    if (reactor->ring) {
+        uring_loop(reactor);
+
+        atomic_fetch_sub(&running_reactors, 1);
+
+        return NULL;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+
+    while (1) {
+        int timeout = -1;
+
+        if (reactor->accept_pending) {
+            timeout = 0;
+        } else if (reactor->parked) {
+            timeout = ZEROCOPY_LINGER_POLL_MS;
+        }
+
+        int count = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, timeout);
+
+        if (count < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("reactor_loop: epoll_wait");
+
+            break;
+        }
+
+        reactor_update_clock(reactor);
+
+        for (int i = 0; i < count; i++) {
+            void* ptr = events[i].data.ptr;
+
+            if (ptr == &reactor->listen_fd) {
+
+                if (!reactor->accept_pending) {
+                    reactor->accept_pending = 1;
+                    reactor->accept_since = metrics_now();
+                }
+
+                continue;
+            }
+
+            if (ptr == &reactor->event_fd) {
+                reactor_drain_inbound(reactor);
+
+                continue;
+            }
+
+            struct connection_t* conn = (struct connection_t*) ptr;
+
+            if (conn->failed) {
+                continue;
+            }
+
+            if ((events[i].events & EPOLLERR) && conn->zerocopy) {
+                zerocopy_complete(conn->zerocopy, conn->data.client_fd);
+            }
+
+            if (events[i].events & EPOLLOUT) {
+
+                if (connection_flush(conn) < 0) {
+                    connection_schedule_close(conn);
+
+                    continue;
+                }
+
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                connection_read(reactor, conn);
+            }
+
+        }
+
+        if (reactor->accept_pending) {
+            accept_clients(reactor);
+        }
+
+        reactor_settle(reactor);
+
+        if (reactor->parked) {
+            zerocopy_drain(&reactor->parked, reactor->now);
+        }
+
+        if (atomic_load_explicit(&reactor->stop, memory_order_acquire)) {
+            break;
+        }
+
+    }
+
+    atomic_fetch_sub(&running_reactors, 1);
+
+    return NULL;
+}
+
+/**
+ * @brief Регистрирует дескриптор в epoll рабочего потока
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int reactor_watch(struct reactor_t* reactor, int fd, void* ptr) {
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.ptr = ptr
+    };
+
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("reactor_watch: epoll_ctl");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Освобождение ресурсов рабочего потока
+ *
+ */
+static void reactor_destroy(struct reactor_t* reactor) {
+    zerocopy_drain(&reactor->parked, UINT64_MAX);
+
+    if (reactor->listen_fd >= 0) {
+        close(reactor->listen_fd);
+    }
+
+    if (reactor->event_fd >= 0) {
+        close(reactor->event_fd);
+    }
+
+    if (reactor->epoll_fd >= 0) {
+        close(reactor->epoll_fd);
+    }
+
+    if (reactor->ring) {
+        uring_destroy(reactor);
+    }
+
+}
+
+/**
+ * @brief Инициализация рабочего потока: слушающий сокет, eventfd и epoll либо io_uring
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int reactor_init(struct reactor_t* reactor, const struct server_config_t* config) {
+    reactor->listen_fd = upgrade_take_listener(reactor->id);
+
+    if (reactor->listen_fd < 0) {
+        reactor->listen_fd = create_listener(config->port, 1, config->listen_backlog);
+    }
+
+    reactor->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reactor->epoll_fd = -1;
+
+    atomic_init(&reactor->inbound, NULL);
+
+    reactor_update_clock(reactor);
+
+    if (reactor->listen_fd < 0) {
+        return -1;
+    }
+
+    if (reactor->event_fd < 0) {
+        perror("reactor_init: eventfd");
+
+        return -1;
+    }
+
+    if (config->io == IO_URING) {
+        return uring_init(reactor);
+    }
+
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (reactor->epoll_fd < 0) {
+        perror("reactor_init: epoll_create1");
+
+        return -1;
+    }
+
+    int flags = fcntl(reactor->listen_fd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(reactor->listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("reactor_init: fcntl");
+
+        return -1;
+    }
+
+    if (reactor_watch(reactor, reactor->listen_fd, &reactor->listen_fd) < 0) {
+        return -1;
+    }
+
+    if (reactor_watch(reactor, reactor->event_fd, &reactor->event_fd) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Передача соединения новому процессу: сокет, имя, комната, неотправленные байты и незавершенный кадр
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int connection_hand_over(struct connection_t* conn) {
+    struct upgrade_record_t record = {
+        .type = UPGRADE_CONNECTION,
+        .index = conn->reactor->id,
+        .state = conn->state,
+        .protocol = conn->data.protocol,
+        .client_id = conn->data.client_id,
+        .client_port = conn->data.client_port,
+        .out_length = conn->out.bytes,
+        .pending_length = conn->reader.pending_length,
+        .zerocopy_next = conn->zerocopy ? conn->zerocopy->next : 0
+    };
+
+    memcpy(record.client_ip, conn->data.client_ip, INET_ADDRSTRLEN);
+    memcpy(record.client_name, conn->data.client_name, MAX_NAME_LENGTH);
+
+    if (conn->data.room) {
+        memcpy(record.room, conn->data.room->name, MAX_ROOM_NAME);
+    }
+
+    struct iovec* data = malloc((conn->out.count + 1) * sizeof(struct iovec));
+
+    if (!data) {
+        perror("connection_hand_over: malloc");
+
+        return -1;
+    }
+
+    int count = 0;
+
+    for (unsigned i = 0; i < conn->out.count; i++) {
+        struct message_t* message = message_queue_at(&conn->out, i);
+        size_t offset = i == 0 ? conn->out.offset : 0;
+
+        data[count].iov_base = message->data + offset;
+        data[count].iov_len = message->length - offset;
+        count++;
+    }
+
+    if (conn->reader.pending_length) {
+        data[count].iov_base = conn->reader.pending;
+        data[count].iov_len = conn->reader.pending_length;
+        count++;
+    }
+
+    int result = upgrade_send(&record, conn->data.client_fd, data, count);
+
+    free(data);
+
+    return result;
+}
+
+/**
+ * @brief Передача состояния остановленных рабочих потоков новому процессу
+ *
+ * Сначала доставляются сообщения из входящих очередей, закрываются соединения
+ * и отправляется все, что принимает ядро: новому процессу достается только остаток
+ *
+ * @return int 0 если новый процесс принял все состояние, -1 при ошибке
+ */
+static int reactor_hand_over(struct reactor_t* group, int count) {
+    int connections = 0;
+
+    for (int i = 0; i < count; i++) {
+        reactor_update_clock(&group[i]);
+        reactor_process_inbound(&group[i]);
+        reactor_settle(&group[i]);
+    }
+
+    if (upgrade_spawn() < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct upgrade_record_t record = {
+            .type = UPGRADE_LISTENER,
+            .index = i
+        };
+
+        if (upgrade_send(&record, group[i].listen_fd, NULL, 0) < 0) {
+            upgrade_abort();
+
+            return -1;
+        }
+
+    }
+
+    for (int i = 0; i < count; i++) {
+
+        for (struct connection_t* conn = group[i].open; conn; conn = conn->next_open) {
+
+            if (conn->failed) {
+                continue;
+            }
+
+            if (connection_hand_over(conn) < 0) {
+                upgrade_abort();
+
+                return -1;
+            }
+
+            connections++;
+        }
+
+    }
+
+    struct upgrade_record_t end = {
+        .type = UPGRADE_END,
+        .client_id = client_id_next()
+    };
+
+    if (upgrade_send(&end, -1, NULL, 0) < 0 || upgrade_wait_ready() < 0) {
+        upgrade_abort();
+
+        return -1;
+    }
+
+    log_printf(LOG_LEVEL_INFO, "Handed over %d connections to the new server process", connections);
+
+    return 0;
+}
+
+/**
+ * @brief Восстановление соединения, полученного от старого процесса
+ *
+ * Клиент возвращается в свою комнату без повтора журнала и без уведомления участников:
+ * для них он не уходил. Неотправленные байты ставятся в очередь одним сообщением.
+ * Учет MSG_ZEROCOPY продолжает нумерацию ядра с номера, переданного старым процессом:
+ * уведомления об отправках старого процесса меньше oldest и пропускаются
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int connection_restore(struct reactor_t* reactor, struct upgrade_connection_t* item) {
+    const struct upgrade_record_t* record = &item->record;
+
+    listener_admit(0);
+
+    struct connection_t* conn = connection_create(reactor, item->fd);
+
+    item->fd = -1;
+
+    if (!conn) {
+        listener_release();
+
+        return -1;
+    }
+
+    conn->data.client_id = record->client_id;
+    conn->data.client_port = record->client_port;
+    conn->data.protocol = record->protocol;
+
+    memcpy(conn->data.client_ip, record->client_ip, INET_ADDRSTRLEN);
+    memcpy(conn->data.client_name, record->client_name, MAX_NAME_LENGTH);
+
+    throttle_init(&conn->throttle, &reactor->config->rate, reactor->now);
+
+    if (conn->zerocopy) {
+        conn->zerocopy->oldest = record->zerocopy_next;
+        conn->zerocopy->next = record->zerocopy_next;
+    }
+
+    if (item->pending) {
+        conn->reader.pending = item->pending;
+        conn->reader.pending_length = record->pending_length;
+        conn->reader.pending_capacity = record->pending_length;
+
+        item->pending = NULL;
+    }
+
+    if (record->state == CONN_ACTIVE) {
+        struct chat_t* room = room_acquire(reactor->rooms, record->room);
+
+        if (!room) {
+            room = room_ref(reactor->rooms->lobby);
+        }
+
+        conn->data.room = room;
+
+        if (client_add_to_chat(room, &conn->data, BACKLOG_NONE) < 0) {
+            conn->data.room = NULL;
+
+            room_release(room);
+            connection_schedule_close(conn);
+
+            return -1;
+        }
+
+        conn->state = CONN_ACTIVE;
+
+        if (conn->data.client_name[0] != '\0' && strcmp(conn->data.client_name, "ANONIM") != 0) {
+            name_index_add(&reactor->rooms->names, &conn->data);
+        }
+
+    }
+
+    if (item->out) {
+        struct message_t* message = message_create(item->out, record->out_length);
+
+        if (!message || connection_enqueue(conn, message) < 0) {
+
+            if (message) {
+                message_unref(message);
+            }
+
+            connection_schedule_close(conn);
+
+            return -1;
+        }
+
+        message_unref(message);
+
+        connection_mark_dirty(conn);
+    }
+
+    if (connection_watch(reactor, conn) < 0) {
+        connection_schedule_close(conn);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Распределение полученных соединений по рабочим потокам, каждое - в поток с тем же номером шарда
+ *
+ */
+static void reactor_restore(struct reactor_t* group, int count) {
+    int restored = 0;
+
+    client_id_restore(upgrade_next_client_id());
+
+    for (int i = 0; i < upgrade_connection_count(); i++) {
+        struct upgrade_connection_t* item = upgrade_connection(i);
+
+        if (connection_restore(&group[item->record.index % count], item) == 0) {
+            restored++;
+        }
+
+    }
+
+    for (int i = 0; i < count; i++) {
+        reactor_reap_connections(&group[i]);
+    }
+
+    if (upgrade_connection_count() > 0) {
+        log_printf(LOG_LEVEL_INFO, "Resumed %d of %d connections", restored, upgrade_connection_count());
+    }
+
+}
+
+/**
+ * @brief Остановка и ожидание завершения count первых рабочих потоков
+ *
+ * Поток выходит из цикла в конце текущей итерации
+ *
+ */
+static void reactor_stop(struct reactor_t* group, int count) {
+
+    for (int i = 0; i < count; i++) {
+        uint64_t value = 1;
+
+        atomic_store_explicit(&group[i].stop, 1, memory_order_release);
+
+        if (write(group[i].event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            perror("reactor_stop: write");
+        }
+
+    }
+
+    for (int i = 0; i < count; i++) {
+        pthread_join(group[i].thread, NULL);
+    }
+
+}
+
+/**
+ * @brief Запуск рабочих потоков группы
+ *
+ * @return int 0 в случае успеха, -1 при ошибке (запущенные потоки останавливаются)
+ */
+static int reactor_start(struct reactor_t* group, int count) {
+
+    for (int i = 0; i < count; i++) {
+        atomic_store(&group[i].stop, 0);
+        atomic_fetch_add(&running_reactors, 1);
+
+        int error = pthread_create(&group[i].thread, NULL, reactor_loop, &group[i]);
+
+        if (error != 0) {
+            fprintf(stderr, "reactor_start: pthread_create: %s\n", strerror(error));
+
+            atomic_fetch_sub(&running_reactors, 1);
+
+            reactor_stop(group, i);
+
+            return -1;
+        }
+
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Ожидание SIGUSR2 в главном потоке, пока работают рабочие потоки
+ *
+ * SIGUSR2 заблокирован во всех потоках и забирается здесь sigtimedwait()
+ *
+ * @return int REACTOR_UPGRADED после передачи соединений, -1 если все рабочие потоки завершились с ошибкой
+ */
+static int reactor_serve(struct reactor_t* group, const struct server_config_t* config) {
+    struct timespec timeout = {
+        .tv_sec = 1
+    };
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR2);
+
+    while (atomic_load(&running_reactors) > 0) {
+
+        if (sigtimedwait(&signals, NULL, &timeout) != SIGUSR2) {
+            continue;
+        }
+
+        if (config->io == IO_URING) {
+            log_printf(LOG_LEVEL_WARN, "Hot upgrade is supported only with the epoll backend");
+
+            continue;
+        }
+
+        log_printf(LOG_LEVEL_INFO, "Hot upgrade requested, stopping the workers");
+
+        reactor_stop(group, config->workers);
+
+        if (reactor_hand_over(group, config->workers) == 0) {
+            return REACTOR_UPGRADED;
+        }
+
+        log_printf(LOG_LEVEL_ERROR, "Hot upgrade failed, resuming service");
+
+        if (reactor_start(group, config->workers) < 0) {
+            return -1;
+        }
+
+    }
+
+    reactor_stop(group, config->workers);
+
+    return -1;
+}
+
+int reactor_run(const struct server_config_t* config, struct room_registry_t* rooms) {
+
+    if (config->io == IO_URING && !uring_supported()) {
+        fprintf(stderr, "reactor_run: server was built without io_uring support\n");
+
+        return -1;
+    }
+
+    raise_fd_limit();
+
+    if (object_pool_init(&connection_pool, "connections", sizeof(struct connection_t), config->prealloc) < 0 ||
+        object_pool_init(&inbound_pool, "inbound", sizeof(struct inbound_t), config->workers > 1 ? config->prealloc : 0) < 0) {
+        return -1;
+    }
+
+    struct reactor_t* group = calloc(config->workers, sizeof(struct reactor_t));
+
+    if (!group) {
+        perror("reactor_run: calloc");
+
+        return -1;
+    }
+
+    int result = 0;
+
+    for (int i = 0; i < config->workers; i++) {
+        group[i].id = i;
+        group[i].count = config->workers;
+        group[i].group = group;
+        group[i].rooms = rooms;
+        group[i].config = config;
+
+        if (reactor_init(&group[i], config) < 0) {
+            result = -1;
+        }
+
+    }
+
+    if (result == 0 && config->io != IO_URING) {
+        reactor_restore(group, config->workers);
+    }
+
+    upgrade_finish();
+
+    if (result == 0 && reactor_start(group, config->workers) == 0) {
+        result = reactor_serve(group, config);
+    } else {
+        result = -1;
+    }
+
+    for (int i = 0; i < config->workers; i++) {
+        reactor_destroy(&group[i]);
+    }
+
+    free(group);
+
+    return result;
+}
@@ -0,0 +1,331 @@
+#include "../headers/room_registry.h"
+#include "../headers/chat_room.h"
+#include "../headers/ebr.h"
+#include "../headers/name_index.h"
+
+#include <ctype.h>
+#include <sys/resource.h>
+
+#define MAX_CLIENT_SLOTS    (1 << 20)
+
+/**
+ * @brief Размер таблицы клиентов по дескрипторам
+ *
+ * Дескриптор клиента всегда меньше жесткого предела RLIMIT_NOFILE:
+ * реактор поднимает мягкий предел до жесткого уже после создания реестра
+ */
+static int client_slot_limit(void) {
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        perror("room_registry_init: getrlimit");
+
+        return 1024;
+    }
+
+    if (limit.rlim_max == RLIM_INFINITY || limit.rlim_max > MAX_CLIENT_SLOTS) {
+        return MAX_CLIENT_SLOTS;
+    }
+
+    return (int) limit.rlim_max;
+}
+
+/**
+ * @brief В журнале комнаты есть сообщения
+ *
+ * Пустую комнату с журналом реестр не удаляет сразу: ее история нужна следующим участникам
+ */
+static int room_has_backlog(struct chat_t* room) {
+    pthread_mutex_lock(&room->backlog.mutex);
+
+    int count = room->backlog.count;
+
+    pthread_mutex_unlock(&room->backlog.mutex);
+
+    return count > 0;
+}
+
+/**
+ * @brief Корзина реестра для имени комнаты (FNV-1a)
+ *
+ */
+static struct room_bucket_t* room_bucket(struct room_registry_t* registry, const char* name) {
+    uint32_t hash = 2166136261u;
+
+    for (; *name; name++) {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+
+    return &registry->buckets[hash % ROOM_BUCKETS];
+}
+
+/**
+ * @brief Добавление комнаты в корзину
+ *
+ * @warning Вызывать под мьютексом корзины
+ */
+static void room_link(struct room_registry_t* registry, struct room_bucket_t* bucket, struct chat_t* room) {
+    room->next = bucket->head;
+    room->linked = 1;
+
+    bucket->head = room;
+
+    atomic_fetch_add(&registry->room_count, 1);
+}
+
+struct room_registry_t* room_registry_init(int shard_count, const struct backlog_limits_t* limits) {
+    struct room_registry_t* registry = calloc(1, sizeof(struct room_registry_t));
+
+    if (!registry) {
+        perror("room_registry_init: calloc");
+
+        return NULL;
+    }
+
+    registry->shard_count = shard_count;
+    registry->backlog = *limits;
+    registry->slot_count = client_slot_limit();
+    registry->slots = calloc(registry->slot_count, sizeof(struct client_slot_t));
+
+    if (!registry->slots) {
+        perror("room_registry_init: calloc");
+
+        free(registry);
+
+        return NULL;
+    }
+
+    if (name_index_init(&registry->names, registry->slot_count) < 0) {
+        free(registry->slots);
+        free(registry);
+
+        return NULL;
+    }
+
+    atomic_init(&registry->room_count, 0);
+    atomic_init(&registry->client_count, 0);
+    atomic_init(&registry->backlog_bytes, 0);
+
+    for (int i = 0; i < ROOM_BUCKETS; i++) {
+        pthread_mutex_init(&registry->buckets[i].mutex, NULL);
+    }
+
+    registry->lobby = chat_init(registry, DEFAULT_ROOM);
+
+    if (!registry->lobby) {
+        name_index_free(&registry->names);
+        free(registry->slots);
+        free(registry);
+
+        return NULL;
+    }
+
+    room_link(registry, room_bucket(registry, DEFAULT_ROOM), registry->lobby);
+
+    return registry;
+}
+
+void room_registry_free(struct room_registry_t* registry) {
+
+    for (int i = 0; i < ROOM_BUCKETS; i++) {
+        struct room_bucket_t* bucket = &registry->buckets[i];
+        struct chat_t* room = bucket->head;
+
+        while (room) {
+            struct chat_t* next = room->next;
+
+            chat_free(room);
+
+            room = next;
+        }
+
+        pthread_mutex_destroy(&bucket->mutex);
+    }
+
+    ebr_drain();
+
+    name_index_free(&registry->names);
+
+    free(registry->slots);
+    free(registry);
+}
+
+/**
+ * @brief Комната без участников и ссылок, кроме ссылки реестра
+ *
+ * @warning Вызывать под мьютексом корзины комнаты
+ */
+static int room_idle(struct room_registry_t* registry, struct chat_t* room) {
+    return room != registry->lobby && atomic_load(&room->refs) == 1;
+}
+
+/**
+ * @brief Удаление комнаты из корзины
+ *
+ * @warning Вызывать под мьютексом корзины
+ */
+static void room_unlink(struct room_registry_t* registry, struct room_bucket_t* bucket, struct chat_t* room) {
+    struct chat_t** link = &bucket->head;
+
+    while (*link != room) {
+        link = &(*link)->next;
+    }
+
+    *link = room->next;
+    room->linked = 0;
+
+    atomic_fetch_sub(&registry->room_count, 1);
+}
+
+/**
+ * @brief Удаление одной пустой комнаты, которую держит только журнал сообщений
+ *
+ * Освобождает место под новую комнату, когда комнат уже MAX_ROOMS
+ *
+ * @return int 1 если комната удалена, 0 если удалять нечего
+ */
+static int room_reclaim(struct room_registry_t* registry) {
+
+    for (int i = 0; i < ROOM_BUCKETS; i++) {
+        struct room_bucket_t* bucket = &registry->buckets[i];
+
+        pthread_mutex_lock(&bucket->mutex);
+
+        for (struct chat_t* room = bucket->head; room; room = room->next) {
+
+            if (room_idle(registry, room)) {
+                room_unlink(registry, bucket, room);
+
+                pthread_mutex_unlock(&bucket->mutex);
+
+                room_release(room);
+
+                return 1;
+            }
+
+        }
+
+        pthread_mutex_unlock(&bucket->mutex);
+    }
+
+    return 0;
+}
+
+struct chat_t* room_acquire(struct room_registry_t* registry, const char* name) {
+    struct room_bucket_t* bucket = room_bucket(registry, name);
+
+    if (atomic_load(&registry->room_count) >= MAX_ROOMS) {
+        room_reclaim(registry);
+    }
+
+    pthread_mutex_lock(&bucket->mutex);
+
+    struct chat_t* room = bucket->head;
+
+    while (room && strcmp(room->name, name) != 0) {
+        room = room->next;
+    }
+
+    if (!room) {
+
+        if (atomic_load(&registry->room_count) >= MAX_ROOMS) {
+            pthread_mutex_unlock(&bucket->mutex);
+
+            return NULL;
+        }
+
+        room = chat_init(registry, name);
+
+        if (!room) {
+            pthread_mutex_unlock(&bucket->mutex);
+
+            return NULL;
+        }
+
+        room_link(registry, bucket, room);
+    }
+
+    room_ref(room);
+
+    pthread_mutex_unlock(&bucket->mutex);
+
+    return room;
+}
+
+struct chat_t* room_ref(struct chat_t* room) {
+    atomic_fetch_add_explicit(&room->refs, 1, memory_order_relaxed);
+
+    return room;
+}
+
+void room_release(struct chat_t* room) {
+    struct room_registry_t* registry = room->registry;
+    int refs = atomic_fetch_sub_explicit(&room->refs, 1, memory_order_acq_rel) - 1;
+
+    if (refs == 0) {
+        chat_free(room);
+
+        return;
+    }
+
+    if (refs != 1 || room == registry->lobby || room_has_backlog(room)) {
+        return;
+    }
+
+    struct room_bucket_t* bucket = room_bucket(registry, room->name);
+
+    pthread_mutex_lock(&bucket->mutex);
+
+    if (!room->linked || !room_idle(registry, room)) {
+        pthread_mutex_unlock(&bucket->mutex);
+
+        return;
+    }
+
+    room_unlink(registry, bucket, room);
+
+    pthread_mutex_unlock(&bucket->mutex);
+
+    if (atomic_fetch_sub_explicit(&room->refs, 1, memory_order_acq_rel) == 1) {
+        chat_free(room);
+    }
+
+}
+
+int foreach_room(struct room_registry_t* registry, room_callback callback, void* arg) {
+
+    for (int i = 0; i < ROOM_BUCKETS; i++) {
+        struct room_bucket_t* bucket = &registry->buckets[i];
+
+        pthread_mutex_lock(&bucket->mutex);
+
+        for (struct chat_t* room = bucket->head; room; room = room->next) {
+
+            if (callback(room, arg) < 0) {
+                pthread_mutex_unlock(&bucket->mutex);
+
+                return -1;
+            }
+
+        }
+
+        pthread_mutex_unlock(&bucket->mutex);
+    }
+
+    return 0;
+}
+
+int room_name_valid(const char* name) {
+    size_t length = 0;
+
+    for (; name[length]; length++) {
+
+        if (!isalnum((unsigned char) name[length]) && name[length] != '-' && name[length] != '_') {
+            return 0;
+        }
+
+    }
+
+    return length > 0 && length < MAX_ROOM_NAME;
+}
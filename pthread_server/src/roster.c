@@ -0,0 +1,373 @@
+#include "../headers/roster.h"
+#include "../headers/client_utils.h"
+#include "../headers/frame.h"
+#include "../headers/message.h"
+
+#define ROSTER_PAGE_SIZE        (BUFFER_SIZE - ROSTER_HEADER_RESERVE)
+
+/**
+ * @brief Элемент списка: имя клиента с необязательным знаком изменения
+ */
+struct roster_item_t {
+    char sign;                              ///< '+' или '-' для изменений, '\0' для полного списка
+    char name[MAX_NAME_LENGTH];             ///< Имя клиента
+};
+
+/**
+ * @brief Растущий массив элементов списка
+ */
+struct roster_items_t {
+    struct roster_item_t* items;            ///< Элементы
+    int count;                              ///< Количество элементов
+    int capacity;                           ///< Размер массива items
+};
+
+/**
+ * @brief Собранные кадры списка
+ */
+struct roster_pages_t {
+    struct message_t** pages;               ///< Кадры
+    int count;                              ///< Количество кадров
+};
+
+void roster_init(struct roster_t* roster) {
+    pthread_mutex_init(&roster->mutex, NULL);
+
+    roster->generation = 0;
+    roster->built = 0;
+    roster->pages = NULL;
+    roster->page_count = 0;
+
+    memset(roster->changes, 0, sizeof(roster->changes));
+}
+
+/**
+ * @brief Освобождение кадров
+ *
+ */
+static void roster_pages_free(struct message_t** pages, int count) {
+
+    for (int i = 0; i < count; i++) {
+        message_unref(pages[i]);
+    }
+
+    free(pages);
+}
+
+void roster_free(struct roster_t* roster) {
+    roster_pages_free(roster->pages, roster->page_count);
+
+    pthread_mutex_destroy(&roster->mutex);
+}
+
+void roster_record(struct chat_t* chat, const struct client_data_t* c_data, int joined) {
+    struct roster_t* roster = &chat->roster;
+
+    pthread_mutex_lock(&roster->mutex);
+
+    struct roster_change_t* change = &roster->changes[++roster->generation % ROSTER_CHANGES];
+
+    change->generation = roster->generation;
+    change->joined = joined;
+
+    memcpy(change->name, c_data->client_name, MAX_NAME_LENGTH);
+
+    pthread_mutex_unlock(&roster->mutex);
+}
+
+/**
+ * @brief Добавление элемента в массив
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int roster_items_push(struct roster_items_t* items, char sign, const char* name) {
+
+    if (items->count == items->capacity) {
+        int capacity = items->capacity ? items->capacity * 2 : 64;
+        struct roster_item_t* grown = realloc(items->items, capacity * sizeof(struct roster_item_t));
+
+        if (!grown) {
+            perror("roster_items_push: realloc");
+
+            return -1;
+        }
+
+        items->items = grown;
+        items->capacity = capacity;
+    }
+
+    struct roster_item_t* item = &items->items[items->count++];
+
+    item->sign = sign;
+
+    memcpy(item->name, name, MAX_NAME_LENGTH);
+
+    return 0;
+}
+
+/**
+ * @brief callback, добавляющий имя клиента в массив элементов
+ *
+ */
+static int roster_name_callback(struct client_node_t* client, void* arg) {
+    return roster_items_push((struct roster_items_t*) arg, '\0', client->data.client_name);
+}
+
+/**
+ * @brief Запись элемента в текст страницы
+ *
+ * @return int Количество записанных байт
+ */
+static int roster_item_print(char* text, size_t size, const struct roster_item_t* item, int first) {
+
+    if (item->sign) {
+        return snprintf(text, size, "%s%c<%s>", first ? "" : ", ", item->sign, item->name);
+    }
+
+    return snprintf(text, size, "%s<%s>", first ? "" : ", ", item->name);
+}
+
+/**
+ * @brief Разбиение элементов на кадры не длиннее BUFFER_SIZE
+ *
+ * Каждый кадр начинается с заголовка "<title>, page i/n: "
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int roster_paginate(const char* title, const struct roster_items_t* items, struct roster_pages_t* result) {
+    int* starts = malloc((items->count + 1) * sizeof(int));
+    int page_count = 0;
+    int length = 0;
+
+    if (!starts) {
+        perror("roster_paginate: malloc");
+
+        return -1;
+    }
+
+    starts[page_count++] = 0;
+
+    for (int i = 0; i < items->count; i++) {
+        int item_length = (int) strlen(items->items[i].name) + 5;
+
+        if (length > 0 && length + item_length > ROSTER_PAGE_SIZE) {
+            starts[page_count++] = i;
+            length = 0;
+        }
+
+        length += item_length;
+    }
+
+    starts[page_count] = items->count;
+
+    result->pages = calloc(page_count, sizeof(struct message_t*));
+    result->count = 0;
+
+    if (!result->pages) {
+        perror("roster_paginate: calloc");
+
+        free(starts);
+
+        return -1;
+    }
+
+    for (int page = 0; page < page_count; page++) {
+        char frame[FRAME_HEADER_SIZE + BUFFER_SIZE];
+        char* text = frame + FRAME_HEADER_SIZE;
+
+        int offset = snprintf(text, BUFFER_SIZE, "%.*s, page %d/%d: ", ROSTER_HEADER_RESERVE - 32, title, page + 1, page_count);
+
+        for (int i = starts[page]; i < starts[page + 1] && offset < BUFFER_SIZE - 1; i++) {
+            offset += roster_item_print(text + offset, BUFFER_SIZE - offset, &items->items[i], i == starts[page]);
+        }
+
+        if (offset > BUFFER_SIZE - 1) {
+            offset = BUFFER_SIZE - 1;
+        }
+
+        frame_set_header(frame, offset);
+
+        struct message_t* message = message_create(frame, FRAME_HEADER_SIZE + offset);
+
+        if (!message) {
+            roster_pages_free(result->pages, result->count);
+            free(starts);
+
+            return -1;
+        }
+
+        result->pages[result->count++] = message;
+    }
+
+    free(starts);
+
+    return 0;
+}
+
+/**
+ * @brief Сборка кадров полного списка для текущего поколения
+ *
+ * @warning Вызывать под мьютексом кэша
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int roster_build(struct chat_t* chat) {
+    struct roster_t* roster = &chat->roster;
+
+    if (roster->pages && roster->built == roster->generation) {
+        return 0;
+    }
+
+    struct roster_items_t items = {0};
+
+    if (foreach_client_expect(chat, -1, roster_name_callback, &items) < 0) {
+        free(items.items);
+
+        return -1;
+    }
+
+    char title[ROSTER_HEADER_RESERVE];
+    struct roster_pages_t result;
+
+    snprintf(title, sizeof(title), "Online in #%s (%d), generation %llu", chat->name, items.count, (unsigned long long) roster->generation);
+
+    int error = roster_paginate(title, &items, &result);
+
+    free(items.items);
+
+    if (error < 0) {
+        return -1;
+    }
+
+    roster_pages_free(roster->pages, roster->page_count);
+
+    roster->pages = result.pages;
+    roster->page_count = result.count;
+    roster->built = roster->generation;
+
+    return 0;
+}
+
+/**
+ * @brief Отправка кадров клиенту с освобождением ссылок
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int roster_send_pages(struct client_data_t* c_data, struct message_t** pages, int count) {
+    int result = 0;
+
+    for (int i = 0; i < count; i++) {
+
+        if (result == 0 && client_send(c_data, pages[i]) < 0) {
+            result = -1;
+        }
+
+        message_unref(pages[i]);
+    }
+
+    return result;
+}
+
+int roster_send(struct chat_t* chat, struct client_data_t* c_data, int page) {
+    struct roster_t* roster = &chat->roster;
+
+    pthread_mutex_lock(&roster->mutex);
+
+    if (roster_build(chat) < 0) {
+        pthread_mutex_unlock(&roster->mutex);
+
+        return -1;
+    }
+
+    if (page > roster->page_count) {
+        int page_count = roster->page_count;
+
+        pthread_mutex_unlock(&roster->mutex);
+
+        struct message_t* message = message_printf("No page %d in #%s: %d pages", page, chat->name, page_count);
+
+        return message ? roster_send_pages(c_data, &message, 1) : -1;
+    }
+
+    int first = page == ROSTER_ALL_PAGES ? 0 : page - 1;
+    int count = page == ROSTER_ALL_PAGES ? roster->page_count : 1;
+
+    struct message_t** pages = malloc(count * sizeof(struct message_t*));
+
+    if (!pages) {
+        perror("roster_send: malloc");
+
+        pthread_mutex_unlock(&roster->mutex);
+
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        pages[i] = message_ref(roster->pages[first + i]);
+    }
+
+    pthread_mutex_unlock(&roster->mutex);
+
+    int result = roster_send_pages(c_data, pages, count);
+
+    free(pages);
+
+    return result;
+}
+
+int roster_send_delta(struct chat_t* chat, struct client_data_t* c_data, uint64_t since) {
+    struct roster_t* roster = &chat->roster;
+
+    pthread_mutex_lock(&roster->mutex);
+
+    uint64_t generation = roster->generation;
+
+    if (since >= generation) {
+        pthread_mutex_unlock(&roster->mutex);
+
+        struct message_t* message = message_printf("Roster of #%s is unchanged, generation %llu", chat->name, (unsigned long long) generation);
+
+        return message ? roster_send_pages(c_data, &message, 1) : -1;
+    }
+
+    if (generation - since > ROSTER_CHANGES) {
+        pthread_mutex_unlock(&roster->mutex);
+
+        return roster_send(chat, c_data, ROSTER_ALL_PAGES);
+    }
+
+    struct roster_items_t items = {0};
+
+    for (uint64_t i = since + 1; i <= generation; i++) {
+        struct roster_change_t* change = &roster->changes[i % ROSTER_CHANGES];
+
+        if (roster_items_push(&items, change->joined ? '+' : '-', change->name) < 0) {
+            pthread_mutex_unlock(&roster->mutex);
+
+            free(items.items);
+
+            return -1;
+        }
+
+    }
+
+    pthread_mutex_unlock(&roster->mutex);
+
+    char title[ROSTER_HEADER_RESERVE];
+    struct roster_pages_t result;
+
+    snprintf(title, sizeof(title), "Roster of #%s since %llu, generation %llu", chat->name, (unsigned long long) since, (unsigned long long) generation);
+
+    int error = roster_paginate(title, &items, &result);
+
+    free(items.items);
+
+    if (error < 0) {
+        return -1;
+    }
+
+    error = roster_send_pages(c_data, result.pages, result.count);
+
+    free(result.pages);
+
+    return error;
+}
@@ -0,0 +1,325 @@
+#include "../headers/scheduler.h"
+#include "../headers/metrics.h"
+
+/**
+ * @brief Рабочий поток пула
+ */
+struct scheduler_worker_t {
+    struct task_deque_t deque;              ///< Дек задач потока
+    pthread_t thread;                       ///< Поток
+    unsigned seed;                          ///< Состояние генератора для выбора жертвы кражи
+} __attribute__((aligned(64)));
+
+/**
+ * @brief Пул рабочих потоков
+ */
+struct scheduler_t {
+    struct scheduler_worker_t* workers;     ///< Рабочие потоки
+    int count;                              ///< Количество рабочих потоков
+    int started;                            ///< Сколько из них запущено
+    pthread_mutex_t lock;                   ///< Защищает общую очередь, stopping и сон потоков
+    pthread_cond_t wake;                    ///< Появилась задача или пул останавливается
+    struct task_t* head;                    ///< Общая очередь задач от потоков вне пула
+    struct task_t* tail;                    ///< Конец общей очереди
+    atomic_int pending;                     ///< Задач во всех деках и в общей очереди
+    atomic_int sleeping;                    ///< Потоков, ждущих задачу на wake
+    int stopping;                           ///< Пул останавливается
+};
+
+static struct scheduler_t scheduler = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+static __thread struct scheduler_worker_t* scheduler_self;
+
+/**
+ * @brief Задача в нижний конец своего дека
+ *
+ * @return int 0 в случае успеха, -1 если дек полон
+ */
+static int deque_push(struct task_deque_t* deque, struct task_t* task) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (bottom - top >= SCHEDULER_DEQUE_SIZE) {
+        return -1;
+    }
+
+    atomic_store_explicit(&deque->items[bottom & (SCHEDULER_DEQUE_SIZE - 1)], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return 0;
+}
+
+/**
+ * @brief Задача с нижнего конца своего дека (последняя положенная)
+ *
+ * За последний элемент владелец соревнуется с ворами через CAS на top
+ *
+ * @return struct task_t* NULL если дек пуст
+ */
+static struct task_t* deque_take(struct task_deque_t* deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+        return NULL;
+    }
+
+    struct task_t* task = atomic_load_explicit(&deque->items[bottom & (SCHEDULER_DEQUE_SIZE - 1)], memory_order_relaxed);
+
+    if (top == bottom) {
+
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+/**
+ * @brief Кража задачи с верхнего конца чужого дека (самой старой)
+ *
+ * @return struct task_t* NULL если дек пуст или задачу перехватили
+ */
+static struct task_t* deque_steal(struct task_deque_t* deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return NULL;
+    }
+
+    struct task_t* task = atomic_load_explicit(&deque->items[top & (SCHEDULER_DEQUE_SIZE - 1)], memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+
+    return task;
+}
+
+/**
+ * @brief Задача из общей очереди
+ *
+ * @return struct task_t* NULL если очередь пуста
+ */
+static struct task_t* scheduler_pop_shared(void) {
+    pthread_mutex_lock(&scheduler.lock);
+
+    struct task_t* task = scheduler.head;
+
+    if (task) {
+        scheduler.head = task->next;
+
+        if (!scheduler.head) {
+            scheduler.tail = NULL;
+        }
+
+    }
+
+    pthread_mutex_unlock(&scheduler.lock);
+
+    return task;
+}
+
+/**
+ * @brief Поиск задачи: свой дек, общая очередь, деки остальных потоков начиная со случайного
+ *
+ * @return struct task_t* NULL если задач не нашлось
+ */
+static struct task_t* scheduler_find(struct scheduler_worker_t* self) {
+    struct task_t* task = deque_take(&self->deque);
+
+    if (task) {
+        return task;
+    }
+
+    task = scheduler_pop_shared();
+
+    if (task) {
+        return task;
+    }
+
+    self->seed = self->seed * 1103515245 + 12345;
+
+    int start = (int) ((self->seed >> 16) % (unsigned) scheduler.count);
+
+    for (int i = 0; i < scheduler.count; i++) {
+        struct scheduler_worker_t* victim = &scheduler.workers[(start + i) % scheduler.count];
+
+        if (victim == self) {
+            continue;
+        }
+
+        task = deque_steal(&victim->deque);
+
+        if (task) {
+            metrics_add(METRICS_TASKS_STOLEN, 1);
+
+            return task;
+        }
+
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Цикл рабочего потока: выполняет задачи, пока они есть, затем спит на wake
+ *
+ */
+static void* scheduler_loop(void* arg) {
+    struct scheduler_worker_t* self = (struct scheduler_worker_t*) arg;
+
+    scheduler_self = self;
+
+    while (1) {
+        struct task_t* task = scheduler_find(self);
+
+        if (task) {
+            atomic_fetch_sub(&scheduler.pending, 1);
+
+            metrics_add(METRICS_TASKS, 1);
+
+            task->run(task);
+
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler.lock);
+
+        atomic_fetch_add(&scheduler.sleeping, 1);
+
+        while (atomic_load(&scheduler.pending) <= 0 && !scheduler.stopping) {
+            pthread_cond_wait(&scheduler.wake, &scheduler.lock);
+        }
+
+        atomic_fetch_sub(&scheduler.sleeping, 1);
+
+        int stop = scheduler.stopping && atomic_load(&scheduler.pending) <= 0;
+
+        pthread_mutex_unlock(&scheduler.lock);
+
+        if (stop) {
+            break;
+        }
+
+    }
+
+    return NULL;
+}
+
+int scheduler_start(int workers) {
+
+    if (workers == 0) {
+        long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+        workers = cpu_count > 0 ? (int) cpu_count : 1;
+    }
+
+    if (workers > MAX_WORKERS) {
+        workers = MAX_WORKERS;
+    }
+
+    scheduler.workers = aligned_alloc(64, workers * sizeof(struct scheduler_worker_t));
+
+    if (!scheduler.workers) {
+        perror("scheduler_start: aligned_alloc");
+
+        return -1;
+    }
+
+    memset(scheduler.workers, 0, workers * sizeof(struct scheduler_worker_t));
+
+    scheduler.count = workers;
+    scheduler.started = 0;
+    scheduler.stopping = 0;
+
+    for (int i = 0; i < workers; i++) {
+        scheduler.workers[i].seed = (unsigned) i + 1;
+    }
+
+    for (int i = 0; i < workers; i++) {
+        int error = pthread_create(&scheduler.workers[i].thread, NULL, scheduler_loop, &scheduler.workers[i]);
+
+        if (error != 0) {
+            fprintf(stderr, "scheduler_start: pthread_create: %s\n", strerror(error));
+
+            scheduler_stop();
+
+            return -1;
+        }
+
+        scheduler.started++;
+    }
+
+    return 0;
+}
+
+void scheduler_submit(struct task_t* task) {
+    struct scheduler_worker_t* self = scheduler_self;
+
+    if (!self || deque_push(&self->deque, task) < 0) {
+        task->next = NULL;
+
+        pthread_mutex_lock(&scheduler.lock);
+
+        if (scheduler.tail) {
+            scheduler.tail->next = task;
+        } else {
+            scheduler.head = task;
+        }
+
+        scheduler.tail = task;
+
+        pthread_mutex_unlock(&scheduler.lock);
+    }
+
+    atomic_fetch_add(&scheduler.pending, 1);
+
+    if (atomic_load(&scheduler.sleeping) > 0) {
+        pthread_mutex_lock(&scheduler.lock);
+        pthread_cond_signal(&scheduler.wake);
+        pthread_mutex_unlock(&scheduler.lock);
+    }
+
+}
+
+void scheduler_stop(void) {
+
+    if (!scheduler.workers) {
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler.lock);
+
+    scheduler.stopping = 1;
+
+    pthread_cond_broadcast(&scheduler.wake);
+    pthread_mutex_unlock(&scheduler.lock);
+
+    for (int i = 0; i < scheduler.started; i++) {
+        pthread_join(scheduler.workers[i].thread, NULL);
+    }
+
+    free(scheduler.workers);
+
+    scheduler.workers = NULL;
+    scheduler.count = 0;
+    scheduler.started = 0;
+}
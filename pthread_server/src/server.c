@@ -1,99 +1,277 @@
+#define _GNU_SOURCE
+
 #include "../headers/common.h"
-#include "../headers/chat_room.h"
+#include "../headers/admin.h"
 #include "../headers/client_handler.h"
-#include "../headers/time_prefix.h"
+#include "../headers/config.h"
+#include "../headers/listener.h"
+#include "../headers/logger.h"
+#include "../headers/message.h"
+#include "../headers/metrics.h"
+#include "../headers/reactor.h"
+#include "../headers/room_registry.h"
+#include "../headers/scheduler.h"
+#include "../headers/store.h"
+#include "../headers/trace.h"
+#include "../headers/upgrade.h"
+#include "../headers/writer.h"
+
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/**
+ * @brief Совместимый режим: отдельный поток на каждого клиента
+ *
+ * Слушающий сокет неблокирующий: после poll() очередь listen() вычитывается пачкой
+ * до config->accept_batch соединений. Отправка клиенту не блокируется: остаток кадров,
+ * не принятых сокетом, дописывает поток клиента (writer.h), а клиент, очередь которого
+ * превышает queue_bytes или queue_age_ms, отключается. Цикла событий в этом режиме нет,
+ * поэтому FLUSH_TICK оставляет объединение мелких отправок алгоритму Нейгла,
+ * FLUSH_IMMEDIATE его отключает. Команды клиентов выполняет пул рабочих потоков scheduler
+ *
+ * @return int -1 при критической ошибке
+ */
+static int threads_accept_loop(int fd, struct room_registry_t* rooms, const struct server_config_t* config) {
+    struct pollfd listener = {
+        .fd = fd,
+        .events = POLLIN
+    };
 
-int main(void) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int flags = fcntl(fd, F_GETFL, 0);
 
-    if (fd < 0) {
-        perror("socket");
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("threads_accept_loop: fcntl");
 
-        return EXIT_FAILURE;
+        return -1;
     }
 
-    int opt = 1;
+    while (1) {
 
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt");
+        if (poll(&listener, 1, -1) < 0) {
 
-        close(fd);
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("threads_accept_loop: poll");
+
+            return -1;
+        }
+
+        uint64_t ready = metrics_now();
+        int accepted = 0;
+
+        for (; accepted < config->accept_batch; accepted++) {
+            struct client_data_t c_data = {0};
+            struct sockaddr_in client_addr = {0};
+            socklen_t client_len = (socklen_t) sizeof(struct sockaddr_in);
+
+            c_data.client_fd = accept4(fd, (struct sockaddr*) &client_addr, &client_len, SOCK_CLOEXEC);
+
+            if (c_data.client_fd < 0) {
+
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("threads_accept_loop: accept4");
+                }
+
+                break;
+            }
+
+            metrics_record(METRICS_ACCEPT_WAIT, metrics_now() - ready);
+
+            if (!listener_admit(config->max_clients)) {
+                metrics_add(METRICS_REJECTED, 1);
+
+                listener_reject(c_data.client_fd);
+
+                continue;
+            }
+
+            if (config->flush == FLUSH_IMMEDIATE) {
+                set_nodelay(c_data.client_fd);
+            }
+
+            metrics_add(METRICS_ACCEPTS, 1);
+
+            c_data.client_port = ntohs(client_addr.sin_port);
+
+            inet_ntop(AF_INET, &client_addr.sin_addr.s_addr, c_data.client_ip, INET_ADDRSTRLEN);
+
+            c_data.writer = client_writer_create(&c_data, config->queue_bytes, config->queue_age_ms);
+
+            if (!c_data.writer) {
+                close(c_data.client_fd);
+                listener_release();
+
+                continue;
+            }
+
+            struct pthread_data_t* pthread_data = pthread_data_create(rooms, &config->rate, &c_data);
+
+            if (!pthread_data) {
+                perror("main: pthread_data_create");
+
+                client_writer_free(c_data.writer);
+
+                return -1;
+            }
+
+            pthread_t pthread;
+
+            if (pthread_create(&pthread, NULL, clients_handler, pthread_data) != 0) {
+                perror("main: pthread_create");
+
+                pthread_data_free(pthread_data);
+                client_writer_free(c_data.writer);
+
+                return -1;
+            }
+
+            pthread_detach(pthread);
+
+            log_printf(LOG_LEVEL_INFO, "New connection: %s:%d", c_data.client_ip, c_data.client_port);
+        }
+
+        if (accepted == config->accept_batch) {
+            metrics_add(METRICS_ACCEPT_BATCHES_FULL, 1);
+        }
 
-        return EXIT_FAILURE;
     }
 
-    struct sockaddr_in addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(PORT),
-        .sin_addr.s_addr = INADDR_ANY
-    };
+    return -1;
+}
 
-    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
-        perror("bind");
+/**
+ * @brief Запуск сервера в выбранном режиме
+ *
+ * @return int -1 при ошибке
+ */
+static int run_server(const struct server_config_t* config) {
+    trace_init(config->trace_sample);
 
-        close(fd);
+    if (message_pool_init(config->prealloc) < 0) {
+        return -1;
+    }
 
-        return EXIT_FAILURE;
+    struct room_registry_t* rooms = room_registry_init(config->mode == MODE_THREADS ? 1 : config->workers, &config->backlog);
+
+    if (!rooms) {
+        return -1;
     }
 
-    if (listen(fd, MAX_CONNECTION_REQUEST) < 0) {
-        perror("listen");
+    if (upgrade_receive() < 0) {
+        room_registry_free(rooms);
 
-        close(fd);
+        return -1;
+    }
 
-        return EXIT_FAILURE;
+    if (config->data_dir && store_open(config, rooms) < 0) {
+        upgrade_finish();
+        room_registry_free(rooms);
+
+        return -1;
     }
 
-    struct chat_t* chat = chat_init();
-    socklen_t client_len = (socklen_t) sizeof(struct sockaddr_in);
+    if (admin_start(config, rooms) < 0) {
+        upgrade_finish();
+        store_close();
+        room_registry_free(rooms);
 
-    print_time_prefix();
-    printf("Server is listening...\n");
+        return -1;
+    }
 
-    while (1) {
-        struct client_data_t c_data = {0};
-        struct sockaddr_in client_addr = {0};
+    int result = 0;
 
-        c_data.client_fd = accept(fd, (struct sockaddr*) &client_addr, &client_len);
+    if (config->mode == MODE_THREADS) {
+        upgrade_finish();
 
-        if (c_data.client_fd < 0) {
-            perror("accept");
+        if (client_handler_pool_init(config->prealloc) < 0) {
+            admin_stop();
+            store_close();
+            room_registry_free(rooms);
 
-            continue;
+            return -1;
         }
 
-        c_data.client_port = ntohs(client_addr.sin_port);
+        if (scheduler_start(config->task_workers) < 0) {
+            admin_stop();
+            store_close();
+            room_registry_free(rooms);
 
-        inet_ntop(AF_INET, &client_addr.sin_addr.s_addr, c_data.client_ip, INET_ADDRSTRLEN);
+            return -1;
+        }
 
-        struct pthread_data_t* pthread_data = malloc(sizeof(struct pthread_data_t));
+        int fd = create_listener(config->port, 0, config->listen_backlog);
 
-        if (!pthread_data) {
-            perror("main: malloc");
+        if (fd < 0) {
+            scheduler_stop();
+            admin_stop();
+            store_close();
+            room_registry_free(rooms);
 
-            return EXIT_FAILURE;
+            return -1;
         }
 
-        pthread_data->chat = chat;
-        pthread_data->client_data = c_data;
+        log_printf(LOG_LEVEL_INFO, "Server is listening on port %d (threads mode)...", config->port);
 
-        pthread_t pthread;
+        result = threads_accept_loop(fd, rooms, config);
 
-        if (pthread_create(&pthread, NULL, clients_handler, pthread_data) != 0) {
-            perror("main: pthread_create");
+        close(fd);
+        scheduler_stop();
+    } else {
+        log_printf(LOG_LEVEL_INFO, "Server is listening on port %d (epoll mode, %d workers)...", config->port, config->workers);
 
-            break;
-        }
-        
-        pthread_detach(pthread);
+        result = reactor_run(config, rooms);
+    }
+
+    if (result == REACTOR_UPGRADED) {
+        admin_stop();
+        store_close();
+        upgrade_commit();
+
+        log_printf(LOG_LEVEL_INFO, "The new server process took over, exiting");
+
+        return 0;
+    }
 
-        print_time_prefix();
-        printf("New connection: %s:%d\n", c_data.client_ip, c_data.client_port);
+    admin_stop();
+    store_close();
+    room_registry_free(rooms);
+
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    struct server_config_t config = {0};
+
+    if (config_parse(&config, argc, argv) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR2);
+
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    upgrade_init(argv);
+
+    if (logger_init(config.log_level) < 0) {
+        return EXIT_FAILURE;
     }
 
-    chat_free(chat);
+    int result = run_server(&config);
 
-    close(fd);
+    logger_shutdown();
 
-    return EXIT_SUCCESS;
-}   
+    return result < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
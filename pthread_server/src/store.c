@@ -0,0 +1,969 @@
+#include "../headers/store.h"
+#include "../headers/backlog.h"
+#include "../headers/logger.h"
+#include "../headers/message.h"
+#include "../headers/metrics.h"
+#include "../headers/room_registry.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define STORE_NAME_FORMAT       "%s/%020llu.%s"
+#define STORE_DIR_MAX           (PATH_MAX - 32)
+
+/**
+ * @brief Заголовок записи сегмента, за ним лежат имя комнаты и кадр сообщения
+ *
+ * Сегмент заполнен нулями заранее, поэтому запись с нулевой длиной означает конец данных
+ */
+struct store_record_t {
+    uint32_t length;                        ///< Длина записи вместе с заголовком
+    uint32_t crc;                           ///< CRC32 записи начиная с поля offset
+    uint64_t offset;                        ///< Сквозной номер записи в хранилище
+    uint64_t seq;                           ///< Номер сообщения в журнале комнаты
+    uint64_t time;                          ///< Время записи, мс
+    uint32_t name_length;                   ///< Длина имени комнаты
+    uint32_t frame_length;                  ///< Длина кадра сообщения
+};
+
+_Static_assert(sizeof(struct store_record_t) == STORE_RECORD_HEADER, "STORE_MIN_SEGMENT must fit the largest record");
+
+/**
+ * @brief Элемент разреженного индекса сегмента: позиция каждой записи, начинающей очередные STORE_INDEX_INTERVAL байт
+ */
+struct store_index_entry_t {
+    uint64_t offset;                        ///< Номер записи
+    uint64_t position;                      ///< Позиция записи в сегменте
+};
+
+/**
+ * @brief Сегмент хранилища
+ */
+struct store_segment_t {
+    uint64_t base;                          ///< Номер первой записи сегмента, он же имя файла
+    size_t bytes;                           ///< Длина данных сегмента
+    time_t mtime;                           ///< Время последней записи в сегмент
+};
+
+/**
+ * @brief Сообщение, ожидающее записи
+ */
+struct store_pending_t {
+    struct message_t* message;              ///< Сообщение со своей ссылкой
+    uint64_t time;                          ///< Время постановки в очередь, мс
+    char room[MAX_ROOM_NAME];               ///< Имя комнаты
+};
+
+/**
+ * @brief Состояние хранилища
+ *
+ * Активный сегмент, индекс и список сегментов меняет только фоновый поток
+ * (и store_open() до его запуска), очередь pending защищена мьютексом
+ */
+struct store_t {
+    char dir[STORE_DIR_MAX];                ///< Каталог хранилища
+    size_t segment_bytes;                   ///< Размер сегмента
+    size_t retain_bytes;                    ///< Лимит размера хранилища, 0 - без лимита
+    int retain_age;                         ///< Лимит возраста сегментов, с, 0 - без лимита
+    int fsync_ms;                           ///< Интервал сброса на диск, мс
+
+    struct store_segment_t* segments;       ///< Сегменты от старых к новым, последний - активный
+    int segment_count;                      ///< Количество сегментов
+    int segment_capacity;                   ///< Размер массива segments
+
+    int fd;                                 ///< Файл активного сегмента
+    int index_fd;                           ///< Файл индекса активного сегмента
+    char* map;                              ///< Отображение активного сегмента
+    size_t used;                            ///< Занятые байты активного сегмента
+    size_t synced;                          ///< Байты активного сегмента, уже сброшенные на диск
+    size_t indexed;                         ///< Позиция последней записи индекса
+    uint64_t next_offset;                   ///< Номер следующей записи
+
+    pthread_mutex_t mutex;                  ///< Мьютекс очереди
+    pthread_cond_t cond;                    ///< Пробуждение фонового потока
+    struct store_pending_t* pending;        ///< Очередь сообщений на запись
+    size_t pending_count;                   ///< Количество сообщений в очереди
+    size_t pending_capacity;                ///< Размер массива pending
+    int stop;                               ///< Фоновый поток должен завершиться
+    pthread_t thread;                       ///< Фоновый поток
+    atomic_int running;                     ///< Хранилище открыто
+};
+
+static struct store_t store = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .fd = -1,
+    .index_fd = -1
+};
+
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+
+        crc_table[i] = crc;
+    }
+
+}
+
+static uint32_t crc32(const char* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFFu;
+
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ (unsigned char) data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Путь к файлу сегмента или его индекса
+ *
+ */
+static void store_path(char* path, uint64_t base, const char* suffix) {
+    snprintf(path, PATH_MAX, STORE_NAME_FORMAT, store.dir, (unsigned long long) base, suffix);
+}
+
+/**
+ * @brief Чтение и проверка записи по позиции
+ *
+ * @return int 0 если запись целая, -1 если это конец данных или запись повреждена
+ */
+static int store_read_record(const char* map, size_t size, size_t position, struct store_record_t* record) {
+
+    if (position + sizeof(struct store_record_t) > size) {
+        return -1;
+    }
+
+    memcpy(record, map + position, sizeof(struct store_record_t));
+
+    if (record->length != sizeof(struct store_record_t) + record->name_length + record->frame_length
+        || record->name_length == 0
+        || record->name_length >= MAX_ROOM_NAME
+        || position + record->length > size) {
+        return -1;
+    }
+
+    size_t skip = offsetof(struct store_record_t, offset);
+
+    if (crc32(map + position + skip, record->length - skip) != record->crc) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Загрузка индекса сегмента
+ *
+ * @return struct store_index_entry_t* Массив элементов или NULL, если индекса нет
+ */
+static struct store_index_entry_t* store_load_index(uint64_t base, size_t* count) {
+    char path[PATH_MAX];
+
+    store_path(path, base, "idx");
+
+    *count = 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(struct store_index_entry_t)) {
+        close(fd);
+
+        return NULL;
+    }
+
+    struct store_index_entry_t* entries = malloc(st.st_size);
+
+    if (!entries) {
+        perror("store_load_index: malloc");
+
+        close(fd);
+
+        return NULL;
+    }
+
+    ssize_t count_of_bytes = pread(fd, entries, st.st_size, 0);
+
+    close(fd);
+
+    if (count_of_bytes < (ssize_t) sizeof(struct store_index_entry_t)) {
+        free(entries);
+
+        return NULL;
+    }
+
+    *count = count_of_bytes / sizeof(struct store_index_entry_t);
+
+    return entries;
+}
+
+/**
+ * @brief Поиск конца данных сегмента
+ *
+ * Просматриваются только записи после последнего элемента индекса, указывающего на целую запись
+ *
+ * @param valid_entries Количество элементов индекса, указывающих на целые записи
+ * @param next_offset Номер записи после последней целой записи, не меняется если записей нет
+ * @return size_t Позиция конца данных
+ */
+static size_t store_find_end(uint64_t base, const char* map, size_t size, size_t* valid_entries, uint64_t* next_offset) {
+    struct store_record_t record;
+    size_t count = 0;
+    size_t position = 0;
+
+    struct store_index_entry_t* entries = store_load_index(base, &count);
+
+    while (count > 0) {
+        struct store_index_entry_t* entry = &entries[count - 1];
+
+        if (store_read_record(map, size, entry->position, &record) == 0 && record.offset == entry->offset) {
+            position = entry->position;
+
+            break;
+        }
+
+        count--;
+    }
+
+    free(entries);
+
+    *valid_entries = count;
+
+    while (store_read_record(map, size, position, &record) == 0) {
+        position += record.length;
+        *next_offset = record.offset + 1;
+    }
+
+    return position;
+}
+
+/**
+ * @brief Добавление сегмента в конец списка
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int store_push_segment(uint64_t base, size_t bytes, time_t mtime) {
+
+    if (store.segment_count == store.segment_capacity) {
+        int capacity = store.segment_capacity ? store.segment_capacity * 2 : 16;
+        struct store_segment_t* segments = realloc(store.segments, capacity * sizeof(struct store_segment_t));
+
+        if (!segments) {
+            perror("store_push_segment: realloc");
+
+            return -1;
+        }
+
+        store.segments = segments;
+        store.segment_capacity = capacity;
+    }
+
+    store.segments[store.segment_count++] = (struct store_segment_t) {
+        .base = base,
+        .bytes = bytes,
+        .mtime = mtime
+    };
+
+    return 0;
+}
+
+/**
+ * @brief Открытие сегмента для записи с позиции used
+ *
+ * Новый файл сегмента сразу получает полный размер и заполняется нулями
+ *
+ * @param valid_entries Сколько элементов индекса оставить, остальные отбрасываются
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int store_activate(uint64_t base, size_t used, size_t valid_entries) {
+    char path[PATH_MAX];
+
+    store_path(path, base, "log");
+
+    store.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if (store.fd < 0) {
+        perror("store_activate: open");
+
+        return -1;
+    }
+
+    if (ftruncate(store.fd, store.segment_bytes) < 0) {
+        perror("store_activate: ftruncate");
+
+        return -1;
+    }
+
+    store.map = mmap(NULL, store.segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, store.fd, 0);
+
+    if (store.map == MAP_FAILED) {
+        perror("store_activate: mmap");
+
+        store.map = NULL;
+
+        return -1;
+    }
+
+    store_path(path, base, "idx");
+
+    store.index_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+
+    if (store.index_fd < 0) {
+        perror("store_activate: open");
+
+        return -1;
+    }
+
+    if (ftruncate(store.index_fd, valid_entries * sizeof(struct store_index_entry_t)) < 0) {
+        perror("store_activate: ftruncate");
+
+        return -1;
+    }
+
+    store.used = used;
+    store.synced = used;
+    store.indexed = used;
+
+    return 0;
+}
+
+/**
+ * @brief Сброс записанных данных активного сегмента и его индекса на диск
+ *
+ */
+static void store_sync(void) {
+
+    if (store.synced == store.used) {
+        return;
+    }
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t start = store.synced & ~(page - 1);
+
+    if (msync(store.map + start, store.used - start, MS_SYNC) < 0) {
+        perror("store_sync: msync");
+    }
+
+    if (fdatasync(store.index_fd) < 0) {
+        perror("store_sync: fdatasync");
+    }
+
+    store.synced = store.used;
+    store.segments[store.segment_count - 1].mtime = time(NULL);
+}
+
+/**
+ * @brief Удаление самых старых сегментов сверх лимитов размера и возраста
+ *
+ * Активный сегмент не удаляется
+ *
+ */
+static void store_retain(void) {
+    size_t total = 0;
+    time_t now = time(NULL);
+
+    for (int i = 0; i < store.segment_count; i++) {
+        total += store.segments[i].bytes;
+    }
+
+    int removed = 0;
+
+    while (removed < store.segment_count - 1) {
+        struct store_segment_t* segment = &store.segments[removed];
+
+        int over_size = store.retain_bytes > 0 && total > store.retain_bytes;
+        int over_age = store.retain_age > 0 && now - segment->mtime > store.retain_age;
+
+        if (!over_size && !over_age) {
+            break;
+        }
+
+        char path[PATH_MAX];
+
+        store_path(path, segment->base, "log");
+        unlink(path);
+
+        store_path(path, segment->base, "idx");
+        unlink(path);
+
+        log_printf(LOG_LEVEL_INFO, "Store segment %llu has been removed by retention (%zu bytes)", (unsigned long long) segment->base, segment->bytes);
+
+        total -= segment->bytes;
+        removed++;
+    }
+
+    if (removed > 0) {
+        memmove(store.segments, store.segments + removed, (store.segment_count - removed) * sizeof(struct store_segment_t));
+
+        store.segment_count -= removed;
+    }
+
+}
+
+/**
+ * @brief Закрытие активного сегмента: сброс на диск и обрезка файла по данным
+ *
+ */
+static void store_seal(void) {
+    store_sync();
+
+    munmap(store.map, store.segment_bytes);
+
+    if (ftruncate(store.fd, store.used) < 0) {
+        perror("store_seal: ftruncate");
+    }
+
+    close(store.fd);
+    close(store.index_fd);
+
+    store.map = NULL;
+    store.fd = -1;
+    store.index_fd = -1;
+}
+
+/**
+ * @brief Переход на новый сегмент, когда запись не помещается в активный
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int store_roll(void) {
+    store_seal();
+
+    if (store_push_segment(store.next_offset, 0, time(NULL)) < 0 || store_activate(store.next_offset, 0, 0) < 0) {
+        return -1;
+    }
+
+    store_retain();
+
+    return 0;
+}
+
+/**
+ * @brief Запись сообщения в активный сегмент
+ *
+ * Запись, которая не помещается даже в пустой сегмент, пропускается: новый сегмент
+ * при used == 0 получил бы имя активного, и store_retain() удалил бы его файл
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int store_write(struct store_pending_t* item) {
+    struct store_record_t record = {
+        .offset = store.next_offset,
+        .seq = item->message->seq,
+        .time = item->time,
+        .name_length = (uint32_t) strlen(item->room),
+        .frame_length = (uint32_t) item->message->length
+    };
+
+    record.length = sizeof(struct store_record_t) + record.name_length + record.frame_length;
+
+    if (record.length > store.segment_bytes) {
+        log_printf(LOG_LEVEL_ERROR, "Store record of %u bytes does not fit a segment of %zu bytes, message %llu of room %s is not persisted", record.length, store.segment_bytes, (unsigned long long) record.seq, item->room);
+
+        return 0;
+    }
+
+    if (store.used > 0 && store.used + record.length > store.segment_bytes && store_roll() < 0) {
+        return -1;
+    }
+
+    char* position = store.map + store.used;
+
+    memcpy(position + sizeof(struct store_record_t), item->room, record.name_length);
+    memcpy(position + sizeof(struct store_record_t) + record.name_length, item->message->data, record.frame_length);
+    memcpy(position, &record, sizeof(struct store_record_t));
+
+    size_t skip = offsetof(struct store_record_t, offset);
+
+    record.crc = crc32(position + skip, record.length - skip);
+
+    memcpy(position + offsetof(struct store_record_t, crc), &record.crc, sizeof(record.crc));
+
+    if (store.used == 0 || store.used - store.indexed >= STORE_INDEX_INTERVAL) {
+        struct store_index_entry_t entry = {
+            .offset = record.offset,
+            .position = store.used
+        };
+
+        if (write(store.index_fd, &entry, sizeof(entry)) != (ssize_t) sizeof(entry)) {
+            perror("store_write: write");
+        }
+
+        store.indexed = store.used;
+    }
+
+    store.used += record.length;
+    store.next_offset++;
+    store.segments[store.segment_count - 1].bytes = store.used;
+
+    return 0;
+}
+
+/**
+ * @brief Фоновый поток: забирает очередь целиком, пишет ее в сегмент и сбрасывает на диск раз в fsync_ms
+ *
+ */
+static void* store_loop(void* arg) {
+    (void) arg;
+
+    struct store_pending_t* batch = NULL;
+    size_t batch_capacity = 0;
+    uint64_t last_sync = now_ms();
+
+    while (1) {
+        pthread_mutex_lock(&store.mutex);
+
+        if (store.pending_count == 0 && !store.stop) {
+            uint64_t deadline_ms = last_sync + store.fsync_ms;
+            struct timespec deadline = {
+                .tv_sec = deadline_ms / 1000,
+                .tv_nsec = (deadline_ms % 1000) * 1000000L
+            };
+
+            pthread_cond_timedwait(&store.cond, &store.mutex, &deadline);
+        }
+
+        struct store_pending_t* items = store.pending;
+        size_t capacity = store.pending_capacity;
+        size_t count = store.pending_count;
+        int stop = store.stop;
+
+        store.pending = batch;
+        store.pending_capacity = batch_capacity;
+        store.pending_count = 0;
+
+        batch = items;
+        batch_capacity = capacity;
+
+        pthread_mutex_unlock(&store.mutex);
+
+        for (size_t i = 0; i < count; i++) {
+
+            if (store.map && store_write(&batch[i]) < 0) {
+                log_printf(LOG_LEVEL_ERROR, "Store is unavailable, messages are no longer persisted");
+            }
+
+            message_unref(batch[i].message);
+        }
+
+        uint64_t now = now_ms();
+
+        if (store.map && (stop || now - last_sync >= (uint64_t) store.fsync_ms)) {
+            store_sync();
+            store_retain();
+
+            last_sync = now;
+        }
+
+        if (stop && count == 0) {
+            break;
+        }
+
+    }
+
+    free(batch);
+
+    return NULL;
+}
+
+/**
+ * @brief Сравнение номеров сегментов для qsort()
+ *
+ */
+static int segment_compare(const void* a, const void* b) {
+    uint64_t left = ((const struct store_segment_t*) a)->base;
+    uint64_t right = ((const struct store_segment_t*) b)->base;
+
+    return left < right ? -1 : left > right;
+}
+
+/**
+ * @brief Поиск сегментов в каталоге хранилища
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int store_scan_dir(void) {
+    DIR* dir = opendir(store.dir);
+
+    if (!dir) {
+        perror("store_scan_dir: opendir");
+
+        return -1;
+    }
+
+    struct dirent* entry;
+
+    while ((entry = readdir(dir))) {
+        unsigned long long base = 0;
+        char suffix[4] = {0};
+
+        if (strlen(entry->d_name) != 24 || sscanf(entry->d_name, "%20llu.%3s", &base, suffix) != 2 || strcmp(suffix, "log") != 0) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        struct stat st;
+
+        store_path(path, base, "log");
+
+        if (stat(path, &st) < 0) {
+            perror("store_scan_dir: stat");
+
+            continue;
+        }
+
+        if (store_push_segment(base, st.st_size, st.st_mtime) < 0) {
+            closedir(dir);
+
+            return -1;
+        }
+
+    }
+
+    closedir(dir);
+
+    qsort(store.segments, store.segment_count, sizeof(struct store_segment_t), segment_compare);
+
+    return 0;
+}
+
+/**
+ * @brief Поиск конца журнала и открытие активного сегмента
+ *
+ * Сегмент полного размера продолжается с конца его данных, иначе он уже был закрыт
+ * и для записи создается новый сегмент
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int store_recover(void) {
+
+    if (store.segment_count == 0) {
+        return store_push_segment(0, 0, time(NULL)) < 0 ? -1 : store_activate(0, 0, 0);
+    }
+
+    struct store_segment_t* last = &store.segments[store.segment_count - 1];
+    uint64_t base = last->base;
+    char path[PATH_MAX];
+
+    store.next_offset = base;
+
+    store_path(path, base, "log");
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        perror("store_recover: open");
+
+        return -1;
+    }
+
+    size_t size = last->bytes;
+    size_t valid_entries = 0;
+    size_t end = 0;
+
+    if (size > 0) {
+        char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED) {
+            perror("store_recover: mmap");
+
+            close(fd);
+
+            return -1;
+        }
+
+        end = store_find_end(base, map, size, &valid_entries, &store.next_offset);
+
+        munmap(map, size);
+    }
+
+    close(fd);
+
+    if (size == store.segment_bytes) {
+        last->bytes = end;
+
+        return store_activate(base, end, valid_entries);
+    }
+
+    last->bytes = end;
+
+    if (store_push_segment(store.next_offset, 0, time(NULL)) < 0) {
+        return -1;
+    }
+
+    return store_activate(store.next_offset, 0, 0);
+}
+
+/**
+ * @brief Загрузка записей сегмента с позиции position в журналы комнат
+ *
+ * @return size_t Количество загруженных сообщений
+ */
+static size_t store_restore_segment(struct room_registry_t* rooms, struct store_segment_t* segment, size_t position) {
+    const char* map = NULL;
+    int mapped = segment == &store.segments[store.segment_count - 1];
+    size_t restored = 0;
+
+    if (mapped) {
+        map = store.map;
+    } else if (segment->bytes > 0) {
+        char path[PATH_MAX];
+
+        store_path(path, segment->base, "log");
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            perror("store_restore_segment: open");
+
+            return 0;
+        }
+
+        map = mmap(NULL, segment->bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        close(fd);
+
+        if (map == MAP_FAILED) {
+            perror("store_restore_segment: mmap");
+
+            return 0;
+        }
+
+    }
+
+    struct store_record_t record;
+
+    while (map && store_read_record(map, segment->bytes, position, &record) == 0) {
+        char name[MAX_ROOM_NAME];
+
+        memcpy(name, map + position + sizeof(struct store_record_t), record.name_length);
+        name[record.name_length] = '\0';
+
+        struct chat_t* room = room_name_valid(name) ? room_acquire(rooms, name) : NULL;
+
+        if (room) {
+            struct message_t* message = message_create(map + position + sizeof(struct store_record_t) + record.name_length, record.frame_length);
+
+            if (message) {
+                message->seq = record.seq;
+
+                backlog_restore(room, message);
+                message_unref(message);
+
+                restored++;
+            }
+
+            room_release(room);
+        }
+
+        position += record.length;
+    }
+
+    if (!mapped && map) {
+        munmap((void*) map, segment->bytes);
+    }
+
+    return restored;
+}
+
+/**
+ * @brief Восстановление журналов комнат из хвоста хранилища
+ *
+ * Хвост не больше общего лимита журналов комнат, начало хвоста находится по разреженному индексу
+ *
+ */
+static void store_restore(struct room_registry_t* rooms) {
+
+    if (rooms->backlog.capacity == 0) {
+        return;
+    }
+
+    uint64_t start = now_ms();
+    size_t window = rooms->backlog.total_bytes;
+    int first = store.segment_count - 1;
+
+    while (first > 0 && store.segments[first].bytes < window) {
+        window -= store.segments[first].bytes;
+        first--;
+    }
+
+    size_t position = 0;
+    size_t count = 0;
+
+    if (store.segments[first].bytes > window) {
+        struct store_index_entry_t* entries = store_load_index(store.segments[first].base, &count);
+        size_t skip = store.segments[first].bytes - window;
+
+        position = store.segments[first].bytes;
+
+        for (size_t i = 0; i < count; i++) {
+
+            if (entries[i].position >= skip && entries[i].position < store.segments[first].bytes) {
+                position = entries[i].position;
+
+                break;
+            }
+
+        }
+
+        free(entries);
+    }
+
+    size_t restored = 0;
+
+    for (int i = first; i < store.segment_count; i++) {
+        restored += store_restore_segment(rooms, &store.segments[i], i == first ? position : 0);
+    }
+
+    log_printf(LOG_LEVEL_INFO, "Restored %zu messages from %d store segments in %llu ms",
+        restored,
+        store.segment_count - first,
+        (unsigned long long) (now_ms() - start)
+    );
+}
+
+int store_open(const struct server_config_t* config, struct room_registry_t* rooms) {
+    if (strlen(config->data_dir) >= STORE_DIR_MAX) {
+        fprintf(stderr, "store_open: data directory path is too long\n");
+
+        return -1;
+    }
+
+    strncpy(store.dir, config->data_dir, STORE_DIR_MAX - 1);
+
+    store.segment_bytes = config->segment_bytes;
+    store.retain_bytes = config->retain_bytes;
+    store.retain_age = config->retain_age;
+    store.fsync_ms = config->fsync_ms;
+
+    crc_init();
+
+    if (mkdir(store.dir, 0755) < 0 && errno != EEXIST) {
+        perror("store_open: mkdir");
+
+        return -1;
+    }
+
+    if (store_scan_dir() < 0 || store_recover() < 0) {
+        return -1;
+    }
+
+    store_retain();
+    store_restore(rooms);
+
+    int error = pthread_create(&store.thread, NULL, store_loop, NULL);
+
+    if (error != 0) {
+        fprintf(stderr, "store_open: pthread_create: %s\n", strerror(error));
+
+        return -1;
+    }
+
+    atomic_store(&store.running, 1);
+
+    log_printf(LOG_LEVEL_INFO, "Store is open in %s: %d segments, next record %llu",
+        store.dir,
+        store.segment_count,
+        (unsigned long long) store.next_offset
+    );
+
+    return 0;
+}
+
+void store_append(struct chat_t* chat, struct message_t* message) {
+
+    if (!atomic_load_explicit(&store.running, memory_order_acquire)) {
+        return;
+    }
+
+    metrics_lock(&store.mutex);
+
+    if (store.pending_count == store.pending_capacity) {
+        size_t capacity = store.pending_capacity ? store.pending_capacity * 2 : STORE_BATCH;
+        struct store_pending_t* pending = realloc(store.pending, capacity * sizeof(struct store_pending_t));
+
+        if (!pending) {
+            pthread_mutex_unlock(&store.mutex);
+
+            log_printf(LOG_LEVEL_ERROR, "Message #%llu in #%s is not persisted: out of memory", (unsigned long long) message->seq, chat->name);
+
+            return;
+        }
+
+        store.pending = pending;
+        store.pending_capacity = capacity;
+    }
+
+    struct store_pending_t* item = &store.pending[store.pending_count++];
+
+    item->message = message_ref(message);
+    item->time = now_ms();
+
+    memcpy(item->room, chat->name, MAX_ROOM_NAME);
+
+    if (store.pending_count == STORE_BATCH) {
+        pthread_cond_signal(&store.cond);
+    }
+
+    pthread_mutex_unlock(&store.mutex);
+}
+
+void store_close(void) {
+
+    if (!atomic_exchange(&store.running, 0)) {
+        return;
+    }
+
+    pthread_mutex_lock(&store.mutex);
+
+    store.stop = 1;
+
+    pthread_cond_signal(&store.cond);
+    pthread_mutex_unlock(&store.mutex);
+
+    pthread_join(store.thread, NULL);
+
+    if (store.map) {
+        store_sync();
+
+        munmap(store.map, store.segment_bytes);
+    }
+
+    if (store.fd >= 0) {
+        close(store.fd);
+    }
+
+    if (store.index_fd >= 0) {
+        close(store.index_fd);
+    }
+
+    free(store.pending);
+    free(store.segments);
+}
@@ -0,0 +1,69 @@
+#include "../headers/throttle.h"
+#include "../headers/metrics.h"
+
+/**
+ * @brief Пополнение одной корзины за elapsed мс с ограничением емкостью
+ *
+ */
+static void throttle_refill(uint64_t* tokens, uint64_t rate, uint64_t elapsed) {
+    uint64_t capacity = rate * THROTTLE_SCALE;
+
+    if (elapsed >= 1000 || *tokens + rate * elapsed >= capacity) {
+        *tokens = capacity;
+    } else {
+        *tokens += rate * elapsed;
+    }
+
+}
+
+void throttle_init(struct throttle_t* throttle, const struct rate_limits_t* limits, uint64_t now) {
+    throttle->messages = (uint64_t) limits->messages * THROTTLE_SCALE;
+    throttle->bytes = (uint64_t) limits->bytes * THROTTLE_SCALE;
+    throttle->updated = now;
+    throttle->violated = 0;
+    throttle->strikes = 0;
+}
+
+enum throttle_verdict throttle_admit(struct throttle_t* throttle, const struct rate_limits_t* limits, size_t length, uint64_t now) {
+
+    if (!limits->messages && !limits->bytes) {
+        return THROTTLE_PASS;
+    }
+
+    if (now > throttle->updated) {
+        uint64_t elapsed = now - throttle->updated;
+
+        throttle_refill(&throttle->messages, limits->messages, elapsed);
+        throttle_refill(&throttle->bytes, limits->bytes, elapsed);
+
+        throttle->updated = now;
+    }
+
+    uint64_t message_cost = limits->messages ? THROTTLE_SCALE : 0;
+    uint64_t byte_cost = limits->bytes ? (uint64_t) length * THROTTLE_SCALE : 0;
+
+    if (throttle->messages >= message_cost && throttle->bytes >= byte_cost) {
+        throttle->messages -= message_cost;
+        throttle->bytes -= byte_cost;
+
+        return THROTTLE_PASS;
+    }
+
+    metrics_add(METRICS_THROTTLED_MESSAGES, 1);
+    metrics_add(METRICS_THROTTLED_BYTES, length);
+
+    if (now - throttle->violated > (uint64_t) limits->window_ms) {
+        throttle->strikes = 0;
+    }
+
+    throttle->violated = now;
+    throttle->strikes++;
+
+    if (limits->strikes && throttle->strikes >= limits->strikes) {
+        metrics_add(METRICS_FLOOD_DISCONNECTS, 1);
+
+        return THROTTLE_DISCONNECT;
+    }
+
+    return throttle->strikes == 1 ? THROTTLE_NOTIFY : THROTTLE_DROP;
+}
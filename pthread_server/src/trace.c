@@ -0,0 +1,55 @@
+#include "../headers/trace.h"
+
+unsigned trace_sample = TRACE_DEFAULT_SAMPLE;
+
+__thread struct trace_t trace_self;
+
+void trace_init(unsigned sample) {
+    trace_sample = sample;
+}
+
+void trace_sampled(void) {
+    trace_self.received = 0;
+    trace_self.pending = metrics_now();
+}
+
+void trace_frame_begin(void) {
+
+    if (!trace_self.pending) {
+        return;
+    }
+
+    uint64_t now = metrics_now();
+
+    trace_self.active = 1;
+    trace_self.start = trace_self.pending;
+    trace_self.frame = now;
+    trace_self.mark = now;
+    trace_self.pending = 0;
+
+    metrics_record(METRICS_READ, now - trace_self.start);
+}
+
+void trace_frame_end(void) {
+
+    if (!trace_self.active) {
+        return;
+    }
+
+    metrics_record(METRICS_FRAME, metrics_now() - trace_self.frame);
+
+    trace_self.active = 0;
+}
+
+void trace_stage(enum metrics_histogram stage) {
+
+    if (!trace_self.active) {
+        return;
+    }
+
+    uint64_t now = metrics_now();
+
+    metrics_record(stage, now - trace_self.mark);
+
+    trace_self.mark = now;
+}
@@ -0,0 +1,558 @@
+#include "../headers/upgrade.h"
+#include "../headers/logger.h"
+
+#include <sys/wait.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define UPGRADE_READY           'R'
+#define UPGRADE_GO              'G'
+#define UPGRADE_TIMEOUT_S       10
+
+extern char** environ;
+
+/**
+ * @brief Состояние горячего обновления процесса
+ *
+ * Старый процесс использует fd и child, новый - полученные listeners и connections
+ */
+struct upgrade_t {
+    char path[PATH_MAX];                    ///< Исполняемый файл сервера
+    char** argv;                            ///< Аргументы запуска
+    int fd;                                 ///< Сокет связи с другим процессом, -1 если обновления нет
+    pid_t child;                            ///< Новый процесс, запущенный старым
+    int* listeners;                         ///< Слушающие сокеты по номеру рабочего потока, -1 если сокета нет
+    int listener_count;                     ///< Размер массива listeners
+    struct upgrade_connection_t* connections; ///< Полученные соединения
+    int connection_count;                   ///< Количество полученных соединений
+    int connection_capacity;                ///< Размер массива connections
+    uint32_t next_client_id;                ///< Следующий свободный номер клиента
+};
+
+static struct upgrade_t upgrade = {
+    .fd = -1
+};
+
+void upgrade_init(char* argv[]) {
+    ssize_t length = readlink("/proc/self/exe", upgrade.path, sizeof(upgrade.path) - 1);
+
+    if (length < 0) {
+        perror("upgrade_init: readlink");
+
+        length = 0;
+    }
+
+    upgrade.path[length] = '\0';
+    upgrade.argv = argv;
+}
+
+/**
+ * @brief Окружение нового процесса: текущее окружение и UPGRADE_ENV с номером сокета
+ *
+ * @return char** Массив строк, NULL при ошибке; освобождается одним free()
+ */
+static char** upgrade_environment(char* variable) {
+    size_t count = 0;
+
+    while (environ[count]) {
+        count++;
+    }
+
+    char** envp = malloc((count + 2) * sizeof(char*));
+
+    if (!envp) {
+        perror("upgrade_environment: malloc");
+
+        return NULL;
+    }
+
+    size_t length = 0;
+
+    for (size_t i = 0; i < count; i++) {
+
+        if (strncmp(environ[i], UPGRADE_ENV "=", strlen(UPGRADE_ENV "=")) != 0) {
+            envp[length++] = environ[i];
+        }
+
+    }
+
+    envp[length++] = variable;
+    envp[length] = NULL;
+
+    return envp;
+}
+
+int upgrade_spawn(void) {
+    int pair[2];
+    char variable[64];
+
+    if (upgrade.path[0] == '\0') {
+        fprintf(stderr, "upgrade_spawn: path of the server binary is unknown\n");
+
+        return -1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        perror("upgrade_spawn: socketpair");
+
+        return -1;
+    }
+
+    struct timeval timeout = {
+        .tv_sec = UPGRADE_TIMEOUT_S
+    };
+
+    if (setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        perror("upgrade_spawn: setsockopt");
+    }
+
+    snprintf(variable, sizeof(variable), UPGRADE_ENV "=%d", pair[1]);
+
+    char** envp = upgrade_environment(variable);
+
+    if (!envp) {
+        close(pair[0]);
+        close(pair[1]);
+
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        fcntl(pair[1], F_SETFD, 0);
+
+        execve(upgrade.path, upgrade.argv, envp);
+
+        perror("upgrade_spawn: execve");
+
+        _exit(127);
+    }
+
+    free(envp);
+    close(pair[1]);
+
+    if (pid < 0) {
+        perror("upgrade_spawn: fork");
+
+        close(pair[0]);
+
+        return -1;
+    }
+
+    upgrade.fd = pair[0];
+    upgrade.child = pid;
+
+    log_printf(LOG_LEVEL_INFO, "Started the new server process %d from %s", (int) pid, upgrade.path);
+
+    return 0;
+}
+
+/**
+ * @brief Запись всех байт в сокет связи
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int upgrade_write(const char* data, size_t length) {
+
+    while (length > 0) {
+        ssize_t count_of_bytes = send(upgrade.fd, data, length, MSG_NOSIGNAL);
+
+        if (count_of_bytes < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("upgrade_write: send");
+
+            return -1;
+        }
+
+        data += count_of_bytes;
+        length -= count_of_bytes;
+    }
+
+    return 0;
+}
+
+int upgrade_send(const struct upgrade_record_t* record, int fd, const struct iovec* data, int count) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec head = {
+        .iov_base = (void*) record,
+        .iov_len = sizeof(*record)
+    };
+    struct msghdr msg = {
+        .msg_iov = &head,
+        .msg_iovlen = 1
+    };
+
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t sent = 0;
+
+    do {
+        sent = sendmsg(upgrade.fd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0) {
+        perror("upgrade_send: sendmsg");
+
+        return -1;
+    }
+
+    if (upgrade_write((const char*) record + sent, sizeof(*record) - sent) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+
+        if (upgrade_write(data[i].iov_base, data[i].iov_len) < 0) {
+            return -1;
+        }
+
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Чтение ровно length байт из сокета связи
+ *
+ * Границы чтений совпадают с границами записей, поэтому дескриптор записи
+ * приходит в чтении ее первых байт
+ *
+ * @param fd Сюда записывается полученный дескриптор, NULL - дескрипторы не ожидаются и закрываются
+ * @return int 0 в случае успеха, -1 при ошибке или закрытии сокета
+ */
+static int upgrade_read(void* data, size_t length, int* fd) {
+    char* position = data;
+
+    while (length > 0) {
+        char control[CMSG_SPACE(sizeof(int))];
+        struct iovec iov = {
+            .iov_base = position,
+            .iov_len = length
+        };
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control,
+            .msg_controllen = sizeof(control)
+        };
+
+        ssize_t count_of_bytes = recvmsg(upgrade.fd, &msg, MSG_CMSG_CLOEXEC);
+
+        if (count_of_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count_of_bytes <= 0) {
+
+            if (count_of_bytes < 0) {
+                perror("upgrade_read: recvmsg");
+            }
+
+            return -1;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+
+            int received = -1;
+
+            memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+
+            if (fd && *fd < 0) {
+                *fd = received;
+            } else {
+                close(received);
+            }
+
+        }
+
+        position += count_of_bytes;
+        length -= count_of_bytes;
+    }
+
+    return 0;
+}
+
+int upgrade_wait_ready(void) {
+    char answer = 0;
+
+    if (upgrade_read(&answer, 1, NULL) < 0 || answer != UPGRADE_READY) {
+        log_printf(LOG_LEVEL_ERROR, "The new server process did not take over the connections");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void upgrade_abort(void) {
+
+    if (upgrade.fd >= 0) {
+        close(upgrade.fd);
+
+        upgrade.fd = -1;
+    }
+
+    if (upgrade.child > 0) {
+        kill(upgrade.child, SIGKILL);
+        waitpid(upgrade.child, NULL, 0);
+
+        upgrade.child = 0;
+    }
+
+}
+
+void upgrade_commit(void) {
+    char go = UPGRADE_GO;
+
+    if (upgrade_write(&go, 1) < 0) {
+        log_printf(LOG_LEVEL_ERROR, "The new server process %d was not released", (int) upgrade.child);
+    }
+
+    close(upgrade.fd);
+
+    upgrade.fd = -1;
+}
+
+/**
+ * @brief Чтение байт, идущих за записью соединения
+ *
+ * @return char* Буфер из length байт, NULL если length равен 0 или при ошибке
+ */
+static char* upgrade_read_bytes(uint32_t length, int* error) {
+
+    if (length == 0) {
+        return NULL;
+    }
+
+    char* data = malloc(length);
+
+    if (!data) {
+        perror("upgrade_read_bytes: malloc");
+
+        *error = 1;
+
+        return NULL;
+    }
+
+    if (upgrade_read(data, length, NULL) < 0) {
+        free(data);
+
+        *error = 1;
+
+        return NULL;
+    }
+
+    return data;
+}
+
+/**
+ * @brief Сохранение записи слушающего сокета или соединения
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int upgrade_store(const struct upgrade_record_t* record, int fd) {
+
+    if (record->type == UPGRADE_LISTENER) {
+
+        if (record->index < 0 || record->index >= MAX_WORKERS) {
+            close(fd);
+
+            return -1;
+        }
+
+        if (record->index >= upgrade.listener_count) {
+            int* listeners = realloc(upgrade.listeners, (record->index + 1) * sizeof(int));
+
+            if (!listeners) {
+                perror("upgrade_store: realloc");
+
+                close(fd);
+
+                return -1;
+            }
+
+            for (int i = upgrade.listener_count; i <= record->index; i++) {
+                listeners[i] = -1;
+            }
+
+            upgrade.listeners = listeners;
+            upgrade.listener_count = record->index + 1;
+        }
+
+        upgrade.listeners[record->index] = fd;
+
+        return 0;
+    }
+
+    if (upgrade.connection_count == upgrade.connection_capacity) {
+        int capacity = upgrade.connection_capacity ? upgrade.connection_capacity * 2 : 64;
+        struct upgrade_connection_t* connections = realloc(upgrade.connections, capacity * sizeof(struct upgrade_connection_t));
+
+        if (!connections) {
+            perror("upgrade_store: realloc");
+
+            close(fd);
+
+            return -1;
+        }
+
+        upgrade.connections = connections;
+        upgrade.connection_capacity = capacity;
+    }
+
+    struct upgrade_connection_t* item = &upgrade.connections[upgrade.connection_count++];
+    int error = 0;
+
+    item->record = *record;
+    item->fd = fd;
+    item->out = upgrade_read_bytes(record->out_length, &error);
+    item->pending = upgrade_read_bytes(record->pending_length, &error);
+
+    item->record.client_name[MAX_NAME_LENGTH - 1] = '\0';
+    item->record.room[MAX_ROOM_NAME - 1] = '\0';
+    item->record.client_ip[INET_ADDRSTRLEN - 1] = '\0';
+
+    return error ? -1 : 0;
+}
+
+int upgrade_receive(void) {
+    const char* value = getenv(UPGRADE_ENV);
+
+    if (!value) {
+        return 0;
+    }
+
+    upgrade.fd = atoi(value);
+
+    unsetenv(UPGRADE_ENV);
+
+    if (fcntl(upgrade.fd, F_SETFD, FD_CLOEXEC) < 0) {
+        perror("upgrade_receive: fcntl");
+
+        upgrade.fd = -1;
+
+        return -1;
+    }
+
+    while (1) {
+        struct upgrade_record_t record;
+        int fd = -1;
+
+        if (upgrade_read(&record, sizeof(record), &fd) < 0) {
+            break;
+        }
+
+        if (record.type == UPGRADE_END) {
+            char answer = UPGRADE_READY;
+
+            upgrade.next_client_id = record.client_id;
+
+            if (upgrade_write(&answer, 1) < 0 || upgrade_read(&answer, 1, NULL) < 0 || answer != UPGRADE_GO) {
+                break;
+            }
+
+            close(upgrade.fd);
+
+            upgrade.fd = -1;
+
+            log_printf(LOG_LEVEL_INFO, "Took over %d listeners and %d connections from the previous server process", upgrade.listener_count, upgrade.connection_count);
+
+            return 1;
+        }
+
+        if (fd < 0 || upgrade_store(&record, fd) < 0) {
+            break;
+        }
+
+    }
+
+    fprintf(stderr, "upgrade_receive: handover from the previous server process was interrupted\n");
+
+    upgrade_finish();
+
+    close(upgrade.fd);
+
+    upgrade.fd = -1;
+
+    return -1;
+}
+
+int upgrade_take_listener(int index) {
+
+    if (index >= upgrade.listener_count) {
+        return -1;
+    }
+
+    int fd = upgrade.listeners[index];
+
+    upgrade.listeners[index] = -1;
+
+    return fd;
+}
+
+int upgrade_connection_count(void) {
+    return upgrade.connection_count;
+}
+
+struct upgrade_connection_t* upgrade_connection(int index) {
+    return &upgrade.connections[index];
+}
+
+uint32_t upgrade_next_client_id(void) {
+    return upgrade.next_client_id;
+}
+
+void upgrade_finish(void) {
+
+    for (int i = 0; i < upgrade.listener_count; i++) {
+
+        if (upgrade.listeners[i] >= 0) {
+            close(upgrade.listeners[i]);
+        }
+
+    }
+
+    for (int i = 0; i < upgrade.connection_count; i++) {
+        struct upgrade_connection_t* item = &upgrade.connections[i];
+
+        if (item->fd >= 0) {
+            close(item->fd);
+        }
+
+        free(item->out);
+        free(item->pending);
+    }
+
+    free(upgrade.listeners);
+    free(upgrade.connections);
+
+    upgrade.listeners = NULL;
+    upgrade.listener_count = 0;
+    upgrade.connections = NULL;
+    upgrade.connection_count = 0;
+    upgrade.connection_capacity = 0;
+}
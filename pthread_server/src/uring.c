@@ -0,0 +1,696 @@
+#include "../headers/uring.h"
+#include "../headers/logger.h"
+#include "../headers/metrics.h"
+
+#ifdef HAVE_IO_URING
+
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define URING_ENTRIES           4096
+#define URING_BUFFER_COUNT      1024
+#define URING_BUFFER_LENGTH     4096
+#define URING_BUFFER_GROUP      0
+#define URING_MAX_CHAIN         64
+
+/**
+ * @brief Тип операции, закодированный в младших битах user_data
+ */
+enum uring_op {
+    OP_ACCEPT,                              ///< Multishot accept на слушающем сокете
+    OP_RECV,                                ///< Multishot recv, указатель - соединение
+    OP_SEND,                                ///< Отправка, указатель - соединение
+    OP_EVENT                                ///< Чтение eventfd входящей очереди
+};
+
+#define URING_OP_MASK           7ULL
+
+/**
+ * @brief Кольцо io_uring рабочего потока
+ */
+struct uring_t {
+    int fd;                                 ///< Дескриптор кольца
+    unsigned entries;                       ///< Размер очереди отправки
+    unsigned* sq_head;                      ///< Голова очереди отправки (двигает ядро)
+    unsigned* sq_tail;                      ///< Хвост очереди отправки
+    unsigned* sq_mask;                      ///< Маска индекса очереди отправки
+    unsigned* sq_array;                     ///< Массив индексов SQE
+    unsigned sq_local_tail;                 ///< Хвост с учетом подготовленных, но не опубликованных SQE
+    unsigned* cq_head;                      ///< Голова очереди завершений
+    unsigned* cq_tail;                      ///< Хвост очереди завершений (двигает ядро)
+    unsigned* cq_mask;                      ///< Маска индекса очереди завершений
+    struct io_uring_sqe* sqes;              ///< Массив SQE
+    struct io_uring_cqe* cqes;              ///< Массив CQE
+    void* sq_ring;                          ///< Отображение кольца отправки
+    size_t sq_ring_size;                    ///< Размер отображения кольца отправки
+    void* cq_ring;                          ///< Отображение кольца завершений (может совпадать с sq_ring)
+    size_t cq_ring_size;                    ///< Размер отображения кольца завершений
+    size_t sqes_size;                       ///< Размер отображения массива SQE
+    struct io_uring_buf_ring* buf_ring;     ///< Кольцо предоставленных буферов для multishot recv
+    size_t buf_ring_size;                   ///< Размер кольца предоставленных буферов
+    char* buffers;                          ///< Память предоставленных буферов
+    unsigned short buf_tail;                ///< Хвост кольца предоставленных буферов
+    uint64_t event_value;                   ///< Буфер для чтения eventfd
+};
+
+int uring_supported(void) {
+    return 1;
+}
+
+/**
+ * @brief Возвращает буфер в кольцо предоставленных буферов
+ *
+ */
+static void uring_buffer_recycle(struct uring_t* ring, unsigned short id) {
+    struct io_uring_buf* buf = &ring->buf_ring->bufs[ring->buf_tail & (URING_BUFFER_COUNT - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) (ring->buffers + (size_t) id * URING_BUFFER_LENGTH);
+    buf->len = URING_BUFFER_LENGTH - 1;
+    buf->bid = id;
+
+    ring->buf_tail++;
+
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Публикует подготовленные SQE и входит в ядро
+ *
+ * @param wait Количество завершений, которых нужно дождаться
+ * @return int 0 в случае успеха, -1 при ошибке (errno сохраняется)
+ */
+static int uring_enter(struct uring_t* ring, unsigned wait) {
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (to_submit == 0 && wait == 0) {
+        return 0;
+    }
+
+    if (syscall(__NR_io_uring_enter, ring->fd, to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Количество свободных мест в очереди отправки
+ *
+ */
+static unsigned uring_sq_space(struct uring_t* ring) {
+    return ring->entries - (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * @brief Получение свободного SQE
+ *
+ * Если очередь отправки заполнена, подготовленные SQE сначала передаются ядру
+ *
+ * @return struct io_uring_sqe* Обнуленный SQE, NULL если места нет
+ */
+static struct io_uring_sqe* uring_get_sqe(struct uring_t* ring) {
+
+    if (uring_sq_space(ring) == 0) {
+
+        if (uring_enter(ring, 0) < 0 && errno != EBUSY && errno != EAGAIN && errno != EINTR) {
+            perror("uring_get_sqe: io_uring_enter");
+        }
+
+        if (uring_sq_space(ring) == 0) {
+            return NULL;
+        }
+
+    }
+
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sq_local_tail & *ring->sq_mask];
+
+    ring->sq_local_tail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+/**
+ * @brief Постановка multishot accept на слушающий сокет
+ *
+ */
+static void uring_arm_accept(struct reactor_t* reactor) {
+    struct io_uring_sqe* sqe = uring_get_sqe(reactor->ring);
+
+    if (!sqe) {
+        fprintf(stderr, "uring_arm_accept: submission queue is full\n");
+
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = reactor->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = OP_ACCEPT;
+}
+
+/**
+ * @brief Постановка чтения eventfd входящей очереди
+ *
+ */
+static void uring_arm_event(struct reactor_t* reactor) {
+    struct io_uring_sqe* sqe = uring_get_sqe(reactor->ring);
+
+    if (!sqe) {
+        fprintf(stderr, "uring_arm_event: submission queue is full\n");
+
+        return;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reactor->event_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &reactor->ring->event_value;
+    sqe->len = sizeof(reactor->ring->event_value);
+    sqe->user_data = OP_EVENT;
+}
+
+/**
+ * @brief Постановка multishot recv с выбором буфера из кольца
+ *
+ */
+static void uring_arm_recv(struct connection_t* conn) {
+    struct io_uring_sqe* sqe = uring_get_sqe(conn->reactor->ring);
+
+    if (!sqe) {
+        fprintf(stderr, "uring_arm_recv: submission queue is full\n");
+
+        connection_schedule_close(conn);
+
+        return;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->data.client_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = (uint64_t) (uintptr_t) conn | OP_RECV;
+
+    conn->uring_refs++;
+}
+
+/**
+ * @brief Освобождает закрытое соединение, если ядро больше не ссылается на него
+ *
+ */
+static void uring_release_if_idle(struct connection_t* conn) {
+
+    if (conn->state == CONN_CLOSED && conn->uring_refs == 0 && !conn->dirty) {
+        connection_free(conn);
+    }
+
+}
+
+/**
+ * @brief Передает ядру отправку всех сообщений из очереди соединения
+ *
+ * Отправки указывают прямо в память общих сообщений и связываются через
+ * IOSQE_IO_LINK, чтобы ядро отправило их по порядку. В режиме FLUSH_TICK все отправки
+ * цепочки, кроме последней, идут с MSG_MORE, и ядро собирает мелкие сообщения в полные сегменты.
+ * Пока предыдущая цепочка не завершилась, новая не ставится
+ *
+ * @return int 0 в случае успеха, -1 если в очереди отправки нет места
+ */
+static int uring_submit_sends(struct connection_t* conn) {
+    struct uring_t* ring = conn->reactor->ring;
+    unsigned count = conn->out.count < URING_MAX_CHAIN ? conn->out.count : URING_MAX_CHAIN;
+    int cork = conn->reactor->config->flush == FLUSH_TICK;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (uring_sq_space(ring) < count) {
+        uring_enter(ring, 0);
+
+        if (uring_sq_space(ring) < count) {
+            count = uring_sq_space(ring);
+        }
+
+        if (count == 0) {
+            return -1;
+        }
+
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        struct io_uring_sqe* sqe = uring_get_sqe(ring);
+        struct message_t* message = message_queue_at(&conn->out, i);
+        size_t offset = i == 0 ? conn->out.offset : 0;
+
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->data.client_fd;
+        sqe->addr = (uint64_t) (uintptr_t) (message->data + offset);
+        sqe->len = message->length - offset;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = (uint64_t) (uintptr_t) conn | OP_SEND;
+
+        if (i + 1 < count) {
+            sqe->flags = IOSQE_IO_LINK;
+
+            if (cork) {
+                sqe->msg_flags |= MSG_MORE;
+            }
+
+        }
+
+        conn->sends_in_flight++;
+        conn->uring_refs++;
+    }
+
+    metrics_add(METRICS_SEND_CALLS, count);
+
+    return 0;
+}
+
+/**
+ * @brief Ставит отправки всех соединений, получивших данные за итерацию
+ *
+ */
+static void uring_flush_dirty(struct reactor_t* reactor) {
+
+    while (reactor->dirty) {
+        struct connection_t* conn = reactor->dirty;
+
+        reactor->dirty = conn->next_dirty;
+
+        conn->dirty = 0;
+        conn->next_dirty = NULL;
+
+        if (conn->state == CONN_CLOSED || conn->failed) {
+            uring_release_if_idle(conn);
+
+            continue;
+        }
+
+        if (conn->sends_in_flight == 0 && uring_submit_sends(conn) < 0) {
+            connection_mark_dirty(conn);
+
+            return;
+        }
+
+    }
+
+}
+
+/**
+ * @brief Завершение multishot accept
+ *
+ */
+static void uring_on_accept(struct reactor_t* reactor, struct io_uring_cqe* cqe) {
+
+    if (cqe->res >= 0) {
+        struct sockaddr_in client_addr = {0};
+        socklen_t client_len = (socklen_t) sizeof(struct sockaddr_in);
+
+        if (getpeername(cqe->res, (struct sockaddr*) &client_addr, &client_len) < 0) {
+            perror("uring_on_accept: getpeername");
+        }
+
+        struct connection_t* conn = reactor_accept_connection(reactor, cqe->res, &client_addr);
+
+        if (conn) {
+            uring_arm_recv(conn);
+        }
+
+    } else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED) {
+        fprintf(stderr, "uring_on_accept: accept: %s\n", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept(reactor);
+    }
+
+}
+
+/**
+ * @brief Завершение multishot recv: одно сообщение клиента в предоставленном буфере
+ *
+ */
+static void uring_on_recv(struct reactor_t* reactor, struct connection_t* conn, struct io_uring_cqe* cqe) {
+    struct uring_t* ring = reactor->ring;
+    int alive = conn->state != CONN_CLOSED && !conn->failed;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        conn->uring_refs--;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char* buffer = ring->buffers + (size_t) id * URING_BUFFER_LENGTH;
+
+        if (alive && cqe->res > 0) {
+            connection_on_data(conn, buffer, cqe->res);
+        }
+
+        uring_buffer_recycle(ring, id);
+    }
+
+    if (alive && cqe->res == 0) {
+        log_printf(LOG_LEVEL_INFO, "Client %s:%d disconnected", conn->data.client_ip, conn->data.client_port);
+
+        connection_schedule_close(conn);
+    } else if (alive && cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        fprintf(stderr, "uring_on_recv: recv: %s\n", strerror(-cqe->res));
+
+        connection_schedule_close(conn);
+    }
+
+    alive = conn->state != CONN_CLOSED && !conn->failed;
+
+    if (alive && !(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_recv(conn);
+    }
+
+    uring_release_if_idle(conn);
+}
+
+/**
+ * @brief Завершение отправки одного сообщения из цепочки
+ *
+ * Завершения цепочки приходят по порядку, поэтому отправленные байты относятся
+ * к началу очереди. Короткая отправка разрывает цепочку: следующие сообщения
+ * приходят с -ECANCELED и ставятся заново вместе с остатком, когда завершится вся цепочка
+ *
+ */
+static void uring_on_send(struct connection_t* conn, struct io_uring_cqe* cqe) {
+    conn->uring_refs--;
+    conn->sends_in_flight--;
+
+    if (cqe->res >= 0) {
+        connection_consume(conn, cqe->res);
+    } else if (cqe->res != -ECANCELED && conn->state != CONN_CLOSED && !conn->failed) {
+        fprintf(stderr, "uring_on_send: send: %s\n", strerror(-cqe->res));
+
+        connection_schedule_close(conn);
+    }
+
+    if (conn->sends_in_flight == 0 && conn->out.count > 0 && conn->state != CONN_CLOSED && !conn->failed) {
+        connection_mark_dirty(conn);
+    }
+
+    uring_release_if_idle(conn);
+}
+
+/**
+ * @brief Обработка всех готовых завершений
+ *
+ */
+static void uring_process_completions(struct reactor_t* reactor) {
+    struct uring_t* ring = reactor->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        void* ptr = (void*) (uintptr_t) (cqe->user_data & ~URING_OP_MASK);
+
+        switch (cqe->user_data & URING_OP_MASK) {
+            case OP_ACCEPT:
+                uring_on_accept(reactor, cqe);
+
+                break;
+
+            case OP_RECV:
+                uring_on_recv(reactor, (struct connection_t*) ptr, cqe);
+
+                break;
+
+            case OP_SEND:
+                uring_on_send((struct connection_t*) ptr, cqe);
+
+                break;
+
+            case OP_EVENT:
+                reactor_process_inbound(reactor);
+
+                uring_arm_event(reactor);
+
+                break;
+
+            default:
+                break;
+        }
+
+        head++;
+
+        if (head == tail) {
+            __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        }
+
+    }
+
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void uring_loop(struct reactor_t* reactor) {
+    uring_arm_accept(reactor);
+    uring_arm_event(reactor);
+
+    while (1) {
+        uring_flush_dirty(reactor);
+
+        if (uring_enter(reactor->ring, 1) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            perror("uring_loop: io_uring_enter");
+
+            break;
+        }
+
+        reactor_update_clock(reactor);
+
+        uring_process_completions(reactor);
+
+        reactor_reap_connections(reactor);
+    }
+
+}
+
+/**
+ * @brief Отображение колец io_uring в память процесса
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int uring_map(struct uring_t* ring, struct io_uring_params* params) {
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+
+        return -1;
+    }
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+
+            return -1;
+        }
+
+    }
+
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+
+        return -1;
+    }
+
+    char* sq = ring->sq_ring;
+    char* cq = ring->cq_ring;
+
+    ring->entries = params->sq_entries;
+    ring->sq_head = (unsigned*) (sq + params->sq_off.head);
+    ring->sq_tail = (unsigned*) (sq + params->sq_off.tail);
+    ring->sq_mask = (unsigned*) (sq + params->sq_off.ring_mask);
+    ring->sq_array = (unsigned*) (sq + params->sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned*) (cq + params->cq_off.head);
+    ring->cq_tail = (unsigned*) (cq + params->cq_off.tail);
+    ring->cq_mask = (unsigned*) (cq + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (cq + params->cq_off.cqes);
+
+    for (unsigned i = 0; i < ring->entries; i++) {
+        ring->sq_array[i] = i;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Регистрация кольца предоставленных буферов для multishot recv
+ *
+ * @return int 0 в случае успеха, -1 при ошибке
+ */
+static int uring_register_buffers(struct uring_t* ring) {
+    ring->buf_ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+
+        return -1;
+    }
+
+    ring->buffers = malloc((size_t) URING_BUFFER_COUNT * URING_BUFFER_LENGTH);
+
+    if (!ring->buffers) {
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t) (uintptr_t) ring->buf_ring,
+        .ring_entries = URING_BUFFER_COUNT,
+        .bgid = URING_BUFFER_GROUP
+    };
+
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+
+    for (unsigned short i = 0; i < URING_BUFFER_COUNT; i++) {
+        uring_buffer_recycle(ring, i);
+    }
+
+    return 0;
+}
+
+int uring_init(struct reactor_t* reactor) {
+    struct uring_t* ring = calloc(1, sizeof(struct uring_t));
+
+    if (!ring) {
+        perror("uring_init: calloc");
+
+        return -1;
+    }
+
+    reactor->ring = ring;
+
+    struct io_uring_params params = {0};
+
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_ENTRIES * 4;
+
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+
+    if (ring->fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = URING_ENTRIES * 4;
+
+        ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+
+    if (ring->fd < 0) {
+        perror("uring_init: io_uring_setup");
+
+        return -1;
+    }
+
+    if (uring_map(ring, &params) < 0) {
+        perror("uring_init: mmap");
+
+        return -1;
+    }
+
+    if (uring_register_buffers(ring) < 0) {
+        perror("uring_init: IORING_REGISTER_PBUF_RING");
+
+        return -1;
+    }
+
+    int flags = fcntl(reactor->event_fd, F_GETFL, 0);
+
+    if (flags < 0 || fcntl(reactor->event_fd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+        perror("uring_init: fcntl");
+
+        return -1;
+    }
+
+    return 0;
+}
+
+void uring_destroy(struct reactor_t* reactor) {
+    struct uring_t* ring = reactor->ring;
+
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+
+    if (ring->sq_ring) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    if (ring->buf_ring) {
+        munmap(ring->buf_ring, ring->buf_ring_size);
+    }
+
+    free(ring->buffers);
+    free(ring);
+
+    reactor->ring = NULL;
+}
+
+#else
+
+int uring_supported(void) {
+    return 0;
+}
+
+int uring_init(struct reactor_t* reactor) {
+    (void) reactor;
+
+    return -1;
+}
+
+void uring_destroy(struct reactor_t* reactor) {
+    (void) reactor;
+}
+
+void uring_loop(struct reactor_t* reactor) {
+    (void) reactor;
+}
+
+#endif
@@ -0,0 +1,366 @@
+#include "../headers/writer.h"
+#include "../headers/ebr.h"
+#include "../headers/logger.h"
+#include "../headers/metrics.h"
+
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <errno.h>
+
+struct client_writer_t* client_writer_create(const struct client_data_t* c_data, size_t max_bytes, int max_age_ms) {
+    struct client_writer_t* writer = calloc(1, sizeof(struct client_writer_t));
+
+    if (!writer) {
+        perror("client_writer_create: calloc");
+
+        return NULL;
+    }
+
+    writer->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (writer->wake_fd < 0) {
+        perror("client_writer_create: eventfd");
+
+        free(writer);
+
+        return NULL;
+    }
+
+    writer->fd = c_data->client_fd;
+    writer->client_port = c_data->client_port;
+    writer->max_bytes = max_bytes;
+    writer->max_age_ms = max_age_ms;
+
+    memcpy(writer->client_ip, c_data->client_ip, INET_ADDRSTRLEN);
+
+    pthread_mutex_init(&writer->lock, NULL);
+
+    return writer;
+}
+
+void client_writer_free(struct client_writer_t* writer) {
+
+    if (!writer) {
+        return;
+    }
+
+    message_queue_clear(&writer->out);
+
+    close(writer->wake_fd);
+
+    pthread_mutex_destroy(&writer->lock);
+
+    free(writer);
+}
+
+/**
+ * @brief Освобождение отправителя после того, как его перестали видеть рассылки
+ *
+ */
+static void client_writer_retired(void* arg) {
+    client_writer_free((struct client_writer_t*) arg);
+}
+
+void client_writer_retire(struct client_writer_t* writer) {
+
+    if (!writer) {
+        return;
+    }
+
+    if (ebr_retire(client_writer_retired, writer) < 0) {
+        log_printf(LOG_LEVEL_ERROR, "Client writer leaked: out of memory");
+    }
+
+}
+
+/**
+ * @brief Текущее время, мс
+ *
+ */
+static uint64_t writer_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Отключение клиента: очередь выбрасывается, поток клиента выходит из poll() по shutdown()
+ *
+ * @warning Вызывать под мьютексом отправителя
+ */
+static void writer_fail(struct client_writer_t* writer) {
+    writer->failed = 1;
+
+    message_queue_clear(&writer->out);
+
+    shutdown(writer->fd, SHUT_RDWR);
+}
+
+/**
+ * @brief Превышает ли очередь лимиты, если добавить length байт
+ *
+ * @warning Вызывать под мьютексом отправителя
+ */
+static int writer_over_budget(struct client_writer_t* writer, size_t length, uint64_t now) {
+
+    if (writer->out.bytes + length > writer->max_bytes) {
+        return 1;
+    }
+
+    return writer->out.count > 0 && now - message_queue_oldest(&writer->out) > (uint64_t) writer->max_age_ms;
+}
+
+/**
+ * @brief Отключение медленного клиента
+ *
+ * @warning Вызывать под мьютексом отправителя
+ */
+static void writer_evict(struct client_writer_t* writer) {
+    log_printf(LOG_LEVEL_WARN, "Client %s:%d is too slow (%u messages, %zu bytes queued), disconnecting", writer->client_ip, writer->client_port, writer->out.count, writer->out.bytes);
+
+    metrics_add(METRICS_EVICTIONS, 1);
+
+    writer_fail(writer);
+}
+
+/**
+ * @brief Запись начала очереди в сокет без блокировки
+ *
+ * @warning Вызывать под мьютексом отправителя
+ * @return int 1 если сокет принял не все, 0 если очередь пуста, -1 при ошибке сокета
+ */
+static int writer_write(struct client_writer_t* writer) {
+
+    while (writer->out.count > 0) {
+        struct iovec iov[WRITER_IOV];
+        int count = 0;
+
+        for (unsigned i = 0; i < writer->out.count && count < WRITER_IOV; i++) {
+            struct message_t* message = message_queue_at(&writer->out, i);
+            size_t offset = i == 0 ? writer->out.offset : 0;
+
+            iov[count].iov_base = message->data + offset;
+            iov[count].iov_len = message->length - offset;
+
+            count++;
+        }
+
+        struct msghdr msg = {
+            .msg_iov = iov,
+            .msg_iovlen = count
+        };
+
+        ssize_t count_of_bytes = sendmsg(writer->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (count_of_bytes < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 1;
+            }
+
+            if (errno != EPIPE && errno != ECONNRESET) {
+                perror("client_writer: sendmsg");
+            }
+
+            return -1;
+        }
+
+        unsigned before = writer->out.count;
+
+        message_queue_consume(&writer->out, count_of_bytes);
+
+        metrics_add(METRICS_SEND_CALLS, 1);
+        metrics_add(METRICS_BYTES_OUT, count_of_bytes);
+        metrics_add(METRICS_MESSAGES_OUT, before - writer->out.count);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Запись кадра в сокет с пустой очередью без блокировки
+ *
+ * @warning Вызывать под мьютексом отправителя
+ * @return ssize_t Количество принятых сокетом байт, -1 при ошибке сокета
+ */
+static ssize_t writer_write_direct(struct client_writer_t* writer, struct message_t* message) {
+    size_t sent = 0;
+
+    while (sent < message->length) {
+        ssize_t count_of_bytes = send(writer->fd, message->data + sent, message->length - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (count_of_bytes > 0) {
+            metrics_add(METRICS_SEND_CALLS, 1);
+
+            sent += count_of_bytes;
+
+            continue;
+        }
+
+        if (count_of_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (count_of_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        if (count_of_bytes < 0 && errno != EPIPE && errno != ECONNRESET) {
+            perror("client_writer: send");
+        }
+
+        return -1;
+    }
+
+    metrics_add(METRICS_BYTES_OUT, sent);
+
+    return (ssize_t) sent;
+}
+
+int client_writer_send(struct client_writer_t* writer, struct message_t* message) {
+    pthread_mutex_lock(&writer->lock);
+
+    if (writer->failed) {
+        pthread_mutex_unlock(&writer->lock);
+
+        return -1;
+    }
+
+    size_t sent = 0;
+
+    if (writer->out.count == 0) {
+        ssize_t count_of_bytes = writer_write_direct(writer, message);
+
+        if (count_of_bytes < 0) {
+            writer_fail(writer);
+
+            pthread_mutex_unlock(&writer->lock);
+
+            return -1;
+        }
+
+        if ((size_t) count_of_bytes == message->length) {
+            metrics_add(METRICS_MESSAGES_OUT, 1);
+
+            pthread_mutex_unlock(&writer->lock);
+
+            return 0;
+        }
+
+        sent = (size_t) count_of_bytes;
+    }
+
+    uint64_t now = writer_now();
+
+    if (writer_over_budget(writer, message->length - sent, now)) {
+        writer_evict(writer);
+
+        pthread_mutex_unlock(&writer->lock);
+
+        return -1;
+    }
+
+    int idle = writer->out.count == 0;
+
+    if (message_queue_push(&writer->out, message, now) < 0) {
+        writer_fail(writer);
+
+        pthread_mutex_unlock(&writer->lock);
+
+        return -1;
+    }
+
+    if (idle) {
+        writer->out.offset = sent;
+        writer->out.bytes -= sent;
+
+        uint64_t value = 1;
+
+        if (write(writer->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+            perror("client_writer_send: write");
+        }
+
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return 0;
+}
+
+int client_writer_timeout(struct client_writer_t* writer) {
+    int timeout = -1;
+
+    pthread_mutex_lock(&writer->lock);
+
+    if (writer->out.count > 0) {
+        uint64_t age = writer_now() - message_queue_oldest(&writer->out);
+
+        timeout = age > (uint64_t) writer->max_age_ms ? 0 : writer->max_age_ms - (int) age + 1;
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return timeout;
+}
+
+int client_writer_flush(struct client_writer_t* writer) {
+    uint64_t value;
+
+    if (read(writer->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        perror("client_writer_flush: read");
+    }
+
+    pthread_mutex_lock(&writer->lock);
+
+    if (writer->failed) {
+        pthread_mutex_unlock(&writer->lock);
+
+        return -1;
+    }
+
+    int result = writer_write(writer);
+
+    if (result < 0) {
+        writer_fail(writer);
+    } else if (result > 0 && writer_over_budget(writer, 0, writer_now())) {
+        writer_evict(writer);
+
+        result = -1;
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return result;
+}
+
+void client_writer_drain(struct client_writer_t* writer) {
+
+    while (client_writer_flush(writer) > 0) {
+        struct pollfd fd = {
+            .fd = writer->fd,
+            .events = POLLOUT
+        };
+
+        if (poll(&fd, 1, client_writer_timeout(writer)) < 0 && errno != EINTR) {
+            perror("client_writer_drain: poll");
+
+            break;
+        }
+
+    }
+
+    pthread_mutex_lock(&writer->lock);
+
+    writer->failed = 1;
+
+    message_queue_clear(&writer->out);
+
+    pthread_mutex_unlock(&writer->lock);
+}
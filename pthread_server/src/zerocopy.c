@@ -0,0 +1,221 @@
+#include "../headers/zerocopy.h"
+#include "../headers/logger.h"
+#include "../headers/metrics.h"
+
+#include <linux/errqueue.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY             60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY            0x4000000
+#endif
+
+struct zerocopy_t* zerocopy_create(int fd) {
+    int opt = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) < 0) {
+        perror("zerocopy_create: setsockopt SO_ZEROCOPY");
+
+        return NULL;
+    }
+
+    struct zerocopy_t* zerocopy = calloc(1, sizeof(struct zerocopy_t));
+
+    if (!zerocopy) {
+        perror("zerocopy_create: calloc");
+
+        return NULL;
+    }
+
+    zerocopy->fd = -1;
+
+    return zerocopy;
+}
+
+ssize_t zerocopy_send(struct zerocopy_t* zerocopy, int fd, struct message_t* message, size_t offset, int flags) {
+
+    if (zerocopy->next - zerocopy->oldest < ZEROCOPY_MAX_PENDING) {
+        ssize_t count_of_bytes = send(fd, message->data + offset, message->length - offset, flags | MSG_ZEROCOPY);
+
+        if (count_of_bytes >= 0) {
+            zerocopy->pending[zerocopy->next % ZEROCOPY_MAX_PENDING] = message_ref(message);
+            zerocopy->next++;
+
+            metrics_add(METRICS_ZEROCOPY_SENDS, 1);
+
+            return count_of_bytes;
+        }
+
+        if (errno != ENOBUFS) {
+            return -1;
+        }
+
+    }
+
+    return send(fd, message->data + offset, message->length - offset, flags);
+}
+
+/**
+ * @brief Отпускает сообщения незавершенных отправок с номерами от first до last включительно
+ *
+ * Номера сравниваются по модулю 2^32, как их считает ядро
+ *
+ */
+static void zerocopy_release(struct zerocopy_t* zerocopy, uint32_t first, uint32_t last) {
+
+    for (uint32_t id = zerocopy->oldest; id != zerocopy->next; id++) {
+        struct message_t** slot = &zerocopy->pending[id % ZEROCOPY_MAX_PENDING];
+
+        if (id - first <= last - first && *slot) {
+            message_unref(*slot);
+
+            *slot = NULL;
+        }
+
+    }
+
+    while (zerocopy->oldest != zerocopy->next && !zerocopy->pending[zerocopy->oldest % ZEROCOPY_MAX_PENDING]) {
+        zerocopy->oldest++;
+    }
+
+}
+
+void zerocopy_complete(struct zerocopy_t* zerocopy, int fd) {
+
+    while (zerocopy->oldest != zerocopy->next) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + CMSG_SPACE(sizeof(struct sockaddr_in))];
+        struct msghdr msg = {
+            .msg_control = control,
+            .msg_controllen = sizeof(control)
+        };
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("zerocopy_complete: recvmsg");
+            }
+
+            return;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) {
+                continue;
+            }
+
+            struct sock_extended_err error;
+
+            memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+
+            if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                metrics_add(METRICS_ZEROCOPY_COPIED, error.ee_data - error.ee_info + 1);
+            }
+
+            zerocopy_release(zerocopy, error.ee_info, error.ee_data);
+        }
+
+    }
+
+}
+
+int zerocopy_park(struct zerocopy_t** parked, struct zerocopy_t* zerocopy, int fd, uint64_t deadline) {
+
+    if (zerocopy->oldest == zerocopy->next) {
+        return -1;
+    }
+
+    shutdown(fd, SHUT_RDWR);
+
+    zerocopy->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    if (zerocopy->fd < 0) {
+        perror("zerocopy_park: fcntl");
+
+        return -1;
+    }
+
+    zerocopy->deadline = deadline;
+    zerocopy->next_parked = *parked;
+
+    *parked = zerocopy;
+
+    return 0;
+}
+
+/**
+ * @brief Сброс соединения, уведомлений которого не дождались
+ *
+ * close() с SO_LINGER {1, 0} отправляет RST и выбрасывает очередь сокета вместе
+ * со страницами сообщений, после чего ссылки на них можно отпустить
+ *
+ */
+static void zerocopy_abort(struct zerocopy_t* zerocopy) {
+    struct linger linger = {
+        .l_onoff = 1,
+        .l_linger = 0
+    };
+
+    log_printf(LOG_LEVEL_WARN, "Zero-copy sends of a closed connection are not completed (%u pending), resetting it", zerocopy->next - zerocopy->oldest);
+
+    if (setsockopt(zerocopy->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger)) < 0) {
+        perror("zerocopy_abort: setsockopt SO_LINGER");
+    }
+
+    close(zerocopy->fd);
+
+    zerocopy->fd = -1;
+}
+
+int zerocopy_drain(struct zerocopy_t** parked, uint64_t now) {
+    struct zerocopy_t** link = parked;
+
+    while (*link) {
+        struct zerocopy_t* zerocopy = *link;
+
+        zerocopy_complete(zerocopy, zerocopy->fd);
+
+        if (zerocopy->oldest != zerocopy->next && now < zerocopy->deadline) {
+            link = &zerocopy->next_parked;
+
+            continue;
+        }
+
+        if (zerocopy->oldest != zerocopy->next) {
+            zerocopy_abort(zerocopy);
+        }
+
+        *link = zerocopy->next_parked;
+
+        zerocopy_free(zerocopy);
+    }
+
+    return *parked != NULL;
+}
+
+void zerocopy_free(struct zerocopy_t* zerocopy) {
+
+    if (!zerocopy) {
+        return;
+    }
+
+    zerocopy_release(zerocopy, zerocopy->oldest, zerocopy->next - 1);
+
+    if (zerocopy->fd >= 0) {
+        close(zerocopy->fd);
+    }
+
+    free(zerocopy);
+}